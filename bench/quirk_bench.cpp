@@ -0,0 +1,395 @@
+// Benchmarks the compiler on generated programs of growing size. Each
+// program is compiled by the quirk executable with --stats=json, and the
+// best of a few runs per size is kept. The time of each phase is then
+// fitted against the program size: a phase whose time grows clearly faster
+// than the size is flagged as superlinear. Results go out as JSON.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#ifndef QUIRK_EXECUTABLE
+#define QUIRK_EXECUTABLE "quirk"
+#endif
+
+namespace {
+
+// Time grows at least like size^kSuperlinear before a phase is flagged,
+// a linear phase fits close to 1
+const double kSuperlinear = 1.3;
+// Phases faster than this at the largest size are below timer noise
+const double kMinimumSeconds = 1e-3;
+// A compile this slow is not repeated, and its size is the generator's last
+const double kSlowSeconds = 5;
+
+const char *const kPhases[] = {"lex",     "parse",    "typecheck",
+                               "codegen", "optimize", "total"};
+const size_t kPhaseCount = sizeof(kPhases) / sizeof(kPhases[0]);
+// Wall time of the whole quirk process, measured here
+const size_t kTotal = kPhaseCount - 1;
+
+struct Generator {
+  const char *name;
+  const char *unit;
+  // Sizes at scale 1, each twice the one before
+  long base;
+  std::string (*program)(long size);
+};
+
+// int v0 = 0; ... int vN = N; every name is new to the parser and the
+// type checker
+std::string declarations(long size) {
+  std::string program;
+  for (long i = 0; i < size; i++) {
+    program += "int v" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+  }
+  return program + "out(v" + std::to_string(size - 1) + ");\n";
+}
+
+// `size` ifs, each inside the one before
+std::string nestedBlocks(long size) {
+  std::string program = "int x = 0;\n";
+  for (long i = 0; i < size; i++) {
+    program += std::string(i % 64, ' ') + "if (x < 1) {\n";
+  }
+  program += "x = x + 1;\n";
+  for (long i = 0; i < size; i++) {
+    program += "}\n";
+  }
+  return program + "out(x);\n";
+}
+
+// if (x == 0) { ... } else if (x == 1) { ... } ... on one variable
+std::string ifChain(long size) {
+  std::string program = "int x = " + std::to_string(size / 2) + ";\nint y = 0;\n";
+  for (long i = 0; i < size; i++) {
+    program += (i == 0 ? "if (x == " : "} else if (x == ") + std::to_string(i) +
+               ") {\ny = " + std::to_string(i + 1) + ";\n";
+  }
+  return program + "} else {\ny = 0;\n}\nout(y);\n";
+}
+
+// `size` counted loops one after the other
+std::string forLoops(long size) {
+  std::string program = "int s = 0;\n";
+  for (long i = 0; i < size; i++) {
+    program += "for (int i = 0; i < " + std::to_string(i % 7 + 2) +
+               "; i++) {\ns = s + i;\n}\n";
+  }
+  return program + "out(s);\n";
+}
+
+// One string literal of `size` characters
+std::string stringLiteral(long size) {
+  std::string text;
+  text.reserve(size);
+  for (long i = 0; i < size; i++) {
+    text += static_cast<char>('a' + i % 26);
+  }
+  return "string s = \"" + text + "\";\nout(s);\n";
+}
+
+const Generator kGenerators[] = {
+    {"declarations", "declarations", 250, declarations},
+    {"nested_blocks", "levels", 50, nestedBlocks},
+    {"if_chain", "branches", 100, ifChain},
+    {"for_loops", "loops", 20, forLoops},
+    {"string_literal", "characters", 50000, stringLiteral},
+};
+
+struct Options {
+  std::string quirk = QUIRK_EXECUTABLE;
+  std::string output;
+  std::string only;
+  int steps = 4;
+  int repeat = 3;
+  double scale = 1;
+};
+
+// Seconds per phase of one compile, and whether it succeeded
+struct Sample {
+  bool ok = false;
+  double seconds[kPhaseCount] = {};
+  double tokens = 0;
+  double irInstructions = 0;
+};
+
+std::string jsonString(const std::string &text) {
+  std::string quoted = "\"";
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += static_cast<char>(c);
+    } else if (c < 0x20) {
+      char escaped[7];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    } else {
+      quoted += static_cast<char>(c);
+    }
+  }
+  return quoted + "\"";
+}
+
+std::string shellQuote(const std::string &text) {
+  std::string quoted = "'";
+  for (char c : text) {
+    quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+  }
+  return quoted + "'";
+}
+
+// The number after `"key": ` in the object after `"section": `
+double jsonNumber(const std::string &json, const std::string &section,
+                  const std::string &key) {
+  size_t at = json.find("\"" + section + "\": ");
+  if (at == std::string::npos) {
+    return 0;
+  }
+  at = json.find("\"" + key + "\": ", at);
+  if (at == std::string::npos) {
+    return 0;
+  }
+  return std::strtod(json.c_str() + at + key.size() + 4, nullptr);
+}
+
+// Compiles `source` once, quiet because of -S; its statistics are the last
+// line quirk writes to stderr
+Sample compile(const Options &options, const std::string &source,
+               const std::string &statsFile) {
+  std::string command = shellQuote(options.quirk) +
+                        " -j 1 --stats=json -S /dev/null " +
+                        shellQuote(source) + " >/dev/null 2>" +
+                        shellQuote(statsFile);
+  auto start = std::chrono::steady_clock::now();
+  int status = std::system(command.c_str());
+  std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+
+  Sample sample;
+  std::ifstream in(statsFile);
+  std::string line;
+  std::string json;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line[0] == '{') {
+      json = line;
+    }
+  }
+  sample.ok = status == 0 && !json.empty();
+  for (size_t phase = 0; phase < kTotal; phase++) {
+    sample.seconds[phase] = jsonNumber(json, kPhases[phase], "seconds");
+  }
+  sample.seconds[kTotal] = total.count();
+  sample.tokens = jsonNumber(json, "lex", "tokens");
+  sample.irInstructions = jsonNumber(json, "codegen", "ir_instructions");
+  return sample;
+}
+
+// Least squares slope of log(seconds) over log(size)
+double scalingExponent(const std::vector<long> &sizes,
+                       const std::vector<double> &seconds) {
+  size_t n = sizes.size();
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (size_t i = 0; i < n; i++) {
+    double x = std::log(static_cast<double>(sizes[i]));
+    double y = std::log(std::max(seconds[i], 1e-9));
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+  double denominator = n * sxx - sx * sx;
+  return n < 2 || denominator == 0 ? 0 : (n * sxy - sx * sy) / denominator;
+}
+
+// Runs one generator over its sizes and appends its JSON object to `out`.
+// False when a compile failed.
+bool benchmark(const Options &options, const Generator &generator,
+               const std::filesystem::path &directory, std::ostream &out) {
+  std::string source = (directory / (std::string(generator.name) + ".qk")).string();
+  std::string statsFile = (directory / "stats.json").string();
+
+  std::vector<long> sizes;
+  std::vector<Sample> samples;
+  long failedAt = 0;
+  for (int step = 0; step < options.steps; step++) {
+    long size = std::max(1L, std::lround(generator.base * options.scale)) << step;
+    std::ofstream(source) << generator.program(size);
+
+    Sample best;
+    for (int run = 0; run < options.repeat; run++) {
+      Sample sample = compile(options, source, statsFile);
+      if (!sample.ok) {
+        best.ok = false;
+        break;
+      }
+      if (!best.ok || sample.seconds[kTotal] < best.seconds[kTotal]) {
+        best = sample;
+      }
+      if (sample.seconds[kTotal] > kSlowSeconds) {
+        break;
+      }
+    }
+    if (!best.ok) {
+      std::cerr << "quirk_bench: " << generator.name << " failed to compile at "
+                << size << " " << generator.unit << std::endl;
+      failedAt = size;
+      break;
+    }
+    std::cerr << "quirk_bench: " << generator.name << " " << size << " "
+              << generator.unit << " in " << best.seconds[kTotal] * 1e3
+              << " ms" << std::endl;
+    sizes.push_back(size);
+    samples.push_back(best);
+    if (best.seconds[kTotal] > kSlowSeconds) {
+      break;
+    }
+  }
+
+  out << "    {\"generator\": " << jsonString(generator.name)
+      << ", \"unit\": " << jsonString(generator.unit) << ",\n     \"runs\": [";
+  for (size_t i = 0; i < samples.size(); i++) {
+    out << (i == 0 ? "\n" : ",\n") << "      {\"size\": " << sizes[i]
+        << ", \"tokens\": " << static_cast<uint64_t>(samples[i].tokens)
+        << ", \"ir_instructions\": "
+        << static_cast<uint64_t>(samples[i].irInstructions);
+    for (size_t phase = 0; phase < kPhaseCount; phase++) {
+      double seconds = samples[i].seconds[phase];
+      out << ", \"" << kPhases[phase] << "\": {\"seconds\": " << seconds
+          << ", \"per_second\": " << (seconds > 0 ? sizes[i] / seconds : 0)
+          << "}";
+    }
+    out << "}";
+  }
+  out << "],\n     \"scaling\": {";
+
+  std::vector<std::string> superlinear;
+  for (size_t phase = 0; phase < kPhaseCount; phase++) {
+    std::vector<double> seconds;
+    for (const Sample &sample : samples) {
+      seconds.push_back(sample.seconds[phase]);
+    }
+    double exponent = scalingExponent(sizes, seconds);
+    out << (phase == 0 ? "" : ", ") << "\"" << kPhases[phase]
+        << "\": " << exponent;
+    if (exponent > kSuperlinear && !seconds.empty() &&
+        seconds.back() >= kMinimumSeconds) {
+      superlinear.push_back(kPhases[phase]);
+      std::cerr << "quirk_bench: SUPERLINEAR " << generator.name << " "
+                << kPhases[phase] << " grows like " << generator.unit << "^"
+                << std::setprecision(3) << exponent << std::setprecision(6)
+                << std::endl;
+    }
+  }
+  out << "},\n     \"superlinear\": [";
+  for (size_t i = 0; i < superlinear.size(); i++) {
+    out << (i == 0 ? "" : ", ") << jsonString(superlinear[i]);
+  }
+  out << "]";
+  if (failedAt != 0) {
+    out << ", \"failed_at\": " << failedAt;
+  }
+  out << "}";
+  return failedAt == 0;
+}
+
+void printUsage() {
+  std::cerr << "Usage: quirk_bench [options]\n"
+            << "  --quirk <file>    compiler to measure, default " QUIRK_EXECUTABLE "\n"
+            << "  -o <file>         write the JSON results to file, default stdout\n"
+            << "  --only <name>     run one generator:";
+  for (const Generator &generator : kGenerators) {
+    std::cerr << " " << generator.name;
+  }
+  std::cerr << "\n"
+            << "  --steps <n>       sizes per generator, each twice the last, default 4\n"
+            << "  --scale <x>       multiply every size by x, default 1\n"
+            << "  --repeat <n>      compiles per size, the fastest counts, default 3\n"
+            << "Phases whose time grows faster than size^" << kSuperlinear
+            << " are reported as SUPERLINEAR." << std::endl;
+}
+
+bool parseArguments(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--quirk" && hasValue) {
+      options.quirk = argv[++i];
+    } else if (arg == "-o" && hasValue) {
+      options.output = argv[++i];
+    } else if (arg == "--only" && hasValue) {
+      options.only = argv[++i];
+    } else if (arg == "--steps" && hasValue) {
+      options.steps = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--scale" && hasValue) {
+      options.scale = std::max(1e-3, std::atof(argv[++i]));
+    } else if (arg == "--repeat" && hasValue) {
+      options.repeat = std::max(1, std::atoi(argv[++i]));
+    } else {
+      printUsage();
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseArguments(argc, argv, options)) {
+    return 1;
+  }
+
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() /
+      ("quirk_bench." + std::to_string(getpid()));
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    std::cerr << "Error: Could not create " << directory << std::endl;
+    return 1;
+  }
+
+  std::ostringstream out;
+  out << "{\"compiler\": " << jsonString(options.quirk)
+      << ", \"repeat\": " << options.repeat
+      << ", \"superlinear_exponent\": " << kSuperlinear
+      << ",\n  \"benchmarks\": [\n";
+  bool ok = true;
+  bool first = true;
+  for (const Generator &generator : kGenerators) {
+    if (!options.only.empty() && options.only != generator.name) {
+      continue;
+    }
+    out << (first ? "" : ",\n");
+    first = false;
+    ok = benchmark(options, generator, directory, out) && ok;
+  }
+  out << "\n  ]}\n";
+  std::filesystem::remove_all(directory, error);
+
+  if (first) {
+    std::cerr << "Error: Unknown generator " << options.only << std::endl;
+    return 1;
+  }
+  if (options.output.empty()) {
+    std::cout << out.str();
+  } else {
+    std::ofstream file(options.output);
+    file << out.str();
+    if (!file) {
+      std::cerr << "Error: Could not write " << options.output << std::endl;
+      return 1;
+    }
+  }
+  return ok ? 0 : 1;
+}
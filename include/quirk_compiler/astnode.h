@@ -1,9 +1,20 @@
 #ifndef ASTNODE_H
 #define ASTNODE_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
+// Value of a numeric literal, converted once by the lexer
+struct NumericConstant {
+    enum Kind : uint8_t { None, Int, Float };
+    Kind kind = None;
+    union {
+        int64_t i = 0;
+        double f;
+    };
+};
+
 class ASTNode {
 public:
     ASTNode(std::string type, std::string value = "", bool processed_ = false);
@@ -20,10 +31,20 @@ public:
 
     bool isProcessed() const { return processed_; }
     void setProcessed(bool processed) { processed_ = processed; }
+
+    // Lowercase type of an expression, set by the type checker
+    const std::string& getValueType() const { return valueType_; }
+    void setValueType(const std::string& valueType) { valueType_ = valueType; }
+
+    // Value of a NUMERIC_LITERAL, kind None on other nodes
+    const NumericConstant& getConstant() const { return constant_; }
+    void setConstant(const NumericConstant& constant) { constant_ = constant; }
     
 private:
     std::string type;
     std::string value;
+    std::string valueType_;
+    NumericConstant constant_;
     std::vector<ASTNode*> children;
     ASTNode* parent_;
     bool processed_;
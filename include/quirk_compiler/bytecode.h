@@ -0,0 +1,161 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "cfg.h"
+#include "module.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class Opcode : uint16_t {
+  MOVE,
+  SELECT,
+  INC_INT,
+  DEC_INT,
+  INC_FLOAT,
+  DEC_FLOAT,
+  TO_FLOAT,
+  ADD_INT,
+  SUB_INT,
+  MUL_INT,
+  DIV_INT,
+  MOD_INT,
+  POW_INT,
+  SHL_INT,
+  SHR_INT,
+  AND_INT,
+  ADD_FLOAT,
+  SUB_FLOAT,
+  MUL_FLOAT,
+  DIV_FLOAT,
+  POW_FLOAT,
+  EQ_INT,
+  NE_INT,
+  LT_INT,
+  LE_INT,
+  GT_INT,
+  GE_INT,
+  EQ_FLOAT,
+  NE_FLOAT,
+  LT_FLOAT,
+  LE_FLOAT,
+  GT_FLOAT,
+  GE_FLOAT,
+  EQ_STRING,
+  NE_STRING,
+  LT_STRING,
+  LE_STRING,
+  GT_STRING,
+  GE_STRING,
+  NEW_ARRAY,
+  LENGTH,
+  LOAD_ELEMENT,
+  STORE_ELEMENT,
+  CHECK_INDEX,
+  JUMP,
+  JUMP_IF,
+  JUMP_IF_NOT,
+  SWITCH,
+  COUNTER,
+  OUT_INT,
+  OUT_FLOAT,
+  OUT_STRING,
+  OUT_CHAR,
+  OUT_BOOL,
+  CALL,
+  ARGS,
+  RET,
+  HALT,
+  COUNT,
+};
+
+// Fixed width, 8 bytes per instruction. a, b and c are frame register
+// indices; jumps keep their 32 bit target in b and c. CALL puts the result
+// in a, calls function b with c arguments and is followed by ARGS words
+// naming up to three argument registers each, which are never executed.
+// SWITCH subtracts register b from register a and is followed by c + 1 JUMP
+// words, the default first, of which it takes the one the difference
+// selects. COUNTER increments the profile counter named by its target.
+// SELECT copies register c into a when register b is true, and otherwise
+// the register named by the a field of the ARGS word that follows it.
+// Arithmetic computes a = b op c; the exponent of POW_FLOAT is an int.
+// DIV_INT and MOD_INT end the program with an error on a zero divisor, as
+// does DIV_INT on INT64_MIN / -1.
+// NEW_ARRAY makes a zero-filled array of length b, LOAD_ELEMENT reads
+// a = b[c] and STORE_ELEMENT writes a[b] = c. CHECK_INDEX stops the program
+// with an error unless index a is within the length of array b.
+struct BytecodeInstruction {
+  Opcode opcode;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+
+  uint32_t target() const { return b | (static_cast<uint32_t>(c) << 16); }
+};
+
+// An array points at its first element, its length is the int before it
+union Value {
+  int64_t i;
+  double f;
+  const std::string *s;
+  Value *a;
+};
+
+// Every function runs in its own register frame. The constant pool is
+// mapped into the top of the frame, so every operand is a plain register
+// index at run time; incoming arguments sit right below the constants.
+// String constants hold an index into the program's `strings` that the VM
+// turns into a pointer when it loads them.
+struct BytecodeFunction {
+  std::string name;
+  uint32_t entry = 0;
+  std::vector<Value> constants;
+  std::vector<uint32_t> stringConstants;
+  uint16_t argumentBase = 0;
+  uint16_t constantBase = 0;
+  uint16_t registerCount = 0;
+};
+
+// main is the first function and ends in HALT, the others return with RET.
+struct BytecodeProgram {
+  std::vector<BytecodeInstruction> code;
+  std::vector<BytecodeFunction> functions;
+  // The module's constant pool, then quoted literals the IR still has
+  std::vector<std::string> strings;
+  uint32_t counterCount = 0;
+};
+
+// Lowers a module to bytecode. Value temporaries share registers according
+// to the linear-scan allocation, alloc slots get a register each.
+class BytecodeCompiler {
+public:
+  explicit BytecodeCompiler(const Module &module);
+
+  BytecodeProgram compile();
+
+private:
+  void compileFunction(const Function &function);
+  uint16_t reg(const std::string &value);
+  uint16_t constant(const std::string &literal);
+  uint16_t floatOperand(const std::string &value, uint16_t scratch);
+  std::string typeOf(const std::string &value) const;
+  void emit(Opcode opcode, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+  void emitJump(Opcode opcode, uint16_t condition, const std::string &label);
+  void emitCall(const DecodedInstruction &instr);
+  void lower(const DecodedInstruction &instr, size_t block);
+
+  const Module &module_;
+  const ControlFlowGraph *cfg_ = nullptr;
+  std::unordered_map<std::string, uint16_t> functionIndex_;
+  std::unordered_map<std::string, std::string> types_;
+  std::unordered_map<std::string, uint16_t> registers_;
+  std::unordered_map<std::string, uint16_t> constantIndex_;
+  std::vector<std::pair<size_t, std::string>> fixups_;
+  uint16_t scratch_ = 0;
+  uint16_t parameters_ = 0;
+  BytecodeFunction *function_ = nullptr;
+  BytecodeProgram program_;
+};
+
+#endif
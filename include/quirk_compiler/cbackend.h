@@ -0,0 +1,39 @@
+#ifndef CBACKEND_H
+#define CBACKEND_H
+
+#include "cfg.h"
+#include "module.h"
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+// Translates a module to one self-contained C99 file. Every function
+// becomes a C function, temporaries and slots become locals declared at
+// the top, blocks become labels and branches gotos. out() calls small
+// printf based runtime functions with the same output as the other
+// backends. Branch weights turn into __builtin_expect where available.
+class CBackend {
+public:
+  explicit CBackend(const Module &module);
+
+  std::string emitSource();
+  // Compiles the source with the system C compiler at -O2.
+  bool buildExecutable(const std::string &outputFile);
+
+private:
+  void emitFunction(const Function &function);
+  void emitInstruction(const DecodedInstruction &instr, size_t block);
+  void emitBranch(const DecodedInstruction &instr, size_t block);
+  std::string value(const std::string &operand) const;
+  std::string typeOf(const std::string &operand) const;
+  std::string prototype(const Function &function) const;
+
+  const Module &module_;
+  const Function *function_ = nullptr;
+  std::unordered_map<std::string, std::string> types_;
+  size_t parameters_ = 0;
+  size_t counters_ = 0;
+  std::ostringstream out_;
+};
+
+#endif
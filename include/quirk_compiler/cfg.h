@@ -0,0 +1,143 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "codegen.h"
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Structured view of a single textual IR instruction. The instruction text
+// stays the source of truth, passes decode it, edit the fields and encode a
+// replacement.
+struct DecodedInstruction {
+  std::string operation;
+  std::string result;
+  std::vector<std::string> operands;
+  std::vector<std::string> targets;
+  // alloc type, call target, label name, counter number of count or the
+  // taken and not taken weights of a conditional br
+  std::string attribute;
+  // value type of call, param and load results, operand type of compares,
+  // element type of newarray and elem
+  std::string type;
+};
+
+DecodedInstruction decodeInstruction(const Instruction &instr);
+std::shared_ptr<Instruction> encodeInstruction(const DecodedInstruction &decoded);
+// Whether a known operation has the operands, targets and result it needs;
+// encodeInstruction and the backends only take such instructions
+bool isWellFormed(const DecodedInstruction &decoded);
+
+bool isTemporary(const std::string &operand);
+// int, float, string, char or bool for literal operands, empty otherwise.
+// Constant pool references ($i) are strings.
+std::string literalType(const std::string &operand);
+// Character code of a char literal such as 'a' or '\n'
+long long charLiteralCode(const std::string &literal);
+// Shortest float literal that reads back as `value`, always with a . or e
+std::string floatLiteral(double value);
+bool isTerminator(const Instruction &instr);
+bool hasSideEffects(const Instruction &instr);
+// Integer division that faults unless the divisor is a literal other than
+// 0 and -1, and array element reads, which are only in bounds where their
+// check ran and see the last setelem; such an instruction must not run
+// where the program would not run it
+bool mayTrap(const Instruction &instr);
+
+struct BasicBlock {
+  std::string label; // empty for the entry block
+  std::vector<std::shared_ptr<Instruction>> instructions;
+
+  std::shared_ptr<Instruction> terminator() const;
+};
+
+// Natural loop formed by the back edges into one header block.
+struct Loop {
+  int header;
+  std::vector<int> latches;
+  std::vector<int> blocks; // sorted, includes the header
+
+  bool contains(int block) const;
+};
+
+// A loop in the shape convertForCondition emits, before or after induction
+// variable promotion:
+//
+//   header: [%c = load %slot]
+//           %t = (%c < bound)
+//           br %t, label %body, label %exit
+//   body:   ...
+//           %c = %c + 1
+//           [store %c, %slot]
+//           br label %header
+//
+// The bound is a literal or a value defined outside the loop, so the loop
+// runs max(bound - start, 0) times.
+struct CountedLoop {
+  int header;
+  int body;
+  std::string counter;
+  std::string slot; // empty once the counter lives in a register
+  std::string bound;
+  std::string exit;
+};
+
+// Flat list of basic blocks in layout order. A block without a terminator
+// falls through to the next one, the last block falling off the end exits
+// the program.
+class ControlFlowGraph {
+public:
+  explicit ControlFlowGraph(std::shared_ptr<Instruction> root);
+
+  std::vector<BasicBlock> blocks;
+
+  std::shared_ptr<Instruction> toIR() const;
+  void reindex();
+
+  int findBlock(const std::string &label) const;
+  std::vector<int> successors(int block) const;
+  std::vector<std::vector<int>> predecessors() const;
+  size_t instructionCount() const;
+
+  std::vector<int> reversePostOrder() const;
+  std::vector<int> immediateDominators() const;
+  static bool dominates(const std::vector<int> &idom, int a, int b);
+  std::vector<Loop> findLoops() const;
+
+  void replaceUses(const std::string &from, const std::string &to);
+
+  void makeFallthroughsExplicit();
+  void removeFallthroughBranches();
+
+private:
+  void flatten(const std::shared_ptr<Instruction> &instr);
+
+  std::unordered_map<std::string, int> labelIndex_;
+};
+
+// Matches `loop` against the CountedLoop shape, with explicit fallthroughs.
+std::optional<CountedLoop> findCountedLoop(const ControlFlowGraph &cfg,
+                                           const Loop &loop);
+
+// Type of the value `decoded` defines, given the types of its operands.
+// Empty when an operand's type is not known yet.
+std::string resultType(
+    const DecodedInstruction &decoded,
+    const std::function<std::string(const std::string &)> &typeOf);
+
+// Value type of every temporary, derived from the alloc types and literals.
+// Alloc results map to the type of the value stored in the slot, arrays
+// are their element type followed by [].
+std::unordered_map<std::string, std::string>
+inferTemporaryTypes(const ControlFlowGraph &cfg);
+
+// int, float, string, char or bool, the type a comparison compares in. IR
+// without the annotation compares in float when either side is a float and
+// as strings when both sides are.
+std::string comparisonType(const DecodedInstruction &instr,
+                           const std::unordered_map<std::string, std::string> &types);
+
+#endif
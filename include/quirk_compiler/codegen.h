@@ -2,8 +2,11 @@
 #define CODEGEN_H
 
 #include "astnode.h"
+#include "constantpool.h"
+#include "stats.h"
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <variant>
@@ -40,7 +43,7 @@ public:
     std::string indent(depth, ' ');
   
     if (!instruction.empty()) {
-      std::cout << indent << instruction << std::endl;
+      std::cout << indent << instruction << '\n';
     }
 
     for (const auto& child : children) {
@@ -53,16 +56,28 @@ public:
   }
 };
 
+// Lowercase IR types, an empty return type for functions without a value
+struct FunctionSignature {
+  std::string returnType;
+  std::vector<std::string> parameterTypes;
+};
+
 class Codegen {
 public:
   Codegen() : temporaries_counter(0), labels_counter(0), parent_(nullptr) {}
 
   std::shared_ptr<Instruction> rootIR;
   std::shared_ptr<Instruction> current_parent;
-  std::shared_ptr<Instruction> last_parent;
 
   void Init();
   void ConvertAST(ASTNode* ast);
+  // Lowers one FUNCTION node into its own rootIR
+  void ConvertFunction(ASTNode* function);
+  void setFunctions(const std::unordered_map<std::string, FunctionSignature>* functions) { functions_ = functions; }
+  // String literals found in the pool are emitted as $i references
+  void setConstants(const ConstantPool* constants) { constants_ = constants; }
+  // Adds the time spent lowering to `stats`
+  void setStats(CompileStats* stats) { stats_ = stats; }
 
   void printInstructions() { rootIR->print(); }
   std::shared_ptr<Instruction> findInstruction(std::shared_ptr<CodegenElement> root, std::shared_ptr<Instruction> isntr);
@@ -73,6 +88,16 @@ private:
   std::vector<std::string> convertForCondition(ASTNode* node, std::string conditionLabel, std::string bodyLabel, std::string endLabel);
   std::string createTemporary() { return "%t" + std::to_string(temporaries_counter++); }
   std::string createLabel(std::string labelStart, int add) { return "%" + labelStart + std::to_string(labels_counter + add); }
+  std::string findSlot(const std::string& name) const;
+  std::string loadIdentifier(const std::string& name);
+  std::string convertCall(ASTNode* call);
+  // Lowers a literal, variable, call or arithmetic expression and returns
+  // the literal or temporary holding its value
+  std::string convertExpression(ASTNode* node);
+  std::string convertArithmetic(ASTNode* node);
+  // newarray, elem or length for the array nodes
+  std::string convertArray(ASTNode* node);
+  std::string compareText(const std::string& type, const std::string& lhs, const std::string& op, const std::string& rhs);
   void switchParent(std::shared_ptr<Instruction> parent);
   void popParent();
   std::string toLowerCase(std::string string);
@@ -81,6 +106,12 @@ private:
   int labels_counter = 0;
   Codegen* parent_;
   std::vector<std::pair<std::string, std::string>> identifierTable_;
+  // Declared type of every slot, which its loads carry
+  std::unordered_map<std::string, std::string> slotTypes_;
+  std::vector<std::shared_ptr<Instruction>> parent_stack_;
+  const std::unordered_map<std::string, FunctionSignature>* functions_ = nullptr;
+  const ConstantPool* constants_ = nullptr;
+  CompileStats* stats_ = nullptr;
 };
 
 #endif
@@ -18,6 +18,8 @@ struct ForLoopCondition {
   std::pair<TokenType, std::string> i2;
   std::pair<TokenType, std::string> ro;
   std::pair<TokenType, std::string> len;
+  // The array named in a len(array) bound
+  std::pair<TokenType, std::string> array;
   std::pair<TokenType, std::string> i3;
   std::pair<TokenType, std::string> uao;
   bool error;
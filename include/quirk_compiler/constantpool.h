@@ -0,0 +1,33 @@
+#ifndef CONSTANTPOOL_H
+#define CONSTANTPOOL_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// String literals of a module, each distinct one stored once. The IR refers
+// to entry i as $i instead of repeating the literal, and the backends emit
+// every entry a single time as read-only data.
+class ConstantPool {
+public:
+  uint32_t intern(std::string_view bytes);
+  // Index of interned bytes, -1 when they are not in the pool. Lookups do
+  // not modify the pool, so parallel codegen can share one.
+  int64_t find(std::string_view bytes) const;
+  const std::string &at(uint32_t index) const { return entries_[index]; }
+  size_t size() const { return entries_.size(); }
+
+private:
+  // A deque keeps the entries in place, the index holds views of them
+  std::deque<std::string> entries_;
+  std::unordered_map<std::string_view, uint32_t> index_;
+};
+
+// $i, the IR operand referring to pool entry i
+std::string poolReference(uint32_t index);
+bool isPoolReference(const std::string &operand);
+uint32_t poolIndex(const std::string &operand);
+
+#endif
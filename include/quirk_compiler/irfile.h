@@ -0,0 +1,143 @@
+#ifndef IRFILE_H
+#define IRFILE_H
+
+#include "cfg.h"
+#include "module.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Binary IR file. Every section is an array of fixed-size little-endian
+// records at an 8 byte aligned offset, so a mapped file is used in place.
+//
+//   header | strings | string data | pool | constants | functions |
+//   symbols | blocks | instructions | operands
+//
+// The pool lists the string of every module constant pool entry in order.
+// Functions own a contiguous run of blocks, main comes first. Operand
+// references carry their table in the top bit: symbols (temporaries and
+// labels) or constants. Symbols are numbered per function, so the same
+// name in two functions gets two records. Operands of an instruction are
+// followed by its branch targets in the operand table.
+
+const uint32_t kIrFileMagic = 0x00524951; // "QIR\0"
+const uint32_t kIrFileVersion = 3;
+const uint32_t kIrNone = 0xffffffff;
+const uint32_t kIrConstantBit = 0x80000000;
+
+struct IrFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t fileSize;
+  uint32_t stringCount;
+  uint32_t stringsOffset;
+  uint32_t stringDataOffset;
+  uint32_t poolCount;
+  uint32_t poolOffset;
+  uint32_t constantCount;
+  uint32_t constantsOffset;
+  uint32_t functionCount;
+  uint32_t functionsOffset;
+  uint32_t symbolCount;
+  uint32_t symbolsOffset;
+  uint32_t blockCount;
+  uint32_t blocksOffset;
+  uint32_t instructionCount;
+  uint32_t instructionsOffset;
+  uint32_t operandCount;
+  uint32_t operandsOffset;
+};
+
+struct IrString {
+  uint32_t offset; // into the string data, NUL terminated
+  uint32_t length;
+};
+
+enum class IrConstantType : uint32_t { Int, Float, String, Char, Bool, Other };
+
+struct IrConstant {
+  IrConstantType type;
+  uint32_t text;  // literal as written in the IR
+  int64_t value;  // integer value, double bits or string index
+};
+
+struct IrFunction {
+  uint32_t name;   // string
+  uint32_t header; // string with the define line, kIrNone for main
+  uint32_t firstBlock;
+  uint32_t blockCount;
+};
+
+enum class IrSymbolKind : uint32_t { Temporary, Slot, Label };
+
+struct IrSymbol {
+  uint32_t name;
+  IrSymbolKind kind;
+  uint32_t block; // defining block for labels, kIrNone otherwise
+  uint32_t reserved;
+};
+
+struct IrBlock {
+  uint32_t label; // symbol, kIrNone for the entry block
+  uint32_t firstInstruction;
+  uint32_t instructionCount;
+  uint32_t reserved;
+};
+
+struct IrInstruction {
+  uint32_t operation; // string
+  uint32_t result;    // operand reference or kIrNone
+  uint32_t attribute; // string or kIrNone
+  uint32_t type;      // string or kIrNone, result type of call and param
+  uint32_t firstOperand;
+  uint16_t operandCount;
+  uint16_t targetCount;
+};
+
+// Serializes the module into one buffer and writes it with a single call.
+bool writeIrFile(const Module &module, const std::string &path);
+
+// Read-only mapping of an IR file. Opening checks the header, the section
+// bounds and every index and offset the tables hold; nothing is decoded
+// until it is asked for.
+class IrFile {
+public:
+  IrFile() = default;
+  ~IrFile();
+  IrFile(const IrFile &) = delete;
+  IrFile &operator=(const IrFile &) = delete;
+
+  bool open(const std::string &path);
+
+  const IrFileHeader &header() const { return *header_; }
+  const IrFunction &function(uint32_t index) const;
+  const IrBlock &block(uint32_t index) const;
+  const IrInstruction &instruction(uint32_t index) const;
+  uint32_t operand(uint32_t index) const;
+  const IrSymbol &symbol(uint32_t index) const;
+  const IrConstant &constant(uint32_t index) const;
+  const char *string(uint32_t index) const;
+  // String of constant pool entry `index`
+  uint32_t poolEntry(uint32_t index) const;
+  // Text of an operand reference
+  const char *reference(uint32_t ref) const;
+
+  DecodedInstruction decode(uint32_t index) const;
+  // Module IR, see Module::fromIR
+  std::shared_ptr<Instruction> toIR() const;
+  // Same text as printing toIR(), written in one go.
+  void disassemble(std::ostream &out) const;
+
+private:
+  template <typename T> const T *section(uint32_t offset) const {
+    return reinterpret_cast<const T *>(data_ + offset);
+  }
+  bool validate(const std::string &path) const;
+  void release();
+
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  const IrFileHeader *header_ = nullptr;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "module.h"
+#include "x86emitter.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compiles a module to x86-64 machine code inside this process and runs it.
+// Code is copied into a writable mapping that is then flipped to
+// read-execute, so no page is ever writable and executable at once.
+class X86Jit {
+public:
+  explicit X86Jit(const Module &module);
+  ~X86Jit();
+  X86Jit(const X86Jit &) = delete;
+  X86Jit &operator=(const X86Jit &) = delete;
+
+  bool compile();
+  // Runs the compiled program, returns its exit status.
+  int run();
+  size_t codeSize() const { return emitter_.code().size(); }
+  // Profile counters after run
+  std::vector<uint64_t> counters() const;
+
+private:
+  void release();
+
+  const Module &module_;
+  MachineCodeEmitter emitter_;
+  void *memory_ = nullptr;
+  size_t mappedSize_ = 0;
+};
+
+#endif
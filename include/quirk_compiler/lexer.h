@@ -1,10 +1,15 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "astnode.h"
+#include "stats.h"
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <optional>
 #include <regex>
+#include <sstream>
+#include <unordered_map>
 #include <utility>
 
 enum TokenType {
@@ -38,15 +43,28 @@ class Lexer {
 public:
     Lexer(const std::string& filename);
     std::pair<TokenType, std::string> getNextToken();
+    // The token getNextToken will return next, without consuming it
+    std::pair<TokenType, std::string> peekToken();
     bool isMathOperator(char c);
     std::string getCurrentLineNumber() const;
-    ~Lexer();
+    // Value of a NUMERIC_LITERAL token this lexer returned, by its text
+    NumericConstant numericConstant(const std::string& text) const;
+    // Times and counts every token read from the file into `stats`
+    void setStats(CompileStats* stats) { stats_ = stats; }
 
 private:
     std::string filename_;
-    std::ifstream file_;
+    std::istringstream file_;
     int currentPos_;
     int lineNumber_;
+    std::optional<std::pair<TokenType, std::string>> peeked_;
+    // Every numeric literal is converted once, when it is lexed
+    std::unordered_map<std::string, NumericConstant> numbers_;
+
+    CompileStats* stats_ = nullptr;
+
+    std::pair<TokenType, std::string> scanToken();
+    bool convertNumber(const std::string& text);
     const std::string MATH_OPERATORS;
     const std::regex KEYWORD_REGEX;
     const std::regex IDENTIFIER_REGEX;
@@ -0,0 +1,61 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "astnode.h"
+#include "cfg.h"
+#include "constantpool.h"
+#include "stats.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Function {
+  std::string name;
+  FunctionSignature signature;
+  ControlFlowGraph cfg{nullptr};
+};
+
+// The functions of one program, `main` first and the rest in source order,
+// and the string literals they share. In the IR the pool entries come
+// first, main's blocks sit at the top level and every other function is a
+// `define` instruction holding its blocks:
+//
+//   $0 = const "sum"
+//   define int @add(int, int)
+//     %t0 = param int
+//     ...
+class Module {
+public:
+  std::vector<Function> functions;
+  ConstantPool constants;
+
+  const Function *findFunction(const std::string &name) const;
+  // Bytes of a string operand, a pool reference or a quoted literal
+  std::string stringConstant(const std::string &operand) const;
+
+  std::shared_ptr<Instruction> toIR() const;
+  static Module fromIR(const std::shared_ptr<Instruction> &root);
+};
+
+// define [type] @name(types)
+std::string functionHeader(const Function &function);
+
+// Checks what the backends take on trust in IR that did not come from the
+// compiler, such as a loaded IR file: operands have the types their
+// instructions read them as, strings and arrays are written on every path
+// before they are read and returned on every way out of a function, and
+// branches name blocks of their function. Reports the first offence.
+bool verifyModule(const Module &module);
+
+// Lowers every function of the program to IR and runs `optimize` over it.
+// String literals are pooled in source order first. Functions are
+// independent, so up to `threads` of them are compiled at once; each
+// result goes to its own slot and the module comes out the same for any
+// thread count. With `stats`, codegen and optimization are timed and the
+// IR is counted before and after optimizing.
+Module buildModule(ASTNode *program, unsigned threads,
+                   const std::function<void(ControlFlowGraph &)> &optimize,
+                   CompileStats *stats = nullptr);
+
+#endif
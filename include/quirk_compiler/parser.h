@@ -6,6 +6,7 @@
 #include "lexer.h"
 #include <iostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class Parser {
@@ -14,6 +15,8 @@ public:
 
   void Initalize();
   ASTNode *parse();
+  // Times parsing and counts the AST nodes into `stats`
+  void setStats(CompileStats *stats);
   Condition parseCondition();
   ForLoopCondition parseForLoopCondition();
 
@@ -22,10 +25,32 @@ private:
   ASTNode *current_parent_;
   std::vector<ASTNode *> scope_stack_;
   std::vector<std::string> uniqueNameList_;
+  // Functions defined so far with their parameter count
+  std::unordered_map<std::string, size_t> functionArity_;
+  ASTNode *currentFunctionBody_ = nullptr;
+  std::vector<std::string> outerNameList_;
+  CompileStats *stats_ = nullptr;
+  bool parsing_ = false;
 
+  bool parseConditionalStatement(const std::string &statement);
+  bool parseStep(const std::string &name);
+  bool parseFunction();
+  ASTNode *parseCall(const std::string &name);
+  bool parseReturn();
   bool parseVarAssignment(TokenType varLiteralType, std::string varType);
-  std::tuple<bool, std::string, std::string> isNextTokenLiteralOrIdentifier();
+  bool parseArrayDeclaration(const std::string &varType);
+  ASTNode *parseArrayLiteral();
+  // The [index] after an array name
+  ASTNode *parseIndex(const std::string &name);
+  // The (array) after len
+  ASTNode *parseLength();
+  ASTNode *parseExpression();
+  ASTNode *parseTerm();
+  ASTNode *parseFactor();
+  ASTNode *parseOperand();
   std::string tokenTypeToString(TokenType tokenType);
+  // Node for a literal or identifier token, numbers carry their value
+  ASTNode *tokenNode(const std::pair<TokenType, std::string> &token);
   void switchParentNode(ASTNode *new_parent);
   void popParentNode();
 };
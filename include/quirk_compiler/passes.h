@@ -0,0 +1,76 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "cfg.h"
+
+class AnalysisManager;
+
+// Every pass returns true when it changed the graph. The analyses it is
+// handed describe the graph as the pass gets it; a pass that asks again
+// after changing the graph invalidates them first.
+
+// Removes unreachable blocks, stores to slots that are never loaded, unused
+// allocs and pure instructions whose results are never read, then folds
+// empty forwarding blocks and straight-line block chains together.
+bool eliminateDeadCode(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+// Global value numbering over the dominator tree: a load or comparison
+// already computed in a dominating position is reused, loads only while no
+// store to their slot can come in between.
+bool numberValues(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+// Removes array bounds checks that cannot fail: constant indices into
+// arrays of a known length, and the counter of a loop testing
+// `i < len(a)` or `i < n` with n at most the length, indexing a. A range
+// analysis finds the values that are never negative.
+bool eliminateBoundsChecks(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+// Checks every array element access of IR that comes from outside the
+// compiler, whose removed checks cannot be trusted, and then removes the
+// checks that are proven again.
+void guardArrayAccesses(ControlFlowGraph &cfg);
+
+// Turns chains of if/else if tests comparing one int value against
+// constants into a jump table when the constants are dense, and into a
+// balanced binary search of compares otherwise. The table is
+//
+//   switch %v, MIN, label %default, label %caseMIN, label %caseMIN+1, ...
+//
+// jumping to the default when %v - MIN is outside the table.
+bool lowerSwitches(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+// If-conversion: an if whose arms only compute pure values and store them
+// to slots, or only return a value, becomes
+//
+//   %v = select %c, A, B
+//
+// feeding the stores or the ret, so no branch is left to mispredict. Arms
+// are limited by a small cost model, since both of them now always run.
+bool convertIfsToSelects(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+// Moves loads of slots that are not stored inside a loop, and pure
+// computations over loop-invariant values, into the loop preheader.
+bool hoistLoopInvariants(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+// Keeps the for loop counter in a register across iterations instead of
+// reloading and storing its slot every time round.
+bool optimizeInductionVariables(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+// Deletes counted for loops (see CountedLoop) whose iterations have no
+// effect visible after the loop: no calls, and nothing they write is read
+// once the loop exits.
+bool removeDeadLoops(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+// Unrolls counted for loops (see CountedLoop) that start and end at int
+// literals. Small trip counts become straight-line code with the counter
+// replaced by its value in every copy; larger ones get a copy of the loop
+// doing several iterations per round, with the original loop left to run
+// the remaining ones.
+bool unrollLoops(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+// Replaces int multiplies, divides and remainders by powers of two with
+// shifts and masks, and powers with a small constant exponent with their
+// chain of multiplies. Multiplying or dividing by one is dropped.
+bool reduceStrength(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef PASSMANAGER_H
+#define PASSMANAGER_H
+
+#include "cfg.h"
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Lazily computed analyses of one CFG, handed to every pass of a pipeline.
+// Results stay cached from one pass to the next until a pass reports a
+// change.
+class AnalysisManager {
+public:
+  explicit AnalysisManager(const ControlFlowGraph &cfg) : cfg_(cfg) {}
+
+  const std::vector<int> &dominators();
+  const std::vector<Loop> &loops();
+  const std::unordered_map<std::string, std::string> &types();
+
+  void invalidate();
+
+  unsigned computed = 0;
+  unsigned reused = 0;
+
+private:
+  const ControlFlowGraph &cfg_;
+  std::optional<std::vector<int>> dominators_;
+  std::optional<std::vector<Loop>> loops_;
+  std::optional<std::unordered_map<std::string, std::string>> types_;
+};
+
+struct PassInfo {
+  const char *name;
+  const char *description;
+  bool (*run)(ControlFlowGraph &cfg, AnalysisManager &analyses);
+  // Skipped without running when the function has no loops
+  bool needsLoops;
+};
+
+// Every pass the pipeline can name, in a stable order.
+const std::vector<PassInfo> &registeredPasses();
+const PassInfo *findPass(const std::string &name);
+
+// Totals for one pass over every function it ran on. Time is summed over
+// the functions, so with parallel compilation it can exceed wall time.
+// Memory growth is how far the process high-water mark of the resident set
+// rose while the pass ran, summed the same way; with parallel compilation
+// it includes whatever other threads allocated meanwhile.
+struct PassStatistics {
+  std::string name;
+  unsigned runs = 0;
+  unsigned skipped = 0;
+  unsigned changed = 0;
+  std::chrono::nanoseconds time{0};
+  size_t instructionsBefore = 0;
+  size_t instructionsAfter = 0;
+  long peakMemoryGrowthKb = 0;
+};
+
+// Runs a pipeline of registered passes over each function. run() may be
+// called from several threads at once, the statistics are shared.
+class PassManager {
+public:
+  static const char *const kDefaultPipeline;
+
+  // Comma separated pass names, false and a message for an unknown name.
+  bool setPipeline(const std::string &pipeline);
+  void setTiming(bool enabled) { timing_ = enabled; }
+
+  bool run(ControlFlowGraph &cfg);
+  void printTimings(std::ostream &out) const;
+
+private:
+  std::vector<const PassInfo *> pipeline_;
+  bool timing_ = false;
+  mutable std::mutex mutex_;
+  std::vector<PassStatistics> statistics_;
+  size_t instructionsBefore_ = 0;
+  size_t instructionsAfter_ = 0;
+  unsigned analysesComputed_ = 0;
+  unsigned analysesReused_ = 0;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "module.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A conditional branch edge, named by the labels of its block and target.
+// The entry block is named "-".
+struct ProfileEdge {
+  std::string function;
+  std::string block;
+  std::string target;
+};
+
+// Execution counts of branch edges. Counter i of an instrumented program
+// counts edges[i]. The file holds one `function block target count` line
+// per edge.
+struct EdgeProfile {
+  std::vector<ProfileEdge> edges;
+  std::vector<uint64_t> counts;
+
+  bool write(const std::string &path) const;
+  bool read(const std::string &path);
+};
+
+// Splits every edge of a conditional branch with a block holding
+// `count N`, numbering the counters across the module in function order.
+// Runs on the optimized module, so a profile only applies to builds with
+// the same pipeline.
+EdgeProfile instrumentModule(Module &module);
+
+// Puts the counts on the conditional branches as `!weights taken
+// not-taken`, then lays every profiled function out again so that the
+// more frequent successor of each block follows it.
+void applyProfile(Module &module, const EdgeProfile &profile);
+
+#endif
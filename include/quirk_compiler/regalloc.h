@@ -0,0 +1,54 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "cfg.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Registers available to the allocator in preference order. Values live
+// across a call never get a caller-saved register.
+struct RegisterFile {
+  std::vector<std::string> registers;
+  std::vector<std::string> callerSaved;
+
+  // rbx, r12-r15 and rcx, rdx, r8-r10. rax, rdi, rsi and r11 are left to the
+  // backend as scratch and argument registers, rsp and rbp for the frame.
+  static RegisterFile x86_64();
+  // r0 .. r<count - 1>, none of them clobbered by calls.
+  static RegisterFile numbered(int count);
+};
+
+// Instruction positions are numbered over the blocks in layout order.
+struct LiveInterval {
+  std::string temporary;
+  int start;
+  int end;
+  bool crossesCall;
+  std::string hint; // operand whose register the result may reuse
+};
+
+struct RegisterAllocation {
+  std::unordered_map<std::string, std::string> registers;
+  std::unordered_map<std::string, int> spillSlots;
+  int spillSlotCount = 0;
+  int coalescedMoves = 0;
+
+  bool isSpilled(const std::string &temporary) const;
+  void print() const;
+};
+
+// Linear-scan allocation over the value temporaries of the IR. Alloc
+// results name stack slots and are left to the backend frame layout.
+class RegisterAllocator {
+public:
+  explicit RegisterAllocator(RegisterFile registerFile);
+
+  std::vector<LiveInterval> buildIntervals(const ControlFlowGraph &cfg) const;
+  RegisterAllocation allocate(const ControlFlowGraph &cfg) const;
+
+private:
+  RegisterFile registerFile_;
+};
+
+#endif
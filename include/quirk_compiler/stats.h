@@ -0,0 +1,65 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Counters of one compile for --stats. The lexer, parser, codegen and
+// module builder only record into it when they were handed a pointer to
+// it, so without --stats nothing is measured. Times are in nanoseconds;
+// codegen and optimization are summed over functions, so with parallel
+// compilation they can exceed wall time.
+struct CompileStats {
+  std::string input;
+  std::atomic<int64_t> lexTime{0};
+  // Including the lexing it drives
+  std::atomic<int64_t> parseTime{0};
+  std::atomic<int64_t> typecheckTime{0};
+  std::atomic<int64_t> codegenTime{0};
+  std::atomic<int64_t> optimizeTime{0};
+  uint64_t tokens = 0;
+  uint64_t astNodes = 0;
+  std::atomic<uint64_t> irInstructions{0};
+  std::atomic<uint64_t> optimizedInstructions{0};
+  long peakMemoryKb = 0;
+  uint64_t allocations = 0;
+};
+
+// Adds the time until it goes out of scope to `total`, nothing when null.
+class PhaseTimer {
+public:
+  explicit PhaseTimer(std::atomic<int64_t> *total) : total_(total) {
+    if (total_ != nullptr) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  ~PhaseTimer() {
+    if (total_ != nullptr) {
+      total_->fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start_)
+                            .count(),
+                        std::memory_order_relaxed);
+    }
+  }
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+  std::atomic<int64_t> *total_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Calls of operator new from here on are counted. Turn it on before any
+// worker thread starts.
+void countAllocations();
+uint64_t allocationCount();
+// Process high-water mark of the resident set
+long peakMemoryKb();
+
+void printStats(const CompileStats &stats, std::ostream &out);
+void printStatsJson(const CompileStats &stats, std::ostream &out);
+
+#endif
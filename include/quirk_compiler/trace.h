@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Chrome trace-event output for --trace, viewable in chrome://tracing or
+// Perfetto. Each thread records complete events into a buffer of its own,
+// so recording takes no lock; a thread registers its buffer with its first
+// event and gets its own track. The buffers are written out once, when the
+// process exits.
+class TraceSpan {
+public:
+  // Records the time until destruction as event `name` on the calling
+  // thread's track; `name` must outlive the process, like a literal.
+  explicit TraceSpan(const char *name) : TraceSpan(name, std::string()) {}
+  // `detail` becomes the event's argument
+  TraceSpan(const char *name, const std::string &detail);
+  ~TraceSpan();
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+  // Starts recording for the whole process; `path` is written at exit
+  static void enable(const std::string &path);
+  static bool enabled() { return enabled_; }
+  // An event measured elsewhere, `start` and `duration` in nanoseconds
+  // since enable()
+  static void record(const char *name, int64_t start, int64_t duration,
+                     const std::string &detail);
+  static int64_t now();
+
+private:
+  static bool enabled_;
+  const char *name_ = nullptr;
+  std::string detail_;
+  int64_t start_ = 0;
+};
+
+#endif
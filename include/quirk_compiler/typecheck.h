@@ -0,0 +1,44 @@
+#ifndef TYPECHECK_H
+#define TYPECHECK_H
+
+#include "astnode.h"
+#include "codegen.h"
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Checks a parsed program and annotates every expression node with its
+// lowercase type (ASTNode::getValueType), so codegen emits typed IR without
+// guessing. An int literal where a float is expected is typed float. The
+// relational operator of a condition gets the type both sides are compared
+// in. Arrays are typed by their element type followed by [], as in int[].
+// Errors go to std::cerr.
+class TypeChecker {
+public:
+  // False when the program has a type error
+  bool check(ASTNode *program);
+
+private:
+  void checkFunction(ASTNode *function);
+  void checkStatement(ASTNode *node);
+  void checkCondition(ASTNode *node);
+  void checkForCondition(ASTNode *node);
+  // Type of an expression, `expected` lets int literals become floats
+  std::string checkExpression(ASTNode *node, const std::string &expected = "");
+  std::string checkArithmetic(ASTNode *node);
+  std::string checkArray(ASTNode *node, const std::string &expected);
+  // Return type of the callee, empty for one without a value
+  std::string checkCall(ASTNode *call);
+  std::string lookup(const std::string &name);
+  void error(const std::string &message);
+
+  std::unordered_map<std::string, FunctionSignature> functions_;
+  // Declared variables and their types, the latest declaration last
+  std::vector<std::pair<std::string, std::string>> variables_;
+  std::string returnType_;
+  bool inFunction_ = false;
+  int errors_ = 0;
+};
+
+#endif
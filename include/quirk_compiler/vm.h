@@ -0,0 +1,38 @@
+#ifndef VM_H
+#define VM_H
+
+#include "bytecode.h"
+#include <memory>
+#include <vector>
+
+// Register VM for BytecodeProgram. Frames are stacked in one value stack;
+// each function's constants are resolved once up front and copied into
+// every new frame, so a call costs two copies and no allocation unless the
+// stack has to grow.
+class VirtualMachine {
+public:
+  explicit VirtualMachine(const BytecodeProgram &program);
+
+  // Exit status, 1 after a runtime error such as an index out of bounds
+  int run();
+  // Profile counters after run, see COUNTER
+  const std::vector<uint64_t> &counters() const { return counters_; }
+
+private:
+  struct CallFrame {
+    const BytecodeInstruction *returnPc;
+    size_t base;
+    uint16_t function;
+    uint16_t result;
+  };
+
+  const BytecodeProgram &program_;
+  std::vector<std::vector<Value>> constants_;
+  std::vector<Value> stack_;
+  std::vector<CallFrame> calls_;
+  std::vector<uint64_t> counters_;
+  // Every array the program made, freed when the VM is
+  std::vector<std::unique_ptr<Value[]>> arrays_;
+};
+
+#endif
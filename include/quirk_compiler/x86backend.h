@@ -0,0 +1,82 @@
+#ifndef X86BACKEND_H
+#define X86BACKEND_H
+
+#include "cfg.h"
+#include "module.h"
+#include "regalloc.h"
+#include "x86emitter.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Lowers a module to x86-64 System V code. The program becomes `main`,
+// out() goes through printf from the C library. Other functions are local
+// to the output and take up to six arguments in the integer argument
+// registers, floats as raw bits; results come back in rax.
+class X86Backend {
+public:
+  explicit X86Backend(const Module &module);
+
+  std::string emitAssembly();
+  // Assembles and links the program with the system C compiler driver.
+  bool buildExecutable(const std::string &outputFile);
+  // Emits every function through `emitter`, main first.
+  void lower(X86Emitter &emitter);
+
+private:
+  void lowerFunction(const Function &function);
+  void emitPrologue(size_t parameters);
+  void emitEpilogue();
+  void emitInstruction(const DecodedInstruction &instr, size_t block);
+  void emitCompare(const DecodedInstruction &instr);
+  void emitArithmetic(const DecodedInstruction &instr);
+  void emitDivision(const DecodedInstruction &instr);
+  void emitPower(const DecodedInstruction &instr);
+  void emitOut(const std::string &value);
+  void emitCall(const DecodedInstruction &instr);
+  void emitReturn(const DecodedInstruction &instr, size_t block);
+  void emitBranch(const DecodedInstruction &instr, size_t block);
+  void emitSwitch(const DecodedInstruction &instr);
+  void emitSelect(const DecodedInstruction &instr);
+  void emitArray(const DecodedInstruction &instr);
+  void emitNewArray(const DecodedInstruction &instr);
+  void emitRuntimeErrors();
+  void emitRuntimeError(const std::string &format);
+
+  void loadValue(const std::string &value, X86Register reg);
+  // The register `value` is allocated to, or `scratch` after loading it
+  X86Register inRegister(const std::string &value, X86Register scratch);
+  void loadDouble(const std::string &value, int xmm);
+  void storeResult(const std::string &temporary, X86Register reg);
+  X86Operand location(const std::string &temporary) const;
+  std::string typeOf(const std::string &value) const;
+  std::string blockLabel(const std::string &label) const;
+  void saveCallerSaved();
+  void restoreCallerSaved();
+
+  const Module &module_;
+  const ControlFlowGraph *cfg_ = nullptr;
+  std::string function_;
+  RegisterAllocation allocation_;
+  std::unordered_map<std::string, std::string> types_;
+  std::unordered_map<std::string, int> frameOffsets_;
+  // Frame slots the incoming arguments are saved to, by position
+  std::vector<int> parameterOffsets_;
+  std::unordered_map<std::string, size_t> parameterIndex_;
+  std::vector<X86Register> savedRegisters_;
+  std::vector<X86Register> liveCallerSaved_;
+  int powerLoops_ = 0;
+  int divisions_ = 0;
+  // Whether the function jumps to its bounds, negative length, division by
+  // zero and division overflow stubs
+  bool outOfBounds_ = false;
+  bool negativeLength_ = false;
+  bool divisionByZero_ = false;
+  bool divisionOverflow_ = false;
+  X86Emitter *out_ = nullptr;
+};
+
+// Label of a function's entry point in the emitted code.
+std::string functionLabel(const std::string &name);
+
+#endif
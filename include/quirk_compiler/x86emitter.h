@@ -0,0 +1,295 @@
+#ifndef X86EMITTER_H
+#define X86EMITTER_H
+
+#include <cstdint>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// General purpose registers in their encoding order.
+enum class X86Register : uint8_t {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+};
+
+// Looks up a register by its allocator name, e.g. "rbx" or "r12".
+X86Register x86Register(const std::string &name);
+
+// Condition codes in their encoding order.
+enum class X86Condition : uint8_t {
+  O,
+  NO,
+  B,
+  AE,
+  E,
+  NE,
+  BE,
+  A,
+  S,
+  NS,
+  P,
+  NP,
+  L,
+  GE,
+  LE,
+  G,
+};
+
+// A 64 bit register, an rbp-relative frame slot or an immediate.
+struct X86Operand {
+  enum Kind { None, Register, Frame, Immediate };
+
+  Kind kind = None;
+  X86Register reg = X86Register::RAX;
+  int64_t value = 0;
+
+  static X86Operand of(X86Register reg);
+  static X86Operand frame(int offset);
+  static X86Operand immediate(int64_t value);
+
+  bool operator==(const X86Operand &other) const;
+  bool operator!=(const X86Operand &other) const { return !(*this == other); }
+};
+
+// The instruction subset X86Backend lowers to. Operands are in Intel order,
+// destination first; xmm registers are passed by number.
+class X86Emitter {
+public:
+  virtual ~X86Emitter() = default;
+
+  virtual void label(const std::string &name) = 0;
+  virtual void push(X86Register reg) = 0;
+  virtual void pop(X86Register reg) = 0;
+  virtual void ret() = 0;
+  // Register to register, frame slot to register and back, or an immediate
+  // into a register.
+  virtual void mov(X86Operand dst, X86Operand src) = 0;
+  virtual void movsx32(X86Register reg) = 0;
+  virtual void movzx8(X86Register reg) = 0;
+  virtual void lea(X86Register dst, X86Operand slot) = 0;
+  // Array memory: the 8 byte element `index` of the array at `base`, and
+  // the length in the 8 bytes before its first element
+  virtual void loadElement(X86Register dst, X86Register base,
+                           X86Register index) = 0;
+  virtual void storeElement(X86Register base, X86Register index,
+                            X86Register src) = 0;
+  virtual void loadLength(X86Register dst, X86Register base) = 0;
+  virtual void storeLength(X86Register base, X86Register src) = 0;
+  virtual void add(X86Register dst, int32_t immediate) = 0;
+  virtual void sub(X86Register dst, int32_t immediate) = 0;
+  virtual void add(X86Register dst, X86Register src) = 0;
+  virtual void sub(X86Register dst, X86Register src) = 0;
+  virtual void imul(X86Register dst, X86Register src) = 0;
+  virtual void and64(X86Register dst, X86Register src) = 0;
+  // Shifts by a constant count; sar keeps the sign, shr does not
+  virtual void shl(X86Register dst, uint8_t count) = 0;
+  virtual void sar(X86Register dst, uint8_t count) = 0;
+  virtual void shr(X86Register dst, uint8_t count) = 0;
+  // Sign extends rax into rdx, then divides rdx:rax leaving rax and rdx
+  virtual void cqo() = 0;
+  virtual void idiv(X86Register src) = 0;
+  virtual void zero(X86Register reg) = 0;
+  // Register against register, or a register or frame slot against an
+  // 8 bit immediate
+  virtual void cmp(X86Operand lhs, X86Operand rhs) = 0;
+  virtual void test(X86Register reg) = 0;
+  virtual void set(X86Condition condition, X86Register reg) = 0;
+  virtual void and8(X86Register dst, X86Register src) = 0;
+  virtual void or8(X86Register dst, X86Register src) = 0;
+  virtual void cmov(X86Condition condition, X86Register dst,
+                    X86Register src) = 0;
+  virtual void movToXmm(int xmm, X86Register src) = 0;
+  virtual void movFromXmm(X86Register dst, int xmm) = 0;
+  virtual void cvtsi2sd(int xmm, X86Register src) = 0;
+  virtual void addsd(int dst, int src) = 0;
+  virtual void subsd(int dst, int src) = 0;
+  virtual void mulsd(int dst, int src) = 0;
+  virtual void divsd(int dst, int src) = 0;
+  virtual void ucomisd(int lhs, int rhs) = 0;
+  virtual void jmp(const std::string &label) = 0;
+  virtual void jcc(X86Condition condition, const std::string &label) = 0;
+  // Jumps to labels[index] through a table of 32 bit offsets placed right
+  // after the jump. The index must be in range; `scratch` is clobbered.
+  virtual void jumpTable(X86Register index, X86Register scratch,
+                         const std::vector<std::string> &labels) = 0;
+  // Calls a C library function: printf, strcmp, calloc, fflush, dprintf or
+  // exit
+  virtual void call(const std::string &function) = 0;
+  // Calls code at a label of this program
+  virtual void callLabel(const std::string &label) = 0;
+  // Address of a NUL terminated copy of `contents`
+  virtual void loadString(X86Register dst, const std::string &contents) = 0;
+  // Adds one to 64 bit profile counter `index`
+  virtual void incrementCounter(uint32_t index) = 0;
+};
+
+// GNU as syntax. Strings are collected into a separate read-only section.
+class AssemblyEmitter : public X86Emitter {
+public:
+  std::string text() const { return text_.str(); }
+  std::string data() const;
+
+  void label(const std::string &name) override;
+  void push(X86Register reg) override;
+  void pop(X86Register reg) override;
+  void ret() override;
+  void mov(X86Operand dst, X86Operand src) override;
+  void movsx32(X86Register reg) override;
+  void movzx8(X86Register reg) override;
+  void lea(X86Register dst, X86Operand slot) override;
+  void loadElement(X86Register dst, X86Register base,
+                   X86Register index) override;
+  void storeElement(X86Register base, X86Register index,
+                    X86Register src) override;
+  void loadLength(X86Register dst, X86Register base) override;
+  void storeLength(X86Register base, X86Register src) override;
+  void add(X86Register dst, int32_t immediate) override;
+  void sub(X86Register dst, int32_t immediate) override;
+  void add(X86Register dst, X86Register src) override;
+  void sub(X86Register dst, X86Register src) override;
+  void imul(X86Register dst, X86Register src) override;
+  void and64(X86Register dst, X86Register src) override;
+  void shl(X86Register dst, uint8_t count) override;
+  void sar(X86Register dst, uint8_t count) override;
+  void shr(X86Register dst, uint8_t count) override;
+  void cqo() override;
+  void idiv(X86Register src) override;
+  void zero(X86Register reg) override;
+  void cmp(X86Operand lhs, X86Operand rhs) override;
+  void test(X86Register reg) override;
+  void set(X86Condition condition, X86Register reg) override;
+  void and8(X86Register dst, X86Register src) override;
+  void or8(X86Register dst, X86Register src) override;
+  void cmov(X86Condition condition, X86Register dst, X86Register src) override;
+  void movToXmm(int xmm, X86Register src) override;
+  void movFromXmm(X86Register dst, int xmm) override;
+  void cvtsi2sd(int xmm, X86Register src) override;
+  void addsd(int dst, int src) override;
+  void subsd(int dst, int src) override;
+  void mulsd(int dst, int src) override;
+  void divsd(int dst, int src) override;
+  void ucomisd(int lhs, int rhs) override;
+  void jmp(const std::string &label) override;
+  void jcc(X86Condition condition, const std::string &label) override;
+  void jumpTable(X86Register index, X86Register scratch,
+                 const std::vector<std::string> &labels) override;
+  void call(const std::string &function) override;
+  void callLabel(const std::string &label) override;
+  void loadString(X86Register dst, const std::string &contents) override;
+  void incrementCounter(uint32_t index) override;
+
+private:
+  std::ostringstream text_;
+  std::ostringstream data_;
+  std::unordered_map<std::string, std::string> strings_;
+  int tables_ = 0;
+  uint32_t counters_ = 0;
+};
+
+// Encodes straight to machine code. Jumps are emitted with 32 bit
+// displacements and patched once every label is known; calls and strings
+// use absolute addresses, so the code only runs inside this process.
+class MachineCodeEmitter : public X86Emitter {
+public:
+  // Resolves the pending jumps, false if one targets an unknown label.
+  bool finish();
+  const std::vector<uint8_t> &code() const { return code_; }
+  const std::deque<uint64_t> &counters() const { return counters_; }
+
+  void label(const std::string &name) override;
+  void push(X86Register reg) override;
+  void pop(X86Register reg) override;
+  void ret() override;
+  void mov(X86Operand dst, X86Operand src) override;
+  void movsx32(X86Register reg) override;
+  void movzx8(X86Register reg) override;
+  void lea(X86Register dst, X86Operand slot) override;
+  void loadElement(X86Register dst, X86Register base,
+                   X86Register index) override;
+  void storeElement(X86Register base, X86Register index,
+                    X86Register src) override;
+  void loadLength(X86Register dst, X86Register base) override;
+  void storeLength(X86Register base, X86Register src) override;
+  void add(X86Register dst, int32_t immediate) override;
+  void sub(X86Register dst, int32_t immediate) override;
+  void add(X86Register dst, X86Register src) override;
+  void sub(X86Register dst, X86Register src) override;
+  void imul(X86Register dst, X86Register src) override;
+  void and64(X86Register dst, X86Register src) override;
+  void shl(X86Register dst, uint8_t count) override;
+  void sar(X86Register dst, uint8_t count) override;
+  void shr(X86Register dst, uint8_t count) override;
+  void cqo() override;
+  void idiv(X86Register src) override;
+  void zero(X86Register reg) override;
+  void cmp(X86Operand lhs, X86Operand rhs) override;
+  void test(X86Register reg) override;
+  void set(X86Condition condition, X86Register reg) override;
+  void and8(X86Register dst, X86Register src) override;
+  void or8(X86Register dst, X86Register src) override;
+  void cmov(X86Condition condition, X86Register dst, X86Register src) override;
+  void movToXmm(int xmm, X86Register src) override;
+  void movFromXmm(X86Register dst, int xmm) override;
+  void cvtsi2sd(int xmm, X86Register src) override;
+  void addsd(int dst, int src) override;
+  void subsd(int dst, int src) override;
+  void mulsd(int dst, int src) override;
+  void divsd(int dst, int src) override;
+  void ucomisd(int lhs, int rhs) override;
+  void jmp(const std::string &label) override;
+  void jcc(X86Condition condition, const std::string &label) override;
+  void jumpTable(X86Register index, X86Register scratch,
+                 const std::vector<std::string> &labels) override;
+  void call(const std::string &function) override;
+  void callLabel(const std::string &label) override;
+  void loadString(X86Register dst, const std::string &contents) override;
+  void incrementCounter(uint32_t index) override;
+
+private:
+  void byte(uint8_t value);
+  void imm32(int32_t value);
+  void imm64(int64_t value);
+  void rex(bool wide, int reg, int rm, bool force = false);
+  void modrm(int reg, int rm);
+  void frameSlot(int reg, int offset);
+  // 64 bit `opcode` on [base + index * 8], or [base - 8] without an index
+  void arrayMemory(uint8_t opcode, int reg, int base, int index);
+  void registers(uint8_t opcode, int reg, int rm);
+  void shift(int extension, X86Register dst, uint8_t count);
+  void movImmediate64(int reg, int64_t value);
+  void rel32(const std::string &label);
+
+  std::vector<uint8_t> code_;
+  std::unordered_map<std::string, size_t> labels_;
+  std::vector<std::pair<size_t, std::string>> fixups_;
+  // Jump table entries: position, target label and start of their table
+  struct TableEntry {
+    size_t position;
+    std::string label;
+    size_t table;
+  };
+  std::vector<TableEntry> tableEntries_;
+  // Owns the strings the code points at; deque keeps them in place
+  std::deque<std::string> strings_;
+  std::unordered_map<std::string, const char *> stringAddresses_;
+  // Profile counters the code increments in place
+  std::deque<uint64_t> counters_;
+};
+
+#endif
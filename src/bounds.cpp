@@ -0,0 +1,416 @@
+#include "passes.h"
+#include "passmanager.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Int literals from 0 up to this stay non-negative when counted up by one,
+// reaching 2^63 from here takes longer than any program runs
+const long long kMaximumCountedStart = 1LL << 32;
+
+// Where a temporary is defined
+struct Definition {
+  int block;
+  size_t index;
+};
+
+using Predicate = std::function<bool(const DecodedInstruction &)>;
+
+class BoundsCheckElimination {
+public:
+  BoundsCheckElimination(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+  bool run();
+
+private:
+  void findNonNegative();
+  bool isNonNegative(const std::string &value) const;
+  bool nonNegativeDefinition(const DecodedInstruction &instr) const;
+  long long minimumLength(const std::string &array,
+                          std::unordered_set<std::string> &visiting) const;
+  bool inBounds(int block, size_t position, const std::string &index,
+                const std::string &array) const;
+  bool boundedByLoop(const Loop &loop, int block, size_t position,
+                     const std::string &index, const std::string &array) const;
+  bool sameLoad(const std::string &loaded, const std::string &value,
+                const Loop &loop, int body, int block, size_t position) const;
+  bool unchanged(int header, int from, int to, size_t position,
+                 const Predicate &kills) const;
+  std::optional<Definition> singleDefinition(const std::string &value) const;
+
+  ControlFlowGraph &cfg_;
+  std::vector<std::vector<DecodedInstruction>> decoded_;
+  std::unordered_map<std::string, std::vector<Definition>> definitions_;
+  // Every value stored to each slot
+  std::unordered_map<std::string, std::vector<std::string>> stored_;
+  std::unordered_set<std::string> nonNegative_;
+  std::unordered_set<std::string> nonNegativeSlots_;
+  const std::vector<int> &idom_;
+  std::vector<std::vector<int>> preds_;
+  const std::vector<Loop> &loops_;
+};
+
+BoundsCheckElimination::BoundsCheckElimination(ControlFlowGraph &cfg,
+                                               AnalysisManager &analyses)
+    : cfg_(cfg), idom_(analyses.dominators()), loops_(analyses.loops()) {
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    decoded_.emplace_back();
+    for (const auto &instr : cfg.blocks[b].instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      if (!decoded.result.empty()) {
+        definitions_[decoded.result].push_back(
+            {static_cast<int>(b), decoded_.back().size()});
+      }
+      if (decoded.operation == "store") {
+        stored_[decoded.operands[1]].push_back(decoded.operands[0]);
+      }
+      decoded_.back().push_back(decoded);
+    }
+  }
+  preds_ = cfg.predecessors();
+  findNonNegative();
+}
+
+std::optional<Definition>
+BoundsCheckElimination::singleDefinition(const std::string &value) const {
+  auto it = definitions_.find(value);
+  if (it == definitions_.end() || it->second.size() != 1) {
+    return std::nullopt;
+  }
+  return it->second[0];
+}
+
+bool BoundsCheckElimination::isNonNegative(const std::string &value) const {
+  if (isTemporary(value)) {
+    return nonNegative_.count(value) > 0;
+  }
+  if (literalType(value) != "int") {
+    return false;
+  }
+  long long literal = std::strtoll(value.c_str(), nullptr, 10);
+  return literal >= 0 && literal <= kMaximumCountedStart;
+}
+
+bool BoundsCheckElimination::nonNegativeDefinition(
+    const DecodedInstruction &instr) const {
+  const std::string &op = instr.operation;
+  if (op == "length") {
+    return true;
+  }
+  if (op == "load") {
+    return nonNegativeSlots_.count(instr.operands[0]) > 0;
+  }
+  if (op == "inc") {
+    return isNonNegative(instr.operands[0]);
+  }
+  if (op == "select") {
+    return isNonNegative(instr.operands[1]) && isNonNegative(instr.operands[2]);
+  }
+  return false;
+}
+
+// Starts from every temporary and slot being non-negative and drops those
+// with a definition or a store that may not be, until nothing changes, so
+// a counter that is only ever incremented from zero stays in
+void BoundsCheckElimination::findNonNegative() {
+  for (const auto &definition : definitions_) {
+    nonNegative_.insert(definition.first);
+  }
+  for (const auto &slot : stored_) {
+    nonNegativeSlots_.insert(slot.first);
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto &slot : stored_) {
+      if (nonNegativeSlots_.count(slot.first) &&
+          !std::all_of(slot.second.begin(), slot.second.end(),
+                       [this](const std::string &value) {
+                         return isNonNegative(value);
+                       })) {
+        nonNegativeSlots_.erase(slot.first);
+        changed = true;
+      }
+    }
+    for (const auto &definition : definitions_) {
+      if (!nonNegative_.count(definition.first)) {
+        continue;
+      }
+      for (const Definition &at : definition.second) {
+        if (!nonNegativeDefinition(decoded_[at.block][at.index])) {
+          nonNegative_.erase(definition.first);
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+}
+
+// Shortest length `array` can have, 0 when it is not known: the literal
+// length of a newarray, or the shortest array stored to the slot it is
+// loaded from
+long long BoundsCheckElimination::minimumLength(
+    const std::string &array, std::unordered_set<std::string> &visiting) const {
+  std::optional<Definition> definition = singleDefinition(array);
+  if (!definition || !visiting.insert(array).second) {
+    return 0;
+  }
+  const DecodedInstruction &instr =
+      decoded_[definition->block][definition->index];
+  if (instr.operation == "newarray") {
+    if (literalType(instr.operands[0]) != "int") {
+      return 0;
+    }
+    return std::max(0LL, std::strtoll(instr.operands[0].c_str(), nullptr, 10));
+  }
+  if (instr.operation != "load") {
+    return 0;
+  }
+  auto stores = stored_.find(instr.operands[0]);
+  if (stores == stored_.end()) {
+    return 0;
+  }
+  long long shortest = LLONG_MAX;
+  for (const auto &value : stores->second) {
+    shortest = std::min(shortest, minimumLength(value, visiting));
+  }
+  return shortest;
+}
+
+// True when no instruction matching `kills` runs on a path from the start
+// of block `from` to the instruction at `position` in block `to` that does
+// not go through the loop header
+bool BoundsCheckElimination::unchanged(int header, int from, int to,
+                                       size_t position,
+                                       const Predicate &kills) const {
+  auto reach = [header](int start, const auto &edges) {
+    std::vector<bool> reached(edges.size(), false);
+    std::vector<int> worklist = {start};
+    while (!worklist.empty()) {
+      int b = worklist.back();
+      worklist.pop_back();
+      if (reached[b] || b == header) {
+        continue;
+      }
+      reached[b] = true;
+      for (int next : edges[b]) {
+        worklist.push_back(next);
+      }
+    }
+    return reached;
+  };
+  std::vector<std::vector<int>> succs;
+  for (size_t b = 0; b < cfg_.blocks.size(); b++) {
+    succs.push_back(cfg_.successors(static_cast<int>(b)));
+  }
+  std::vector<bool> forward = reach(from, succs);
+  std::vector<bool> backward = reach(to, preds_);
+
+  for (size_t b = 0; b < cfg_.blocks.size(); b++) {
+    if (!forward[b] || !backward[b]) {
+      continue;
+    }
+    size_t end = decoded_[b].size();
+    // All of `to` runs before the position when it can be entered again
+    if (static_cast<int>(b) == to &&
+        std::none_of(succs[b].begin(), succs[b].end(), [&](int next) {
+          return forward[next] && backward[next];
+        })) {
+      end = position;
+    }
+    for (size_t i = 0; i < end; i++) {
+      if (kills(decoded_[b][i])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// `value` is a load of the slot `loaded` reads in the loop header, the
+// load dominates the instruction at `position` in `block` and the slot is
+// not stored in between
+bool BoundsCheckElimination::sameLoad(const std::string &loaded,
+                                      const std::string &value,
+                                      const Loop &loop, int body, int block,
+                                      size_t position) const {
+  const std::vector<DecodedInstruction> &header = decoded_[loop.header];
+  size_t last = header.size();
+  for (size_t i = 0; i < header.size(); i++) {
+    if (header[i].result == loaded) {
+      last = i;
+    }
+  }
+  std::optional<Definition> definition = singleDefinition(value);
+  if (last == header.size() || header[last].operation != "load" ||
+      !definition) {
+    return false;
+  }
+  const DecodedInstruction &load = decoded_[definition->block][definition->index];
+  const std::string &slot = header[last].operands[0];
+  if (load.operation != "load" || load.operands[0] != slot ||
+      !loop.contains(definition->block) ||
+      !ControlFlowGraph::dominates(idom_, body, definition->block) ||
+      (definition->block == block ? definition->index > position
+                                  : !ControlFlowGraph::dominates(
+                                        idom_, definition->block, block))) {
+    return false;
+  }
+
+  auto storesSlot = [&slot](const DecodedInstruction &instr) {
+    return instr.operation == "store" && instr.operands[1] == slot;
+  };
+  for (size_t i = last + 1; i < header.size(); i++) {
+    if (storesSlot(header[i])) {
+      return false;
+    }
+  }
+  return unchanged(loop.header, body, definition->block, definition->index,
+                   storesSlot);
+}
+
+// The check at `position` in `block` is only reached through the body of
+// a loop whose header tests `counter < bound`, `index` still holds the
+// counter, and the bound is at most the length of `array`:
+//
+//   header: %i = load int %slot
+//           %n = length %a
+//           %c = (int %i < %n)
+//           br %c, label %body, label %exit
+//   body:   ...
+//           check %i, %a
+bool BoundsCheckElimination::boundedByLoop(const Loop &loop, int block,
+                                           size_t position,
+                                           const std::string &index,
+                                           const std::string &array) const {
+  const std::vector<DecodedInstruction> &header = decoded_[loop.header];
+  const DecodedInstruction &branch = header.back();
+  if (branch.operation != "br" || branch.operands.size() != 1 ||
+      branch.targets.size() != 2) {
+    return false;
+  }
+  int body = cfg_.findBlock(branch.targets[0]);
+  std::optional<Definition> test = singleDefinition(branch.operands[0]);
+  if (body < 0 || !loop.contains(body) || preds_[body].size() != 1 ||
+      !ControlFlowGraph::dominates(idom_, body, block) || !test ||
+      test->block != loop.header) {
+    return false;
+  }
+  const DecodedInstruction &compare = header[test->index];
+  if (compare.operation != "lt" || compare.type != "int") {
+    return false;
+  }
+  const std::string &counter = compare.operands[0];
+  const std::string &bound = compare.operands[1];
+
+  auto definesCounter = [&counter](const DecodedInstruction &instr) {
+    return instr.result == counter;
+  };
+  bool counted = false;
+  if (index == counter) {
+    counted = std::none_of(header.begin() + test->index, header.end(),
+                           definesCounter) &&
+              unchanged(loop.header, body, block, position, definesCounter);
+  } else {
+    counted = sameLoad(counter, index, loop, body, block, position);
+  }
+  if (!counted) {
+    return false;
+  }
+
+  if (literalType(bound) == "int") {
+    std::unordered_set<std::string> visiting;
+    return std::strtoll(bound.c_str(), nullptr, 10) <=
+           minimumLength(array, visiting);
+  }
+  std::optional<Definition> length = singleDefinition(bound);
+  if (!length || (loop.contains(length->block) && length->block != loop.header)) {
+    return false;
+  }
+  const DecodedInstruction &instr = decoded_[length->block][length->index];
+  if (instr.operation != "length") {
+    return false;
+  }
+  if (instr.operands[0] != array) {
+    return length->block == loop.header &&
+           sameLoad(instr.operands[0], array, loop, body, block, position);
+  }
+  std::optional<Definition> definition = singleDefinition(array);
+  return definition && (!loop.contains(definition->block) ||
+                        definition->block == loop.header);
+}
+
+bool BoundsCheckElimination::inBounds(int block, size_t position,
+                                      const std::string &index,
+                                      const std::string &array) const {
+  if (literalType(index) == "int") {
+    std::unordered_set<std::string> visiting;
+    long long value = std::strtoll(index.c_str(), nullptr, 10);
+    return value >= 0 && value < minimumLength(array, visiting);
+  }
+  if (!isNonNegative(index)) {
+    return false;
+  }
+  return std::any_of(loops_.begin(), loops_.end(), [&](const Loop &loop) {
+    return loop.contains(block) &&
+           boundedByLoop(loop, block, position, index, array);
+  });
+}
+
+bool BoundsCheckElimination::run() {
+  bool changed = false;
+  for (size_t b = 0; b < cfg_.blocks.size(); b++) {
+    std::vector<std::shared_ptr<Instruction>> kept;
+    for (size_t i = 0; i < decoded_[b].size(); i++) {
+      const DecodedInstruction &instr = decoded_[b][i];
+      if (instr.operation == "check" &&
+          inBounds(static_cast<int>(b), i, instr.operands[0],
+                   instr.operands[1])) {
+        changed = true;
+        continue;
+      }
+      kept.push_back(cfg_.blocks[b].instructions[i]);
+    }
+    cfg_.blocks[b].instructions = kept;
+  }
+  return changed;
+}
+
+} // namespace
+
+bool eliminateBoundsChecks(ControlFlowGraph &cfg, AnalysisManager &analyses) {
+  cfg.makeFallthroughsExplicit();
+  bool changed = BoundsCheckElimination(cfg, analyses).run();
+  cfg.removeFallthroughBranches();
+  return changed;
+}
+
+void guardArrayAccesses(ControlFlowGraph &cfg) {
+  for (auto &block : cfg.blocks) {
+    std::vector<std::shared_ptr<Instruction>> guarded;
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      size_t array = decoded.operation == "elem"      ? 0
+                     : decoded.operation == "setelem" ? 1
+                                                      : decoded.operands.size();
+      if (array < decoded.operands.size()) {
+        std::string check =
+            "check " + decoded.operands[array + 1] + ", " + decoded.operands[array];
+        if (guarded.empty() || guarded.back()->instruction != check) {
+          guarded.push_back(std::make_shared<Instruction>("check", check));
+        }
+      }
+      guarded.push_back(instr);
+    }
+    block.instructions = std::move(guarded);
+  }
+  AnalysisManager analyses(cfg);
+  eliminateBoundsChecks(cfg, analyses);
+}
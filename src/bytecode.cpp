@@ -0,0 +1,347 @@
+#include "bytecode.h"
+#include "regalloc.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+// Registers handed to the allocator; spilled values get frame registers
+// above this range, so a spill costs nothing extra in the VM.
+const int kAllocatableRegisters = 64;
+
+Opcode compareOpcode(const std::string &op, const std::string &type) {
+  static const std::unordered_map<std::string, int> order = {
+      {"cmp", 0}, {"neq", 1}, {"lt", 2}, {"le", 3}, {"gt", 4}, {"ge", 5}};
+  Opcode first = type == "float"    ? Opcode::EQ_FLOAT
+                 : type == "string" ? Opcode::EQ_STRING
+                                    : Opcode::EQ_INT;
+  return static_cast<Opcode>(static_cast<uint16_t>(first) + order.at(op));
+}
+
+// Opcode of an arithmetic operation, COUNT if there is none for the type
+Opcode arithmeticOpcode(const std::string &op, bool isFloat) {
+  static const std::unordered_map<std::string, Opcode> intOpcodes = {
+      {"add", Opcode::ADD_INT}, {"sub", Opcode::SUB_INT},
+      {"mul", Opcode::MUL_INT}, {"div", Opcode::DIV_INT},
+      {"mod", Opcode::MOD_INT}, {"pow", Opcode::POW_INT},
+      {"shl", Opcode::SHL_INT}, {"shr", Opcode::SHR_INT},
+      {"and", Opcode::AND_INT}};
+  static const std::unordered_map<std::string, Opcode> floatOpcodes = {
+      {"add", Opcode::ADD_FLOAT}, {"sub", Opcode::SUB_FLOAT},
+      {"mul", Opcode::MUL_FLOAT}, {"div", Opcode::DIV_FLOAT},
+      {"pow", Opcode::POW_FLOAT}};
+  const auto &opcodes = isFloat ? floatOpcodes : intOpcodes;
+  auto it = opcodes.find(op);
+  return it == opcodes.end() ? Opcode::COUNT : it->second;
+}
+
+} // namespace
+
+BytecodeCompiler::BytecodeCompiler(const Module &module) : module_(module) {}
+
+BytecodeProgram BytecodeCompiler::compile() {
+  program_ = BytecodeProgram();
+  functionIndex_.clear();
+  for (uint32_t i = 0; i < module_.constants.size(); i++) {
+    program_.strings.push_back(module_.constants.at(i));
+  }
+  for (size_t i = 0; i < module_.functions.size(); i++) {
+    functionIndex_[module_.functions[i].name] = static_cast<uint16_t>(i);
+  }
+
+  for (const Function &function : module_.functions) {
+    compileFunction(function);
+  }
+
+  return std::move(program_);
+}
+
+void BytecodeCompiler::compileFunction(const Function &function) {
+  cfg_ = &function.cfg;
+  types_ = inferTemporaryTypes(*cfg_);
+  registers_.clear();
+  constantIndex_.clear();
+  fixups_.clear();
+  parameters_ = 0;
+  program_.functions.push_back(BytecodeFunction());
+  function_ = &program_.functions.back();
+  function_->name = function.name;
+  function_->entry = static_cast<uint32_t>(program_.code.size());
+
+  RegisterAllocation allocation =
+      RegisterAllocator(RegisterFile::numbered(kAllocatableRegisters))
+          .allocate(*cfg_);
+
+  int next = 0;
+  for (const auto &entry : allocation.registers) {
+    int index = std::atoi(entry.second.c_str() + 1);
+    registers_[entry.first] = static_cast<uint16_t>(index);
+    next = std::max(next, index + 1);
+  }
+  for (const auto &entry : allocation.spillSlots) {
+    registers_[entry.first] =
+        static_cast<uint16_t>(kAllocatableRegisters + entry.second);
+    next = std::max(next, kAllocatableRegisters + entry.second + 1);
+  }
+  for (const auto &block : cfg_->blocks) {
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      if (decoded.operation == "alloc" && !registers_.count(decoded.result)) {
+        registers_[decoded.result] = static_cast<uint16_t>(next++);
+      }
+    }
+  }
+
+  // Frame: registers, two scratch registers, arguments, constants
+  scratch_ = static_cast<uint16_t>(next);
+  function_->argumentBase = static_cast<uint16_t>(next + 2);
+  function_->constantBase = static_cast<uint16_t>(
+      function_->argumentBase + function.signature.parameterTypes.size());
+
+  std::unordered_map<std::string, size_t> labelStart;
+  for (size_t b = 0; b < cfg_->blocks.size(); b++) {
+    if (!cfg_->blocks[b].label.empty()) {
+      labelStart[cfg_->blocks[b].label] = program_.code.size();
+    }
+    for (const auto &instr : cfg_->blocks[b].instructions) {
+      lower(decodeInstruction(*instr), b);
+    }
+  }
+  if (function.name == "main") {
+    emit(Opcode::HALT);
+  } else if (program_.code.size() == function_->entry ||
+             program_.code.back().opcode != Opcode::RET) {
+    emit(Opcode::RET, constant("0"));
+  }
+
+  for (const auto &fixup : fixups_) {
+    uint32_t target = static_cast<uint32_t>(labelStart[fixup.second]);
+    program_.code[fixup.first].b = static_cast<uint16_t>(target & 0xffff);
+    program_.code[fixup.first].c = static_cast<uint16_t>(target >> 16);
+  }
+
+  size_t registerCount = function_->constantBase + function_->constants.size();
+  if (registerCount > std::numeric_limits<uint16_t>::max()) {
+    std::cerr << "Bytecode: " << function.name << " needs " << registerCount
+              << " registers, more than a frame can address" << std::endl;
+    registerCount = std::numeric_limits<uint16_t>::max();
+  }
+  function_->registerCount = static_cast<uint16_t>(registerCount);
+}
+
+void BytecodeCompiler::lower(const DecodedInstruction &instr, size_t block) {
+  const std::string &op = instr.operation;
+
+  if (op == "store") {
+    emit(Opcode::MOVE, reg(instr.operands[1]), reg(instr.operands[0]));
+  } else if (op == "load") {
+    if (registers_.count(instr.result) &&
+        reg(instr.result) != reg(instr.operands[0])) {
+      emit(Opcode::MOVE, reg(instr.result), reg(instr.operands[0]));
+    }
+  } else if (op == "inc" || op == "dec") {
+    bool isFloat = typeOf(instr.operands[0]) == "float";
+    Opcode opcode = op == "inc" ? (isFloat ? Opcode::INC_FLOAT : Opcode::INC_INT)
+                                : (isFloat ? Opcode::DEC_FLOAT : Opcode::DEC_INT);
+    emit(opcode, reg(instr.result), reg(instr.operands[0]));
+  } else if (op == "select") {
+    emit(Opcode::SELECT, reg(instr.result), reg(instr.operands[0]),
+         reg(instr.operands[1]));
+    emit(Opcode::ARGS, reg(instr.operands[2]));
+  } else if (op == "add" || op == "sub" || op == "mul" || op == "div" ||
+             op == "mod" || op == "pow" || op == "shl" || op == "shr" ||
+             op == "and") {
+    // The exponent of a power stays an int
+    bool isFloat = typeOf(instr.operands[0]) == "float" ||
+                   (op != "pow" && typeOf(instr.operands[1]) == "float");
+    Opcode opcode = arithmeticOpcode(op, isFloat);
+    if (opcode == Opcode::COUNT) {
+      std::cerr << "Bytecode: no float form of '" << op << "'" << std::endl;
+    } else if (isFloat && op != "pow") {
+      uint16_t lhs = floatOperand(instr.operands[0], scratch_);
+      uint16_t rhs = floatOperand(instr.operands[1], scratch_ + 1);
+      emit(opcode, reg(instr.result), lhs, rhs);
+    } else {
+      emit(opcode, reg(instr.result), reg(instr.operands[0]),
+           reg(instr.operands[1]));
+    }
+  } else if (op == "cmp" || op == "neq" || op == "lt" || op == "le" ||
+             op == "gt" || op == "ge") {
+    std::string type = comparisonType(instr, types_);
+    if (type == "float") {
+      uint16_t lhs = floatOperand(instr.operands[0], scratch_);
+      uint16_t rhs = floatOperand(instr.operands[1], scratch_ + 1);
+      emit(compareOpcode(op, type), reg(instr.result), lhs, rhs);
+    } else {
+      emit(compareOpcode(op, type), reg(instr.result), reg(instr.operands[0]),
+           reg(instr.operands[1]));
+    }
+  } else if (op == "newarray") {
+    emit(Opcode::NEW_ARRAY, reg(instr.result), reg(instr.operands[0]));
+  } else if (op == "length") {
+    emit(Opcode::LENGTH, reg(instr.result), reg(instr.operands[0]));
+  } else if (op == "elem") {
+    emit(Opcode::LOAD_ELEMENT, reg(instr.result), reg(instr.operands[0]),
+         reg(instr.operands[1]));
+  } else if (op == "setelem") {
+    emit(Opcode::STORE_ELEMENT, reg(instr.operands[1]), reg(instr.operands[2]),
+         reg(instr.operands[0]));
+  } else if (op == "check") {
+    emit(Opcode::CHECK_INDEX, reg(instr.operands[0]), reg(instr.operands[1]));
+  } else if (op == "br") {
+    std::string next =
+        block + 1 < cfg_->blocks.size() ? cfg_->blocks[block + 1].label : "";
+
+    if (instr.operands.empty()) {
+      if (instr.targets[0] != next) {
+        emitJump(Opcode::JUMP, 0, instr.targets[0]);
+      }
+    } else if (instr.targets[0] == next) {
+      emitJump(Opcode::JUMP_IF_NOT, reg(instr.operands[0]), instr.targets[1]);
+    } else {
+      emitJump(Opcode::JUMP_IF, reg(instr.operands[0]), instr.targets[0]);
+      if (instr.targets[1] != next) {
+        emitJump(Opcode::JUMP, 0, instr.targets[1]);
+      }
+    }
+  } else if (op == "switch") {
+    size_t entries = instr.targets.size() - 1;
+    emit(Opcode::SWITCH, reg(instr.operands[0]), reg(instr.operands[1]),
+         static_cast<uint16_t>(entries));
+    for (const auto &target : instr.targets) {
+      emitJump(Opcode::JUMP, 0, target);
+    }
+  } else if (op == "count") {
+    uint32_t counter = static_cast<uint32_t>(
+        std::strtoul(instr.attribute.c_str(), nullptr, 10));
+    program_.counterCount = std::max(program_.counterCount, counter + 1);
+    emit(Opcode::COUNTER, 0, static_cast<uint16_t>(counter & 0xffff),
+         static_cast<uint16_t>(counter >> 16));
+  } else if (op == "call" && instr.attribute == "out") {
+    std::string value = instr.operands.empty() ? "\"\"" : instr.operands[0];
+    std::string type = typeOf(value);
+    Opcode opcode = type == "float"    ? Opcode::OUT_FLOAT
+                    : type == "string" ? Opcode::OUT_STRING
+                    : type == "char"   ? Opcode::OUT_CHAR
+                    : type == "bool"   ? Opcode::OUT_BOOL
+                                       : Opcode::OUT_INT;
+    emit(opcode, reg(value));
+  } else if (op == "call") {
+    emitCall(instr);
+  } else if (op == "param") {
+    uint16_t index = parameters_++;
+    if (registers_.count(instr.result)) {
+      emit(Opcode::MOVE, reg(instr.result),
+           static_cast<uint16_t>(function_->argumentBase + index));
+    }
+  } else if (op == "ret") {
+    emit(Opcode::RET,
+         instr.operands.empty() ? constant("0") : reg(instr.operands[0]));
+  } else if (op != "alloc") {
+    std::cerr << "Bytecode: unsupported operation '" << op << "'" << std::endl;
+  }
+}
+
+uint16_t BytecodeCompiler::reg(const std::string &value) {
+  if (!isTemporary(value)) {
+    return constant(value);
+  }
+  auto it = registers_.find(value);
+  if (it == registers_.end()) {
+    // Undefined temporary, reads as zero
+    it = registers_.emplace(value, constant("0")).first;
+  }
+  return it->second;
+}
+
+uint16_t BytecodeCompiler::constant(const std::string &literal) {
+  auto it = constantIndex_.find(literal);
+  if (it != constantIndex_.end()) {
+    return it->second;
+  }
+
+  Value value;
+  std::string type = literalType(literal);
+  if (type == "float") {
+    value.f = std::strtod(literal.c_str(), nullptr);
+  } else if (type == "string") {
+    if (isPoolReference(literal)) {
+      value.i = poolIndex(literal);
+    } else {
+      value.i = static_cast<int64_t>(program_.strings.size());
+      program_.strings.push_back(module_.stringConstant(literal));
+    }
+    function_->stringConstants.push_back(
+        static_cast<uint32_t>(function_->constants.size()));
+  } else if (type == "char") {
+    value.i = charLiteralCode(literal);
+  } else if (type == "bool") {
+    value.i = literal == "true" ? 1 : 0;
+  } else {
+    value.i = std::strtoll(literal.c_str(), nullptr, 10);
+  }
+
+  uint16_t index =
+      static_cast<uint16_t>(function_->constantBase + function_->constants.size());
+  function_->constants.push_back(value);
+  constantIndex_[literal] = index;
+  return index;
+}
+
+uint16_t BytecodeCompiler::floatOperand(const std::string &value,
+                                        uint16_t scratch) {
+  if (typeOf(value) == "float") {
+    return reg(value);
+  }
+  emit(Opcode::TO_FLOAT, scratch, reg(value));
+  return scratch;
+}
+
+std::string BytecodeCompiler::typeOf(const std::string &value) const {
+  if (isTemporary(value)) {
+    auto it = types_.find(value);
+    return it == types_.end() ? "int" : it->second;
+  }
+  return literalType(value);
+}
+
+void BytecodeCompiler::emit(Opcode opcode, uint16_t a, uint16_t b, uint16_t c) {
+  program_.code.push_back({opcode, a, b, c});
+}
+
+void BytecodeCompiler::emitCall(const DecodedInstruction &instr) {
+  auto callee = functionIndex_.find(instr.attribute);
+  if (callee == functionIndex_.end() || callee->second == 0) {
+    std::cerr << "Bytecode: call to unknown function '" << instr.attribute
+              << "'" << std::endl;
+    return;
+  }
+
+  // A call without a result writes its return value to scratch
+  uint16_t result = instr.result.empty() || !registers_.count(instr.result)
+                        ? scratch_
+                        : reg(instr.result);
+  std::vector<uint16_t> arguments;
+  for (const auto &argument : instr.operands) {
+    arguments.push_back(reg(argument));
+  }
+
+  emit(Opcode::CALL, result, callee->second,
+       static_cast<uint16_t>(arguments.size()));
+  for (size_t i = 0; i < arguments.size(); i += 3) {
+    BytecodeInstruction words = {Opcode::ARGS, 0, 0, 0};
+    uint16_t *slots[] = {&words.a, &words.b, &words.c};
+    for (size_t k = 0; k < 3 && i + k < arguments.size(); k++) {
+      *slots[k] = arguments[i + k];
+    }
+    program_.code.push_back(words);
+  }
+}
+
+void BytecodeCompiler::emitJump(Opcode opcode, uint16_t condition,
+                                const std::string &label) {
+  fixups_.push_back({program_.code.size(), label});
+  emit(opcode, condition);
+}
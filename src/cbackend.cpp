@@ -0,0 +1,438 @@
+#include "cbackend.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+namespace {
+
+const char *const runtime = R"(#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+#define QUIRK_LIKELY(x) __builtin_expect(!!(x), 1)
+#define QUIRK_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define QUIRK_LIKELY(x) (x)
+#define QUIRK_UNLIKELY(x) (x)
+#endif
+
+static void quirk_out_int(int64_t value) { printf("%lld\n", (long long)value); }
+static void quirk_out_float(double value) { printf("%g\n", value); }
+static void quirk_out_string(const char *value) { printf("%s\n", value); }
+static void quirk_out_char(int64_t value) { printf("%c\n", (int)value); }
+static void quirk_out_bool(int64_t value) { puts(value ? "true" : "false"); }
+
+static int64_t quirk_pow_int(int64_t base, int64_t n) {
+  uint64_t result = 1, b = (uint64_t)base;
+  for (; n > 0; n >>= 1) {
+    if (n & 1) result *= b;
+    b *= b;
+  }
+  return (int64_t)result;
+}
+static double quirk_pow_float(double base, int64_t n) {
+  double result = 1.0;
+  for (; n > 0; n >>= 1) {
+    if (n & 1) result *= base;
+    base *= base;
+  }
+  return result;
+}
+
+/* An array points at its first element, its length is the 8 bytes before */
+#define quirk_length(a) (((const int64_t *)(a))[-1])
+static void *quirk_new_array(int64_t n) {
+  if (QUIRK_UNLIKELY(n < 0)) {
+    fflush(stdout);
+    fprintf(stderr, "Runtime error: negative array length %lld\n", (long long)n);
+    exit(1);
+  }
+  int64_t *array = calloc((size_t)n + 1, sizeof(int64_t));
+  array[0] = n;
+  return array + 1;
+}
+static int64_t quirk_div(int64_t a, int64_t b) {
+  if (QUIRK_UNLIKELY(b == 0 || (b == -1 && a == INT64_MIN))) {
+    fflush(stdout);
+    if (b == 0) {
+      fprintf(stderr, "Runtime error: division by zero\n");
+    } else {
+      fprintf(stderr, "Runtime error: integer overflow in %lld / %lld\n",
+              (long long)a, (long long)b);
+    }
+    exit(1);
+  }
+  return a / b;
+}
+static int64_t quirk_mod(int64_t a, int64_t b) {
+  if (QUIRK_UNLIKELY(b == 0)) {
+    quirk_div(a, b);
+  }
+  return b == -1 ? 0 : a % b;
+}
+static void quirk_check(int64_t i, const void *a) {
+  if (QUIRK_UNLIKELY((uint64_t)i >= (uint64_t)quirk_length(a))) {
+    fflush(stdout);
+    fprintf(stderr, "Runtime error: index %lld out of bounds for length %lld\n",
+            (long long)i, (long long)quirk_length(a));
+    exit(1);
+  }
+}
+)";
+
+std::string cType(const std::string &type) {
+  bool array = type.size() > 2 && type.compare(type.size() - 2, 2, "[]") == 0;
+  return type == "float"     ? "double"
+         : type == "string"  ? "const char *"
+         : type == "float[]" ? "double *"
+         : array             ? "int64_t *"
+                             : "int64_t";
+}
+
+std::string zero(const std::string &type) {
+  return type == "float" ? "0.0" : type == "string" ? "\"\"" : "0";
+}
+
+// IR names are %name; keep C identifiers to letters, digits and _
+std::string identifier(const std::string &prefix, const std::string &name) {
+  std::string result = prefix;
+  for (char c : name.substr(name[0] == '%' || name[0] == '@' ? 1 : 0)) {
+    result += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  }
+  return result;
+}
+
+std::string label(const std::string &name) { return identifier("L_", name); }
+
+std::string functionName(const std::string &name) {
+  return identifier("quirk_", name);
+}
+
+std::string stringLiteral(const std::string &contents) {
+  std::string literal = "\"";
+  for (unsigned char c : contents) {
+    if (c == '"' || c == '\\') {
+      literal += '\\';
+      literal += static_cast<char>(c);
+    } else if (c < 0x20 || c >= 0x7f) {
+      char octal[5];
+      std::snprintf(octal, sizeof(octal), "\\%03o", c);
+      literal += octal;
+    } else {
+      literal += static_cast<char>(c);
+    }
+  }
+  return literal + "\"";
+}
+
+const char *comparison(const std::string &op) {
+  return op == "cmp"   ? "=="
+         : op == "neq" ? "!="
+         : op == "lt"  ? "<"
+         : op == "le"  ? "<="
+         : op == "gt"  ? ">"
+                       : ">=";
+}
+
+// C operator of an arithmetic operation other than pow
+const char *arithmetic(const std::string &op) {
+  return op == "add"   ? "+"
+         : op == "sub" ? "-"
+         : op == "mul" ? "*"
+         : op == "div" ? "/"
+         : op == "mod" ? "%"
+         : op == "shl" ? "<<"
+         : op == "shr" ? ">>"
+                       : "&";
+}
+
+} // namespace
+
+CBackend::CBackend(const Module &module) : module_(module) {}
+
+std::string CBackend::emitSource() {
+  out_.str("");
+  counters_ = 0;
+  for (const Function &function : module_.functions) {
+    for (const auto &block : function.cfg.blocks) {
+      for (const auto &instr : block.instructions) {
+        DecodedInstruction decoded = decodeInstruction(*instr);
+        if (decoded.operation == "count") {
+          counters_ = std::max<size_t>(
+              counters_, std::strtoul(decoded.attribute.c_str(), nullptr, 10) + 1);
+        }
+      }
+    }
+  }
+
+  out_ << runtime;
+  if (module_.constants.size() > 0) {
+    out_ << "\n";
+  }
+  for (uint32_t i = 0; i < module_.constants.size(); i++) {
+    out_ << "static const char quirk_s" << i << "[] = "
+         << stringLiteral(module_.constants.at(i)) << ";\n";
+  }
+  if (counters_ > 0) {
+    out_ << "\nstatic uint64_t quirk_counters[" << counters_ << "];\n";
+  }
+  out_ << "\n";
+  for (const Function &function : module_.functions) {
+    if (function.name != "main") {
+      out_ << prototype(function) << ";\n";
+    }
+  }
+  for (const Function &function : module_.functions) {
+    emitFunction(function);
+  }
+  return out_.str();
+}
+
+bool CBackend::buildExecutable(const std::string &outputFile) {
+  std::string sourceFile = outputFile + ".tmp.c";
+  std::ofstream out(sourceFile);
+  if (!out.is_open()) {
+    std::cerr << "Error: Could not write " << sourceFile << std::endl;
+    return false;
+  }
+  out << emitSource();
+  out.close();
+
+  std::string command =
+      "cc -std=c99 -O2 -o '" + outputFile + "' '" + sourceFile + "'";
+  int status = std::system(command.c_str());
+  std::remove(sourceFile.c_str());
+
+  if (status != 0) {
+    std::cerr << "Error: Compiling " << outputFile << " failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::string CBackend::prototype(const Function &function) const {
+  std::string text = "static " + cType(function.signature.returnType) + " " +
+                     functionName(function.name) + "(";
+  const auto &parameters = function.signature.parameterTypes;
+  for (size_t i = 0; i < parameters.size(); i++) {
+    text += (i == 0 ? "" : ", ") + cType(parameters[i]) + " p" +
+            std::to_string(i);
+  }
+  return text + (parameters.empty() ? "void)" : ")");
+}
+
+void CBackend::emitFunction(const Function &function) {
+  function_ = &function;
+  types_ = inferTemporaryTypes(function.cfg);
+  parameters_ = 0;
+
+  out_ << "\n"
+       << (function.name == "main" ? std::string("int main(void)")
+                                   : prototype(function))
+       << " {\n";
+
+  // Every temporary and slot, in name order so the output is stable
+  std::set<std::string> locals;
+  for (const auto &block : function.cfg.blocks) {
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      if (!decoded.result.empty()) {
+        locals.insert(decoded.result);
+      }
+      for (const auto &operand : decoded.operands) {
+        if (isTemporary(operand)) {
+          locals.insert(operand);
+        }
+      }
+    }
+  }
+  for (const auto &local : locals) {
+    std::string type = typeOf(local);
+    out_ << "  " << cType(type) << " " << identifier("", local) << " = "
+         << zero(type) << ";\n";
+  }
+
+  const auto &blocks = function.cfg.blocks;
+  for (size_t b = 0; b < blocks.size(); b++) {
+    if (!blocks[b].label.empty()) {
+      out_ << label(blocks[b].label) << ":;\n";
+    }
+    for (const auto &instr : blocks[b].instructions) {
+      emitInstruction(decodeInstruction(*instr), b);
+    }
+  }
+
+  std::string returnType =
+      function.name == "main" ? "int" : function.signature.returnType;
+  out_ << "  return " << zero(returnType) << ";\n}\n";
+}
+
+void CBackend::emitInstruction(const DecodedInstruction &instr, size_t block) {
+  const std::string &op = instr.operation;
+  std::string result = instr.result.empty() ? "" : identifier("", instr.result);
+
+  if (op == "alloc") {
+    return;
+  } else if (op == "store") {
+    out_ << "  " << identifier("", instr.operands[1]) << " = "
+         << value(instr.operands[0]) << ";\n";
+  } else if (op == "load") {
+    out_ << "  " << result << " = " << identifier("", instr.operands[0])
+         << ";\n";
+  } else if (op == "inc" || op == "dec") {
+    out_ << "  " << result << " = " << value(instr.operands[0])
+         << (op == "inc" ? " + 1" : " - 1") << ";\n";
+  } else if (op == "select") {
+    out_ << "  " << result << " = " << value(instr.operands[0]) << " ? "
+         << value(instr.operands[1]) << " : " << value(instr.operands[2])
+         << ";\n";
+  } else if (op == "newarray") {
+    out_ << "  " << result << " = quirk_new_array(" << value(instr.operands[0])
+         << ");\n";
+  } else if (op == "length") {
+    out_ << "  " << result << " = quirk_length(" << value(instr.operands[0])
+         << ");\n";
+  } else if (op == "elem") {
+    out_ << "  " << result << " = " << value(instr.operands[0]) << "["
+         << value(instr.operands[1]) << "];\n";
+  } else if (op == "setelem") {
+    out_ << "  " << value(instr.operands[1]) << "[" << value(instr.operands[2])
+         << "] = " << value(instr.operands[0]) << ";\n";
+  } else if (op == "check") {
+    out_ << "  quirk_check(" << value(instr.operands[0]) << ", "
+         << value(instr.operands[1]) << ");\n";
+  } else if (op == "pow") {
+    out_ << "  " << result << " = "
+         << (typeOf(instr.operands[0]) == "float" ? "quirk_pow_float("
+                                                  : "quirk_pow_int(")
+         << value(instr.operands[0]) << ", " << value(instr.operands[1])
+         << ");\n";
+  } else if (op == "add" || op == "sub" || op == "mul" || op == "div" ||
+             op == "mod" || op == "shl" || op == "shr" || op == "and") {
+    std::string lhs = value(instr.operands[0]);
+    std::string rhs = value(instr.operands[1]);
+    bool isFloat = typeOf(instr.operands[0]) == "float" ||
+                   typeOf(instr.operands[1]) == "float";
+    if (!isFloat && (op == "add" || op == "sub" || op == "mul" || op == "shl")) {
+      // Signed overflow is undefined in C, the language wraps around
+      out_ << "  " << result << " = (int64_t)((uint64_t)" << lhs << " "
+           << arithmetic(op) << " (uint64_t)" << rhs << ");\n";
+    } else if (!isFloat && (op == "div" || op == "mod")) {
+      out_ << "  " << result << " = quirk_" << op << "(" << lhs << ", " << rhs
+           << ");\n";
+    } else {
+      out_ << "  " << result << " = " << lhs << " " << arithmetic(op) << " "
+           << rhs << ";\n";
+    }
+  } else if (op == "cmp" || op == "neq" || op == "lt" || op == "le" ||
+             op == "gt" || op == "ge") {
+    std::string lhs = value(instr.operands[0]);
+    std::string rhs = value(instr.operands[1]);
+    if (comparisonType(instr, types_) == "string") {
+      out_ << "  " << result << " = strcmp(" << lhs << ", " << rhs << ") "
+           << comparison(op) << " 0;\n";
+    } else {
+      out_ << "  " << result << " = " << lhs << " " << comparison(op) << " "
+           << rhs << ";\n";
+    }
+  } else if (op == "br") {
+    emitBranch(instr, block);
+  } else if (op == "switch") {
+    long long minimum = std::strtoll(instr.operands[1].c_str(), nullptr, 10);
+    out_ << "  switch (" << value(instr.operands[0]) << ") {\n";
+    for (size_t i = 1; i < instr.targets.size(); i++) {
+      if (instr.targets[i] != instr.targets[0]) {
+        out_ << "  case " << minimum + static_cast<long long>(i - 1)
+             << ": goto " << label(instr.targets[i]) << ";\n";
+      }
+    }
+    out_ << "  default: goto " << label(instr.targets[0]) << ";\n  }\n";
+  } else if (op == "count") {
+    out_ << "  quirk_counters[" << instr.attribute << "]++;\n";
+  } else if (op == "call" && instr.attribute == "out") {
+    std::string argument = instr.operands.empty() ? "\"\"" : instr.operands[0];
+    std::string type = typeOf(argument);
+    out_ << "  quirk_out_"
+         << (type == "float" || type == "string" || type == "char" ||
+                     type == "bool"
+                 ? type
+                 : "int")
+         << "(" << value(argument) << ");\n";
+  } else if (op == "call") {
+    out_ << "  " << (result.empty() ? "" : result + " = ")
+         << functionName(instr.attribute) << "(";
+    for (size_t i = 0; i < instr.operands.size(); i++) {
+      out_ << (i == 0 ? "" : ", ") << value(instr.operands[i]);
+    }
+    out_ << ");\n";
+  } else if (op == "param") {
+    out_ << "  " << result << " = p" << parameters_++ << ";\n";
+  } else if (op == "ret") {
+    std::string returnType = function_->signature.returnType;
+    out_ << "  return "
+         << (instr.operands.empty() ? zero(returnType) : value(instr.operands[0]))
+         << ";\n";
+  } else {
+    std::cerr << "C backend: unsupported operation '" << op << "'"
+              << std::endl;
+  }
+}
+
+void CBackend::emitBranch(const DecodedInstruction &instr, size_t block) {
+  const auto &blocks = function_->cfg.blocks;
+  std::string next = block + 1 < blocks.size() ? blocks[block + 1].label : "";
+
+  if (instr.operands.empty()) {
+    if (instr.targets[0] != next) {
+      out_ << "  goto " << label(instr.targets[0]) << ";\n";
+    }
+    return;
+  }
+
+  std::string condition = value(instr.operands[0]);
+  if (!instr.attribute.empty()) {
+    unsigned long long taken = 0, notTaken = 0;
+    std::sscanf(instr.attribute.c_str(), "%llu %llu", &taken, &notTaken);
+    condition = (taken >= notTaken ? "QUIRK_LIKELY(" : "QUIRK_UNLIKELY(") +
+                condition + ")";
+  }
+  out_ << "  if (" << condition << ") goto " << label(instr.targets[0])
+       << ";\n";
+  if (instr.targets[1] != next) {
+    out_ << "  goto " << label(instr.targets[1]) << ";\n";
+  }
+}
+
+std::string CBackend::value(const std::string &operand) const {
+  if (isTemporary(operand)) {
+    return identifier("", operand);
+  }
+
+  std::string type = literalType(operand);
+  if (isPoolReference(operand)) {
+    return "quirk_s" + std::to_string(poolIndex(operand));
+  } else if (type == "string") {
+    return stringLiteral(operand.substr(1, operand.size() - 2));
+  } else if (type == "char") {
+    return std::to_string(charLiteralCode(operand));
+  } else if (type == "bool") {
+    return operand == "true" ? "1" : "0";
+  } else if (type == "int") {
+    return "INT64_C(" + operand + ")";
+  }
+  return operand;
+}
+
+std::string CBackend::typeOf(const std::string &operand) const {
+  if (isTemporary(operand)) {
+    auto it = types_.find(operand);
+    return it == types_.end() ? "int" : it->second;
+  }
+  return literalType(operand);
+}
@@ -0,0 +1,829 @@
+#include "cfg.h"
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <cstdlib>
+#include <map>
+
+namespace {
+
+const std::map<std::string, std::string> binaryOperators = {
+    {"cmp", "=="}, {"neq", "!="}, {"lt", "<"},
+    {"gt", ">"},   {"le", "<="},  {"ge", ">="},
+};
+
+// `%r = a + b`; shifts and the mask only come from strength reduction
+const std::map<std::string, std::string> arithmeticOperators = {
+    {"add", "+"}, {"sub", "-"},  {"mul", "*"},  {"div", "/"}, {"mod", "%"},
+    {"pow", "^"}, {"shl", "<<"}, {"shr", ">>"}, {"and", "&"},
+};
+
+std::string trim(const std::string &string) {
+  size_t begin = string.find_first_not_of(' ');
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = string.find_last_not_of(' ');
+  return string.substr(begin, end - begin + 1);
+}
+
+// Splits instruction text on whitespace, commas and round parens while
+// keeping string and char literals intact.
+std::vector<std::string> tokenize(const std::string &text) {
+  std::vector<std::string> tokens;
+  std::string current;
+
+  for (size_t i = 0; i < text.size(); i++) {
+    char c = text[i];
+
+    if (c == '"' || c == '\'') {
+      size_t end = text.find(c, i + 1);
+      if (end == std::string::npos) {
+        end = text.size() - 1;
+      }
+      current += text.substr(i, end - i + 1);
+      i = end;
+    } else if (std::isspace(static_cast<unsigned char>(c)) || c == ',' ||
+               c == '(' || c == ')') {
+      if (!current.empty()) {
+        tokens.push_back(current);
+        current.clear();
+      }
+    } else {
+      current += c;
+    }
+  }
+
+  if (!current.empty()) {
+    tokens.push_back(current);
+  }
+
+  return tokens;
+}
+
+// Type names are the only bare words besides true and false
+bool isTypeName(const std::string &token) {
+  return !isTemporary(token) && literalType(token).empty() &&
+         std::isalpha(static_cast<unsigned char>(token[0]));
+}
+
+} // namespace
+
+DecodedInstruction decodeInstruction(const Instruction &instr) {
+  DecodedInstruction decoded;
+  decoded.operation = trim(instr.operation);
+
+  std::vector<std::string> tokens = tokenize(instr.instruction);
+  const std::string &op = decoded.operation;
+
+  if (op == "root") {
+    return decoded;
+  }
+
+  if (op == "label") {
+    decoded.attribute = trim(instr.instruction);
+    return decoded;
+  }
+
+  size_t valueStart = 0;
+  if (tokens.size() > 1 && tokens[1] == "=") {
+    decoded.result = tokens[0];
+    valueStart = 2;
+  }
+
+  if (op == "alloc" && tokens.size() > valueStart + 1) {
+    decoded.attribute = tokens[valueStart + 1];
+  } else if (op == "store" || op == "load") {
+    // %r = load [type] %slot
+    size_t first = valueStart + 1;
+    if (op == "load" && tokens.size() > first + 1 && isTypeName(tokens[first])) {
+      decoded.type = tokens[first++];
+    }
+    for (size_t i = first; i < tokens.size(); i++) {
+      decoded.operands.push_back(tokens[i]);
+    }
+  } else if (binaryOperators.count(op) && tokens.size() >= valueStart + 3) {
+    // %r = ([type] a op b)
+    size_t first = valueStart;
+    if (tokens.size() >= first + 4 && isTypeName(tokens[first])) {
+      decoded.type = tokens[first++];
+    }
+    decoded.operands.push_back(tokens[first]);
+    decoded.operands.push_back(tokens[first + 2]);
+  } else if (arithmeticOperators.count(op) && tokens.size() >= valueStart + 3) {
+    decoded.operands.push_back(tokens[valueStart]);
+    decoded.operands.push_back(tokens[valueStart + 2]);
+  } else if ((op == "newarray" || op == "elem") &&
+             tokens.size() > valueStart + 2) {
+    // %r = newarray type n, %r = elem type %array, i
+    decoded.type = tokens[valueStart + 1];
+    for (size_t i = valueStart + 2; i < tokens.size(); i++) {
+      decoded.operands.push_back(tokens[i]);
+    }
+  } else if (op == "setelem" || op == "length" || op == "check") {
+    // setelem value, %array, i; %r = length %array; check i, %array
+    for (size_t i = valueStart + 1; i < tokens.size(); i++) {
+      decoded.operands.push_back(tokens[i]);
+    }
+  } else if ((op == "inc" || op == "dec") && tokens.size() > valueStart) {
+    decoded.operands.push_back(tokens[valueStart]);
+  } else if (op == "select" && tokens.size() >= valueStart + 4) {
+    // %r = select %c, A, B
+    for (size_t i = valueStart + 1; i < valueStart + 4; i++) {
+      decoded.operands.push_back(tokens[i]);
+    }
+  } else if (op == "br" || op == "switch") {
+    for (size_t i = 1; i < tokens.size(); i++) {
+      if (tokens[i] == "label" && i + 1 < tokens.size()) {
+        decoded.targets.push_back(tokens[++i]);
+      } else if (tokens[i] == "!weights") {
+        for (i++; i < tokens.size(); i++) {
+          decoded.attribute += (decoded.attribute.empty() ? "" : " ") + tokens[i];
+        }
+      } else {
+        decoded.operands.push_back(tokens[i]);
+      }
+    }
+  } else if (op == "call" && tokens.size() > valueStart + 1) {
+    // [%r =] call [type] @name(args)
+    size_t target = valueStart + 1;
+    if (tokens[target][0] != '@' && target + 1 < tokens.size()) {
+      decoded.type = tokens[target++];
+    }
+    decoded.attribute = tokens[target].substr(tokens[target][0] == '@' ? 1 : 0);
+    for (size_t i = target + 1; i < tokens.size(); i++) {
+      decoded.operands.push_back(tokens[i]);
+    }
+  } else if (op == "param" && tokens.size() > valueStart + 1) {
+    decoded.type = tokens[valueStart + 1];
+  } else if (op == "count" && tokens.size() > 1) {
+    decoded.attribute = tokens[1];
+  } else if (op == "ret") {
+    for (size_t i = 1; i < tokens.size(); i++) {
+      decoded.operands.push_back(tokens[i]);
+    }
+  } else {
+    for (size_t i = valueStart; i < tokens.size(); i++) {
+      if (isTemporary(tokens[i])) {
+        decoded.operands.push_back(tokens[i]);
+      }
+    }
+  }
+
+  return decoded;
+}
+
+std::shared_ptr<Instruction>
+encodeInstruction(const DecodedInstruction &decoded) {
+  const std::string &op = decoded.operation;
+  const std::vector<std::string> &operands = decoded.operands;
+  std::string text;
+
+  if (op == "label") {
+    text = decoded.attribute;
+  } else if (op == "alloc") {
+    text = decoded.result + " = alloc " + decoded.attribute;
+  } else if (op == "store") {
+    text = "store " + operands[0] + ", " + operands[1];
+  } else if (op == "load") {
+    text = decoded.result + " = load " +
+           (decoded.type.empty() ? "" : decoded.type + " ") + operands[0];
+  } else if (binaryOperators.count(op)) {
+    text = decoded.result + " = (" +
+           (decoded.type.empty() ? "" : decoded.type + " ") + operands[0] +
+           " " + binaryOperators.at(op) + " " + operands[1] + ")";
+  } else if (arithmeticOperators.count(op)) {
+    text = decoded.result + " = " + operands[0] + " " +
+           arithmeticOperators.at(op) + " " + operands[1];
+  } else if (op == "newarray") {
+    text = decoded.result + " = newarray " + decoded.type + " " + operands[0];
+  } else if (op == "elem") {
+    text = decoded.result + " = elem " + decoded.type + " " + operands[0] +
+           ", " + operands[1];
+  } else if (op == "setelem") {
+    text = "setelem " + operands[0] + ", " + operands[1] + ", " + operands[2];
+  } else if (op == "length") {
+    text = decoded.result + " = length " + operands[0];
+  } else if (op == "check") {
+    text = "check " + operands[0] + ", " + operands[1];
+  } else if (op == "inc") {
+    text = decoded.result + " = " + operands[0] + " + 1";
+  } else if (op == "dec") {
+    text = decoded.result + " = " + operands[0] + " - 1";
+  } else if (op == "select") {
+    text = decoded.result + " = select " + operands[0] + ", " + operands[1] +
+           ", " + operands[2];
+  } else if (op == "br" || op == "switch") {
+    text = op;
+    std::string separator = " ";
+    for (const auto &operand : operands) {
+      text += separator + operand;
+      separator = ", ";
+    }
+    for (const auto &target : decoded.targets) {
+      text += separator + "label " + target;
+      separator = ", ";
+    }
+    // Weights only mean something while the branch is conditional
+    if (!decoded.attribute.empty() && op == "br" && operands.size() == 1 &&
+        decoded.targets.size() == 2) {
+      text += ", !weights " + decoded.attribute;
+    }
+  } else if (op == "count") {
+    text = "count " + decoded.attribute;
+  } else if (op == "call") {
+    if (!decoded.result.empty()) {
+      text = decoded.result + " = ";
+    }
+    text += "call " + (decoded.type.empty() ? "" : decoded.type + " ") + "@" +
+            decoded.attribute + "(";
+    for (size_t i = 0; i < operands.size(); i++) {
+      text += (i == 0 ? "" : ", ") + operands[i];
+    }
+    text += ")";
+  } else if (op == "param") {
+    text = decoded.result + " = param " + decoded.type;
+  } else if (op == "ret") {
+    text = operands.empty() ? "ret" : "ret " + operands[0];
+  }
+
+  return std::make_shared<Instruction>(op, text);
+}
+
+bool isWellFormed(const DecodedInstruction &decoded) {
+  const std::string &op = decoded.operation;
+  size_t operands = decoded.operands.size();
+  size_t targets = decoded.targets.size();
+  bool result = !decoded.result.empty();
+  auto shape = [&](size_t wantOperands, bool wantResult) {
+    return operands == wantOperands && targets == 0 && result == wantResult;
+  };
+
+  if (op == "alloc" || op == "param") {
+    return shape(0, true);
+  } else if (op == "load" || op == "newarray" || op == "length" ||
+             op == "inc" || op == "dec") {
+    return shape(1, true);
+  } else if (binaryOperators.count(op) || arithmeticOperators.count(op) ||
+             op == "elem") {
+    return shape(2, true);
+  } else if (op == "select") {
+    return shape(3, true);
+  } else if (op == "store" || op == "check") {
+    return shape(2, false);
+  } else if (op == "setelem") {
+    return shape(3, false);
+  } else if (op == "count") {
+    return shape(0, false) && !decoded.attribute.empty();
+  } else if (op == "br") {
+    return !result && ((operands == 0 && targets == 1) ||
+                       (operands == 1 && targets == 2));
+  } else if (op == "switch") {
+    return !result && operands == 2 && targets >= 1;
+  } else if (op == "call") {
+    return targets == 0 && !decoded.attribute.empty();
+  } else if (op == "ret") {
+    return !result && operands <= 1 && targets == 0;
+  }
+  return false;
+}
+
+bool isTemporary(const std::string &operand) {
+  return operand.size() > 1 && operand[0] == '%';
+}
+
+std::string literalType(const std::string &operand) {
+  if (operand.empty() || isTemporary(operand)) {
+    return "";
+  }
+  if (operand[0] == '"' || operand[0] == '$') {
+    return "string";
+  }
+  if (operand[0] == '\'') {
+    return "char";
+  }
+  if (operand == "true" || operand == "false") {
+    return "bool";
+  }
+  if (std::isdigit(static_cast<unsigned char>(operand[0])) ||
+      operand[0] == '-') {
+    return operand.find_first_of(".eE") == std::string::npos ? "int" : "float";
+  }
+  return "";
+}
+
+std::string floatLiteral(double value) {
+  char buffer[32];
+  char *end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+  std::string text(buffer, end);
+  if (text.find_first_of(".e") == std::string::npos) {
+    text += ".0";
+  }
+  return text;
+}
+
+long long charLiteralCode(const std::string &literal) {
+  if (literal.size() < 3) {
+    return 0;
+  }
+  if (literal[1] == '\\' && literal.size() > 3) {
+    switch (literal[2]) {
+    case 'n':
+      return '\n';
+    case 't':
+      return '\t';
+    case '0':
+      return 0;
+    default:
+      return static_cast<unsigned char>(literal[2]);
+    }
+  }
+  return static_cast<unsigned char>(literal[1]);
+}
+
+bool isTerminator(const Instruction &instr) {
+  std::string op = trim(instr.operation);
+  return op == "br" || op == "switch" || op == "ret";
+}
+
+bool hasSideEffects(const Instruction &instr) {
+  std::string op = trim(instr.operation);
+  // Parameters are numbered by position and must never be dropped. Every
+  // newarray is a distinct array, and a failing check ends the program.
+  return op == "store" || op == "call" || op == "br" || op == "switch" ||
+         op == "ret" || op == "param" || op == "count" || op == "newarray" ||
+         op == "setelem" || op == "check";
+}
+
+bool mayTrap(const Instruction &instr) {
+  std::string op = trim(instr.operation);
+  if (op == "elem") {
+    return true;
+  }
+  if (op != "div" && op != "mod") {
+    return false;
+  }
+  DecodedInstruction decoded = decodeInstruction(instr);
+  const std::string &divisor = decoded.operands[1];
+  if (literalType(divisor) == "float") {
+    return false;
+  }
+  long long value = std::strtoll(divisor.c_str(), nullptr, 10);
+  return literalType(divisor) != "int" || value == 0 || value == -1;
+}
+
+std::shared_ptr<Instruction> BasicBlock::terminator() const {
+  if (!instructions.empty() && isTerminator(*instructions.back())) {
+    return instructions.back();
+  }
+  return nullptr;
+}
+
+ControlFlowGraph::ControlFlowGraph(std::shared_ptr<Instruction> root) {
+  blocks.push_back(BasicBlock());
+  if (root != nullptr) {
+    for (const auto &child : root->children) {
+      flatten(std::dynamic_pointer_cast<Instruction>(child));
+    }
+  }
+  reindex();
+}
+
+void ControlFlowGraph::flatten(const std::shared_ptr<Instruction> &instr) {
+  if (instr == nullptr) {
+    return;
+  }
+
+  if (trim(instr->operation) == "label") {
+    BasicBlock block;
+    block.label = trim(instr->instruction);
+    blocks.push_back(block);
+  } else {
+    blocks.back().instructions.push_back(instr);
+  }
+
+  for (const auto &child : instr->children) {
+    flatten(std::dynamic_pointer_cast<Instruction>(child));
+  }
+}
+
+std::shared_ptr<Instruction> ControlFlowGraph::toIR() const {
+  std::shared_ptr<Instruction> root = std::make_shared<Instruction>("root");
+
+  for (const auto &block : blocks) {
+    std::shared_ptr<Instruction> parent = root;
+    if (!block.label.empty()) {
+      parent = std::make_shared<Instruction>("label", block.label);
+      root->addElement(parent);
+    }
+
+    for (const auto &instr : block.instructions) {
+      instr->children.clear();
+      parent->addElement(instr);
+    }
+  }
+
+  return root;
+}
+
+void ControlFlowGraph::reindex() {
+  labelIndex_.clear();
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (!blocks[i].label.empty()) {
+      labelIndex_[blocks[i].label] = static_cast<int>(i);
+    }
+  }
+}
+
+int ControlFlowGraph::findBlock(const std::string &label) const {
+  auto it = labelIndex_.find(label);
+  return it == labelIndex_.end() ? -1 : it->second;
+}
+
+std::vector<int> ControlFlowGraph::successors(int block) const {
+  std::vector<int> result;
+
+  std::shared_ptr<Instruction> terminator = blocks[block].terminator();
+  if (terminator != nullptr) {
+    for (const auto &target : decodeInstruction(*terminator).targets) {
+      int index = findBlock(target);
+      if (index >= 0 &&
+          std::find(result.begin(), result.end(), index) == result.end()) {
+        result.push_back(index);
+      }
+    }
+  } else if (block + 1 < static_cast<int>(blocks.size())) {
+    result.push_back(block + 1);
+  }
+
+  return result;
+}
+
+std::vector<std::vector<int>> ControlFlowGraph::predecessors() const {
+  std::vector<std::vector<int>> result(blocks.size());
+  for (size_t i = 0; i < blocks.size(); i++) {
+    for (int successor : successors(static_cast<int>(i))) {
+      result[successor].push_back(static_cast<int>(i));
+    }
+  }
+  return result;
+}
+
+size_t ControlFlowGraph::instructionCount() const {
+  size_t count = 0;
+  for (const auto &block : blocks) {
+    count += block.instructions.size() + (block.label.empty() ? 0 : 1);
+  }
+  return count;
+}
+
+bool Loop::contains(int block) const {
+  return std::binary_search(blocks.begin(), blocks.end(), block);
+}
+
+std::vector<int> ControlFlowGraph::reversePostOrder() const {
+  std::vector<int> order;
+  std::vector<bool> visited(blocks.size(), false);
+  std::vector<std::pair<int, size_t>> stack = {{0, 0}};
+  std::vector<std::vector<int>> successorCache(blocks.size());
+  successorCache[0] = successors(0);
+  visited[0] = true;
+
+  while (!stack.empty()) {
+    auto &[block, next] = stack.back();
+    if (next < successorCache[block].size()) {
+      int successor = successorCache[block][next++];
+      if (!visited[successor]) {
+        visited[successor] = true;
+        successorCache[successor] = successors(successor);
+        stack.push_back({successor, 0});
+      }
+    } else {
+      order.push_back(block);
+      stack.pop_back();
+    }
+  }
+
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+// Iterative dominator computation by Cooper, Harvey and Kennedy. Unreachable
+// blocks get -1, the entry block is its own immediate dominator.
+std::vector<int> ControlFlowGraph::immediateDominators() const {
+  std::vector<int> order = reversePostOrder();
+  std::vector<int> position(blocks.size(), -1);
+  for (size_t i = 0; i < order.size(); i++) {
+    position[order[i]] = static_cast<int>(i);
+  }
+
+  std::vector<std::vector<int>> preds = predecessors();
+  std::vector<int> idom(blocks.size(), -1);
+  idom[0] = 0;
+
+  auto intersect = [&](int a, int b) {
+    while (a != b) {
+      while (position[a] > position[b]) {
+        a = idom[a];
+      }
+      while (position[b] > position[a]) {
+        b = idom[b];
+      }
+    }
+    return a;
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 1; i < order.size(); i++) {
+      int block = order[i];
+      int newIdom = -1;
+      for (int pred : preds[block]) {
+        if (idom[pred] == -1) {
+          continue;
+        }
+        newIdom = newIdom == -1 ? pred : intersect(pred, newIdom);
+      }
+      if (newIdom != idom[block]) {
+        idom[block] = newIdom;
+        changed = true;
+      }
+    }
+  }
+
+  return idom;
+}
+
+bool ControlFlowGraph::dominates(const std::vector<int> &idom, int a, int b) {
+  if (idom[b] == -1) {
+    return false;
+  }
+  while (b != a && b != 0) {
+    b = idom[b];
+  }
+  return b == a;
+}
+
+std::vector<Loop> ControlFlowGraph::findLoops() const {
+  std::vector<int> idom = immediateDominators();
+  std::vector<std::vector<int>> preds = predecessors();
+  std::vector<Loop> loops;
+
+  for (size_t b = 0; b < blocks.size(); b++) {
+    for (int header : successors(static_cast<int>(b))) {
+      if (!dominates(idom, header, static_cast<int>(b))) {
+        continue;
+      }
+
+      auto existing = std::find_if(
+          loops.begin(), loops.end(),
+          [header](const Loop &loop) { return loop.header == header; });
+      if (existing == loops.end()) {
+        loops.push_back({header, {}, {header}});
+        existing = loops.end() - 1;
+      }
+      existing->latches.push_back(static_cast<int>(b));
+
+      std::vector<bool> inLoop(blocks.size(), false);
+      for (int block : existing->blocks) {
+        inLoop[block] = true;
+      }
+      std::vector<int> worklist = {static_cast<int>(b)};
+      while (!worklist.empty()) {
+        int block = worklist.back();
+        worklist.pop_back();
+        if (inLoop[block]) {
+          continue;
+        }
+        inLoop[block] = true;
+        existing->blocks.push_back(block);
+        for (int pred : preds[block]) {
+          worklist.push_back(pred);
+        }
+      }
+      std::sort(existing->blocks.begin(), existing->blocks.end());
+    }
+  }
+
+  return loops;
+}
+
+std::optional<CountedLoop> findCountedLoop(const ControlFlowGraph &cfg,
+                                           const Loop &loop) {
+  if (loop.blocks.size() != 2 || loop.latches.size() != 1 ||
+      loop.latches[0] == loop.header) {
+    return std::nullopt;
+  }
+
+  CountedLoop counted;
+  counted.header = loop.header;
+  counted.body = loop.latches[0];
+
+  const BasicBlock &header = cfg.blocks[counted.header];
+  const BasicBlock &body = cfg.blocks[counted.body];
+  std::shared_ptr<Instruction> headerBranch = header.terminator();
+  std::shared_ptr<Instruction> bodyBranch = body.terminator();
+  if (headerBranch == nullptr || bodyBranch == nullptr) {
+    return std::nullopt;
+  }
+
+  DecodedInstruction branch = decodeInstruction(*headerBranch);
+  if (branch.operands.size() != 1 || branch.targets.size() != 2 ||
+      branch.targets[0] != body.label ||
+      cfg.findBlock(branch.targets[1]) < 0 ||
+      loop.contains(cfg.findBlock(branch.targets[1]))) {
+    return std::nullopt;
+  }
+  counted.exit = branch.targets[1];
+
+  DecodedInstruction back = decodeInstruction(*bodyBranch);
+  if (!back.operands.empty() || back.targets.size() != 1 ||
+      back.targets[0] != header.label) {
+    return std::nullopt;
+  }
+
+  // Header: loads, then the compare. A load there may reload the counter
+  // or read the bound.
+  std::vector<DecodedInstruction> headerCode;
+  for (size_t i = 0; i + 1 < header.instructions.size(); i++) {
+    headerCode.push_back(decodeInstruction(*header.instructions[i]));
+  }
+  if (headerCode.empty()) {
+    return std::nullopt;
+  }
+  const DecodedInstruction &compare = headerCode.back();
+  if (compare.operation != "lt" || compare.result != branch.operands[0]) {
+    return std::nullopt;
+  }
+  counted.counter = compare.operands[0];
+  counted.bound = compare.operands[1];
+  if (!isTemporary(counted.counter)) {
+    return std::nullopt;
+  }
+
+  std::string boundSlot;
+  for (size_t i = 0; i + 1 < headerCode.size(); i++) {
+    const DecodedInstruction &load = headerCode[i];
+    if (load.operation != "load") {
+      return std::nullopt;
+    }
+    if (load.result == counted.counter) {
+      counted.slot = load.operands[0];
+    } else if (load.result == counted.bound) {
+      boundSlot = load.operands[0];
+    }
+  }
+
+  // Body: the counter is defined once, by the increment, and written back
+  // to its slot, if it has one, right after. Nothing redefines the bound.
+  bool incremented = false;
+  bool writtenBack = false;
+  for (const auto &instr : body.instructions) {
+    DecodedInstruction decoded = decodeInstruction(*instr);
+    if (decoded.result == counted.bound) {
+      return std::nullopt;
+    }
+    if (decoded.result == counted.counter) {
+      if (incremented || decoded.operation != "inc" ||
+          decoded.operands[0] != counted.counter) {
+        return std::nullopt;
+      }
+      incremented = true;
+    }
+    if (decoded.operation == "store" && !boundSlot.empty() &&
+        decoded.operands[1] == boundSlot) {
+      return std::nullopt;
+    }
+    if (decoded.operation == "store" && !counted.slot.empty() &&
+        decoded.operands[1] == counted.slot) {
+      if (writtenBack || !incremented || decoded.operands[0] != counted.counter) {
+        return std::nullopt;
+      }
+      writtenBack = true;
+    }
+  }
+  if (!incremented || (!counted.slot.empty() && !writtenBack)) {
+    return std::nullopt;
+  }
+
+  return counted;
+}
+
+void ControlFlowGraph::replaceUses(const std::string &from,
+                                   const std::string &to) {
+  for (auto &block : blocks) {
+    for (auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      bool replaced = false;
+      for (auto &operand : decoded.operands) {
+        if (operand == from) {
+          operand = to;
+          replaced = true;
+        }
+      }
+      if (replaced) {
+        instr = encodeInstruction(decoded);
+      }
+    }
+  }
+}
+
+void ControlFlowGraph::makeFallthroughsExplicit() {
+  for (size_t i = 0; i + 1 < blocks.size(); i++) {
+    if (blocks[i].terminator() == nullptr) {
+      blocks[i].instructions.push_back(std::make_shared<Instruction>(
+          "br", "br label " + blocks[i + 1].label));
+    }
+  }
+}
+
+void ControlFlowGraph::removeFallthroughBranches() {
+  for (size_t i = 0; i + 1 < blocks.size(); i++) {
+    std::shared_ptr<Instruction> terminator = blocks[i].terminator();
+    if (terminator == nullptr) {
+      continue;
+    }
+
+    DecodedInstruction decoded = decodeInstruction(*terminator);
+    if (decoded.operands.empty() && decoded.targets.size() == 1 &&
+        decoded.targets[0] == blocks[i + 1].label) {
+      blocks[i].instructions.pop_back();
+    }
+  }
+}
+
+std::string resultType(
+    const DecodedInstruction &decoded,
+    const std::function<std::string(const std::string &)> &typeOf) {
+  if (decoded.operation == "alloc") {
+    return decoded.attribute;
+  } else if (decoded.operation == "call" || decoded.operation == "param" ||
+             decoded.operation == "elem" ||
+             (decoded.operation == "load" && !decoded.type.empty())) {
+    return decoded.type;
+  } else if (decoded.operation == "newarray") {
+    return decoded.type + "[]";
+  } else if (decoded.operation == "length") {
+    return "int";
+  } else if (binaryOperators.count(decoded.operation)) {
+    return "bool";
+  } else if (decoded.operation == "select") {
+    std::string type = typeOf(decoded.operands[1]);
+    return type.empty() ? typeOf(decoded.operands[2]) : type;
+  } else if (!decoded.operands.empty()) {
+    return typeOf(decoded.operands[0]);
+  }
+  return "";
+}
+
+std::unordered_map<std::string, std::string>
+inferTemporaryTypes(const ControlFlowGraph &cfg) {
+  std::unordered_map<std::string, std::string> types;
+
+  auto typeOf = [&types](const std::string &operand) {
+    if (isTemporary(operand)) {
+      auto it = types.find(operand);
+      return it == types.end() ? std::string() : it->second;
+    }
+    return literalType(operand);
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto &block : cfg.blocks) {
+      for (const auto &instr : block.instructions) {
+        DecodedInstruction decoded = decodeInstruction(*instr);
+        if (decoded.result.empty() || types.count(decoded.result)) {
+          continue;
+        }
+
+        std::string type = resultType(decoded, typeOf);
+        if (!type.empty()) {
+          types[decoded.result] = type;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  return types;
+}
+
+std::string comparisonType(const DecodedInstruction &instr,
+                           const std::unordered_map<std::string, std::string> &types) {
+  if (!instr.type.empty()) {
+    return instr.type;
+  }
+  auto typeOf = [&types](const std::string &operand) {
+    auto it = types.find(operand);
+    return isTemporary(operand) ? (it == types.end() ? "int" : it->second)
+                                : literalType(operand);
+  };
+  std::string lhs = typeOf(instr.operands[0]);
+  std::string rhs = typeOf(instr.operands[1]);
+  return lhs == "float" || rhs == "float"      ? "float"
+         : lhs == "string" && rhs == "string" ? "string"
+                                               : "int";
+}
@@ -1,5 +1,6 @@
 #include "codegen.h"
 #include "astnode.h"
+#include "cfg.h"
 #include <algorithm>
 #include <cctype>
 #include <iostream>
@@ -12,6 +13,7 @@ void Codegen::Init() {
 }
 
 void Codegen::ConvertAST(ASTNode *ast) {
+  PhaseTimer timer(stats_ == nullptr ? nullptr : &stats_->codegenTime);
   Init();
   if (ast != nullptr) {
     dfsAST(ast);
@@ -39,33 +41,66 @@ void Codegen::dfsAST(ASTNode *node) {
       dfsAST(child);
     }
   } else {
+    // Functions are lowered separately by ConvertFunction
     for (const auto &child : node->getChildren()) {
-      dfsAST(child);
+      if (child->getType() != "FUNCTION") {
+        dfsAST(child);
+      }
     }
   }
 }
 
+void Codegen::ConvertFunction(ASTNode *function) {
+  PhaseTimer timer(stats_ == nullptr ? nullptr : &stats_->codegenTime);
+  Init();
+
+  // Parameters arrive as values and get a slot like any other variable
+  ASTNode *parameters = function->getChildren()[1];
+  for (ASTNode *parameter : parameters->getChildren()) {
+    std::string type = toLowerCase(parameter->getChildren()[0]->getValue());
+    std::string value = createTemporary();
+    std::string slot = createTemporary();
+    current_parent->addElement(
+        std::make_shared<Instruction>("param", value + " = param " + type));
+    current_parent->addElement(
+        std::make_shared<Instruction>("alloc", slot + " = alloc " + type));
+    current_parent->addElement(
+        std::make_shared<Instruction>("store", "store " + value + ", " + slot));
+    identifierTable_.push_back(std::make_pair(slot, parameter->getValue()));
+    slotTypes_[slot] = type;
+  }
+
+  processNode(function->getChildren()[2], false);
+  current_parent->addElement(std::make_shared<Instruction>("ret", "ret"));
+}
+
 std::string Codegen::processNode(ASTNode *node, bool return_string) {
   std::string nodeType = node->getType();
 
   if (nodeType == "VAR_DECLARATION") {
     std::string temporary = createTemporary();
     std::string varName = node->getChildren()[1]->getValue();
-    std::string literalValue =
-        node->getChildren()[2]->getChildren()[0]->getValue();
+    ASTNode *initializer = node->getChildren()[2]->getChildren()[0];
     std::string varType = toLowerCase(node->getChildren()[0]->getValue());
-    std::transform(varType.begin(), varType.end(), varType.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
 
     if (!return_string) {
+      std::string value = convertExpression(initializer);
       current_parent->addElement(std::make_shared<Instruction>(
           "alloc", temporary + " = alloc " + varType));
       current_parent->addElement(std::make_shared<Instruction>(
-          "store", "store " + literalValue + ", " + temporary));
+          "store", "store " + value + ", " + temporary));
       identifierTable_.push_back(std::make_pair(temporary, varName));
+      slotTypes_[temporary] = varType;
     }
   } else if (nodeType == "STRING_LITERAL") {
     std::string valueString = node->getValue();
+    int64_t entry = constants_ == nullptr
+                        ? -1
+                        : constants_->find(std::string_view(valueString).substr(
+                              1, valueString.size() - 2));
+    if (entry >= 0) {
+      valueString = poolReference(static_cast<uint32_t>(entry));
+    }
 
     if (return_string) {
       return valueString;
@@ -77,7 +112,20 @@ std::string Codegen::processNode(ASTNode *node, bool return_string) {
       return valueChar;
     }
   } else if (nodeType == "NUMERIC_LITERAL") {
+    // Printed from the lexer's value, so the IR spells every number one way.
+    // The type checker types an int literal float where a float is expected.
     std::string valueNumeric = node->getValue();
+    const NumericConstant &constant = node->getConstant();
+    if (constant.kind == NumericConstant::Float) {
+      valueNumeric = floatLiteral(constant.f);
+    } else if (constant.kind == NumericConstant::Int) {
+      valueNumeric = node->getValueType() == "float"
+                         ? floatLiteral(static_cast<double>(constant.i))
+                         : std::to_string(constant.i);
+    } else if (node->getValueType() == "float" &&
+               literalType(valueNumeric) == "int") {
+      valueNumeric += ".0";
+    }
 
     if (return_string) {
       return valueNumeric;
@@ -89,140 +137,81 @@ std::string Codegen::processNode(ASTNode *node, bool return_string) {
       return valueBool;
     }
   } else if (nodeType == "STATEMENT" && node->getValue() == "if") {
-    convertCondition(node->getChildren()[0]);
-
-    std::string conditionTemp = "%t" + std::to_string(temporaries_counter - 1);
-    std::string thenLabel = createLabel("then", 0);
-    std::string elseifLabel = createLabel("elseif", 0);
-    std::string elseifBlockLabel = createLabel("then", 1);
-    std::string elseLabel = createLabel("else", 0);
-    std::string mergeLabel = createLabel("merge", 0);
-
-    std::shared_ptr<Instruction> brInstruction = std::make_shared<Instruction>(
-        "br", "br " + conditionTemp + ", label " + thenLabel);
-    current_parent->addElement(brInstruction);
-
-    std::shared_ptr<Instruction> thenLabelIR =
-        std::make_shared<Instruction>("label", thenLabel);
-    current_parent->addElement(thenLabelIR);
-    switchParent(thenLabelIR);
-    ASTNode *thenBlock = node->getChildren()[1];
-    thenBlock->setProcessed(true);
-    processNode(thenBlock, false);
-
-    current_parent->addElement(
-        std::make_shared<Instruction>("br", "br label " + mergeLabel));
-    popParent();
-
-    // Check for else if and else nodes
     ASTNode *parent = node->get_parent();
     if (parent == nullptr) {
       std::cerr << "parent is null" << std::endl;
       std::terminate();
     }
 
+    // The if is followed by any number of else if siblings and an optional
+    // else
+    std::vector<ASTNode *> arms = {node};
+    ASTNode *elseNode = nullptr;
     std::vector<ASTNode *> siblings = parent->getChildren();
-
-    bool elseNodeFound = false;
-    bool elseifNodeFound = false;
-
-    ASTNode *elseifNode;
-    ASTNode *elseNode;
-
-    for (int i = 0; i < siblings.size(); i++) {
-      if (siblings[i] == node) {
-        // Check the sibling right after the current 'if'
-        if (i + 1 < siblings.size()) {
-          ASTNode *siblingAfterIfNode = siblings[i + 1];
-          if (siblingAfterIfNode != nullptr) {
-            if (siblingAfterIfNode->getValue() == "else if") {
-              elseifNode = siblingAfterIfNode;
-              elseifNodeFound = true;
-              if (siblings[i + 2] != nullptr) {
-                if (siblings[i + 2]->getValue() == "else") {
-                  elseNode = siblings[i + 2];
-                  elseNodeFound = true;
-                  break;
-                }
-              }
-              break;
-            } else if (siblingAfterIfNode->getValue() == "else") {
-              elseNode = siblingAfterIfNode;
-              elseNodeFound = true;
-              break;
-            }
-          }
+    auto position = std::find(siblings.begin(), siblings.end(), node);
+    for (auto it = position + 1; it != siblings.end(); ++it) {
+      if ((*it)->getValue() == "else if") {
+        arms.push_back(*it);
+      } else {
+        if ((*it)->getValue() == "else") {
+          elseNode = *it;
         }
-        break; // No need to check further once the current 'if' is found
+        break;
       }
     }
 
-    std::shared_ptr<Instruction> updatedBrInstruction;
-
-    if (elseifNodeFound && elseifNode != nullptr) {
-      std::shared_ptr<Instruction> elseifSectionLabel =
-          std::make_shared<Instruction>("label", elseifLabel);
-      current_parent->addElement(elseifSectionLabel);
-
-      ASTNode *elseifCondition = elseifNode->getChildren()[0];
-      convertCondition(elseifCondition);
-
-      std::string insertAfter = " label " + thenLabel;
-      updatedBrInstruction = findInstruction(rootIR, brInstruction);
-      updatedBrInstruction->insertAfter(insertAfter, ", label " + elseifLabel);
+    std::string elseLabel = createLabel("else", 0);
+    std::string mergeLabel = createLabel("merge", 0);
+    std::vector<std::string> testLabels = {""};
+    std::vector<std::string> thenLabels = {createLabel("then", 0)};
+    for (size_t k = 1; k < arms.size(); k++) {
+      std::string suffix = k == 1 ? "" : "_" + std::to_string(k - 1);
+      testLabels.push_back(createLabel("elseif", 0) + suffix);
+      thenLabels.push_back(createLabel("elseif_then", 0) + suffix);
+    }
+    labels_counter++;
 
-      std::string conditionTempElseif =
-          "%t" + std::to_string(temporaries_counter - 1);
-      std::shared_ptr<Instruction> brInstructionElseif =
-          std::make_shared<Instruction>(
-              "br", "br " + conditionTempElseif + ", label " +
-                        elseifBlockLabel + ", label " + elseLabel);
-      current_parent->addElement(brInstructionElseif);
+    for (size_t k = 0; k < arms.size(); k++) {
+      if (k > 0) {
+        current_parent->addElement(
+            std::make_shared<Instruction>("label", testLabels[k]));
+      }
 
-      std::shared_ptr<Instruction> elseifLabelIR =
-          std::make_shared<Instruction>("label ", elseifBlockLabel);
-      current_parent->addElement(elseifLabelIR);
-      switchParent(elseifLabelIR);
+      convertCondition(arms[k]->getChildren()[0]);
+      std::string conditionTemp = "%t" + std::to_string(temporaries_counter - 1);
+      std::string falseLabel = k + 1 < arms.size() ? testLabels[k + 1]
+                               : elseNode != nullptr ? elseLabel
+                                                     : mergeLabel;
+      current_parent->addElement(std::make_shared<Instruction>(
+          "br", "br " + conditionTemp + ", label " + thenLabels[k] +
+                    ", label " + falseLabel));
 
-      ASTNode *elseifBlock = elseifNode->getChildren()[1];
-      elseifBlock->setProcessed(true);
-      processNode(elseifBlock, false);
+      std::shared_ptr<Instruction> thenLabelIR =
+          std::make_shared<Instruction>("label", thenLabels[k]);
+      current_parent->addElement(thenLabelIR);
+      switchParent(thenLabelIR);
+      ASTNode *thenBlock = arms[k]->getChildren()[1];
+      thenBlock->setProcessed(true);
+      processNode(thenBlock, false);
 
       current_parent->addElement(
           std::make_shared<Instruction>("br", "br label " + mergeLabel));
       popParent();
     }
 
-    if (elseNodeFound && elseNode != nullptr) {
-      std::shared_ptr<Instruction> elseBrInstruction;
-
-      std::string insertAfter = "";
-      if (elseifNodeFound) {
-        insertAfter = " label " + elseifLabel;
-        elseBrInstruction = updatedBrInstruction;
-      } else {
-        insertAfter = " label " + thenLabel;
-        elseBrInstruction = brInstruction;
-      }
-
-      if (!insertAfter.empty()) {
-        std::shared_ptr<Instruction> storedBrInstruction =
-            findInstruction(rootIR, elseBrInstruction);
-        storedBrInstruction->insertAfter(insertAfter, ", label " + elseLabel);
+    if (elseNode != nullptr) {
+      std::shared_ptr<Instruction> elseLabelIR =
+          std::make_shared<Instruction>("label", elseLabel);
+      current_parent->addElement(elseLabelIR);
+      switchParent(elseLabelIR);
 
-        std::shared_ptr<Instruction> elseLabelIR =
-            std::make_shared<Instruction>("label ", elseLabel);
-        current_parent->addElement(elseLabelIR);
-        switchParent(elseLabelIR);
+      ASTNode *elseBlock = elseNode->getChildren()[0];
+      elseBlock->setProcessed(true);
+      processNode(elseBlock, false);
 
-        ASTNode *elseBlock = elseNode->getChildren()[0];
-        elseBlock->setProcessed(true);
-        processNode(elseBlock, false);
-
-        current_parent->addElement(
-            std::make_shared<Instruction>("br", "br label " + mergeLabel));
-        popParent();
-      }
+      current_parent->addElement(
+          std::make_shared<Instruction>("br", "br label " + mergeLabel));
+      popParent();
     }
 
     // Add merge
@@ -232,6 +221,7 @@ std::string Codegen::processNode(ASTNode *node, bool return_string) {
     std::string loopConditionLabel = createLabel("for_loop", 0);
     std::string loopBodyLabel = createLabel("loop_body", 0);
     std::string loopEndLabel = createLabel("loop_end", 0);
+    labels_counter++;
     std::vector<std::string> conditionTemps = convertForCondition(
         node->getChildren()[0], loopConditionLabel, loopBodyLabel, loopEndLabel);
 
@@ -264,6 +254,99 @@ std::string Codegen::processNode(ASTNode *node, bool return_string) {
 
     // Loop end label
     current_parent->addElement(std::make_shared<Instruction>("label", loopEndLabel));
+  } else if (nodeType == "STATEMENT" && node->getValue() == "while") {
+    // Rotated: the condition is tested once before entering and again at the
+    // bottom of the body, so an iteration takes a single branch
+    std::string loopBodyLabel = createLabel("while_body", 0);
+    std::string loopEndLabel = createLabel("while_end", 0);
+    labels_counter++;
+    ASTNode *condition = node->getChildren()[0];
+
+    convertCondition(condition);
+    current_parent->addElement(std::make_shared<Instruction>(
+        "br", "br %t" + std::to_string(temporaries_counter - 1) + ", label " +
+                  loopBodyLabel + ", label " + loopEndLabel));
+
+    std::shared_ptr<Instruction> loopBodyLabelIR =
+        std::make_shared<Instruction>("label", loopBodyLabel);
+    current_parent->addElement(loopBodyLabelIR);
+    switchParent(loopBodyLabelIR);
+
+    ASTNode *loopBody = node->getChildren()[1];
+    loopBody->setProcessed(true);
+    processNode(loopBody, false);
+
+    convertCondition(condition);
+    current_parent->addElement(std::make_shared<Instruction>(
+        "br", "br %t" + std::to_string(temporaries_counter - 1) + ", label " +
+                  loopBodyLabel + ", label " + loopEndLabel));
+    popParent();
+
+    current_parent->addElement(std::make_shared<Instruction>("label", loopEndLabel));
+  } else if (nodeType == "STATEMENT" && node->getValue() == "step") {
+    std::string name = node->getChildren()[0]->getValue();
+    std::string slot = findSlot(name);
+    if (slot.empty()) {
+      std::cerr << "Unknown identifier '" << name << "'" << std::endl;
+      return "";
+    }
+    std::string value = loadIdentifier(name);
+    std::string stepped = createTemporary();
+    if (node->getChildren()[1]->getValue() == "++") {
+      current_parent->addElement(std::make_shared<Instruction>(
+          "inc", stepped + " = " + value + " + 1"));
+    } else {
+      current_parent->addElement(std::make_shared<Instruction>(
+          "dec", stepped + " = " + value + " - 1"));
+    }
+    current_parent->addElement(std::make_shared<Instruction>(
+        "store", "store " + stepped + ", " + slot));
+  } else if (nodeType == "STATEMENT" && node->getValue() == "assign") {
+    ASTNode *target = node->getChildren()[0];
+    std::string name = target->getValue();
+    std::string slot = findSlot(name);
+    if (slot.empty()) {
+      std::cerr << "Unknown identifier '" << name << "'" << std::endl;
+      return "";
+    }
+    if (target->getType() == "ARRAY_ACCESS") {
+      target->setProcessed(true);
+      std::string array = loadIdentifier(name);
+      std::string index = convertExpression(target->getChildren()[0]);
+      std::string value = convertExpression(node->getChildren()[1]);
+      current_parent->addElement(std::make_shared<Instruction>(
+          "check", "check " + index + ", " + array));
+      current_parent->addElement(std::make_shared<Instruction>(
+          "setelem", "setelem " + value + ", " + array + ", " + index));
+      return "";
+    }
+    std::string value = convertExpression(node->getChildren()[1]);
+    current_parent->addElement(std::make_shared<Instruction>(
+        "store", "store " + value + ", " + slot));
+  } else if (nodeType == "STATEMENT" && node->getValue() == "out") {
+    ASTNode *argument = node->getChildren()[0]->getChildren()[0];
+    std::string value = convertExpression(argument);
+    if (value.empty()) {
+      return "";
+    }
+
+    current_parent->addElement(
+        std::make_shared<Instruction>("call", "call @out(" + value + ")"));
+  } else if (nodeType == "STATEMENT" && node->getValue() == "call") {
+    node->getChildren()[0]->setProcessed(true);
+    convertCall(node->getChildren()[0]);
+  } else if (nodeType == "STATEMENT" && node->getValue() == "return") {
+    std::string value;
+    if (!node->getChildren().empty()) {
+      value = convertExpression(node->getChildren()[0]);
+    }
+    current_parent->addElement(std::make_shared<Instruction>(
+        "ret", value.empty() ? "ret" : "ret " + value));
+
+    // Anything after the return lands in an unreachable block
+    current_parent->addElement(std::make_shared<Instruction>(
+        "label", createLabel("after_return", 0)));
+    labels_counter++;
   } else if (nodeType == "CODE_BLOCK") {
     std::vector<ASTNode *> codeBlockChildren = node->getChildren();
     for (int i = 0; i < codeBlockChildren.size(); i++) {
@@ -280,14 +363,7 @@ void Codegen::convertCondition(ASTNode *node) {
 
   // Convert left operand
   if (node->getChildren()[0]->getType() == "IDENTIFIER") {
-    std::string var = node->getChildren()[0]->getValue();
-
-    if (auto it = std::find_if(
-            identifierTable_.begin(), identifierTable_.end(),
-            [&var](const auto &pair) { return pair.second == var; });
-        it != identifierTable_.end()) {
-      leftTemp = it->first;
-    }
+    leftTemp = loadIdentifier(node->getChildren()[0]->getValue());
   } else {
     node->getChildren()[0]->setProcessed(true);
     leftTemp = processNode(node->getChildren()[0], true);
@@ -297,41 +373,23 @@ void Codegen::convertCondition(ASTNode *node) {
 
   // Convert right operand
   if (node->getChildren()[2]->getType() == "IDENTIFIER") {
-    std::string var = node->getChildren()[2]->getValue();
-
-    if (auto it = std::find_if(
-            identifierTable_.begin(), identifierTable_.end(),
-            [&var](const auto &pair) { return pair.second == var; });
-        it != identifierTable_.end()) {
-      rightTemp = it->first;
-    }
-    rightTemp = node->getChildren()[2]->getValue();
+    rightTemp = loadIdentifier(node->getChildren()[2]->getValue());
   } else {
     node->getChildren()[2]->setProcessed(true);
     rightTemp = processNode(node->getChildren()[2], true);
   }
 
-  std::string tempVar = createTemporary();
-
-  if (operatorTemp == "==") {
-    current_parent->addElement(std::make_shared<Instruction>(
-        "cmp", tempVar + " = (" + leftTemp + " == " + rightTemp + ")"));
-  } else if (operatorTemp == "!=") {
-    current_parent->addElement(std::make_shared<Instruction>(
-        "neq", tempVar + " = (" + leftTemp + " != " + rightTemp + ")"));
-  } else if (operatorTemp == "<") {
-    current_parent->addElement(std::make_shared<Instruction>(
-        "lt", tempVar + " = (" + leftTemp + " < " + rightTemp + ")"));
-  } else if (operatorTemp == ">") {
-    current_parent->addElement(std::make_shared<Instruction>(
-        "gt", tempVar + " = (" + leftTemp + " > " + rightTemp + ")"));
-  } else if (operatorTemp == "<=") {
-    current_parent->addElement(std::make_shared<Instruction>(
-        "le", tempVar + " = (" + leftTemp + " <= " + rightTemp + ")"));
-  } else if (operatorTemp == ">=") {
-    current_parent->addElement(std::make_shared<Instruction>(
-        "ge", tempVar + " = (" + leftTemp + " >= " + rightTemp + ")"));
+  static const std::unordered_map<std::string, std::string> operations = {
+      {"==", "cmp"}, {"!=", "neq"}, {"<", "lt"},
+      {">", "gt"},   {"<=", "le"},  {">=", "ge"}};
+  auto operation = operations.find(operatorTemp);
+  if (operation == operations.end()) {
+    return;
   }
+  current_parent->addElement(std::make_shared<Instruction>(
+      operation->second,
+      compareText(node->getChildren()[1]->getValueType(), leftTemp,
+                  operatorTemp, rightTemp)));
 }
 
 std::vector<std::string> Codegen::convertForCondition(ASTNode *node,
@@ -347,14 +405,9 @@ std::vector<std::string> Codegen::convertForCondition(ASTNode *node,
       "alloc", counterVarTemporary + " = alloc " + counterVarType));
   current_parent->addElement(std::make_shared<Instruction>(
       "store", "store " + counterVarValue + ", " + counterVarTemporary));
-
-  // Loop bound variable initialization
-  std::string loopBoundVarName = "%" + node->getChildren()[5]->getValue();
-  std::string loopBoundVarTemporary = createTemporary();
-  current_parent->addElement(std::make_shared<Instruction>(
-      "alloc", loopBoundVarTemporary + " = alloc int"));
-  current_parent->addElement(std::make_shared<Instruction>(
-      "store", "store " + loopBoundVarName + ", " + loopBoundVarTemporary));
+  identifierTable_.push_back(
+      std::make_pair(counterVarTemporary, counterVarName));
+  slotTypes_[counterVarTemporary] = counterVarType;
 
   // For loop condition
   std::shared_ptr<Instruction> conditionLabelIR =
@@ -364,17 +417,30 @@ std::vector<std::string> Codegen::convertForCondition(ASTNode *node,
 
   std::string conditionCounterTemporary = createTemporary();
   current_parent->addElement(std::make_shared<Instruction>(
-      "load", conditionCounterTemporary + " = load " + counterVarTemporary));
-
-  std::string conditionLoopBoundTemporary = createTemporary();
-  current_parent->addElement(std::make_shared<Instruction>(
-      "load",
-      conditionLoopBoundTemporary + " = load " + loopBoundVarTemporary));
+      "load", conditionCounterTemporary + " = load " + counterVarType + " " +
+                  counterVarTemporary));
+
+  // The loop bound is compared directly when it is a literal, a variable
+  // bound or len(array) is read from its slot and left for LICM to hoist
+  ASTNode *loopBoundNode = node->getChildren()[5];
+  std::string conditionLoopBoundTemporary = loopBoundNode->getValue();
+  if (loopBoundNode->getType() == "ARRAY_LENGTH") {
+    conditionLoopBoundTemporary = convertExpression(loopBoundNode);
+  } else if (loopBoundNode->getType() == "IDENTIFIER") {
+    conditionLoopBoundTemporary = loadIdentifier(loopBoundNode->getValue());
+    if (conditionLoopBoundTemporary.empty()) {
+      std::cerr << "Unknown loop bound '" << loopBoundNode->getValue() << "'"
+                << std::endl;
+      conditionLoopBoundTemporary = "0";
+    }
+  }
 
-  std::string conditionCompareTemporary = createTemporary();
   current_parent->addElement(std::make_shared<Instruction>(
-      "lt", conditionCompareTemporary + " = (" + conditionCounterTemporary +
-                " < " + conditionLoopBoundTemporary + ")"));
+      "lt", compareText(node->getChildren()[4]->getValueType(),
+                        conditionCounterTemporary, "<",
+                        conditionLoopBoundTemporary)));
+  std::string conditionCompareTemporary =
+      "%t" + std::to_string(temporaries_counter - 1);
 
   // For loop condition break instruction
   current_parent->addElement(std::make_shared<Instruction>(
@@ -385,14 +451,164 @@ std::vector<std::string> Codegen::convertForCondition(ASTNode *node,
   return {conditionCounterTemporary, counterVarTemporary};
 }
 
+// Emits [%r =] call [type] @name(args) and returns the result temporary
+std::string Codegen::convertCall(ASTNode *call) {
+  std::string returnType;
+  if (functions_ != nullptr) {
+    auto it = functions_->find(call->getValue());
+    if (it != functions_->end()) {
+      returnType = it->second.returnType;
+    }
+  }
+
+  std::string arguments;
+  for (ASTNode *argument : call->getChildren()) {
+    std::string value = convertExpression(argument);
+    arguments += (arguments.empty() ? "" : ", ") + value;
+  }
+
+  std::string result;
+  std::string text = "call @" + call->getValue() + "(" + arguments + ")";
+  if (!returnType.empty()) {
+    result = createTemporary();
+    text = result + " = call " + returnType + " @" + call->getValue() + "(" +
+           arguments + ")";
+  }
+  current_parent->addElement(std::make_shared<Instruction>("call", text));
+  return result;
+}
+
+std::string Codegen::findSlot(const std::string &name) const {
+  // Search from the back so the most recent declaration wins
+  auto it = std::find_if(
+      identifierTable_.rbegin(), identifierTable_.rend(),
+      [&name](const auto &pair) { return pair.second == name; });
+  return it == identifierTable_.rend() ? "" : it->first;
+}
+
+std::string Codegen::loadIdentifier(const std::string &name) {
+  std::string slot = findSlot(name);
+  if (slot.empty()) {
+    return "";
+  }
+
+  std::string temporary = createTemporary();
+  current_parent->addElement(std::make_shared<Instruction>(
+      "load", temporary + " = load " + slotTypes_[slot] + " " + slot));
+  return temporary;
+}
+
+std::string Codegen::convertExpression(ASTNode *node) {
+  node->setProcessed(true);
+  std::string nodeType = node->getType();
+
+  if (nodeType == "IDENTIFIER") {
+    std::string value = loadIdentifier(node->getValue());
+    if (value.empty()) {
+      std::cerr << "Unknown identifier '" << node->getValue() << "'"
+                << std::endl;
+    }
+    return value;
+  } else if (nodeType == "FUNCTIONCALL") {
+    return convertCall(node);
+  } else if (nodeType == "MATH_OPERATOR") {
+    return convertArithmetic(node);
+  } else if (nodeType.compare(0, 6, "ARRAY_") == 0 || nodeType == "NEW_ARRAY") {
+    return convertArray(node);
+  }
+  return processNode(node, true);
+}
+
+// An element read is checked against the length first. A literal fills a
+// new array element by element, those indices are known to be in bounds.
+std::string Codegen::convertArray(ASTNode *node) {
+  std::string nodeType = node->getType();
+  std::string type = node->getValueType();
+
+  if (nodeType == "NEW_ARRAY") {
+    std::string size = convertExpression(node->getChildren()[0]);
+    std::string result = createTemporary();
+    current_parent->addElement(std::make_shared<Instruction>(
+        "newarray", result + " = newarray " + toLowerCase(node->getValue()) +
+                        " " + size));
+    return result;
+  }
+  if (nodeType == "ARRAY_LITERAL") {
+    const std::vector<ASTNode *> &elements = node->getChildren();
+    std::string result = createTemporary();
+    current_parent->addElement(std::make_shared<Instruction>(
+        "newarray", result + " = newarray " + type.substr(0, type.size() - 2) +
+                        " " + std::to_string(elements.size())));
+    for (size_t k = 0; k < elements.size(); k++) {
+      std::string value = convertExpression(elements[k]);
+      current_parent->addElement(std::make_shared<Instruction>(
+          "setelem", "setelem " + value + ", " + result + ", " +
+                         std::to_string(k)));
+    }
+    return result;
+  }
+
+  std::string array = loadIdentifier(node->getValue());
+  if (array.empty()) {
+    std::cerr << "Unknown identifier '" << node->getValue() << "'" << std::endl;
+    return "";
+  }
+  if (nodeType == "ARRAY_LENGTH") {
+    std::string result = createTemporary();
+    current_parent->addElement(std::make_shared<Instruction>(
+        "length", result + " = length " + array));
+    return result;
+  }
+  std::string index = convertExpression(node->getChildren()[0]);
+  current_parent->addElement(std::make_shared<Instruction>(
+      "check", "check " + index + ", " + array));
+  std::string result = createTemporary();
+  current_parent->addElement(std::make_shared<Instruction>(
+      "elem", result + " = elem " + type + " " + array + ", " + index));
+  return result;
+}
+
+// Operands are lowered left to right into one instruction per operator,
+// `%t = a + b`, with the types the checker gave them. Negation is 0 - x.
+std::string Codegen::convertArithmetic(ASTNode *node) {
+  static const std::unordered_map<std::string, std::string> operations = {
+      {"+", "add"}, {"-", "sub"}, {"*", "mul"},
+      {"/", "div"}, {"%", "mod"}, {"^", "pow"}};
+  const std::vector<ASTNode *> &operands = node->getChildren();
+  std::string op = node->getValue();
+
+  std::string lhs;
+  std::string rhs;
+  if (operands.size() == 1) {
+    rhs = convertExpression(operands[0]);
+    lhs = node->getValueType() == "float" ? "0.0" : "0";
+  } else {
+    lhs = convertExpression(operands[0]);
+    rhs = convertExpression(operands[1]);
+  }
+
+  std::string result = createTemporary();
+  current_parent->addElement(std::make_shared<Instruction>(
+      operations.at(op), result + " = " + lhs + " " + op + " " + rhs));
+  return result;
+}
+
+// `%t = (type a op b)` into a fresh temporary
+std::string Codegen::compareText(const std::string &type,
+                                 const std::string &lhs, const std::string &op,
+                                 const std::string &rhs) {
+  return createTemporary() + " = (" + (type.empty() ? "" : type + " ") + lhs +
+         " " + op + " " + rhs + ")";
+}
+
 void Codegen::switchParent(std::shared_ptr<Instruction> newParent) {
-  last_parent = current_parent;
+  parent_stack_.push_back(current_parent);
   current_parent = newParent;
 }
 
 void Codegen::popParent() {
-  current_parent = last_parent;
-  last_parent = nullptr;
+  current_parent = parent_stack_.back();
+  parent_stack_.pop_back();
 }
 
 std::shared_ptr<Instruction>
@@ -0,0 +1,33 @@
+#include "constantpool.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+uint32_t ConstantPool::intern(std::string_view bytes) {
+  auto it = index_.find(bytes);
+  if (it != index_.end()) {
+    return it->second;
+  }
+  uint32_t index = static_cast<uint32_t>(entries_.size());
+  entries_.emplace_back(bytes);
+  index_.emplace(entries_.back(), index);
+  return index;
+}
+
+int64_t ConstantPool::find(std::string_view bytes) const {
+  auto it = index_.find(bytes);
+  return it == index_.end() ? -1 : it->second;
+}
+
+std::string poolReference(uint32_t index) {
+  return "$" + std::to_string(index);
+}
+
+bool isPoolReference(const std::string &operand) {
+  return operand.size() > 1 && operand[0] == '$' &&
+         std::all_of(operand.begin() + 1, operand.end(), ::isdigit);
+}
+
+uint32_t poolIndex(const std::string &operand) {
+  return static_cast<uint32_t>(std::strtoul(operand.c_str() + 1, nullptr, 10));
+}
@@ -0,0 +1,320 @@
+#include "passes.h"
+#include "passmanager.h"
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+bool removeUnreachableBlocks(ControlFlowGraph &cfg) {
+  std::vector<bool> reachable(cfg.blocks.size(), false);
+  std::vector<int> worklist = {0};
+  reachable[0] = true;
+
+  while (!worklist.empty()) {
+    int block = worklist.back();
+    worklist.pop_back();
+    for (int successor : cfg.successors(block)) {
+      if (!reachable[successor]) {
+        reachable[successor] = true;
+        worklist.push_back(successor);
+      }
+    }
+  }
+
+  std::vector<BasicBlock> kept;
+  for (size_t i = 0; i < cfg.blocks.size(); i++) {
+    if (reachable[i]) {
+      kept.push_back(std::move(cfg.blocks[i]));
+    }
+  }
+
+  bool changed = kept.size() != reachable.size();
+  cfg.blocks = std::move(kept);
+  cfg.reindex();
+  return changed;
+}
+
+// Slots that are only ever written lose their alloc and every store. Any
+// other store is dead when its slot is not live afterwards, found with a
+// backwards liveness analysis over the slots.
+bool removeDeadStores(ControlFlowGraph &cfg) {
+  std::unordered_set<std::string> slots;
+  std::unordered_map<std::string, int> reads;
+
+  for (const auto &block : cfg.blocks) {
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      if (decoded.operation == "alloc") {
+        slots.insert(decoded.result);
+      } else if (decoded.operation == "store") {
+        reads[decoded.operands[0]]++;
+      } else {
+        for (const auto &operand : decoded.operands) {
+          reads[operand]++;
+        }
+      }
+    }
+  }
+
+  using SlotSet = std::unordered_set<std::string>;
+  std::vector<SlotSet> liveIn(cfg.blocks.size());
+  std::vector<std::vector<int>> successors(cfg.blocks.size());
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    successors[b] = cfg.successors(static_cast<int>(b));
+  }
+
+  auto liveOutOf = [&](size_t b) {
+    SlotSet live;
+    for (int successor : successors[b]) {
+      live.insert(liveIn[successor].begin(), liveIn[successor].end());
+    }
+    return live;
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = cfg.blocks.size(); b-- > 0;) {
+      SlotSet live = liveOutOf(b);
+      const auto &instructions = cfg.blocks[b].instructions;
+      for (auto it = instructions.rbegin(); it != instructions.rend(); ++it) {
+        DecodedInstruction decoded = decodeInstruction(**it);
+        if (decoded.operation == "store") {
+          live.erase(decoded.operands[1]);
+        } else if (decoded.operation == "load") {
+          live.insert(decoded.operands[0]);
+        }
+      }
+      if (live.size() != liveIn[b].size()) {
+        liveIn[b] = std::move(live);
+        changed = true;
+      }
+    }
+  }
+
+  bool removed = false;
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    auto &instructions = cfg.blocks[b].instructions;
+    SlotSet live = liveOutOf(b);
+    std::vector<bool> dead(instructions.size(), false);
+
+    for (size_t i = instructions.size(); i-- > 0;) {
+      DecodedInstruction decoded = decodeInstruction(*instructions[i]);
+      if (decoded.operation == "alloc" && reads[decoded.result] == 0) {
+        dead[i] = true;
+      } else if (decoded.operation == "store") {
+        const std::string &slot = decoded.operands[1];
+        if (slots.count(slot) && (reads[slot] == 0 || !live.count(slot))) {
+          dead[i] = true;
+        }
+        live.erase(slot);
+      } else if (decoded.operation == "load") {
+        live.insert(decoded.operands[0]);
+      }
+    }
+
+    std::vector<std::shared_ptr<Instruction>> kept;
+    for (size_t i = 0; i < instructions.size(); i++) {
+      if (!dead[i]) {
+        kept.push_back(instructions[i]);
+      }
+    }
+
+    removed |= kept.size() != instructions.size();
+    instructions = std::move(kept);
+  }
+
+  return removed;
+}
+
+// Drops pure instructions whose result is never read. Self updates such as
+// `%t6 = %t6 + 1` do not count as a use of their own result.
+bool removeUnusedResults(ControlFlowGraph &cfg) {
+  std::unordered_map<std::string, int> uses;
+
+  for (const auto &block : cfg.blocks) {
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      for (const auto &operand : decoded.operands) {
+        if (operand != decoded.result) {
+          uses[operand]++;
+        }
+      }
+    }
+  }
+
+  bool changed = false;
+  for (auto &block : cfg.blocks) {
+    auto end = std::remove_if(
+        block.instructions.begin(), block.instructions.end(),
+        [&uses](const std::shared_ptr<Instruction> &instr) {
+          if (hasSideEffects(*instr)) {
+            return false;
+          }
+          std::string result = decodeInstruction(*instr).result;
+          return !result.empty() && uses[result] == 0;
+        });
+
+    changed |= end != block.instructions.end();
+    block.instructions.erase(end, block.instructions.end());
+  }
+
+  return changed;
+}
+
+// Blocks holding nothing but `br label %X` are bypassed by retargeting every
+// branch into them.
+bool removeForwardingBlocks(ControlFlowGraph &cfg) {
+  std::unordered_map<std::string, std::string> forward;
+
+  for (size_t i = 1; i < cfg.blocks.size(); i++) {
+    const BasicBlock &block = cfg.blocks[i];
+    if (block.instructions.size() != 1 || block.terminator() == nullptr) {
+      continue;
+    }
+
+    DecodedInstruction decoded = decodeInstruction(*block.terminator());
+    if (decoded.operands.empty() && decoded.targets.size() == 1 &&
+        decoded.targets[0] != block.label) {
+      forward[block.label] = decoded.targets[0];
+    }
+  }
+
+  if (forward.empty()) {
+    return false;
+  }
+
+  auto resolve = [&forward](std::string label) {
+    for (size_t steps = 0; steps <= forward.size(); steps++) {
+      auto it = forward.find(label);
+      if (it == forward.end()) {
+        return label;
+      }
+      label = it->second;
+    }
+    return std::string(); // forwarding cycle
+  };
+
+  std::unordered_set<std::string> removable;
+  for (const auto &entry : forward) {
+    if (!resolve(entry.first).empty()) {
+      removable.insert(entry.first);
+    }
+  }
+
+  for (auto &block : cfg.blocks) {
+    std::shared_ptr<Instruction> terminator = block.terminator();
+    if (terminator == nullptr || removable.count(block.label)) {
+      continue;
+    }
+
+    DecodedInstruction decoded = decodeInstruction(*terminator);
+    bool retargeted = false;
+    for (auto &target : decoded.targets) {
+      if (removable.count(target)) {
+        target = resolve(target);
+        retargeted = true;
+      }
+    }
+
+    if (decoded.targets.size() == 2 && decoded.targets[0] == decoded.targets[1]) {
+      decoded.operands.clear();
+      decoded.targets.pop_back();
+      retargeted = true;
+    }
+
+    if (retargeted) {
+      block.instructions.back() = encodeInstruction(decoded);
+    }
+  }
+
+  cfg.blocks.erase(std::remove_if(cfg.blocks.begin(), cfg.blocks.end(),
+                                  [&removable](const BasicBlock &block) {
+                                    return removable.count(block.label) > 0;
+                                  }),
+                   cfg.blocks.end());
+  cfg.reindex();
+  return !removable.empty();
+}
+
+// Appends a block to its only predecessor when that predecessor jumps to it
+// unconditionally.
+bool mergeStraightLineBlocks(ControlFlowGraph &cfg) {
+  std::vector<std::vector<int>> predecessors = cfg.predecessors();
+  int exitBlock = static_cast<int>(cfg.blocks.size()) - 1;
+  if (cfg.blocks[exitBlock].terminator() != nullptr) {
+    exitBlock = -1;
+  }
+
+  std::vector<bool> removed(cfg.blocks.size(), false);
+  int mergedExit = -1;
+
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    if (removed[b]) {
+      continue;
+    }
+
+    BasicBlock &block = cfg.blocks[b];
+    while (block.terminator() != nullptr) {
+      DecodedInstruction decoded = decodeInstruction(*block.terminator());
+      if (!decoded.operands.empty() || decoded.targets.size() != 1) {
+        break;
+      }
+
+      int successor = cfg.findBlock(decoded.targets[0]);
+      if (successor <= 0 || successor == static_cast<int>(b) ||
+          removed[successor] || predecessors[successor].size() != 1) {
+        break;
+      }
+
+      block.instructions.pop_back();
+      for (const auto &instr : cfg.blocks[successor].instructions) {
+        block.instructions.push_back(instr);
+      }
+      cfg.blocks[successor].instructions.clear();
+      removed[successor] = true;
+
+      if (successor == exitBlock) {
+        mergedExit = static_cast<int>(b);
+      }
+    }
+  }
+
+  std::vector<BasicBlock> kept;
+  for (size_t i = 0; i < cfg.blocks.size(); i++) {
+    if (!removed[i] && static_cast<int>(i) != mergedExit) {
+      kept.push_back(std::move(cfg.blocks[i]));
+    }
+  }
+
+  // The block that absorbed the exit has no terminator and has to stay last
+  if (mergedExit >= 0) {
+    kept.push_back(std::move(cfg.blocks[mergedExit]));
+  }
+
+  bool changed = kept.size() != cfg.blocks.size();
+  cfg.blocks = std::move(kept);
+  cfg.reindex();
+  return changed;
+}
+
+} // namespace
+
+bool eliminateDeadCode(ControlFlowGraph &cfg, AnalysisManager &) {
+  cfg.makeFallthroughsExplicit();
+
+  bool changed = false;
+  bool progress = true;
+  while (progress) {
+    progress = removeUnreachableBlocks(cfg);
+    progress |= removeDeadStores(cfg);
+    progress |= removeUnusedResults(cfg);
+    progress |= removeForwardingBlocks(cfg);
+    progress |= mergeStraightLineBlocks(cfg);
+    changed |= progress;
+  }
+
+  cfg.removeFallthroughBranches();
+  return changed;
+}
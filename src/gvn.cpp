@@ -0,0 +1,267 @@
+#include "passes.h"
+#include "passmanager.h"
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Where an available value was computed
+struct Available {
+  int block;
+  size_t index;
+  std::string result;
+};
+
+class ValueNumbering {
+public:
+  ValueNumbering(ControlFlowGraph &cfg, AnalysisManager &analyses)
+      : cfg_(cfg), analyses_(analyses) {}
+
+  bool run();
+
+private:
+  std::string leader(const std::string &value) const;
+  std::string key(const DecodedInstruction &instr) const;
+  bool storeBetween(const Available &from, int block, size_t index,
+                    const std::string &slot);
+  const std::vector<bool> &reachableFrom(int block);
+
+  ControlFlowGraph &cfg_;
+  AnalysisManager &analyses_;
+  std::vector<std::vector<DecodedInstruction>> decoded_;
+  std::unordered_map<std::string, int> definitions_;
+  std::unordered_map<std::string, std::vector<int>> storeBlocks_;
+  std::unordered_map<int, std::vector<bool>> reachable_;
+  std::unordered_map<std::string, std::string> leaders_;
+};
+
+// Value a temporary was found equal to, itself otherwise
+std::string ValueNumbering::leader(const std::string &value) const {
+  auto it = leaders_.find(value);
+  return it == leaders_.end() ? value : it->second;
+}
+
+// Expression key of a load, length, compare or arithmetic, empty if it
+// cannot be numbered. Temporaries assigned more than once (loop counters)
+// never take part.
+std::string ValueNumbering::key(const DecodedInstruction &instr) const {
+  static const std::unordered_map<std::string, std::string> swapped = {
+      {"gt", "lt"}, {"ge", "le"}};
+  static const std::unordered_set<std::string> commutative = {
+      "cmp", "neq", "add", "mul", "and"};
+  static const std::unordered_set<std::string> ordered = {
+      "lt", "le", "sub", "div", "mod", "pow", "shl", "shr"};
+
+  if (instr.result.empty() || definitions_.at(instr.result) != 1) {
+    return "";
+  }
+  std::vector<std::string> operands;
+  for (const auto &operand : instr.operands) {
+    if (isTemporary(operand) && definitions_.count(operand) &&
+        definitions_.at(operand) != 1) {
+      return "";
+    }
+    operands.push_back(leader(operand));
+  }
+
+  std::string op = instr.operation;
+  if (op == "load") {
+    return "load " + operands[0];
+  }
+  // An array keeps the length it was created with
+  if (op == "length") {
+    return "length " + operands[0];
+  }
+  if (operands.size() != 2 ||
+      (!commutative.count(op) && !ordered.count(op) && !swapped.count(op))) {
+    return "";
+  }
+  // a > b is b < a, and equality does not care about the order
+  if (swapped.count(op)) {
+    op = swapped.at(op);
+    std::swap(operands[0], operands[1]);
+  } else if (commutative.count(op) && operands[1] < operands[0]) {
+    std::swap(operands[0], operands[1]);
+  }
+  return op + " " + operands[0] + " " + operands[1];
+}
+
+const std::vector<bool> &ValueNumbering::reachableFrom(int block) {
+  auto it = reachable_.find(block);
+  if (it != reachable_.end()) {
+    return it->second;
+  }
+
+  std::vector<bool> reached(cfg_.blocks.size(), false);
+  std::vector<int> worklist = cfg_.successors(block);
+  while (!worklist.empty()) {
+    int b = worklist.back();
+    worklist.pop_back();
+    if (reached[b]) {
+      continue;
+    }
+    reached[b] = true;
+    for (int successor : cfg_.successors(b)) {
+      worklist.push_back(successor);
+    }
+  }
+  return reachable_[block] = std::move(reached);
+}
+
+// True if a store to `slot` can run between the available load and the
+// instruction at `index` of `block`.
+bool ValueNumbering::storeBetween(const Available &from, int block,
+                                  size_t index, const std::string &slot) {
+  auto isStore = [&slot](const DecodedInstruction &instr) {
+    return instr.operation == "store" && instr.operands[1] == slot;
+  };
+
+  if (from.block == block) {
+    for (size_t i = from.index + 1; i < index; i++) {
+      if (isStore(decoded_[block][i])) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const auto &fromCode = decoded_[from.block];
+  for (size_t i = from.index + 1; i < fromCode.size(); i++) {
+    if (isStore(fromCode[i])) {
+      return true;
+    }
+  }
+  for (size_t i = 0; i < index; i++) {
+    if (isStore(decoded_[block][i])) {
+      return true;
+    }
+  }
+  // Any other path from the load to here through a storing block
+  auto stores = storeBlocks_.find(slot);
+  if (stores == storeBlocks_.end()) {
+    return false;
+  }
+  for (int storing : stores->second) {
+    if (reachableFrom(from.block)[storing] && reachableFrom(storing)[block]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ValueNumbering::run() {
+  for (size_t b = 0; b < cfg_.blocks.size(); b++) {
+    decoded_.emplace_back();
+    for (const auto &instr : cfg_.blocks[b].instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      if (!decoded.result.empty()) {
+        definitions_[decoded.result]++;
+      }
+      if (decoded.operation == "store") {
+        std::vector<int> &blocks = storeBlocks_[decoded.operands[1]];
+        if (blocks.empty() || blocks.back() != static_cast<int>(b)) {
+          blocks.push_back(static_cast<int>(b));
+        }
+      }
+      decoded_.back().push_back(decoded);
+    }
+  }
+
+  const std::vector<int> &idom = analyses_.dominators();
+  std::vector<std::vector<int>> children(cfg_.blocks.size());
+  for (size_t b = 1; b < cfg_.blocks.size(); b++) {
+    if (idom[b] >= 0) {
+      children[idom[b]].push_back(static_cast<int>(b));
+    }
+  }
+
+  // Walk the dominator tree keeping the expressions of the dominating
+  // blocks in scope
+  std::unordered_map<std::string, Available> table;
+  std::vector<std::vector<std::string>> scopes;
+  std::vector<std::pair<int, size_t>> stack = {{0, 0}};
+  std::vector<std::vector<bool>> redundant(cfg_.blocks.size());
+  bool changed = false;
+
+  scopes.emplace_back();
+  while (!stack.empty()) {
+    int block = stack.back().first;
+    size_t &child = stack.back().second;
+
+    if (child == 0 && redundant[block].empty()) {
+      redundant[block].assign(decoded_[block].size(), false);
+      for (size_t i = 0; i < decoded_[block].size(); i++) {
+        const DecodedInstruction &instr = decoded_[block][i];
+        std::string expression = key(instr);
+        if (expression.empty()) {
+          continue;
+        }
+
+        auto found = table.find(expression);
+        bool reusable =
+            found != table.end() &&
+            (instr.operation != "load" ||
+             !storeBetween(found->second, block, i, leader(instr.operands[0])));
+        if (reusable) {
+          leaders_[instr.result] = found->second.result;
+          redundant[block][i] = true;
+          changed = true;
+        } else {
+          if (found == table.end()) {
+            scopes.back().push_back(expression);
+          }
+          table[expression] = {block, i, instr.result};
+        }
+      }
+    }
+
+    if (child < children[block].size()) {
+      int next = children[block][child++];
+      stack.push_back({next, 0});
+      scopes.emplace_back();
+      continue;
+    }
+
+    for (const auto &expression : scopes.back()) {
+      table.erase(expression);
+    }
+    scopes.pop_back();
+    stack.pop_back();
+  }
+
+  if (!changed) {
+    return false;
+  }
+
+  // Drop the redundant instructions and point their uses at the leaders
+  for (size_t b = 0; b < cfg_.blocks.size(); b++) {
+    std::vector<std::shared_ptr<Instruction>> kept;
+    for (size_t i = 0; i < decoded_[b].size(); i++) {
+      if (!redundant[b].empty() && redundant[b][i]) {
+        continue;
+      }
+      DecodedInstruction &instr = decoded_[b][i];
+      bool replaced = false;
+      for (auto &operand : instr.operands) {
+        std::string value = leader(operand);
+        if (value != operand) {
+          operand = value;
+          replaced = true;
+        }
+      }
+      kept.push_back(replaced ? encodeInstruction(instr)
+                              : cfg_.blocks[b].instructions[i]);
+    }
+    cfg_.blocks[b].instructions = kept;
+  }
+  return true;
+}
+
+} // namespace
+
+bool numberValues(ControlFlowGraph &cfg, AnalysisManager &analyses) {
+  cfg.makeFallthroughsExplicit();
+  bool changed = ValueNumbering(cfg, analyses).run();
+  cfg.removeFallthroughBranches();
+  return changed;
+}
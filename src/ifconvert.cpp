@@ -0,0 +1,277 @@
+#include "passes.h"
+#include "passmanager.h"
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <unordered_map>
+
+namespace {
+
+// Most work both arms together may do unconditionally once converted
+const int kMaximumCost = 6;
+// A string compare is a strcmp call in native code
+const int kStringCompareCost = 4;
+
+// Straight-line arm of an if: pure instructions that can run on both paths,
+// the last value it stores to each slot, and where it goes afterwards.
+struct Arm {
+  int block = -1; // -1 for the missing arm of an if without else
+  std::vector<std::shared_ptr<Instruction>> hoisted;
+  std::map<std::string, std::string> stores;
+  std::string next;
+  bool returns = false;
+  std::string returned;
+  int cost = 0;
+};
+
+class IfConversion {
+public:
+  IfConversion(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+  bool run();
+
+private:
+  std::optional<Arm> matchArm(int block) const;
+  bool convert(int head);
+  std::string typeOf(const std::string &value) const;
+  std::string freshTemporary();
+
+  ControlFlowGraph &cfg_;
+  AnalysisManager &analyses_;
+  std::unordered_map<std::string, int> definitions_;
+  const std::unordered_map<std::string, std::string> *types_ = nullptr;
+  std::vector<std::vector<int>> preds_;
+  int nextTemporary_ = 0;
+};
+
+IfConversion::IfConversion(ControlFlowGraph &cfg, AnalysisManager &analyses)
+    : cfg_(cfg), analyses_(analyses) {
+  for (const auto &block : cfg.blocks) {
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      const std::string &result = decoded.result;
+      if (result.empty()) {
+        continue;
+      }
+      definitions_[result]++;
+      if (result.size() > 2 && result.compare(0, 2, "%t") == 0 &&
+          std::all_of(result.begin() + 2, result.end(), ::isdigit)) {
+        nextTemporary_ =
+            std::max(nextTemporary_, std::atoi(result.c_str() + 2) + 1);
+      }
+    }
+  }
+}
+
+std::optional<Arm> IfConversion::matchArm(int block) const {
+  if (preds_[block].size() != 1 || cfg_.blocks[block].terminator() == nullptr) {
+    return std::nullopt;
+  }
+
+  Arm arm;
+  arm.block = block;
+  const auto &code = cfg_.blocks[block].instructions;
+  for (size_t i = 0; i + 1 < code.size(); i++) {
+    DecodedInstruction decoded = decodeInstruction(*code[i]);
+    if (decoded.operation == "store") {
+      arm.stores[decoded.operands[1]] = decoded.operands[0];
+      continue;
+    }
+    // Hoisted instructions run before any of the stores, and must not
+    // change a value the other path still reads
+    if (hasSideEffects(*code[i]) || mayTrap(*code[i]) ||
+        decoded.result.empty() || definitions_.at(decoded.result) != 1 ||
+        (decoded.operation == "load" && arm.stores.count(decoded.operands[0]))) {
+      return std::nullopt;
+    }
+    bool stringCompare = decoded.operands.size() == 2 &&
+                         typeOf(decoded.operands[0]) == "string";
+    arm.cost += stringCompare ? kStringCompareCost : 1;
+    arm.hoisted.push_back(code[i]);
+  }
+
+  DecodedInstruction exit = decodeInstruction(*code.back());
+  if (exit.operation == "br" && exit.operands.empty() &&
+      exit.targets.size() == 1) {
+    arm.next = exit.targets[0];
+  } else if (exit.operation == "ret" && exit.operands.size() == 1) {
+    arm.returns = true;
+    arm.returned = exit.operands[0];
+  } else {
+    return std::nullopt;
+  }
+  return arm;
+}
+
+// Replaces `br %c, label %T, label %F` at the end of `head` when both arms
+// only store to slots and meet again, or only return a value:
+//
+//   %v = select %c, A, B
+//   store %v, %slot            or            ret %v
+//
+// An arm that does not store a slot the other one does keeps the value the
+// slot had before the branch.
+bool IfConversion::convert(int head) {
+  std::shared_ptr<Instruction> terminator = cfg_.blocks[head].terminator();
+  if (terminator == nullptr) {
+    return false;
+  }
+  DecodedInstruction branch = decodeInstruction(*terminator);
+  if (branch.operation != "br" || branch.operands.size() != 1 ||
+      branch.targets.size() != 2 || branch.targets[0] == branch.targets[1]) {
+    return false;
+  }
+  int onTrue = cfg_.findBlock(branch.targets[0]);
+  int onFalse = cfg_.findBlock(branch.targets[1]);
+  if (onTrue <= 0 || onFalse <= 0 || onTrue == head || onFalse == head) {
+    return false;
+  }
+
+  std::optional<Arm> thenArm = matchArm(onTrue);
+  std::optional<Arm> elseArm = matchArm(onFalse);
+  if (thenArm && thenArm->next == branch.targets[1]) {
+    elseArm = Arm();
+    elseArm->next = branch.targets[1];
+  } else if (elseArm && elseArm->next == branch.targets[0]) {
+    thenArm = Arm();
+    thenArm->next = branch.targets[0];
+  }
+  if (!thenArm || !elseArm || thenArm->returns != elseArm->returns ||
+      thenArm->next != elseArm->next) {
+    return false;
+  }
+
+  const std::string &condition = branch.operands[0];
+  int cost = thenArm->cost + elseArm->cost;
+  std::vector<std::shared_ptr<Instruction>> code = cfg_.blocks[head].instructions;
+  code.pop_back();
+  code.insert(code.end(), thenArm->hoisted.begin(), thenArm->hoisted.end());
+  code.insert(code.end(), elseArm->hoisted.begin(), elseArm->hoisted.end());
+
+  auto select = [&](const std::string &a, const std::string &b) {
+    if (a == b) {
+      return a;
+    }
+    DecodedInstruction decoded;
+    decoded.operation = "select";
+    decoded.result = freshTemporary();
+    decoded.operands = {condition, a, b};
+    code.push_back(encodeInstruction(decoded));
+    cost++;
+    return decoded.result;
+  };
+
+  if (thenArm->returns) {
+    if (typeOf(thenArm->returned) != typeOf(elseArm->returned)) {
+      return false;
+    }
+    DecodedInstruction ret;
+    ret.operation = "ret";
+    ret.operands = {select(thenArm->returned, elseArm->returned)};
+    code.push_back(encodeInstruction(ret));
+  } else {
+    std::map<std::string, std::string> stores;
+    for (const Arm *arm : {&*thenArm, &*elseArm}) {
+      for (const auto &store : arm->stores) {
+        stores[store.first];
+      }
+    }
+    if (stores.empty()) {
+      return false;
+    }
+
+    // Every slot is read before any of them is written
+    for (auto &store : stores) {
+      const std::string &slot = store.first;
+      auto storedValue = [&](const Arm &arm) {
+        auto it = arm.stores.find(slot);
+        return it == arm.stores.end() ? std::string() : it->second;
+      };
+      std::string a = storedValue(*thenArm);
+      std::string b = storedValue(*elseArm);
+      if (typeOf(a.empty() ? slot : a) != typeOf(b.empty() ? slot : b)) {
+        return false;
+      }
+      if (a.empty() || b.empty()) {
+        DecodedInstruction load;
+        load.operation = "load";
+        load.result = freshTemporary();
+        load.type = typeOf(slot);
+        load.operands = {slot};
+        code.push_back(encodeInstruction(load));
+        (a.empty() ? a : b) = load.result;
+        cost++;
+      }
+      store.second = select(a, b);
+    }
+    for (const auto &store : stores) {
+      DecodedInstruction decoded;
+      decoded.operation = "store";
+      decoded.operands = {store.second, store.first};
+      code.push_back(encodeInstruction(decoded));
+    }
+    DecodedInstruction jump;
+    jump.operation = "br";
+    jump.targets = {thenArm->next};
+    code.push_back(encodeInstruction(jump));
+  }
+
+  if (cost > kMaximumCost) {
+    return false;
+  }
+
+  cfg_.blocks[head].instructions = code;
+  std::vector<int> removed;
+  for (const Arm *arm : {&*thenArm, &*elseArm}) {
+    if (arm->block >= 0) {
+      removed.push_back(arm->block);
+    }
+  }
+  std::sort(removed.rbegin(), removed.rend());
+  for (int block : removed) {
+    cfg_.blocks.erase(cfg_.blocks.begin() + block);
+  }
+  cfg_.reindex();
+  return true;
+}
+
+std::string IfConversion::typeOf(const std::string &value) const {
+  if (isTemporary(value)) {
+    auto it = types_->find(value);
+    return it == types_->end() ? "int" : it->second;
+  }
+  return literalType(value);
+}
+
+std::string IfConversion::freshTemporary() {
+  std::string name = "%t" + std::to_string(nextTemporary_++);
+  definitions_[name] = 1;
+  return name;
+}
+
+bool IfConversion::run() {
+  bool changed = false;
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    preds_ = cfg_.predecessors();
+    types_ = &analyses_.types();
+    for (size_t b = 0; b < cfg_.blocks.size(); b++) {
+      if (convert(static_cast<int>(b))) {
+        analyses_.invalidate();
+        progress = changed = true;
+        break;
+      }
+    }
+  }
+  return changed;
+}
+
+} // namespace
+
+bool convertIfsToSelects(ControlFlowGraph &cfg, AnalysisManager &analyses) {
+  cfg.makeFallthroughsExplicit();
+  bool changed = IfConversion(cfg, analyses).run();
+  cfg.removeFallthroughBranches();
+  return changed;
+}
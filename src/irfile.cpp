@@ -0,0 +1,528 @@
+#include "irfile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+uint32_t align8(size_t offset) {
+  return static_cast<uint32_t>((offset + 7) & ~static_cast<size_t>(7));
+}
+
+IrConstantType constantType(const std::string &literal) {
+  std::string type = literalType(literal);
+  return type == "int"      ? IrConstantType::Int
+         : type == "float"  ? IrConstantType::Float
+         : type == "string" ? IrConstantType::String
+         : type == "char"   ? IrConstantType::Char
+         : type == "bool"   ? IrConstantType::Bool
+                            : IrConstantType::Other;
+}
+
+// Collects the tables of one file while the CFG is walked.
+class IrWriter {
+public:
+  explicit IrWriter(const Module &module);
+
+  std::string serialize();
+
+private:
+  void addFunction(const Function &function);
+  uint32_t intern(const std::string &string);
+  uint32_t symbol(const std::string &name, IrSymbolKind kind);
+  uint32_t reference(const std::string &operand);
+  uint32_t constant(const std::string &literal);
+
+  std::vector<IrString> strings_;
+  std::string stringData_;
+  std::unordered_map<std::string, uint32_t> stringIndex_;
+  const ConstantPool &pool_;
+  std::vector<uint32_t> poolEntries_;
+  std::vector<IrConstant> constants_;
+  std::unordered_map<std::string, uint32_t> constantIndex_;
+  std::vector<IrFunction> functions_;
+  std::vector<IrSymbol> symbols_;
+  std::unordered_map<std::string, uint32_t> symbolIndex_;
+  std::vector<IrBlock> blocks_;
+  std::vector<IrInstruction> instructions_;
+  std::vector<uint32_t> operands_;
+};
+
+IrWriter::IrWriter(const Module &module) : pool_(module.constants) {
+  for (uint32_t i = 0; i < pool_.size(); i++) {
+    poolEntries_.push_back(intern(pool_.at(i)));
+  }
+  for (const Function &function : module.functions) {
+    addFunction(function);
+  }
+}
+
+void IrWriter::addFunction(const Function &function) {
+  const ControlFlowGraph &cfg = function.cfg;
+  IrFunction record = {};
+  record.name = intern(function.name);
+  record.header =
+      function.name == "main" ? kIrNone : intern(functionHeader(function));
+  record.firstBlock = static_cast<uint32_t>(blocks_.size());
+  record.blockCount = static_cast<uint32_t>(cfg.blocks.size());
+  functions_.push_back(record);
+  symbolIndex_.clear();
+
+  // Labels first, so every target resolves to its block
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    if (!cfg.blocks[b].label.empty()) {
+      uint32_t label = symbol(cfg.blocks[b].label, IrSymbolKind::Label);
+      symbols_[label].block = record.firstBlock + static_cast<uint32_t>(b);
+    }
+  }
+
+  for (const auto &block : cfg.blocks) {
+    IrBlock record = {};
+    record.label = block.label.empty() ? kIrNone : symbolIndex_[block.label];
+    record.firstInstruction = static_cast<uint32_t>(instructions_.size());
+
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      IrInstruction ir = {};
+      ir.operation = intern(decoded.operation);
+      ir.result = kIrNone;
+      if (!decoded.result.empty()) {
+        ir.result = symbol(decoded.result, decoded.operation == "alloc"
+                                               ? IrSymbolKind::Slot
+                                               : IrSymbolKind::Temporary);
+      }
+      ir.attribute =
+          decoded.attribute.empty() ? kIrNone : intern(decoded.attribute);
+      ir.type = decoded.type.empty() ? kIrNone : intern(decoded.type);
+      ir.firstOperand = static_cast<uint32_t>(operands_.size());
+      ir.operandCount = static_cast<uint16_t>(decoded.operands.size());
+      ir.targetCount = static_cast<uint16_t>(decoded.targets.size());
+      for (const auto &operand : decoded.operands) {
+        operands_.push_back(reference(operand));
+      }
+      for (const auto &target : decoded.targets) {
+        operands_.push_back(symbol(target, IrSymbolKind::Label));
+      }
+      instructions_.push_back(ir);
+    }
+
+    record.instructionCount =
+        static_cast<uint32_t>(instructions_.size()) - record.firstInstruction;
+    blocks_.push_back(record);
+  }
+}
+
+std::string IrWriter::serialize() {
+  IrFileHeader header = {};
+  header.magic = kIrFileMagic;
+  header.version = kIrFileVersion;
+
+  size_t offset = align8(sizeof(IrFileHeader));
+  auto place = [&offset](uint32_t &field, size_t bytes) {
+    field = static_cast<uint32_t>(offset);
+    offset = align8(offset + bytes);
+  };
+  header.stringCount = static_cast<uint32_t>(strings_.size());
+  place(header.stringsOffset, strings_.size() * sizeof(IrString));
+  place(header.stringDataOffset, stringData_.size());
+  header.poolCount = static_cast<uint32_t>(poolEntries_.size());
+  place(header.poolOffset, poolEntries_.size() * sizeof(uint32_t));
+  header.constantCount = static_cast<uint32_t>(constants_.size());
+  place(header.constantsOffset, constants_.size() * sizeof(IrConstant));
+  header.functionCount = static_cast<uint32_t>(functions_.size());
+  place(header.functionsOffset, functions_.size() * sizeof(IrFunction));
+  header.symbolCount = static_cast<uint32_t>(symbols_.size());
+  place(header.symbolsOffset, symbols_.size() * sizeof(IrSymbol));
+  header.blockCount = static_cast<uint32_t>(blocks_.size());
+  place(header.blocksOffset, blocks_.size() * sizeof(IrBlock));
+  header.instructionCount = static_cast<uint32_t>(instructions_.size());
+  place(header.instructionsOffset,
+        instructions_.size() * sizeof(IrInstruction));
+  header.operandCount = static_cast<uint32_t>(operands_.size());
+  place(header.operandsOffset, operands_.size() * sizeof(uint32_t));
+  header.fileSize = static_cast<uint32_t>(offset);
+
+  std::string buffer(offset, '\0');
+  auto copy = [&buffer](uint32_t at, const void *data, size_t bytes) {
+    if (bytes > 0) {
+      std::memcpy(&buffer[at], data, bytes);
+    }
+  };
+  copy(0, &header, sizeof(header));
+  copy(header.stringsOffset, strings_.data(),
+       strings_.size() * sizeof(IrString));
+  copy(header.stringDataOffset, stringData_.data(), stringData_.size());
+  copy(header.poolOffset, poolEntries_.data(),
+       poolEntries_.size() * sizeof(uint32_t));
+  copy(header.constantsOffset, constants_.data(),
+       constants_.size() * sizeof(IrConstant));
+  copy(header.functionsOffset, functions_.data(),
+       functions_.size() * sizeof(IrFunction));
+  copy(header.symbolsOffset, symbols_.data(),
+       symbols_.size() * sizeof(IrSymbol));
+  copy(header.blocksOffset, blocks_.data(), blocks_.size() * sizeof(IrBlock));
+  copy(header.instructionsOffset, instructions_.data(),
+       instructions_.size() * sizeof(IrInstruction));
+  copy(header.operandsOffset, operands_.data(),
+       operands_.size() * sizeof(uint32_t));
+  return buffer;
+}
+
+uint32_t IrWriter::intern(const std::string &string) {
+  auto it = stringIndex_.find(string);
+  if (it != stringIndex_.end()) {
+    return it->second;
+  }
+  uint32_t index = static_cast<uint32_t>(strings_.size());
+  strings_.push_back({static_cast<uint32_t>(stringData_.size()),
+                      static_cast<uint32_t>(string.size())});
+  stringData_ += string;
+  stringData_ += '\0';
+  stringIndex_[string] = index;
+  return index;
+}
+
+uint32_t IrWriter::symbol(const std::string &name, IrSymbolKind kind) {
+  auto it = symbolIndex_.find(name);
+  if (it != symbolIndex_.end()) {
+    return it->second;
+  }
+  uint32_t index = static_cast<uint32_t>(symbols_.size());
+  symbols_.push_back({intern(name), kind, kIrNone, 0});
+  symbolIndex_[name] = index;
+  return index;
+}
+
+uint32_t IrWriter::reference(const std::string &operand) {
+  if (isTemporary(operand)) {
+    return symbol(operand, IrSymbolKind::Temporary);
+  }
+  return constant(operand) | kIrConstantBit;
+}
+
+uint32_t IrWriter::constant(const std::string &literal) {
+  auto it = constantIndex_.find(literal);
+  if (it != constantIndex_.end()) {
+    return it->second;
+  }
+
+  IrConstant record = {};
+  record.type = constantType(literal);
+  record.text = intern(literal);
+  switch (record.type) {
+  case IrConstantType::Int:
+    record.value = std::strtoll(literal.c_str(), nullptr, 10);
+    break;
+  case IrConstantType::Float: {
+    double value = std::strtod(literal.c_str(), nullptr);
+    std::memcpy(&record.value, &value, sizeof(value));
+    break;
+  }
+  case IrConstantType::String:
+    record.value = isPoolReference(literal)
+                       ? poolEntries_.at(poolIndex(literal))
+                       : intern(literal.substr(1, literal.size() - 2));
+    break;
+  case IrConstantType::Char:
+    record.value = charLiteralCode(literal);
+    break;
+  case IrConstantType::Bool:
+    record.value = literal == "true" ? 1 : 0;
+    break;
+  default:
+    break;
+  }
+
+  uint32_t index = static_cast<uint32_t>(constants_.size());
+  constants_.push_back(record);
+  constantIndex_[literal] = index;
+  return index;
+}
+
+} // namespace
+
+bool writeIrFile(const Module &module, const std::string &path) {
+  std::string buffer = IrWriter(module).serialize();
+
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    std::cerr << "Error: Could not write " << path << std::endl;
+    return false;
+  }
+  bool written = std::fwrite(buffer.data(), 1, buffer.size(), file) ==
+                 buffer.size();
+  written = std::fclose(file) == 0 && written;
+  if (!written) {
+    std::cerr << "Error: Writing " << path << " failed" << std::endl;
+  }
+  return written;
+}
+
+IrFile::~IrFile() { release(); }
+
+bool IrFile::open(const std::string &path) {
+  release();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Error: Could not open " << path << std::endl;
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(IrFileHeader))) {
+    std::cerr << "Error: " << path << " is not an IR file" << std::endl;
+    ::close(fd);
+    return false;
+  }
+
+  void *memory = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    std::cerr << "Error: Could not map " << path << std::endl;
+    return false;
+  }
+
+  data_ = static_cast<const char *>(memory);
+  size_ = static_cast<size_t>(info.st_size);
+  header_ = section<IrFileHeader>(0);
+  if (!validate(path)) {
+    release();
+    return false;
+  }
+  return true;
+}
+
+bool IrFile::validate(const std::string &path) const {
+  const IrFileHeader &h = *header_;
+  if (h.magic != kIrFileMagic) {
+    std::cerr << "Error: " << path << " is not an IR file" << std::endl;
+    return false;
+  }
+  if (h.version != kIrFileVersion) {
+    std::cerr << "Error: " << path << " has IR version " << h.version
+              << ", expected " << kIrFileVersion << std::endl;
+    return false;
+  }
+
+  auto fits = [&h](uint32_t offset, uint64_t count, size_t record) {
+    return offset % 8 == 0 && offset <= h.fileSize &&
+           count * record <= h.fileSize - offset;
+  };
+  bool valid = h.fileSize <= size_ &&
+               fits(h.stringsOffset, h.stringCount, sizeof(IrString)) &&
+               fits(h.poolOffset, h.poolCount, sizeof(uint32_t)) &&
+               fits(h.constantsOffset, h.constantCount, sizeof(IrConstant)) &&
+               fits(h.functionsOffset, h.functionCount, sizeof(IrFunction)) &&
+               fits(h.symbolsOffset, h.symbolCount, sizeof(IrSymbol)) &&
+               fits(h.blocksOffset, h.blockCount, sizeof(IrBlock)) &&
+               fits(h.instructionsOffset, h.instructionCount,
+                    sizeof(IrInstruction)) &&
+               fits(h.operandsOffset, h.operandCount, sizeof(uint32_t)) &&
+               h.stringDataOffset <= h.fileSize;
+  // Every index and offset is checked here, the accessors trust them
+  for (uint32_t s = 0; valid && s < h.stringCount; s++) {
+    const IrString &string = section<IrString>(h.stringsOffset)[s];
+    uint64_t end = static_cast<uint64_t>(h.stringDataOffset) + string.offset +
+                   string.length;
+    valid = end < h.fileSize && data_[end] == '\0';
+  }
+  auto isString = [&h](uint32_t index) { return index < h.stringCount; };
+  auto isReference = [&h](uint32_t ref) {
+    return ref & kIrConstantBit ? (ref & ~kIrConstantBit) < h.constantCount
+                                : ref < h.symbolCount;
+  };
+  for (uint32_t p = 0; valid && p < h.poolCount; p++) {
+    valid = isString(section<uint32_t>(h.poolOffset)[p]);
+  }
+  for (uint32_t c = 0; valid && c < h.constantCount; c++) {
+    valid = isString(section<IrConstant>(h.constantsOffset)[c].text);
+  }
+  for (uint32_t f = 0; valid && f < h.functionCount; f++) {
+    const IrFunction &function = section<IrFunction>(h.functionsOffset)[f];
+    valid = isString(function.name) &&
+            (function.header == kIrNone || isString(function.header)) &&
+            static_cast<uint64_t>(function.firstBlock) + function.blockCount <=
+                h.blockCount;
+  }
+  for (uint32_t s = 0; valid && s < h.symbolCount; s++) {
+    valid = isString(section<IrSymbol>(h.symbolsOffset)[s].name);
+  }
+  for (uint32_t b = 0; valid && b < h.blockCount; b++) {
+    const IrBlock &block = section<IrBlock>(h.blocksOffset)[b];
+    valid = (block.label == kIrNone || isReference(block.label)) &&
+            static_cast<uint64_t>(block.firstInstruction) +
+                    block.instructionCount <=
+                h.instructionCount;
+  }
+  for (uint32_t i = 0; valid && i < h.instructionCount; i++) {
+    const IrInstruction &instr = section<IrInstruction>(h.instructionsOffset)[i];
+    valid = isString(instr.operation) &&
+            (instr.result == kIrNone || isReference(instr.result)) &&
+            (instr.attribute == kIrNone || isString(instr.attribute)) &&
+            (instr.type == kIrNone || isString(instr.type)) &&
+            static_cast<uint64_t>(instr.firstOperand) + instr.operandCount +
+                    instr.targetCount <=
+                h.operandCount;
+  }
+  for (uint32_t o = 0; valid && o < h.operandCount; o++) {
+    valid = isReference(section<uint32_t>(h.operandsOffset)[o]);
+  }
+  // Instructions are used as text, which must decode to the same shape
+  for (uint32_t i = 0; valid && i < h.instructionCount; i++) {
+    DecodedInstruction decoded = decode(i);
+    valid = isWellFormed(decoded) &&
+            isWellFormed(decodeInstruction(*encodeInstruction(decoded)));
+  }
+  if (!valid) {
+    std::cerr << "Error: " << path << " is truncated or corrupt" << std::endl;
+  }
+  return valid;
+}
+
+void IrFile::release() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  header_ = nullptr;
+}
+
+const IrFunction &IrFile::function(uint32_t index) const {
+  return section<IrFunction>(header_->functionsOffset)[index];
+}
+
+const IrBlock &IrFile::block(uint32_t index) const {
+  return section<IrBlock>(header_->blocksOffset)[index];
+}
+
+const IrInstruction &IrFile::instruction(uint32_t index) const {
+  return section<IrInstruction>(header_->instructionsOffset)[index];
+}
+
+uint32_t IrFile::poolEntry(uint32_t index) const {
+  return section<uint32_t>(header_->poolOffset)[index];
+}
+
+uint32_t IrFile::operand(uint32_t index) const {
+  return section<uint32_t>(header_->operandsOffset)[index];
+}
+
+const IrSymbol &IrFile::symbol(uint32_t index) const {
+  return section<IrSymbol>(header_->symbolsOffset)[index];
+}
+
+const IrConstant &IrFile::constant(uint32_t index) const {
+  return section<IrConstant>(header_->constantsOffset)[index];
+}
+
+const char *IrFile::string(uint32_t index) const {
+  return data_ + header_->stringDataOffset +
+         section<IrString>(header_->stringsOffset)[index].offset;
+}
+
+const char *IrFile::reference(uint32_t ref) const {
+  if (ref & kIrConstantBit) {
+    return string(constant(ref & ~kIrConstantBit).text);
+  }
+  return string(symbol(ref).name);
+}
+
+DecodedInstruction IrFile::decode(uint32_t index) const {
+  const IrInstruction &instr = instruction(index);
+  DecodedInstruction decoded;
+  decoded.operation = string(instr.operation);
+  if (instr.result != kIrNone) {
+    decoded.result = reference(instr.result);
+  }
+  if (instr.attribute != kIrNone) {
+    decoded.attribute = string(instr.attribute);
+  }
+  if (instr.type != kIrNone) {
+    decoded.type = string(instr.type);
+  }
+  for (uint32_t i = 0; i < instr.operandCount; i++) {
+    decoded.operands.push_back(reference(operand(instr.firstOperand + i)));
+  }
+  for (uint32_t i = 0; i < instr.targetCount; i++) {
+    decoded.targets.push_back(
+        reference(operand(instr.firstOperand + instr.operandCount + i)));
+  }
+  return decoded;
+}
+
+std::shared_ptr<Instruction> IrFile::toIR() const {
+  std::shared_ptr<Instruction> root = std::make_shared<Instruction>("root");
+
+  for (uint32_t p = 0; p < header_->poolCount; p++) {
+    root->addElement(std::make_shared<Instruction>(
+        "const", poolReference(p) + " = const \"" + string(poolEntry(p)) + "\""));
+  }
+  for (uint32_t f = 0; f < header_->functionCount; f++) {
+    const IrFunction &record = function(f);
+    std::shared_ptr<Instruction> body = root;
+    if (record.header != kIrNone) {
+      body = std::make_shared<Instruction>("define", string(record.header));
+      root->addElement(body);
+    }
+
+    for (uint32_t b = record.firstBlock; b < record.firstBlock + record.blockCount;
+         b++) {
+      const IrBlock &blockRecord = block(b);
+      std::shared_ptr<Instruction> parent = body;
+      if (blockRecord.label != kIrNone) {
+        parent =
+            std::make_shared<Instruction>("label", reference(blockRecord.label));
+        body->addElement(parent);
+      }
+      for (uint32_t i = 0; i < blockRecord.instructionCount; i++) {
+        parent->addElement(
+            encodeInstruction(decode(blockRecord.firstInstruction + i)));
+      }
+    }
+  }
+
+  return root;
+}
+
+void IrFile::disassemble(std::ostream &out) const {
+  std::ostringstream text;
+
+  for (uint32_t p = 0; p < header_->poolCount; p++) {
+    text << "  " << poolReference(p) << " = const \"" << string(poolEntry(p))
+         << "\"\n";
+  }
+  for (uint32_t f = 0; f < header_->functionCount; f++) {
+    const IrFunction &record = function(f);
+    std::string base = "  ";
+    if (record.header != kIrNone) {
+      text << "  " << string(record.header) << '\n';
+      base = "    ";
+    }
+
+    for (uint32_t b = record.firstBlock; b < record.firstBlock + record.blockCount;
+         b++) {
+      const IrBlock &blockRecord = block(b);
+      std::string indent = base;
+      if (blockRecord.label != kIrNone) {
+        text << base << reference(blockRecord.label) << '\n';
+        indent = base + "  ";
+      }
+      for (uint32_t i = 0; i < blockRecord.instructionCount; i++) {
+        text << indent
+             << encodeInstruction(decode(blockRecord.firstInstruction + i))
+                    ->instruction
+             << '\n';
+      }
+    }
+  }
+
+  out << text.str();
+}
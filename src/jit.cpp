@@ -0,0 +1,65 @@
+#include "jit.h"
+#include "x86backend.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+X86Jit::X86Jit(const Module &module) : module_(module) {}
+
+X86Jit::~X86Jit() { release(); }
+
+bool X86Jit::compile() {
+  release();
+  emitter_ = MachineCodeEmitter();
+  X86Backend(module_).lower(emitter_);
+  if (!emitter_.finish()) {
+    return false;
+  }
+
+  const std::vector<uint8_t> &code = emitter_.code();
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t size = (code.size() + page - 1) / page * page;
+
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    std::cerr << "JIT: could not map " << size << " bytes" << std::endl;
+    return false;
+  }
+  std::memcpy(memory, code.data(), code.size());
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    std::cerr << "JIT: could not make code executable" << std::endl;
+    munmap(memory, size);
+    return false;
+  }
+
+  memory_ = memory;
+  mappedSize_ = size;
+  return true;
+}
+
+int X86Jit::run() {
+  if (memory_ == nullptr) {
+    std::cerr << "JIT: nothing compiled" << std::endl;
+    return 1;
+  }
+  // main is lowered first, so it starts the code
+  auto entry = reinterpret_cast<int (*)()>(memory_);
+  int status = entry();
+  std::fflush(stdout);
+  return status;
+}
+
+std::vector<uint64_t> X86Jit::counters() const {
+  return {emitter_.counters().begin(), emitter_.counters().end()};
+}
+
+void X86Jit::release() {
+  if (memory_ != nullptr) {
+    munmap(memory_, mappedSize_);
+    memory_ = nullptr;
+    mappedSize_ = 0;
+  }
+}
@@ -1,4 +1,6 @@
 #include "lexer.h"
+#include "trace.h"
+#include <charconv>
 
 Lexer::Lexer(const std::string &filename)
     : filename_(filename), currentPos_(0), lineNumber_(1),
@@ -10,13 +12,40 @@ Lexer::Lexer(const std::string &filename)
       STRING_REGEX("string"), CHAR_REGEX("char"), BOOL_REGEX("bool"),
       RELATIONAL_OPERATOR_REGEX("==|!=|<|>|<=|>="),
       UNARY_ARITHMETIC_OPERATOR_REGEX("\\+\\+|--") {
-  file_.open(filename_, std::ios::in);
-  if (!file_.is_open()) {
+  // The whole file is read up front, tokens are then scanned from memory
+  TraceSpan span("read", filename_);
+  std::ifstream file(filename_, std::ios::in);
+  if (!file.is_open()) {
     std::cerr << "Error: Could not open file " << filename_ << std::endl;
+    return;
   }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  file_.str(contents.str());
+}
+
+std::pair<TokenType, std::string> Lexer::peekToken() {
+  if (!peeked_) {
+    peeked_ = getNextToken();
+  }
+  return *peeked_;
 }
 
 std::pair<TokenType, std::string> Lexer::getNextToken() {
+  if (peeked_) {
+    std::pair<TokenType, std::string> token = *peeked_;
+    peeked_.reset();
+    return token;
+  }
+  if (stats_ == nullptr) {
+    return scanToken();
+  }
+  PhaseTimer timer(&stats_->lexTime);
+  stats_->tokens++;
+  return scanToken();
+}
+
+std::pair<TokenType, std::string> Lexer::scanToken() {
   std::string tokenValue;
   char c;
 
@@ -75,36 +104,33 @@ std::pair<TokenType, std::string> Lexer::getNextToken() {
     }
   }
 
-  // Handle numeric literals
+  // Handle numeric literals: digits, then an optional fraction and exponent
   if (std::isdigit(c)) {
+    auto takeDigits = [this, &tokenValue]() {
+      while (std::isdigit(file_.peek())) {
+        tokenValue += static_cast<char>(file_.get());
+      }
+    };
     tokenValue += c;
-    while (file_.get(c) && std::isdigit(c)) {
-      tokenValue += c;
-    }
-    file_.unget();
+    takeDigits();
     if (file_.peek() == '.') {
-      tokenValue += '.';
-      file_.get(c);
-      while (file_.get(c) && std::isdigit(c)) {
-        tokenValue += c;
-      }
-      currentPos_ += tokenValue.size();
-      return std::make_pair(TokenType::NUMERIC_LITERAL, tokenValue);
+      tokenValue += static_cast<char>(file_.get());
+      takeDigits();
     }
-    if (c == 'e' || c == 'E') {
-      tokenValue += c;
-      if (file_.get(c) && (c == '+' || c == '-' || std::isdigit(c))) {
-        tokenValue += c;
-        while (file_.get(c) && std::isdigit(c)) {
-          tokenValue += c;
-        }
-        file_.unget();
-        currentPos_ += tokenValue.size();
-        return std::make_pair(TokenType::NUMERIC_LITERAL, tokenValue);
-      } else {
+    if (file_.peek() == 'e' || file_.peek() == 'E') {
+      tokenValue += static_cast<char>(file_.get());
+      if (file_.peek() == '+' || file_.peek() == '-') {
+        tokenValue += static_cast<char>(file_.get());
+      }
+      if (!std::isdigit(file_.peek())) {
         currentPos_ += tokenValue.size();
         return std::make_pair(TokenType::ERROR, tokenValue);
       }
+      takeDigits();
+    }
+    currentPos_ += tokenValue.size();
+    if (!convertNumber(tokenValue)) {
+      return std::make_pair(TokenType::ERROR, tokenValue);
     }
     return std::make_pair(TokenType::NUMERIC_LITERAL, tokenValue);
   }
@@ -133,6 +159,11 @@ std::pair<TokenType, std::string> Lexer::getNextToken() {
       return std::make_pair(TokenType::BOOL, tokenValue);
     }
 
+    // Check for bool literals
+    if (std::regex_match(tokenValue, BOOL_LITERAL_REGEX)) {
+      return std::make_pair(TokenType::BOOL_LITERAL, tokenValue);
+    }
+
     // Check for keywords
     if (std::regex_match(tokenValue, KEYWORD_REGEX)) {
       return std::make_pair(TokenType::KEYWORD, tokenValue);
@@ -168,20 +199,18 @@ std::pair<TokenType, std::string> Lexer::getNextToken() {
     }
   }
 
-  // Handle math operators
+  // Handle math operators; only ++ and -- take two characters, so a * -b
+  // needs no space between the operators
   if (isMathOperator(c)) {
     tokenValue += c;
-    while (file_.get(c) && isMathOperator(c)) {
+    if ((c == '+' || c == '-') && file_.peek() == c) {
+      file_.get(c);
       tokenValue += c;
-    }
-    file_.unget();
-    if (tokenValue.size() > 1) {
       currentPos_ += tokenValue.size();
       return std::make_pair(TokenType::UNARY_ARITHMETIC_OPERATOR, tokenValue);
-    } else {
-      currentPos_ += tokenValue.size();
-      return std::make_pair(TokenType::MATH_OPERATOR, tokenValue);
     }
+    currentPos_ += tokenValue.size();
+    return std::make_pair(TokenType::MATH_OPERATOR, tokenValue);
   }
 
   // If none of the above, return an error
@@ -192,8 +221,46 @@ bool Lexer::isMathOperator(char c) {
   return MATH_OPERATORS.find(c) != std::string::npos;
 }
 
+// Ints must fit in 64 bits and floats in a double. Each spelling is
+// converted once, repeated literals reuse the first conversion.
+bool Lexer::convertNumber(const std::string &text) {
+  if (numbers_.count(text)) {
+    return true;
+  }
+  NumericConstant constant;
+  const char *first = text.data();
+  const char *last = first + text.size();
+  std::from_chars_result result;
+  if (text.find_first_of(".eE") == std::string::npos) {
+    constant.kind = NumericConstant::Int;
+    result = std::from_chars(first, last, constant.i);
+  } else {
+    constant.kind = NumericConstant::Float;
+    result = std::from_chars(first, last, constant.f);
+  }
+
+  if (result.ec == std::errc::result_out_of_range) {
+    std::cerr << "Syntax error: "
+              << (constant.kind == NumericConstant::Int
+                      ? "Integer literal " + text + " does not fit in 64 bits"
+                      : "Float literal " + text + " is out of range")
+              << "! Line: " << getCurrentLineNumber() << std::endl;
+    return false;
+  }
+  if (result.ec != std::errc() || result.ptr != last) {
+    std::cerr << "Syntax error: Malformed number " << text
+              << "! Line: " << getCurrentLineNumber() << std::endl;
+    return false;
+  }
+  numbers_.emplace(text, constant);
+  return true;
+}
+
+NumericConstant Lexer::numericConstant(const std::string &text) const {
+  auto it = numbers_.find(text);
+  return it == numbers_.end() ? NumericConstant() : it->second;
+}
+
 std::string Lexer::getCurrentLineNumber() const {
   return std::to_string(lineNumber_) + "; " + std::to_string(currentPos_);
 }
-
-Lexer::~Lexer() { file_.close(); }
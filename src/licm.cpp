@@ -0,0 +1,386 @@
+#include <cstdio>
+#include <map>
+#include "passes.h"
+#include "passmanager.h"
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// The loops of the graph innermost first, so invariants bubble outwards
+// one loop level at a time, with the predecessors and definition counts
+// the transforms need. Computed once per pass and kept up to date as
+// preheaders are inserted and loads removed.
+struct LoopNest {
+  std::vector<Loop> loops;
+  std::vector<std::vector<int>> preds;
+  std::unordered_map<std::string, int> definitions;
+};
+
+LoopNest findLoopNest(const ControlFlowGraph &cfg, AnalysisManager &analyses) {
+  LoopNest nest;
+  nest.loops = analyses.loops();
+  std::sort(nest.loops.begin(), nest.loops.end(),
+            [](const Loop &a, const Loop &b) {
+              return a.blocks.size() < b.blocks.size();
+            });
+  nest.preds = cfg.predecessors();
+  for (const auto &block : cfg.blocks) {
+    for (const auto &instr : block.instructions) {
+      std::string result = decodeInstruction(*instr).result;
+      if (!result.empty()) {
+        nest.definitions[result]++;
+      }
+    }
+  }
+  return nest;
+}
+
+// Accounts for a preheader inserted at `position`, in front of the header
+// that was there, taking the edges from `outside`. It belongs to every
+// loop around the one it was made for.
+void addPreheader(LoopNest &nest, int position, const std::vector<int> &outside) {
+  auto shift = [position](int &block) {
+    if (block >= position) {
+      block++;
+    }
+  };
+  for (Loop &loop : nest.loops) {
+    bool encloses = loop.header != position && loop.contains(position);
+    shift(loop.header);
+    std::for_each(loop.latches.begin(), loop.latches.end(), shift);
+    std::for_each(loop.blocks.begin(), loop.blocks.end(), shift);
+    if (encloses) {
+      loop.blocks.insert(
+          std::lower_bound(loop.blocks.begin(), loop.blocks.end(), position),
+          position);
+    }
+  }
+
+  for (auto &preds : nest.preds) {
+    std::for_each(preds.begin(), preds.end(), shift);
+  }
+  std::vector<int> entering = outside;
+  std::for_each(entering.begin(), entering.end(), shift);
+  std::vector<int> &headerPreds = nest.preds[position];
+  headerPreds.erase(std::remove_if(headerPreds.begin(), headerPreds.end(),
+                                   [&entering](int pred) {
+                                     return std::find(entering.begin(),
+                                                      entering.end(),
+                                                      pred) != entering.end();
+                                   }),
+                    headerPreds.end());
+  headerPreds.push_back(position);
+  nest.preds.insert(nest.preds.begin() + position, entering);
+}
+
+// Returns the index of a block that is the only way into loop `index` from
+// outside, inserting an empty one in front of the header when needed.
+// Expects explicit fallthrough branches.
+
+static void checkNest(const ControlFlowGraph &cfg, const LoopNest &nest) {
+  auto fresh = cfg.findLoops();
+  std::map<int, std::pair<std::vector<int>, std::vector<int>>> a, b;
+  for (auto &l : fresh) a[l.header] = {l.blocks, l.latches};
+  for (auto &l : nest.loops) b[l.header] = {l.blocks, l.latches};
+  auto p = cfg.predecessors();
+  auto q = nest.preds;
+  for (auto &v : p) std::sort(v.begin(), v.end());
+  for (auto &v : q) std::sort(v.begin(), v.end());
+  if (a != b || p != q) { fprintf(stderr, "NEST MISMATCH\n"); abort(); }
+}
+int ensurePreheader(ControlFlowGraph &cfg, LoopNest &nest, size_t index) {
+  const Loop &loop = nest.loops[index];
+  std::vector<int> outside;
+  for (int pred : nest.preds[loop.header]) {
+    if (!loop.contains(pred)) {
+      outside.push_back(pred);
+    }
+  }
+
+  if (outside.size() == 1 && cfg.successors(outside[0]).size() == 1) {
+    return outside[0];
+  }
+
+  int position = loop.header;
+  std::string headerLabel = cfg.blocks[position].label;
+  BasicBlock preheader;
+  preheader.label = headerLabel + "_preheader";
+  preheader.instructions.push_back(
+      std::make_shared<Instruction>("br", "br label " + headerLabel));
+
+  for (int pred : outside) {
+    auto &terminator = cfg.blocks[pred].instructions.back();
+    DecodedInstruction decoded = decodeInstruction(*terminator);
+    for (auto &target : decoded.targets) {
+      if (target == headerLabel) {
+        target = preheader.label;
+      }
+    }
+    terminator = encodeInstruction(decoded);
+  }
+
+  cfg.blocks.insert(cfg.blocks.begin() + position, preheader);
+  cfg.reindex();
+  addPreheader(nest, position, outside);
+  checkNest(cfg, nest);
+  return position;
+}
+
+void appendBeforeTerminator(BasicBlock &block,
+                            const std::shared_ptr<Instruction> &instr) {
+  auto position = block.instructions.end();
+  if (block.terminator() != nullptr) {
+    position--;
+  }
+  block.instructions.insert(position, instr);
+}
+
+bool hoistFromLoop(ControlFlowGraph &cfg, LoopNest &nest, size_t index) {
+  const Loop &loop = nest.loops[index];
+  std::unordered_map<std::string, int> &definitions = nest.definitions;
+  std::unordered_set<std::string> definedInLoop;
+  std::unordered_set<std::string> storedSlots;
+
+  for (int b : loop.blocks) {
+    for (const auto &instr : cfg.blocks[b].instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      if (!decoded.result.empty()) {
+        definedInLoop.insert(decoded.result);
+      }
+      if (decoded.operation == "store") {
+        storedSlots.insert(decoded.operands[1]);
+      }
+    }
+  }
+
+  std::unordered_set<std::string> invariant;
+  std::vector<std::shared_ptr<Instruction>> hoisted;
+  std::unordered_set<Instruction *> hoistedSet;
+
+  auto isInvariantOperand = [&](const std::string &operand) {
+    return !isTemporary(operand) || !definedInLoop.count(operand) ||
+           invariant.count(operand);
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b : loop.blocks) {
+      for (const auto &instr : cfg.blocks[b].instructions) {
+        // The preheader also runs when the loop does not
+        if (hasSideEffects(*instr) || mayTrap(*instr) ||
+            hoistedSet.count(instr.get())) {
+          continue;
+        }
+
+        DecodedInstruction decoded = decodeInstruction(*instr);
+        if (decoded.result.empty() || definitions[decoded.result] != 1 ||
+            decoded.operation == "inc" || decoded.operation == "dec") {
+          continue;
+        }
+        if (decoded.operation == "load" &&
+            storedSlots.count(decoded.operands[0])) {
+          continue;
+        }
+        if (!std::all_of(decoded.operands.begin(), decoded.operands.end(),
+                         isInvariantOperand)) {
+          continue;
+        }
+
+        invariant.insert(decoded.result);
+        hoisted.push_back(instr);
+        hoistedSet.insert(instr.get());
+        changed = true;
+      }
+    }
+  }
+
+  if (hoisted.empty()) {
+    return false;
+  }
+
+  for (int b : loop.blocks) {
+    auto &instructions = cfg.blocks[b].instructions;
+    instructions.erase(std::remove_if(instructions.begin(), instructions.end(),
+                                      [&hoistedSet](const auto &instr) {
+                                        return hoistedSet.count(instr.get()) > 0;
+                                      }),
+                       instructions.end());
+  }
+
+  int preheader = ensurePreheader(cfg, nest, index);
+  for (const auto &instr : hoisted) {
+    appendBeforeTerminator(cfg.blocks[preheader], instr);
+  }
+
+  return true;
+}
+
+// Recognises the counter pattern codegen emits for every for loop
+//
+//   header: %c = load %slot
+//   latch:  %c = %c + 1
+//           store %c, %slot
+//
+// and keeps %c in a register for the whole loop: the load moves to the
+// preheader, loads of %slot inside the loop reuse %c and the store is sunk
+// to the loop exits.
+bool promoteInductionVariable(ControlFlowGraph &cfg, LoopNest &nest,
+                              size_t index) {
+  const Loop &loop = nest.loops[index];
+  if (loop.latches.size() != 1) {
+    return false;
+  }
+  BasicBlock &header = cfg.blocks[loop.header];
+  BasicBlock &latch = cfg.blocks[loop.latches[0]];
+  std::unordered_map<std::string, int> &definitions = nest.definitions;
+
+  for (size_t h = 0; h < header.instructions.size(); h++) {
+    DecodedInstruction counterLoad = decodeInstruction(*header.instructions[h]);
+    if (counterLoad.operation != "load" ||
+        definitions[counterLoad.result] != 2) {
+      continue;
+    }
+    const std::string &counter = counterLoad.result;
+    const std::string &slot = counterLoad.operands[0];
+
+    // Exactly one update of the counter followed by one store in the latch
+    int stepIndex = -1;
+    int storeIndex = -1;
+    int storesInLoop = 0;
+    for (int b : loop.blocks) {
+      const auto &instructions = cfg.blocks[b].instructions;
+      for (size_t i = 0; i < instructions.size(); i++) {
+        DecodedInstruction decoded = decodeInstruction(*instructions[i]);
+        if (decoded.operation == "store" && decoded.operands[1] == slot) {
+          storesInLoop++;
+          if (b == loop.latches[0] && decoded.operands[0] == counter) {
+            storeIndex = static_cast<int>(i);
+          }
+        } else if ((decoded.operation == "inc" || decoded.operation == "dec") &&
+                   decoded.result == counter && b == loop.latches[0]) {
+          stepIndex = static_cast<int>(i);
+        }
+      }
+    }
+    if (storesInLoop != 1 || stepIndex < 0 || storeIndex < stepIndex) {
+      continue;
+    }
+
+    // Every other load of the slot must observe the value before the step
+    std::vector<std::string> aliases;
+    bool safe = true;
+    for (int b : loop.blocks) {
+      const auto &instructions = cfg.blocks[b].instructions;
+      for (size_t i = 0; i < instructions.size(); i++) {
+        DecodedInstruction decoded = decodeInstruction(*instructions[i]);
+        bool afterStep = b == loop.latches[0] && static_cast<int>(i) > stepIndex;
+        if (decoded.operation == "load" && decoded.operands[0] == slot &&
+            decoded.result != counter) {
+          if (afterStep || definitions[decoded.result] != 1) {
+            safe = false;
+          }
+          aliases.push_back(decoded.result);
+        } else if (afterStep && std::any_of(decoded.operands.begin(),
+                                            decoded.operands.end(),
+                                            [&aliases](const std::string &op) {
+                                              return std::find(aliases.begin(),
+                                                               aliases.end(),
+                                                               op) !=
+                                                     aliases.end();
+                                            })) {
+          safe = false;
+        }
+      }
+    }
+
+    // The value has to be written back on every exit edge
+    const std::vector<std::vector<int>> &preds = nest.preds;
+    std::vector<std::string> exits;
+    for (int b : loop.blocks) {
+      for (int successor : cfg.successors(b)) {
+        if (loop.contains(successor)) {
+          continue;
+        }
+        for (int pred : preds[successor]) {
+          if (!loop.contains(pred)) {
+            safe = false;
+          }
+        }
+        if (std::find(exits.begin(), exits.end(),
+                      cfg.blocks[successor].label) == exits.end()) {
+          exits.push_back(cfg.blocks[successor].label);
+        }
+      }
+    }
+    if (!safe) {
+      continue;
+    }
+
+    std::shared_ptr<Instruction> load = header.instructions[h];
+    std::shared_ptr<Instruction> store = latch.instructions[storeIndex];
+    header.instructions.erase(header.instructions.begin() + h);
+    latch.instructions.erase(latch.instructions.begin() + storeIndex);
+
+    for (const auto &alias : aliases) {
+      cfg.replaceUses(alias, counter);
+      definitions.erase(alias);
+    }
+    for (int b : loop.blocks) {
+      auto &instructions = cfg.blocks[b].instructions;
+      instructions.erase(
+          std::remove_if(instructions.begin(), instructions.end(),
+                         [&](const auto &instr) {
+                           DecodedInstruction decoded = decodeInstruction(*instr);
+                           return decoded.operation == "load" &&
+                                  std::find(aliases.begin(), aliases.end(),
+                                            decoded.result) != aliases.end();
+                         }),
+          instructions.end());
+    }
+
+    for (const auto &exit : exits) {
+      auto &instructions = cfg.blocks[cfg.findBlock(exit)].instructions;
+      instructions.insert(instructions.begin(), store);
+    }
+
+    int preheader = ensurePreheader(cfg, nest, index);
+    appendBeforeTerminator(cfg.blocks[preheader], load);
+    return true;
+  }
+
+  return false;
+}
+
+} // namespace
+
+bool hoistLoopInvariants(ControlFlowGraph &cfg, AnalysisManager &analyses) {
+  cfg.makeFallthroughsExplicit();
+
+  LoopNest nest = findLoopNest(cfg, analyses);
+  bool changed = false;
+  for (size_t i = 0; i < nest.loops.size(); i++) {
+    changed |= hoistFromLoop(cfg, nest, i);
+  }
+
+  cfg.removeFallthroughBranches();
+  return changed;
+}
+
+bool optimizeInductionVariables(ControlFlowGraph &cfg,
+                                AnalysisManager &analyses) {
+  cfg.makeFallthroughsExplicit();
+
+  LoopNest nest = findLoopNest(cfg, analyses);
+  bool changed = false;
+  for (size_t i = 0; i < nest.loops.size(); i++) {
+    while (promoteInductionVariable(cfg, nest, i)) {
+      changed = true;
+    }
+  }
+
+  cfg.removeFallthroughBranches();
+  return changed;
+}
@@ -0,0 +1,127 @@
+#include "passes.h"
+#include "passmanager.h"
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+
+bool removeDeadLoop(ControlFlowGraph &cfg, AnalysisManager &analyses,
+                    const Loop &loop) {
+  std::optional<CountedLoop> counted = findCountedLoop(cfg, loop);
+  if (!counted) {
+    return false;
+  }
+
+  const std::unordered_map<std::string, std::string> &types = analyses.types();
+  auto typeOf = [&types](const std::string &value) {
+    if (!isTemporary(value)) {
+      return literalType(value);
+    }
+    auto it = types.find(value);
+    return it == types.end() ? std::string("int") : it->second;
+  };
+  // Only an integer counter is sure to reach the bound
+  if (typeOf(counted->counter) != "int" || typeOf(counted->bound) != "int") {
+    return false;
+  }
+
+  // Everything the loop writes, temporaries and slots
+  std::unordered_set<std::string> written;
+  // Only code that can run after the loop observes it
+  std::vector<bool> after(cfg.blocks.size(), false);
+  std::vector<int> worklist = {cfg.findBlock(counted->exit)};
+  while (!worklist.empty()) {
+    int b = worklist.back();
+    worklist.pop_back();
+    if (after[b]) {
+      continue;
+    }
+    after[b] = true;
+    for (int successor : cfg.successors(b)) {
+      worklist.push_back(successor);
+    }
+  }
+
+  std::unordered_set<std::string> loaded;
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    if (!after[b]) {
+      continue;
+    }
+    for (const auto &instr : cfg.blocks[b].instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      if (decoded.operation == "load") {
+        loaded.insert(decoded.operands[0]);
+      }
+    }
+  }
+  for (int b : loop.blocks) {
+    for (const auto &instr : cfg.blocks[b].instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      // Array writes are not tracked, and a failing check or negative
+      // length ends the program
+      if (decoded.operation == "call" || decoded.operation == "ret" ||
+          decoded.operation == "setelem" || decoded.operation == "check" ||
+          decoded.operation == "newarray") {
+        return false;
+      }
+      if (!decoded.result.empty()) {
+        written.insert(decoded.result);
+      }
+      if (decoded.operation == "store") {
+        written.insert(decoded.operands[1]);
+      }
+    }
+  }
+
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    if (!after[b] || loop.contains(static_cast<int>(b))) {
+      continue;
+    }
+    for (const auto &instr : cfg.blocks[b].instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      // Stores only read their value, and only if the slot is ever loaded
+      size_t reads = decoded.operands.size();
+      if (decoded.operation == "store") {
+        reads = loaded.count(decoded.operands[1]) ? 1 : 0;
+      }
+      for (size_t i = 0; i < reads; i++) {
+        if (written.count(decoded.operands[i])) {
+          return false;
+        }
+      }
+    }
+  }
+
+  // The header becomes a jump to the exit and the body is dropped
+  BasicBlock &header = cfg.blocks[counted->header];
+  header.instructions.clear();
+  header.instructions.push_back(
+      std::make_shared<Instruction>("br", "br label " + counted->exit));
+  cfg.blocks.erase(cfg.blocks.begin() + counted->body);
+  cfg.reindex();
+  return true;
+}
+
+} // namespace
+
+bool removeDeadLoops(ControlFlowGraph &cfg, AnalysisManager &analyses) {
+  cfg.makeFallthroughsExplicit();
+
+  bool changed = false;
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (const Loop &loop : analyses.loops()) {
+      if (removeDeadLoop(cfg, analyses, loop)) {
+        progress = changed = true;
+        break;
+      }
+    }
+    if (progress) {
+      analyses.invalidate();
+    }
+  }
+
+  cfg.removeFallthroughBranches();
+  return changed;
+}
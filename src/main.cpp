@@ -3,24 +3,317 @@
 #include <fstream>
 #include <regex>
 #include <optional>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
 
 #include "parser.h"
+#include "typecheck.h"
 #include "codegen.h"
+#include "cfg.h"
+#include "module.h"
+#include "passes.h"
+#include "passmanager.h"
+#include "x86backend.h"
+#include "cbackend.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "jit.h"
+#include "irfile.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
 
-int main() {
-    Parser parser("test.qk");
+struct Options {
+    std::string inputFile = "test.qk";
+    std::string outputFile;
+    std::string assemblyFile;
+    std::string irFile;
+    std::string cFile;
+    bool cBackend = false;
+    std::string passes = PassManager::kDefaultPipeline;
+    std::string profileGenerate;
+    std::string profileUse;
+    bool timePasses = false;
+    // Empty, "text" or "json"
+    std::string stats;
+    std::string traceFile;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bool run = false;
+    bool disassemble = false;
+    bool jit = false;
+};
+
+static const char* const kDefaultProfile = "quirk.profile";
+
+static void printUsage() {
+    std::cerr << "Usage: quirk [options] [file.qk]\n"
+              << "       quirk run [--jit] file.qk\n"
+              << "       quirk dis file.qir\n"
+              << "  -o <file>         build a native x86-64 executable\n"
+              << "  -S <file>         write x86-64 assembly\n"
+              << "  --emit-ir <file>  write the optimized IR in binary form\n"
+              << "  --emit-c <file>   write the program as portable C99\n"
+              << "  --backend=<name>  x86 (default) or c, what -o builds with\n"
+              << "  -j <n>            compile up to n functions in parallel\n"
+              << "  --passes=<list>   comma separated optimization pipeline, default "
+              << PassManager::kDefaultPipeline << "\n"
+              << "  --time-passes     report time, IR size and memory growth per pass\n"
+              << "  --stats[=json]    report time and counts per phase, peak memory and\n"
+              << "                    heap allocations of the compile, as text or JSON\n"
+              << "  --trace=<file>    write a Chrome trace of every phase, one track per thread\n"
+              << "  --jit             with run, execute native code compiled in process\n"
+              << "  --profile-generate[=<file>]\n"
+              << "                    with run, count branch edges into file, default "
+              << kDefaultProfile << "\n"
+              << "  --profile-use[=<file>]\n"
+              << "                    weight branches and lay out blocks from a profile\n"
+              << "Inputs ending in .qir are loaded as binary IR instead of being compiled.\n"
+              << "Without an output option the AST and the IR are printed." << std::endl;
+}
+
+static std::optional<Options> parseArguments(int argc, char** argv) {
+    Options options;
+
+    int first = 1;
+    if (argc > 1 && std::string(argv[1]) == "run") {
+        options.run = true;
+        first = 2;
+    } else if (argc > 1 && std::string(argv[1]) == "dis") {
+        options.disassemble = true;
+        first = 2;
+    }
+
+    for (int i = first; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if ((arg == "-o" || arg == "-S") && i + 1 < argc) {
+            (arg == "-o" ? options.outputFile : options.assemblyFile) = argv[++i];
+        } else if (arg == "--emit-ir" && i + 1 < argc) {
+            options.irFile = argv[++i];
+        } else if (arg == "--emit-c" && i + 1 < argc) {
+            options.cFile = argv[++i];
+        } else if (arg == "--backend=x86" || arg == "--backend=c") {
+            options.cBackend = arg == "--backend=c";
+        } else if (arg.rfind("--passes=", 0) == 0) {
+            options.passes = arg.substr(std::string("--passes=").size());
+        } else if (arg == "--time-passes") {
+            options.timePasses = true;
+        } else if (arg == "--stats" || arg == "--stats=text" || arg == "--stats=json") {
+            options.stats = arg == "--stats=json" ? "json" : "text";
+        } else if (arg.rfind("--trace=", 0) == 0 && arg.size() > 8) {
+            options.traceFile = arg.substr(std::string("--trace=").size());
+        } else if (arg == "-j" && i + 1 < argc) {
+            options.threads = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--jit" && options.run) {
+            options.jit = true;
+        } else if (arg == "--profile-generate" || arg == "--profile-use") {
+            (arg == "--profile-use" ? options.profileUse : options.profileGenerate) = kDefaultProfile;
+        } else if (arg.rfind("--profile-generate=", 0) == 0) {
+            options.profileGenerate = arg.substr(std::string("--profile-generate=").size());
+        } else if (arg.rfind("--profile-use=", 0) == 0) {
+            options.profileUse = arg.substr(std::string("--profile-use=").size());
+        } else if (!arg.empty() && arg[0] == '-') {
+            printUsage();
+            return std::nullopt;
+        } else {
+            options.inputFile = arg;
+        }
+    }
+
+    // Counters are collected in process, so only a run can produce them
+    if (!options.profileGenerate.empty() && !options.run) {
+        std::cerr << "Error: --profile-generate needs run" << std::endl;
+        return std::nullopt;
+    }
+
+    return options;
+}
+
+static bool hasExtension(const std::string& file, const std::string& extension) {
+    return file.size() >= extension.size() &&
+           file.compare(file.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// Parses, type checks and optimizes a source file, printing the AST and the IR on the way
+// unless quiet. A profile given with --profile-use is applied last. Functions go through codegen and the pass pipeline on up to
+// `options.threads` threads.
+static std::optional<Module> compileSource(const Options& options, bool quiet) {
+    PassManager passManager;
+    if (!passManager.setPipeline(options.passes)) {
+        return std::nullopt;
+    }
+    passManager.setTiming(options.timePasses);
+
+    EdgeProfile profile;
+    if (!options.profileUse.empty() && !profile.read(options.profileUse)) {
+        return std::nullopt;
+    }
+
+    // A trace shows the lexing time the stats sum up
+    std::unique_ptr<CompileStats> stats;
+    if (!options.stats.empty() || TraceSpan::enabled()) {
+        stats = std::make_unique<CompileStats>();
+        stats->input = options.inputFile;
+    }
+    if (!options.stats.empty()) {
+        countAllocations();
+    }
+
+    Parser parser(options.inputFile);
+    parser.setStats(stats.get());
 
     parser.Initalize();
- 
+
     ASTNode* root = parser.parse();
+    if (root == nullptr) {
+        return std::nullopt;
+    }
+    bool typed;
+    {
+        TraceSpan span("typecheck");
+        PhaseTimer timer(stats ? &stats->typecheckTime : nullptr);
+        typed = TypeChecker().check(root);
+    }
+    if (!typed) {
+        delete root;
+        return std::nullopt;
+    }
+
+    if (!quiet) {
+        printAST(root, 0);
+    }
 
-    printAST(root, 0);
-  
-    Codegen codegen;
-    codegen.ConvertAST(root);
-    codegen.printInstructions();
+    Module module = buildModule(root, options.threads, [&passManager](ControlFlowGraph& cfg) {
+        passManager.run(cfg);
+    }, stats.get());
+    if (!options.profileUse.empty()) {
+        applyProfile(module, profile);
+    }
+
+    if (!quiet) {
+        module.toIR()->print();
+    }
+    if (options.timePasses) {
+        passManager.printTimings(std::cerr);
+    }
 
     delete root;
 
-    return 0;
+    if (!options.stats.empty()) {
+        stats->peakMemoryKb = peakMemoryKb();
+        stats->allocations = allocationCount();
+        options.stats == "json" ? printStatsJson(*stats, std::cerr)
+                                : printStats(*stats, std::cerr);
+    }
+
+    return module;
+}
+
+int main(int argc, char** argv) {
+    std::optional<Options> options = parseArguments(argc, argv);
+    if (!options) {
+        return 1;
+    }
+    if (!options->traceFile.empty()) {
+        TraceSpan::enable(options->traceFile);
+    }
+    bool emitNative = !options->outputFile.empty() || !options->assemblyFile.empty() ||
+                      !options->cFile.empty();
+    bool quiet = emitNative || options->run || !options->irFile.empty();
+
+    std::optional<Module> module;
+    if (options->disassemble || hasExtension(options->inputFile, ".qir")) {
+        IrFile file;
+        bool opened;
+        {
+            TraceSpan span("read", options->inputFile);
+            opened = file.open(options->inputFile);
+        }
+        if (!opened) {
+            return 1;
+        }
+        if (options->disassemble) {
+            file.disassemble(std::cout);
+            return 0;
+        }
+        TraceSpan load("load");
+        module = Module::fromIR(file.toIR());
+        if (!verifyModule(*module)) {
+            return 1;
+        }
+        for (Function &function : module->functions) {
+            guardArrayAccesses(function.cfg);
+        }
+    } else {
+        module = compileSource(*options, quiet);
+        if (!module) {
+            return 1;
+        }
+    }
+
+    std::optional<EdgeProfile> profile;
+    if (!options->profileGenerate.empty()) {
+        profile = instrumentModule(*module);
+    }
+
+    int status = 0;
+    if (!options->irFile.empty()) {
+        TraceSpan span("emit-ir", options->irFile);
+        if (!writeIrFile(*module, options->irFile)) {
+            status = 1;
+        }
+    }
+
+    std::vector<uint64_t> counters;
+    if (options->run && options->jit) {
+        X86Jit jit(*module);
+        bool compiled;
+        {
+            TraceSpan span("jit");
+            compiled = jit.compile();
+        }
+        TraceSpan span("run");
+        status = compiled ? jit.run() : 1;
+        counters = jit.counters();
+    } else if (options->run) {
+        BytecodeProgram program;
+        {
+            TraceSpan span("bytecode");
+            program = BytecodeCompiler(*module).compile();
+        }
+        TraceSpan span("run");
+        VirtualMachine vm(program);
+        status = vm.run();
+        counters = vm.counters();
+    }
+    if (profile) {
+        counters.resize(profile->edges.size(), 0);
+        profile->counts = counters;
+        if (!profile->write(options->profileGenerate)) {
+            status = 1;
+        }
+    }
+
+    if (!options->assemblyFile.empty()) {
+        TraceSpan span("emit-asm", options->assemblyFile);
+        std::ofstream assembly(options->assemblyFile);
+        assembly << X86Backend(*module).emitAssembly();
+    }
+    if (!options->cFile.empty()) {
+        TraceSpan span("emit-c", options->cFile);
+        std::ofstream source(options->cFile);
+        source << CBackend(*module).emitSource();
+    }
+    if (!options->outputFile.empty()) {
+        TraceSpan span("build", options->outputFile);
+        bool built = options->cBackend ? CBackend(*module).buildExecutable(options->outputFile)
+                                       : X86Backend(*module).buildExecutable(options->outputFile);
+        if (!built) {
+            status = 1;
+        }
+    }
+
+    return status;
 }
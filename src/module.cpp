@@ -0,0 +1,443 @@
+#include "module.h"
+#include "codegen.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+std::string lowerCase(std::string string) {
+  std::transform(string.begin(), string.end(), string.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return string;
+}
+
+FunctionSignature signatureOf(ASTNode *function) {
+  FunctionSignature signature;
+  signature.returnType = lowerCase(function->getChildren()[0]->getValue());
+  for (ASTNode *parameter : function->getChildren()[1]->getChildren()) {
+    signature.parameterTypes.push_back(
+        lowerCase(parameter->getChildren()[0]->getValue()));
+  }
+  return signature;
+}
+
+// Runs body(0) .. body(count - 1) on up to `threads` threads.
+void parallelFor(size_t count, unsigned threads,
+                 const std::function<void(size_t)> &body) {
+  size_t workers = std::min<size_t>(std::max(threads, 1u), count);
+  if (workers <= 1) {
+    for (size_t i = 0; i < count; i++) {
+      body(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> pool;
+  for (size_t w = 0; w < workers; w++) {
+    pool.emplace_back([&]() {
+      for (size_t i = next++; i < count; i = next++) {
+        body(i);
+      }
+    });
+  }
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+}
+
+// Every string literal in the tree, in source order
+void internLiterals(ASTNode *node, ConstantPool &pool) {
+  if (node->getType() == "STRING_LITERAL") {
+    const std::string &text = node->getValue();
+    pool.intern(std::string_view(text).substr(1, text.size() - 2));
+  }
+  for (ASTNode *child : node->getChildren()) {
+    internLiterals(child, pool);
+  }
+}
+
+// Strings and arrays are held as pointers
+bool isPointerType(const std::string &type) {
+  return type == "string" ||
+         (type.size() > 2 && type.compare(type.size() - 2, 2, "[]") == 0);
+}
+
+// Whether every operand of `instr` has the type the backends read it as;
+// they take the IR's word for what a register holds.
+bool isWellTyped(const Module &module, const Function &function,
+                 const DecodedInstruction &instr,
+                 const std::unordered_set<std::string> &slots,
+                 const std::function<std::string(const std::string &)> &typeOf) {
+  const std::string &op = instr.operation;
+  const std::vector<std::string> &operands = instr.operands;
+  auto isScalar = [&typeOf](const std::string &operand) {
+    std::string type = typeOf(operand);
+    return type == "int" || type == "float" || type == "char" ||
+           type == "bool";
+  };
+  auto isArray = [&typeOf](const std::string &operand) {
+    std::string type = typeOf(operand);
+    return isPointerType(type) && type != "string";
+  };
+
+  if (op == "store") {
+    return slots.count(operands[1]) &&
+           typeOf(operands[0]) == typeOf(operands[1]);
+  } else if (op == "load") {
+    return slots.count(operands[0]) &&
+           (instr.type.empty() || instr.type == typeOf(operands[0]));
+  } else if (op == "cmp" || op == "neq" || op == "lt" || op == "gt" ||
+             op == "le" || op == "ge") {
+    // Strings compare by contents, only with strings
+    return (typeOf(operands[0]) == "string" &&
+            typeOf(operands[1]) == "string") ||
+           (isScalar(operands[0]) && isScalar(operands[1]));
+  } else if (op == "newarray") {
+    return !instr.type.empty() && isScalar(operands[0]);
+  } else if (op == "elem") {
+    return typeOf(operands[0]) == instr.type + "[]" && isScalar(operands[1]);
+  } else if (op == "setelem") {
+    return typeOf(operands[1]) == typeOf(operands[0]) + "[]" &&
+           isScalar(operands[2]);
+  } else if (op == "length") {
+    return isArray(operands[0]);
+  } else if (op == "check") {
+    return isScalar(operands[0]) && isArray(operands[1]);
+  } else if (op == "select") {
+    return isScalar(operands[0]) && typeOf(operands[1]) == typeOf(operands[2]);
+  } else if (op == "call" && instr.attribute == "out") {
+    return true;
+  } else if (op == "call") {
+    const Function *callee = module.findFunction(instr.attribute);
+    if (callee == nullptr || callee == &module.functions[0] ||
+        callee->signature.parameterTypes.size() != operands.size() ||
+        (!instr.result.empty() && instr.type != callee->signature.returnType)) {
+      return false;
+    }
+    for (size_t i = 0; i < operands.size(); i++) {
+      if (typeOf(operands[i]) != callee->signature.parameterTypes[i]) {
+        return false;
+      }
+    }
+    return true;
+  } else if (op == "ret") {
+    const std::string &type = function.signature.returnType;
+    return operands.empty()
+               ? !isPointerType(type)
+               : typeOf(operands[0]) == (type.empty() ? "int" : type);
+  }
+  // Arithmetic, branches, switches and the rest only read scalars
+  for (const auto &operand : operands) {
+    if (!isScalar(operand)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+std::string Module::stringConstant(const std::string &operand) const {
+  if (isPoolReference(operand)) {
+    uint32_t index = poolIndex(operand);
+    return index < constants.size() ? constants.at(index) : std::string();
+  }
+  return operand.size() >= 2 ? operand.substr(1, operand.size() - 2) : "";
+}
+
+const Function *Module::findFunction(const std::string &name) const {
+  for (const Function &function : functions) {
+    if (function.name == name) {
+      return &function;
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<Instruction> Module::toIR() const {
+  std::shared_ptr<Instruction> root = std::make_shared<Instruction>("root");
+
+  for (uint32_t i = 0; i < constants.size(); i++) {
+    root->addElement(std::make_shared<Instruction>(
+        "const", poolReference(i) + " = const \"" + constants.at(i) + "\""));
+  }
+  for (const Function &function : functions) {
+    std::shared_ptr<Instruction> body = function.cfg.toIR();
+    if (function.name == "main") {
+      root->children.insert(root->children.end(), body->children.begin(),
+                            body->children.end());
+      continue;
+    }
+
+    std::shared_ptr<Instruction> define =
+        std::make_shared<Instruction>("define", functionHeader(function));
+    define->children = body->children;
+    root->addElement(define);
+  }
+
+  return root;
+}
+
+Module Module::fromIR(const std::shared_ptr<Instruction> &root) {
+  Module module;
+  module.functions.push_back(Function{"main", {}, ControlFlowGraph(nullptr)});
+
+  std::shared_ptr<Instruction> mainBody = std::make_shared<Instruction>("root");
+  for (const auto &child : root->children) {
+    auto instr = std::dynamic_pointer_cast<Instruction>(child);
+    if (instr != nullptr && instr->operation == "const") {
+      // $i = const "bytes", entries in index order
+      const std::string &text = instr->instruction;
+      size_t open = text.find('"');
+      module.constants.intern(open == std::string::npos || text.size() < open + 2
+                                  ? std::string_view()
+                                  : std::string_view(text).substr(
+                                        open + 1, text.size() - open - 2));
+      continue;
+    }
+    if (instr == nullptr || instr->operation != "define") {
+      mainBody->addElement(child);
+      continue;
+    }
+
+    // define [type] @name(types)
+    Function function;
+    std::string text = instr->instruction;
+    size_t at = text.find('@');
+    size_t open = text.find('(', at);
+    size_t close = text.rfind(')');
+    if (at == std::string::npos || open == std::string::npos ||
+        close == std::string::npos || close < open) {
+      std::cerr << "Malformed function header '" << text << "'" << std::endl;
+      continue;
+    }
+    std::string head = text.substr(0, at);
+    head.erase(0, std::string("define").size());
+    head.erase(std::remove(head.begin(), head.end(), ' '), head.end());
+    function.signature.returnType = head;
+    function.name = text.substr(at + 1, open - at - 1);
+
+    std::string parameters = text.substr(open + 1, close - open - 1);
+    size_t start = 0;
+    while (start < parameters.size()) {
+      size_t comma = parameters.find(',', start);
+      if (comma == std::string::npos) {
+        comma = parameters.size();
+      }
+      std::string type = parameters.substr(start, comma - start);
+      type.erase(std::remove(type.begin(), type.end(), ' '), type.end());
+      if (!type.empty()) {
+        function.signature.parameterTypes.push_back(type);
+      }
+      start = comma + 1;
+    }
+
+    std::shared_ptr<Instruction> body = std::make_shared<Instruction>("root");
+    body->children = instr->children;
+    function.cfg = ControlFlowGraph(body);
+    module.functions.push_back(std::move(function));
+  }
+  module.functions[0].cfg = ControlFlowGraph(mainBody);
+
+  return module;
+}
+
+bool verifyModule(const Module &module) {
+  for (const Function &function : module.functions) {
+    const ControlFlowGraph &cfg = function.cfg;
+    std::unordered_map<std::string, std::string> types =
+        inferTemporaryTypes(cfg);
+    auto typeOf = [&](const std::string &operand) {
+      if (isTemporary(operand)) {
+        auto it = types.find(operand);
+        return it == types.end() ? std::string() : it->second;
+      }
+      if (isPoolReference(operand) &&
+          poolIndex(operand) >= module.constants.size()) {
+        return std::string();
+      }
+      return literalType(operand);
+    };
+
+    // Temporaries are numbered for the sets of them written on every path
+    // into a block; a slot counts once something is stored in it. Only
+    // strings and arrays must be written before they are read, an int read
+    // early is just a wrong number.
+    std::unordered_map<std::string, size_t> numbers;
+    std::unordered_set<std::string> slots;
+    std::unordered_set<std::string> labels;
+    for (const auto &block : cfg.blocks) {
+      labels.insert(block.label);
+      for (const auto &instr : block.instructions) {
+        DecodedInstruction decoded = decodeInstruction(*instr);
+        if (decoded.operation == "alloc") {
+          slots.insert(decoded.result);
+        }
+        if (!decoded.result.empty()) {
+          numbers.emplace(decoded.result, numbers.size());
+        }
+      }
+    }
+    auto writes = [](const DecodedInstruction &decoded) {
+      return decoded.operation == "store" ? decoded.operands[1]
+             : decoded.operation == "alloc" ? std::string()
+                                            : decoded.result;
+    };
+
+    std::vector<int> order = cfg.reversePostOrder();
+    std::vector<std::vector<int>> preds = cfg.predecessors();
+    std::vector<bool> reached(cfg.blocks.size(), false);
+    std::vector<std::vector<bool>> written(
+        cfg.blocks.size(), std::vector<bool>(numbers.size(), true));
+    auto entryState = [&](int block) {
+      std::vector<bool> state(numbers.size(), block != 0);
+      for (int pred : preds[block]) {
+        if (reached[pred]) {
+          for (size_t t = 0; t < state.size(); t++) {
+            state[t] = state[t] && written[pred][t];
+          }
+        }
+      }
+      return state;
+    };
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (int block : order) {
+        std::vector<bool> state = entryState(block);
+        for (const auto &instr : cfg.blocks[block].instructions) {
+          std::string defined = writes(decodeInstruction(*instr));
+          if (numbers.count(defined)) {
+            state[numbers[defined]] = true;
+          }
+        }
+        if (!reached[block] || state != written[block]) {
+          reached[block] = true;
+          written[block] = std::move(state);
+          changed = true;
+        }
+      }
+    }
+
+    size_t parameters = 0;
+    for (int block : order) {
+      std::vector<bool> state = entryState(block);
+      for (const auto &instr : cfg.blocks[block].instructions) {
+        DecodedInstruction decoded = decodeInstruction(*instr);
+        bool valid = resultType(decoded, typeOf) == typeOf(decoded.result) ||
+                     decoded.result.empty();
+        for (size_t i = 0; i < decoded.operands.size(); i++) {
+          const std::string &operand = decoded.operands[i];
+          bool destination = decoded.operation == "store" && i == 1;
+          std::string type = typeOf(operand);
+          valid = valid && !type.empty() &&
+                  (!isTemporary(operand) || destination ||
+                   !isPointerType(type) || state[numbers.at(operand)]);
+        }
+        for (const auto &target : decoded.targets) {
+          valid = valid && labels.count(target);
+        }
+        if (decoded.operation == "param") {
+          valid = valid &&
+                  parameters < function.signature.parameterTypes.size() &&
+                  decoded.type ==
+                      function.signature.parameterTypes[parameters++];
+        }
+        if (!valid || !isWellTyped(module, function, decoded, slots, typeOf)) {
+          std::cerr << "Invalid IR in @" << function.name << ": '"
+                    << instr->instruction << "'" << std::endl;
+          return false;
+        }
+        std::string defined = writes(decoded);
+        if (numbers.count(defined)) {
+          state[numbers[defined]] = true;
+        }
+      }
+      // A string or array is returned on every way out of the function
+      std::shared_ptr<Instruction> last = cfg.blocks[block].terminator();
+      if (isPointerType(function.signature.returnType) &&
+          cfg.successors(block).empty() &&
+          (last == nullptr || last->operation != "ret")) {
+        std::cerr << "Invalid IR in @" << function.name
+                  << ": falls off its end without returning a "
+                  << function.signature.returnType << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+std::string functionHeader(const Function &function) {
+  std::string text = "define ";
+  if (!function.signature.returnType.empty()) {
+    text += function.signature.returnType + " ";
+  }
+  text += "@" + function.name + "(";
+  for (size_t i = 0; i < function.signature.parameterTypes.size(); i++) {
+    text += (i == 0 ? "" : ", ") + function.signature.parameterTypes[i];
+  }
+  return text + ")";
+}
+
+Module buildModule(ASTNode *program, unsigned threads,
+                   const std::function<void(ControlFlowGraph &)> &optimize,
+                   CompileStats *stats) {
+  std::vector<ASTNode *> definitions;
+  for (ASTNode *child : program->getChildren()) {
+    if (child->getType() == "FUNCTION") {
+      definitions.push_back(child);
+    }
+  }
+
+  // Signatures are collected up front so every body can be lowered on its
+  // own, calls only need the callee's return type.
+  std::unordered_map<std::string, FunctionSignature> signatures;
+  Module module;
+  internLiterals(program, module.constants);
+  module.functions.resize(definitions.size() + 1);
+  module.functions[0].name = "main";
+  for (size_t i = 0; i < definitions.size(); i++) {
+    Function &function = module.functions[i + 1];
+    function.name = definitions[i]->getValue();
+    function.signature = signatureOf(definitions[i]);
+    signatures[function.name] = function.signature;
+  }
+
+  parallelFor(module.functions.size(), threads, [&](size_t i) {
+    Codegen codegen;
+    codegen.setFunctions(&signatures);
+    codegen.setConstants(&module.constants);
+    codegen.setStats(stats);
+    {
+      TraceSpan span("codegen", module.functions[i].name);
+      if (i == 0) {
+        codegen.ConvertAST(program);
+      } else {
+        codegen.ConvertFunction(definitions[i - 1]);
+      }
+    }
+
+    ControlFlowGraph cfg(codegen.rootIR);
+    TraceSpan span("optimize", module.functions[i].name);
+    if (stats == nullptr) {
+      optimize(cfg);
+    } else {
+      stats->irInstructions += cfg.instructionCount();
+      {
+        PhaseTimer timer(&stats->optimizeTime);
+        optimize(cfg);
+      }
+      stats->optimizedInstructions += cfg.instructionCount();
+    }
+    module.functions[i].cfg = std::move(cfg);
+  });
+
+  return module;
+}
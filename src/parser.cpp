@@ -1,5 +1,6 @@
 #include "parser.h"
 #include "lexer.h"
+#include "trace.h"
 #include <algorithm>
 
 Parser::Parser(const std::string &filename)
@@ -12,7 +13,44 @@ void Parser::Initalize() {
   scope_stack_.push_back(root);
 }
 
+void Parser::setStats(CompileStats *stats) {
+  stats_ = stats;
+  lexer_.setStats(stats);
+}
+
+namespace {
+
+uint64_t countNodes(const ASTNode *node) {
+  uint64_t count = 1;
+  for (const ASTNode *child : node->getChildren()) {
+    count += countNodes(child);
+  }
+  return count;
+}
+
+} // namespace
+
 ASTNode *Parser::parse() {
+  // Blocks parse recursively, only the outermost call is measured
+  if (stats_ != nullptr && !parsing_) {
+    parsing_ = true;
+    ASTNode *program;
+    int64_t start;
+    {
+      TraceSpan span("parse");
+      start = TraceSpan::now();
+      PhaseTimer timer(&stats_->parseTime);
+      program = parse();
+    }
+    parsing_ = false;
+    stats_->astNodes = program == nullptr ? 0 : countNodes(program);
+    // Tokens are lexed one at a time as the parser asks for them, so the
+    // trace shows their summed time from the start of parsing
+    TraceSpan::record("lex", start, stats_->lexTime,
+                      std::to_string(stats_->tokens) + " tokens");
+    return program;
+  }
+
   std::pair<TokenType, std::string> token;
 
   do {
@@ -20,65 +58,17 @@ ASTNode *Parser::parse() {
 
     switch (token.first) {
     case TokenType::KEYWORD:
-      if (token.second == "if") {
-        ASTNode *if_node = new ASTNode("STATEMENT", "if");
-
-        Condition condition = parseCondition();
-
-        if (condition.error) {
-          ASTNode *error_node = new ASTNode("ERROR", "error");
-          root->add_child(error_node);
-          return nullptr;
-        } else {
-          ASTNode *condition_node = new ASTNode("CONDITION", "");
-          ASTNode *left_condition_node = new ASTNode(
-              tokenTypeToString(condition.left.first), condition.left.second);
-          ASTNode *operator_condition_node = new ASTNode(
-              tokenTypeToString(condition.op.first), condition.op.second);
-          ASTNode *right_condition_node = new ASTNode(
-              tokenTypeToString(condition.right.first), condition.right.second);
-
-          condition_node->add_child(left_condition_node);
-          condition_node->add_child(operator_condition_node);
-          condition_node->add_child(right_condition_node);
-          if_node->add_child(condition_node);
-
-          ASTNode *codeBlock_node = new ASTNode("CODE_BLOCK", "");
-          if_node->add_child(codeBlock_node);
-          current_parent_->add_child(if_node);
-          switchParentNode(codeBlock_node);
-        }
-      } else if (token.second == "else if") {
-        ASTNode *elseif_node = new ASTNode("STATEMENT", "else if");
-
-        Condition condition = parseCondition();
-
-        if (condition.error) {
-          ASTNode *error_node = new ASTNode("ERROR", "error");
-          root->add_child(error_node);
+      if (token.second == "if" || token.second == "else if") {
+        if (!parseConditionalStatement(token.second)) {
           return nullptr;
-        } else {
-          ASTNode *condition_node = new ASTNode("CONDITION", "");
-          ASTNode *left_condition_node = new ASTNode(
-              tokenTypeToString(condition.left.first), condition.left.second);
-          ASTNode *operator_condition_node = new ASTNode(
-              tokenTypeToString(condition.op.first), condition.op.second);
-          ASTNode *right_condition_node = new ASTNode(
-              tokenTypeToString(condition.right.first), condition.right.second);
-          ASTNode *codeBlock_node = new ASTNode("CODE_BLOCK", "");
-
-          condition_node->add_child(left_condition_node);
-          condition_node->add_child(operator_condition_node);
-          condition_node->add_child(right_condition_node);
-          elseif_node->add_child(condition_node);
-          elseif_node->add_child(codeBlock_node);
-
-          current_parent_->add_child(elseif_node);
-          switchParentNode(codeBlock_node);
         }
       } else if (token.second == "else") {
         token = lexer_.getNextToken();
-        if (token.first == TokenType::CURLY_PAREN && token.second == "{") {
+        if (token.first == TokenType::KEYWORD && token.second == "if") {
+          if (!parseConditionalStatement("else if")) {
+            return nullptr;
+          }
+        } else if (token.first == TokenType::CURLY_PAREN && token.second == "{") {
           ASTNode *else_node = new ASTNode("STATEMENT", "else");
           ASTNode *codeBlock_node = new ASTNode("CODE_BLOCK", "");
 
@@ -88,24 +78,8 @@ ASTNode *Parser::parse() {
           parse();
         }
       } else if (token.second == "while") {
-        ASTNode *while_node = new ASTNode("STATEMENT", "while");
-
-        Condition condition = parseCondition();
-
-        if (condition.error) {
-          ASTNode *error_node = new ASTNode("ERROR", "error");
-          root->add_child(error_node);
+        if (!parseConditionalStatement("while")) {
           return nullptr;
-        } else {
-          ASTNode *condition_node = new ASTNode("CONDITION", "");
-          ASTNode *codeBlock_node = new ASTNode("CODE_BLOCK", "");
-
-          while_node->add_child(condition_node);
-          while_node->add_child(codeBlock_node);
-
-          current_parent_->add_child(while_node);
-          switchParentNode(codeBlock_node);
-          parse();
         }
       } else if (token.second == "for") {
         ASTNode *for_node = new ASTNode("STATEMENT", "for");
@@ -122,13 +96,14 @@ ASTNode *Parser::parse() {
           ASTNode *int_node = new ASTNode("INT", condition.cInt.second);
           ASTNode *i1_node = new ASTNode("IDENTIFIER", condition.i.second);
           ASTNode *assignment_node = new ASTNode("ASSIGNMENT", "");
-          ASTNode *nl_node = new ASTNode(tokenTypeToString(condition.nl.first),
-                                         condition.nl.second);
+          ASTNode *nl_node = tokenNode(condition.nl);
           ASTNode *i2_node = new ASTNode("IDENTIFIER", condition.i2.second);
           ASTNode *ro_node =
               new ASTNode("RELATIONAL_OPERATOR", condition.ro.second);
-          ASTNode *len_node = new ASTNode(
-              tokenTypeToString(condition.len.first), condition.len.second);
+          ASTNode *len_node =
+              condition.array.second.empty()
+                  ? tokenNode(condition.len)
+                  : new ASTNode("ARRAY_LENGTH", condition.array.second);
           ASTNode *i3_node = new ASTNode("IDENTIFIER", condition.i3.second);
           ASTNode *uao_node =
               new ASTNode("UNARY_ARITHMETIC_OPERATOR", condition.uao.second);
@@ -157,35 +132,37 @@ ASTNode *Parser::parse() {
 
         token = lexer_.getNextToken();
 
-        if (token.first == TokenType::ROUND_PAREN) {
-          std::tuple<bool, std::string, std::string> tokenInfo =
-              isNextTokenLiteralOrIdentifier();
-
-          bool isLiteralOrIdentifier = std::get<0>(tokenInfo);
-          std::string tokenType = std::get<1>(tokenInfo);
-          std::string tokenValue = std::get<2>(tokenInfo);
-
-          if (isLiteralOrIdentifier) {
-            ASTNode *literal_node = new ASTNode(tokenType, tokenValue);
-            functionCall_node->add_child(literal_node);
-            out_node->add_child(functionCall_node);
-
-            token = lexer_.getNextToken();
-            if (token.first == TokenType::ROUND_PAREN) {
-              current_parent_->add_child(out_node);
-              parse();
-            } else {
-              std::cerr << "Syntax error: Unexpected token '" << token.second
-                        << "' Line: " << lexer_.getCurrentLineNumber()
-                        << std::endl;
-              return nullptr;
-            }
+        if (token.first == TokenType::ROUND_PAREN && token.second == "(") {
+          ASTNode *argument_node = parseExpression();
+          if (argument_node == nullptr) {
+            return nullptr;
+          }
+          functionCall_node->add_child(argument_node);
+          out_node->add_child(functionCall_node);
+
+          token = lexer_.getNextToken();
+          if (token.first == TokenType::ROUND_PAREN && token.second == ")") {
+            current_parent_->add_child(out_node);
+            parse();
+          } else {
+            std::cerr << "Syntax error: Unexpected token '" << token.second
+                      << "' Line: " << lexer_.getCurrentLineNumber()
+                      << std::endl;
+            return nullptr;
           }
         } else {
           std::cerr << "Syntax error: Unexpected token '" << token.second
                     << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
           return nullptr;
         }
+      } else if (token.second == "function") {
+        if (!parseFunction()) {
+          return nullptr;
+        }
+      } else if (token.second == "return") {
+        if (!parseReturn()) {
+          return nullptr;
+        }
       } else {
         std::cerr << "Syntax error: Unexpected token '" << token.second
                   << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
@@ -193,11 +170,26 @@ ASTNode *Parser::parse() {
       }
       break;
     case TokenType::IDENTIFIER:
+      if (functionArity_.count(token.second)) {
+        ASTNode *call_node = parseCall(token.second);
+        if (call_node == nullptr) {
+          return nullptr;
+        }
+        ASTNode *statement_node = new ASTNode("STATEMENT", "call");
+        statement_node->add_child(call_node);
+        current_parent_->add_child(statement_node);
+      } else if (!parseStep(token.second)) {
+        return nullptr;
+      }
       break;
     case TokenType::CURLY_PAREN:
       if (token.second == "{") {
         parse();
       } else if (token.second == "}") {
+        if (current_parent_ == currentFunctionBody_) {
+          uniqueNameList_ = outerNameList_;
+          currentFunctionBody_ = nullptr;
+        }
         popParentNode();
         parse();
       }
@@ -314,6 +306,15 @@ Condition Parser::parseCondition() {
         left = token;
         parsingPart1 = false;
       }
+    } else if (token.first == TokenType::MATH_OPERATOR) {
+      std::cerr << "Syntax error: Conditions compare variables or literals, "
+                   "compute '"
+                << token.second << "' into a variable first! Line: "
+                << lexer_.getCurrentLineNumber() << std::endl;
+      return {{TokenType::UNKNOWN, ""},
+              {TokenType::UNKNOWN, ""},
+              {TokenType::UNKNOWN, ""},
+              true};
     } else if (!parsingPart1 && token.first == TokenType::RELATIONAL_OPERATOR) {
       op = token; // Capture the operator
     } else if (!parsingPart1 && (token.first == TokenType::IDENTIFIER ||
@@ -372,6 +373,10 @@ ForLoopCondition Parser::parseForLoopCondition() {
     return condition;
   }
   condition.i = token;
+  if (std::find(uniqueNameList_.begin(), uniqueNameList_.end(),
+                token.second) == uniqueNameList_.end()) {
+    uniqueNameList_.push_back(token.second);
+  }
 
   token = lexer_.getNextToken();
   if (token.first != TokenType::ASSIGNMENT) {
@@ -440,6 +445,15 @@ ForLoopCondition Parser::parseForLoopCondition() {
     return condition;
   }
   condition.len = token;
+  if (token.first == TokenType::IDENTIFIER && token.second == "len" &&
+      !functionArity_.count("len") && lexer_.peekToken().second == "(") {
+    ASTNode *length_node = parseLength();
+    if (length_node == nullptr) {
+      condition.error = true;
+      return condition;
+    }
+    condition.array = {TokenType::IDENTIFIER, length_node->getValue()};
+  }
 
   token = lexer_.getNextToken();
   if (token.first != TokenType::PUNCTUATION) {
@@ -487,7 +501,11 @@ bool Parser::parseVarAssignment(TokenType varLiteralType, std::string varType) {
   ASTNode *identifier_node = new ASTNode("IDENTIFIER", "");
   ASTNode *type_node = new ASTNode("VAR_TYPE", varType);
   ASTNode *assignment_node = new ASTNode("ASSIGNMENT", "");
-  ASTNode *literal_node = new ASTNode(tokenTypeToString(varLiteralType), "");
+
+  token = lexer_.peekToken();
+  if (token.first == TokenType::SQUARE_PAREN && token.second == "[") {
+    return parseArrayDeclaration(varType);
+  }
 
   token = lexer_.getNextToken();
   if (token.first != TokenType::IDENTIFIER) {
@@ -496,10 +514,7 @@ bool Parser::parseVarAssignment(TokenType varLiteralType, std::string varType) {
     return false;
   } else {
     if (std::find(uniqueNameList_.begin(), uniqueNameList_.end(),
-                  token.second) == uniqueNameList_.end()) {
-      uniqueNameList_.push_back(token.second);
-      identifier_node->set_value(token.second);
-    } else {
+                  token.second) != uniqueNameList_.end()) {
       std::cerr << "Syntax error: Variable already exists! Line: "
                 << lexer_.getCurrentLineNumber() << std::endl;
       return false;
@@ -514,16 +529,23 @@ bool Parser::parseVarAssignment(TokenType varLiteralType, std::string varType) {
     return false;
   }
 
-  token = lexer_.getNextToken();
-  if (token.first != varLiteralType) {
-    std::cerr << "Syntax error: Unexpected token '" << token.second
+  // A literal initializer must match the declared type, anything else is
+  // checked when the expression is lowered
+  std::pair<TokenType, std::string> first = lexer_.peekToken();
+  ASTNode *initializer_node = parseExpression();
+  if (initializer_node == nullptr) {
+    return false;
+  }
+  bool literal = initializer_node->getType().find("_LITERAL") != std::string::npos;
+  if (literal && initializer_node->getType() != tokenTypeToString(varLiteralType)) {
+    std::cerr << "Syntax error: Unexpected token '" << first.second
               << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
     return false;
-  } else {
-    literal_node->set_value(token.second);
   }
+  // Declared only now, the initializer cannot read the new variable
+  uniqueNameList_.push_back(identifier_node->getValue());
 
-  assignment_node->add_child(literal_node);
+  assignment_node->add_child(initializer_node);
   varDeclaration_node->add_child(type_node);
   varDeclaration_node->add_child(identifier_node);
   varDeclaration_node->add_child(assignment_node);
@@ -533,18 +555,527 @@ bool Parser::parseVarAssignment(TokenType varLiteralType, std::string varType) {
   return true;
 }
 
-std::tuple<bool, std::string, std::string>
-Parser::isNextTokenLiteralOrIdentifier() {
+// type[] name = [a, b, ...] or = another array, type[size] name zero-filled
+bool Parser::parseArrayDeclaration(const std::string &varType) {
+  std::pair<TokenType, std::string> token = lexer_.getNextToken();
+  ASTNode *size_node = nullptr;
+  if (lexer_.peekToken().second != "]") {
+    size_node = parseExpression();
+    if (size_node == nullptr) {
+      return false;
+    }
+  }
+  token = lexer_.getNextToken();
+  if (token.first != TokenType::SQUARE_PAREN || token.second != "]") {
+    std::cerr << "Syntax error: Expected ']' in array type, got '"
+              << token.second << "' Line: " << lexer_.getCurrentLineNumber()
+              << std::endl;
+    return false;
+  }
+
+  token = lexer_.getNextToken();
+  if (token.first != TokenType::IDENTIFIER) {
+    std::cerr << "Syntax error: Unexpected token '" << token.second
+              << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+  if (std::find(uniqueNameList_.begin(), uniqueNameList_.end(),
+                token.second) != uniqueNameList_.end()) {
+    std::cerr << "Syntax error: Variable already exists! Line: "
+              << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+  std::string name = token.second;
+
+  ASTNode *initializer_node = nullptr;
+  if (size_node != nullptr) {
+    initializer_node = new ASTNode("NEW_ARRAY", varType);
+    initializer_node->add_child(size_node);
+  } else {
+    token = lexer_.getNextToken();
+    if (token.first != TokenType::ASSIGNMENT) {
+      std::cerr << "Syntax error: Expected '=' or a size for array " << name
+                << "! Line: " << lexer_.getCurrentLineNumber() << std::endl;
+      return false;
+    }
+    token = lexer_.peekToken();
+    initializer_node = token.first == TokenType::SQUARE_PAREN && token.second == "["
+                           ? parseArrayLiteral()
+                           : parseExpression();
+    if (initializer_node == nullptr) {
+      return false;
+    }
+  }
+  uniqueNameList_.push_back(name);
+
+  ASTNode *varDeclaration_node = new ASTNode("VAR_DECLARATION", "");
+  ASTNode *assignment_node = new ASTNode("ASSIGNMENT", "");
+  assignment_node->add_child(initializer_node);
+  varDeclaration_node->add_child(new ASTNode("VAR_TYPE", varType + "[]"));
+  varDeclaration_node->add_child(new ASTNode("IDENTIFIER", name));
+  varDeclaration_node->add_child(assignment_node);
+  current_parent_->add_child(varDeclaration_node);
+  return true;
+}
+
+// [a, b, ...] with an expression for every element
+ASTNode *Parser::parseArrayLiteral() {
+  lexer_.getNextToken();
+  ASTNode *literal_node = new ASTNode("ARRAY_LITERAL", "");
+
+  std::pair<TokenType, std::string> token = lexer_.peekToken();
+  if (token.first == TokenType::SQUARE_PAREN && token.second == "]") {
+    lexer_.getNextToken();
+  }
+  while (!(token.first == TokenType::SQUARE_PAREN && token.second == "]")) {
+    ASTNode *element_node = parseExpression();
+    if (element_node == nullptr) {
+      return nullptr;
+    }
+    literal_node->add_child(element_node);
+
+    token = lexer_.getNextToken();
+    if (token.first != TokenType::COMMA &&
+        !(token.first == TokenType::SQUARE_PAREN && token.second == "]")) {
+      std::cerr << "Syntax error: Expected ',' or ']' in array literal! Line: "
+                << lexer_.getCurrentLineNumber() << std::endl;
+      return nullptr;
+    }
+  }
+  return literal_node;
+}
+
+ASTNode *Parser::parseIndex(const std::string &name) {
+  lexer_.getNextToken();
+  ASTNode *index_node = parseExpression();
+  if (index_node == nullptr) {
+    return nullptr;
+  }
   std::pair<TokenType, std::string> token = lexer_.getNextToken();
-  TokenType tokenType = token.first;
-  bool isLiteralOrIdentifier = (tokenType == TokenType::STRING_LITERAL ||
-                                tokenType == TokenType::NUMERIC_LITERAL ||
-                                tokenType == TokenType::CHAR_LITERAL ||
-                                tokenType == TokenType::BOOL_LITERAL ||
-                                tokenType == TokenType::IDENTIFIER);
-
-  return std::make_tuple(isLiteralOrIdentifier, tokenTypeToString(tokenType),
-                         token.second);
+  if (token.first != TokenType::SQUARE_PAREN || token.second != "]") {
+    std::cerr << "Syntax error: Expected ']' after index of " << name
+              << ", got '" << token.second
+              << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
+    return nullptr;
+  }
+  ASTNode *access_node = new ASTNode("ARRAY_ACCESS", name);
+  access_node->add_child(index_node);
+  return access_node;
+}
+
+ASTNode *Parser::parseLength() {
+  std::pair<TokenType, std::string> open = lexer_.getNextToken();
+  std::pair<TokenType, std::string> array = lexer_.getNextToken();
+  std::pair<TokenType, std::string> close = lexer_.getNextToken();
+  if (open.second != "(" || array.first != TokenType::IDENTIFIER ||
+      close.second != ")") {
+    std::cerr << "Syntax error: Expected len(array)! Line: "
+              << lexer_.getCurrentLineNumber() << std::endl;
+    return nullptr;
+  }
+  if (std::find(uniqueNameList_.begin(), uniqueNameList_.end(),
+                array.second) == uniqueNameList_.end()) {
+    std::cerr << "Variable " << array.second
+              << " does not exists! Line: " << lexer_.getCurrentLineNumber()
+              << std::endl;
+    return nullptr;
+  }
+  return new ASTNode("ARRAY_LENGTH", array.second);
+}
+
+// Parses the condition of an if, else if or while and opens its code block.
+bool Parser::parseConditionalStatement(const std::string &statement) {
+  Condition condition = parseCondition();
+
+  if (condition.error) {
+    ASTNode *error_node = new ASTNode("ERROR", "error");
+    root->add_child(error_node);
+    return false;
+  }
+
+  ASTNode *statement_node = new ASTNode("STATEMENT", statement);
+  ASTNode *condition_node = new ASTNode("CONDITION", "");
+  ASTNode *left_condition_node = tokenNode(condition.left);
+  ASTNode *operator_condition_node = new ASTNode(
+      tokenTypeToString(condition.op.first), condition.op.second);
+  ASTNode *right_condition_node = tokenNode(condition.right);
+  ASTNode *codeBlock_node = new ASTNode("CODE_BLOCK", "");
+
+  condition_node->add_child(left_condition_node);
+  condition_node->add_child(operator_condition_node);
+  condition_node->add_child(right_condition_node);
+  statement_node->add_child(condition_node);
+  statement_node->add_child(codeBlock_node);
+
+  current_parent_->add_child(statement_node);
+  switchParentNode(codeBlock_node);
+  return true;
+}
+
+// name++, name-- or name = expression on a declared variable, or
+// name[index] = expression on an array element
+bool Parser::parseStep(const std::string &name) {
+  if (std::find(uniqueNameList_.begin(), uniqueNameList_.end(), name) ==
+      uniqueNameList_.end()) {
+    std::cerr << "Syntax error: Unknown variable '" << name
+              << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+
+  ASTNode *target_node = new ASTNode("IDENTIFIER", name);
+  std::pair<TokenType, std::string> token = lexer_.peekToken();
+  if (token.first == TokenType::SQUARE_PAREN && token.second == "[") {
+    target_node = parseIndex(name);
+    if (target_node == nullptr) {
+      return false;
+    }
+  }
+
+  token = lexer_.getNextToken();
+  if (target_node->getType() == "ARRAY_ACCESS" &&
+      token.first != TokenType::ASSIGNMENT) {
+    std::cerr << "Syntax error: Expected '=' after " << name
+              << "[...], got '" << token.second
+              << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+  if (token.first == TokenType::ASSIGNMENT) {
+    ASTNode *value_node = parseExpression();
+    if (value_node == nullptr) {
+      return false;
+    }
+    ASTNode *assign_node = new ASTNode("STATEMENT", "assign");
+    assign_node->add_child(target_node);
+    assign_node->add_child(value_node);
+    current_parent_->add_child(assign_node);
+    return true;
+  }
+  if (token.first != TokenType::UNARY_ARITHMETIC_OPERATOR) {
+    std::cerr << "Syntax error: Unexpected token '" << token.second
+              << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+
+  ASTNode *step_node = new ASTNode("STATEMENT", "step");
+  step_node->add_child(new ASTNode("IDENTIFIER", name));
+  step_node->add_child(new ASTNode("UNARY_ARITHMETIC_OPERATOR", token.second));
+  current_parent_->add_child(step_node);
+  return true;
+}
+
+// function [type] name(type a, type b) { ... }
+bool Parser::parseFunction() {
+  std::pair<TokenType, std::string> token = lexer_.getNextToken();
+
+  if (current_parent_ != root) {
+    std::cerr << "Syntax error: Functions can only be defined at the top "
+                 "level! Line: "
+              << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+
+  std::string returnType;
+  if (token.first == TokenType::INT || token.first == TokenType::FLOAT ||
+      token.first == TokenType::STRING || token.first == TokenType::CHAR ||
+      token.first == TokenType::BOOL) {
+    returnType = tokenTypeToString(token.first);
+    token = lexer_.getNextToken();
+  }
+
+  if (token.first != TokenType::IDENTIFIER || token.second == "main") {
+    std::cerr << "Syntax error: Expected function name, got '" << token.second
+              << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+  std::string name = token.second;
+  if (functionArity_.count(name)) {
+    std::cerr << "Syntax error: Function " << name
+              << " already exists! Line: " << lexer_.getCurrentLineNumber()
+              << std::endl;
+    return false;
+  }
+
+  token = lexer_.getNextToken();
+  if (token.first != TokenType::ROUND_PAREN || token.second != "(") {
+    std::cerr << "Syntax error: Expected '(' after function name! Line: "
+              << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+
+  ASTNode *parameters_node = new ASTNode("PARAMETERS", "");
+  std::vector<std::string> parameterNames;
+
+  token = lexer_.getNextToken();
+  while (!(token.first == TokenType::ROUND_PAREN && token.second == ")")) {
+    if (token.first != TokenType::INT && token.first != TokenType::FLOAT &&
+        token.first != TokenType::STRING && token.first != TokenType::CHAR &&
+        token.first != TokenType::BOOL) {
+      std::cerr << "Syntax error: Expected parameter type, got '"
+                << token.second << "' Line: " << lexer_.getCurrentLineNumber()
+                << std::endl;
+      return false;
+    }
+    ASTNode *type_node = new ASTNode("VAR_TYPE", tokenTypeToString(token.first));
+
+    token = lexer_.getNextToken();
+    if (token.first != TokenType::IDENTIFIER ||
+        std::find(parameterNames.begin(), parameterNames.end(),
+                  token.second) != parameterNames.end()) {
+      std::cerr << "Syntax error: Expected parameter name, got '"
+                << token.second << "' Line: " << lexer_.getCurrentLineNumber()
+                << std::endl;
+      return false;
+    }
+    ASTNode *parameter_node = new ASTNode("PARAMETER", token.second);
+    parameter_node->add_child(type_node);
+    parameters_node->add_child(parameter_node);
+    parameterNames.push_back(token.second);
+
+    token = lexer_.getNextToken();
+    if (token.first == TokenType::COMMA) {
+      token = lexer_.getNextToken();
+    } else if (!(token.first == TokenType::ROUND_PAREN && token.second == ")")) {
+      std::cerr << "Syntax error: Expected ',' or ')' in parameter list! Line: "
+                << lexer_.getCurrentLineNumber() << std::endl;
+      return false;
+    }
+  }
+
+  // Every argument travels in a register
+  if (parameterNames.size() > 6) {
+    std::cerr << "Syntax error: Function " << name
+              << " has more than 6 parameters! Line: "
+              << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+
+  ASTNode *function_node = new ASTNode("FUNCTION", name);
+  ASTNode *codeBlock_node = new ASTNode("CODE_BLOCK", "");
+  function_node->add_child(new ASTNode("VAR_TYPE", returnType));
+  function_node->add_child(parameters_node);
+  function_node->add_child(codeBlock_node);
+  current_parent_->add_child(function_node);
+
+  // Registered before the body so the function can call itself
+  functionArity_[name] = parameterNames.size();
+  outerNameList_ = uniqueNameList_;
+  uniqueNameList_ = parameterNames;
+  currentFunctionBody_ = codeBlock_node;
+  switchParentNode(codeBlock_node);
+  return true;
+}
+
+// name(arg, ...) with an expression for every argument
+ASTNode *Parser::parseCall(const std::string &name) {
+  std::pair<TokenType, std::string> token = lexer_.getNextToken();
+  if (token.first != TokenType::ROUND_PAREN || token.second != "(") {
+    std::cerr << "Syntax error: Expected '(' after " << name
+              << "! Line: " << lexer_.getCurrentLineNumber() << std::endl;
+    return nullptr;
+  }
+
+  ASTNode *call_node = new ASTNode("FUNCTIONCALL", name);
+
+  token = lexer_.peekToken();
+  if (token.first == TokenType::ROUND_PAREN && token.second == ")") {
+    lexer_.getNextToken();
+  }
+  while (!(token.first == TokenType::ROUND_PAREN && token.second == ")")) {
+    ASTNode *argument_node = parseExpression();
+    if (argument_node == nullptr) {
+      return nullptr;
+    }
+    call_node->add_child(argument_node);
+
+    token = lexer_.getNextToken();
+    if (token.first != TokenType::COMMA &&
+        !(token.first == TokenType::ROUND_PAREN && token.second == ")")) {
+      std::cerr << "Syntax error: Expected ',' or ')' in call to " << name
+                << "! Line: " << lexer_.getCurrentLineNumber() << std::endl;
+      return nullptr;
+    }
+  }
+
+  if (call_node->getChildren().size() != functionArity_[name]) {
+    std::cerr << "Syntax error: " << name << " expects "
+              << functionArity_[name] << " arguments! Line: "
+              << lexer_.getCurrentLineNumber() << std::endl;
+    return nullptr;
+  }
+
+  return call_node;
+}
+
+// return; or return expression;
+bool Parser::parseReturn() {
+  if (currentFunctionBody_ == nullptr) {
+    std::cerr << "Syntax error: 'return' outside of a function! Line: "
+              << lexer_.getCurrentLineNumber() << std::endl;
+    return false;
+  }
+
+  ASTNode *return_node = new ASTNode("STATEMENT", "return");
+  if (lexer_.peekToken().first != TokenType::PUNCTUATION) {
+    ASTNode *value_node = parseExpression();
+    if (value_node == nullptr) {
+      return false;
+    }
+    return_node->add_child(value_node);
+  }
+
+  current_parent_->add_child(return_node);
+  return true;
+}
+
+// expression := term (('+' | '-') term)*
+ASTNode *Parser::parseExpression() {
+  ASTNode *left = parseTerm();
+  while (left != nullptr) {
+    std::pair<TokenType, std::string> token = lexer_.peekToken();
+    if (token.first != TokenType::MATH_OPERATOR ||
+        (token.second != "+" && token.second != "-")) {
+      break;
+    }
+    lexer_.getNextToken();
+    ASTNode *right = parseTerm();
+    if (right == nullptr) {
+      return nullptr;
+    }
+    ASTNode *operation = new ASTNode("MATH_OPERATOR", token.second);
+    operation->add_child(left);
+    operation->add_child(right);
+    left = operation;
+  }
+  return left;
+}
+
+// term := factor (('*' | '/' | '%') factor)*
+ASTNode *Parser::parseTerm() {
+  ASTNode *left = parseFactor();
+  while (left != nullptr) {
+    std::pair<TokenType, std::string> token = lexer_.peekToken();
+    if (token.first != TokenType::MATH_OPERATOR ||
+        (token.second != "*" && token.second != "/" && token.second != "%")) {
+      break;
+    }
+    lexer_.getNextToken();
+    ASTNode *right = parseFactor();
+    if (right == nullptr) {
+      return nullptr;
+    }
+    ASTNode *operation = new ASTNode("MATH_OPERATOR", token.second);
+    operation->add_child(left);
+    operation->add_child(right);
+    left = operation;
+  }
+  return left;
+}
+
+// factor := '-' factor | operand ('^' factor)?
+// ^ binds tighter than negation and to the right, -2 ^ 2 is -4 and
+// 2 ^ 3 ^ 2 is 2 ^ 9. A negated number becomes a negative literal.
+ASTNode *Parser::parseFactor() {
+  std::pair<TokenType, std::string> token = lexer_.peekToken();
+  if (token.first == TokenType::MATH_OPERATOR && token.second == "-") {
+    lexer_.getNextToken();
+    ASTNode *operand = parseFactor();
+    if (operand == nullptr) {
+      return nullptr;
+    }
+    if (operand->getType() == "NUMERIC_LITERAL" &&
+        operand->getValue()[0] != '-') {
+      NumericConstant constant = operand->getConstant();
+      if (constant.kind == NumericConstant::Float) {
+        constant.f = -constant.f;
+      } else {
+        constant.i = -constant.i;
+      }
+      operand->set_value("-" + operand->getValue());
+      operand->setConstant(constant);
+      return operand;
+    }
+    ASTNode *negation = new ASTNode("MATH_OPERATOR", "-");
+    negation->add_child(operand);
+    return negation;
+  }
+
+  ASTNode *base = parseOperand();
+  token = lexer_.peekToken();
+  if (base == nullptr || token.first != TokenType::MATH_OPERATOR ||
+      token.second != "^") {
+    return base;
+  }
+  lexer_.getNextToken();
+  ASTNode *exponent = parseFactor();
+  if (exponent == nullptr) {
+    return nullptr;
+  }
+  ASTNode *power = new ASTNode("MATH_OPERATOR", "^");
+  power->add_child(base);
+  power->add_child(exponent);
+  return power;
+}
+
+// A literal, a variable, an array element, len(array), a call or a
+// parenthesized expression
+ASTNode *Parser::parseOperand() {
+  std::pair<TokenType, std::string> token = lexer_.getNextToken();
+
+  if (token.first == TokenType::ROUND_PAREN && token.second == "(") {
+    ASTNode *inner = parseExpression();
+    if (inner == nullptr) {
+      return nullptr;
+    }
+    token = lexer_.getNextToken();
+    if (token.first != TokenType::ROUND_PAREN || token.second != ")") {
+      std::cerr << "Syntax error: Expected ')' in expression, got '"
+                << token.second << "' Line: " << lexer_.getCurrentLineNumber()
+                << std::endl;
+      return nullptr;
+    }
+    return inner;
+  }
+
+  if (token.first == TokenType::IDENTIFIER) {
+    if (functionArity_.count(token.second)) {
+      return parseCall(token.second);
+    }
+    std::pair<TokenType, std::string> next = lexer_.peekToken();
+    if (token.second == "len" && next.first == TokenType::ROUND_PAREN &&
+        next.second == "(") {
+      return parseLength();
+    }
+    if (std::find(uniqueNameList_.begin(), uniqueNameList_.end(),
+                  token.second) == uniqueNameList_.end()) {
+      std::cerr << "Variable " << token.second
+                << " does not exists! Line: " << lexer_.getCurrentLineNumber()
+                << std::endl;
+      return nullptr;
+    }
+    if (next.first == TokenType::SQUARE_PAREN && next.second == "[") {
+      return parseIndex(token.second);
+    }
+    return new ASTNode("IDENTIFIER", token.second);
+  }
+
+  if (token.first == TokenType::STRING_LITERAL ||
+      token.first == TokenType::NUMERIC_LITERAL ||
+      token.first == TokenType::CHAR_LITERAL ||
+      token.first == TokenType::BOOL_LITERAL) {
+    return tokenNode(token);
+  }
+
+  std::cerr << "Syntax error: Unexpected token '" << token.second
+            << "' Line: " << lexer_.getCurrentLineNumber() << std::endl;
+  return nullptr;
+}
+
+ASTNode *Parser::tokenNode(const std::pair<TokenType, std::string> &token) {
+  ASTNode *node = new ASTNode(tokenTypeToString(token.first), token.second);
+  if (token.first == TokenType::NUMERIC_LITERAL) {
+    node->setConstant(lexer_.numericConstant(token.second));
+  }
+  return node;
 }
 
 std::string Parser::tokenTypeToString(TokenType tokenType) {
@@ -625,8 +1156,11 @@ void printAST(ASTNode *node, int depth) {
     std::cout << "  ";
   }
 
-  std::cout << "Type: " << node->getType() << ", Value: " << node->getValue()
-            << std::endl;
+  std::cout << "Type: " << node->getType() << ", Value: " << node->getValue();
+  if (!node->getValueType().empty()) {
+    std::cout << ", ValueType: " << node->getValueType();
+  }
+  std::cout << std::endl;
 
   const std::vector<ASTNode *> &children = node->getChildren();
   for (ASTNode *child : children) {
@@ -0,0 +1,235 @@
+#include "passmanager.h"
+#include "passes.h"
+#include "stats.h"
+#include "trace.h"
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+
+const std::vector<int> &AnalysisManager::dominators() {
+  if (dominators_) {
+    reused++;
+  } else {
+    dominators_ = cfg_.immediateDominators();
+    computed++;
+  }
+  return *dominators_;
+}
+
+const std::vector<Loop> &AnalysisManager::loops() {
+  if (loops_) {
+    reused++;
+  } else {
+    loops_ = cfg_.findLoops();
+    computed++;
+  }
+  return *loops_;
+}
+
+const std::unordered_map<std::string, std::string> &AnalysisManager::types() {
+  if (types_) {
+    reused++;
+  } else {
+    types_ = inferTemporaryTypes(cfg_);
+    computed++;
+  }
+  return *types_;
+}
+
+void AnalysisManager::invalidate() {
+  dominators_.reset();
+  loops_.reset();
+  types_.reset();
+}
+
+const std::vector<PassInfo> &registeredPasses() {
+  static const std::vector<PassInfo> passes = {
+      {"dce", "remove dead code and fold trivial blocks", eliminateDeadCode,
+       false},
+      {"gvn", "reuse loads and comparisons that are already available",
+       numberValues, false},
+      {"bounds", "remove array bounds checks that cannot fail",
+       eliminateBoundsChecks, false},
+      {"switch", "lower if/else if chains on one value to tables or searches",
+       lowerSwitches, false},
+      {"ifconvert", "turn small if/else value choices into selects",
+       convertIfsToSelects, false},
+      {"licm", "hoist loop invariant loads and computations",
+       hoistLoopInvariants, true},
+      {"iv", "keep for loop counters in registers", optimizeInductionVariables,
+       true},
+      {"deadloop", "delete counted loops without visible effects",
+       removeDeadLoops, true},
+      {"unroll", "unroll counted loops with constant trip counts", unrollLoops,
+       true},
+      {"strength", "turn multiplies and divides by constants into shifts",
+       reduceStrength, false},
+  };
+  return passes;
+}
+
+const PassInfo *findPass(const std::string &name) {
+  for (const PassInfo &pass : registeredPasses()) {
+    if (name == pass.name) {
+      return &pass;
+    }
+  }
+  return nullptr;
+}
+
+const char *const PassManager::kDefaultPipeline = "dce,gvn,bounds,switch,ifconvert,licm,iv,dce,deadloop,unroll,strength,dce";
+
+bool PassManager::setPipeline(const std::string &pipeline) {
+  std::vector<const PassInfo *> passes;
+
+  size_t start = 0;
+  while (start < pipeline.size()) {
+    size_t comma = pipeline.find(',', start);
+    if (comma == std::string::npos) {
+      comma = pipeline.size();
+    }
+    std::string name = pipeline.substr(start, comma - start);
+    start = comma + 1;
+    if (name.empty()) {
+      continue;
+    }
+
+    const PassInfo *pass = findPass(name);
+    if (pass == nullptr) {
+      std::cerr << "Unknown pass '" << name << "'. Available passes:\n";
+      for (const PassInfo &known : registeredPasses()) {
+        std::cerr << "  " << std::left << std::setw(10) << known.name
+                  << known.description << "\n";
+      }
+      std::cerr.flush();
+      return false;
+    }
+    passes.push_back(pass);
+  }
+
+  pipeline_ = passes;
+  statistics_.clear();
+  for (const PassInfo *pass : pipeline_) {
+    bool seen = false;
+    for (const auto &entry : statistics_) {
+      seen |= entry.name == pass->name;
+    }
+    if (!seen) {
+      statistics_.push_back(PassStatistics());
+      statistics_.back().name = pass->name;
+    }
+  }
+  return true;
+}
+
+bool PassManager::run(ControlFlowGraph &cfg) {
+  AnalysisManager analyses(cfg);
+  std::vector<PassStatistics> local;
+  size_t before = timing_ ? cfg.instructionCount() : 0;
+
+  bool changed = false;
+  for (const PassInfo *pass : pipeline_) {
+    PassStatistics stats;
+    stats.name = pass->name;
+
+    if (pass->needsLoops && analyses.loops().empty()) {
+      stats.skipped = 1;
+      local.push_back(stats);
+      continue;
+    }
+
+    long peakBefore = 0;
+    if (timing_) {
+      stats.instructionsBefore = cfg.instructionCount();
+      peakBefore = peakMemoryKb();
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool passChanged;
+    {
+      TraceSpan span(pass->name);
+      passChanged = pass->run(cfg, analyses);
+    }
+    stats.time = std::chrono::steady_clock::now() - start;
+    if (timing_) {
+      stats.instructionsAfter = cfg.instructionCount();
+      stats.peakMemoryGrowthKb = peakMemoryKb() - peakBefore;
+    }
+
+    stats.runs = 1;
+    stats.changed = passChanged ? 1 : 0;
+    if (passChanged) {
+      analyses.invalidate();
+      changed = true;
+    }
+    local.push_back(stats);
+  }
+
+  size_t after = timing_ ? cfg.instructionCount() : 0;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  instructionsBefore_ += before;
+  instructionsAfter_ += after;
+  for (const PassStatistics &stats : local) {
+    for (PassStatistics &total : statistics_) {
+      if (total.name != stats.name) {
+        continue;
+      }
+      total.runs += stats.runs;
+      total.skipped += stats.skipped;
+      total.changed += stats.changed;
+      total.time += stats.time;
+      total.instructionsBefore += stats.instructionsBefore;
+      total.instructionsAfter += stats.instructionsAfter;
+      total.peakMemoryGrowthKb += stats.peakMemoryGrowthKb;
+    }
+  }
+  analysesComputed_ += analyses.computed;
+  analysesReused_ += analyses.reused;
+  return changed;
+}
+
+void PassManager::printTimings(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::chrono::nanoseconds total{0};
+  for (const PassStatistics &stats : statistics_) {
+    total += stats.time;
+  }
+
+  out << "===== Pass execution timing report =====\n"
+      << std::left << std::setw(10) << "pass" << std::right << std::setw(6)
+      << "runs" << std::setw(9) << "skipped" << std::setw(9) << "changed"
+      << std::setw(12) << "time (ms)" << std::setw(8) << "%"
+      << std::setw(12) << "IR before" << std::setw(11) << "IR after"
+      << std::setw(17) << "RSS growth (KB)" << "\n";
+
+  auto row = [&out, total](const PassStatistics &stats) {
+    double ms = stats.time.count() / 1e6;
+    double share = total.count() > 0 ? 100.0 * stats.time.count() / total.count()
+                                     : 0.0;
+    out << std::left << std::setw(10) << stats.name << std::right
+        << std::setw(6) << stats.runs << std::setw(9) << stats.skipped
+        << std::setw(9) << stats.changed << std::setw(12) << std::fixed
+        << std::setprecision(3) << ms << std::setw(8) << std::setprecision(1)
+        << share << std::setw(12) << stats.instructionsBefore << std::setw(11)
+        << stats.instructionsAfter << std::setw(17) << stats.peakMemoryGrowthKb
+        << "\n";
+  };
+
+  PassStatistics sum;
+  sum.name = "total";
+  sum.instructionsBefore = instructionsBefore_;
+  sum.instructionsAfter = instructionsAfter_;
+  for (const PassStatistics &stats : statistics_) {
+    row(stats);
+    sum.runs += stats.runs;
+    sum.skipped += stats.skipped;
+    sum.changed += stats.changed;
+    sum.time += stats.time;
+    sum.peakMemoryGrowthKb += stats.peakMemoryGrowthKb;
+  }
+  row(sum);
+  out << "analyses: " << analysesComputed_ << " computed, " << analysesReused_
+      << " reused from cache\n";
+  out << std::defaultfloat;
+}
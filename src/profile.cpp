@@ -0,0 +1,223 @@
+#include "profile.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+std::string blockName(const BasicBlock &block) {
+  return block.label.empty() ? "-" : block.label;
+}
+
+std::string edgeKey(const std::string &function, const std::string &block,
+                    const std::string &target) {
+  return function + ' ' + block + ' ' + target;
+}
+
+bool isConditional(const DecodedInstruction &branch) {
+  return branch.operation == "br" && branch.operands.size() == 1 &&
+         branch.targets.size() == 2;
+}
+
+void instrumentFunction(Function &function, EdgeProfile &profile) {
+  ControlFlowGraph &cfg = function.cfg;
+  cfg.makeFallthroughsExplicit();
+
+  int nextLabel = 0;
+  auto freshLabel = [&cfg, &nextLabel]() {
+    std::string label;
+    do {
+      label = "%edge" + std::to_string(nextLabel++);
+    } while (cfg.findBlock(label) >= 0);
+    return label;
+  };
+
+  std::vector<BasicBlock> blocks;
+  for (auto &block : cfg.blocks) {
+    blocks.push_back(block);
+    std::shared_ptr<Instruction> terminator = block.terminator();
+    if (terminator == nullptr) {
+      continue;
+    }
+    DecodedInstruction branch = decodeInstruction(*terminator);
+    if (!isConditional(branch)) {
+      continue;
+    }
+
+    size_t owner = blocks.size() - 1;
+    for (auto &target : branch.targets) {
+      BasicBlock edge;
+      edge.label = freshLabel();
+      edge.instructions.push_back(std::make_shared<Instruction>(
+          "count", "count " + std::to_string(profile.edges.size())));
+      edge.instructions.push_back(
+          std::make_shared<Instruction>("br", "br label " + target));
+      profile.edges.push_back({function.name, blockName(block), target});
+      profile.counts.push_back(0);
+      target = edge.label;
+      blocks.push_back(edge);
+    }
+    blocks[owner].instructions.back() = encodeInstruction(branch);
+  }
+
+  cfg.blocks = std::move(blocks);
+  cfg.reindex();
+  cfg.removeFallthroughBranches();
+}
+
+// Greedy chaining: after each block comes its most frequent successor that
+// is not placed yet, otherwise the first unplaced block in the old order.
+// A last block that falls off the end of the function stays last.
+void layoutFunction(ControlFlowGraph &cfg) {
+  size_t count = cfg.blocks.size();
+  int pinned = cfg.blocks.back().terminator() == nullptr
+                   ? static_cast<int>(count) - 1
+                   : -1;
+  std::vector<bool> placed(count, false);
+  if (pinned >= 0) {
+    placed[pinned] = true;
+  }
+
+  auto successor = [&](int block) {
+    std::shared_ptr<Instruction> terminator = cfg.blocks[block].terminator();
+    if (terminator == nullptr) {
+      return -1;
+    }
+    DecodedInstruction branch = decodeInstruction(*terminator);
+    std::vector<std::string> targets = branch.targets;
+    if (isConditional(branch) && !branch.attribute.empty()) {
+      std::istringstream weights(branch.attribute);
+      uint64_t taken = 0, notTaken = 0;
+      weights >> taken >> notTaken;
+      if (notTaken > taken) {
+        std::swap(targets[0], targets[1]);
+      }
+    }
+    for (const auto &target : targets) {
+      int index = cfg.findBlock(target);
+      if (index >= 0 && !placed[index]) {
+        return index;
+      }
+    }
+    return -1;
+  };
+
+  std::vector<int> order;
+  int current = 0;
+  while (current >= 0) {
+    placed[current] = true;
+    order.push_back(current);
+    current = successor(current);
+    if (current < 0) {
+      auto unplaced = std::find(placed.begin(), placed.end(), false);
+      current = unplaced == placed.end()
+                    ? -1
+                    : static_cast<int>(unplaced - placed.begin());
+    }
+  }
+  if (pinned >= 0) {
+    order.push_back(pinned);
+  }
+
+  std::vector<BasicBlock> blocks;
+  for (int index : order) {
+    blocks.push_back(std::move(cfg.blocks[index]));
+  }
+  cfg.blocks = std::move(blocks);
+  cfg.reindex();
+}
+
+} // namespace
+
+bool EdgeProfile::write(const std::string &path) const {
+  std::ofstream out(path);
+  if (!out.is_open()) {
+    std::cerr << "Error: Could not write profile " << path << std::endl;
+    return false;
+  }
+  for (size_t i = 0; i < edges.size(); i++) {
+    out << edges[i].function << ' ' << edges[i].block << ' ' << edges[i].target
+        << ' ' << (i < counts.size() ? counts[i] : 0) << '\n';
+  }
+  return true;
+}
+
+bool EdgeProfile::read(const std::string &path) {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    std::cerr << "Error: Could not open profile " << path << std::endl;
+    return false;
+  }
+
+  edges.clear();
+  counts.clear();
+  std::string line;
+  size_t number = 0;
+  while (std::getline(in, line)) {
+    number++;
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream fields(line);
+    ProfileEdge edge;
+    uint64_t count = 0;
+    if (!(fields >> edge.function >> edge.block >> edge.target >> count)) {
+      std::cerr << "Error: " << path << ":" << number
+                << ": expected 'function block target count'" << std::endl;
+      return false;
+    }
+    edges.push_back(edge);
+    counts.push_back(count);
+  }
+  return true;
+}
+
+EdgeProfile instrumentModule(Module &module) {
+  EdgeProfile profile;
+  for (auto &function : module.functions) {
+    instrumentFunction(function, profile);
+  }
+  return profile;
+}
+
+void applyProfile(Module &module, const EdgeProfile &profile) {
+  std::unordered_map<std::string, uint64_t> counts;
+  for (size_t i = 0; i < profile.edges.size(); i++) {
+    const ProfileEdge &edge = profile.edges[i];
+    counts[edgeKey(edge.function, edge.block, edge.target)] += profile.counts[i];
+  }
+
+  for (auto &function : module.functions) {
+    ControlFlowGraph &cfg = function.cfg;
+    cfg.makeFallthroughsExplicit();
+
+    bool profiled = false;
+    for (auto &block : cfg.blocks) {
+      std::shared_ptr<Instruction> terminator = block.terminator();
+      if (terminator == nullptr) {
+        continue;
+      }
+      DecodedInstruction branch = decodeInstruction(*terminator);
+      if (!isConditional(branch)) {
+        continue;
+      }
+      auto taken = counts.find(
+          edgeKey(function.name, blockName(block), branch.targets[0]));
+      auto notTaken = counts.find(
+          edgeKey(function.name, blockName(block), branch.targets[1]));
+      if (taken == counts.end() || notTaken == counts.end()) {
+        continue;
+      }
+      branch.attribute =
+          std::to_string(taken->second) + " " + std::to_string(notTaken->second);
+      block.instructions.back() = encodeInstruction(branch);
+      profiled = profiled || taken->second + notTaken->second > 0;
+    }
+
+    if (profiled) {
+      layoutFunction(cfg);
+    }
+    cfg.removeFallthroughBranches();
+  }
+}
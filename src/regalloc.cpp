@@ -0,0 +1,280 @@
+#include "regalloc.h"
+#include <algorithm>
+#include <iostream>
+#include <unordered_set>
+
+RegisterFile RegisterFile::x86_64() {
+  return {{"rbx", "r12", "r13", "r14", "r15", "rcx", "rdx", "r8", "r9", "r10"},
+          {"rcx", "rdx", "r8", "r9", "r10"}};
+}
+
+RegisterFile RegisterFile::numbered(int count) {
+  RegisterFile file;
+  for (int i = 0; i < count; i++) {
+    file.registers.push_back("r" + std::to_string(i));
+  }
+  return file;
+}
+
+bool RegisterAllocation::isSpilled(const std::string &temporary) const {
+  return spillSlots.count(temporary) > 0;
+}
+
+void RegisterAllocation::print() const {
+  std::vector<std::string> temporaries;
+  for (const auto &entry : registers) {
+    temporaries.push_back(entry.first);
+  }
+  for (const auto &entry : spillSlots) {
+    temporaries.push_back(entry.first);
+  }
+  std::sort(temporaries.begin(), temporaries.end());
+
+  for (const auto &temporary : temporaries) {
+    if (isSpilled(temporary)) {
+      std::cout << temporary << " -> [spill " << spillSlots.at(temporary) << "]"
+                << std::endl;
+    } else {
+      std::cout << temporary << " -> " << registers.at(temporary) << std::endl;
+    }
+  }
+  std::cout << "spill slots: " << spillSlotCount
+            << ", coalesced moves: " << coalescedMoves << std::endl;
+}
+
+RegisterAllocator::RegisterAllocator(RegisterFile registerFile)
+    : registerFile_(std::move(registerFile)) {}
+
+std::vector<LiveInterval>
+RegisterAllocator::buildIntervals(const ControlFlowGraph &cfg) const {
+  using TemporarySet = std::unordered_set<std::string>;
+
+  std::vector<std::vector<DecodedInstruction>> decoded(cfg.blocks.size());
+  std::vector<int> blockFrom(cfg.blocks.size());
+  std::vector<int> callPositions;
+  TemporarySet slots;
+  int position = 0;
+
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    blockFrom[b] = position;
+    for (const auto &instr : cfg.blocks[b].instructions) {
+      decoded[b].push_back(decodeInstruction(*instr));
+      if (decoded[b].back().operation == "alloc") {
+        slots.insert(decoded[b].back().result);
+      } else if (decoded[b].back().operation == "call") {
+        callPositions.push_back(position);
+      }
+      position++;
+    }
+  }
+
+  auto isValue = [&slots](const std::string &operand) {
+    return isTemporary(operand) && !slots.count(operand);
+  };
+
+  // Block level liveness of value temporaries
+  std::vector<TemporarySet> uses(cfg.blocks.size());
+  std::vector<TemporarySet> defs(cfg.blocks.size());
+  std::vector<std::vector<int>> successors(cfg.blocks.size());
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    successors[b] = cfg.successors(static_cast<int>(b));
+    for (const auto &instr : decoded[b]) {
+      for (const auto &operand : instr.operands) {
+        if (isValue(operand) && !defs[b].count(operand)) {
+          uses[b].insert(operand);
+        }
+      }
+      if (isValue(instr.result)) {
+        defs[b].insert(instr.result);
+      }
+    }
+  }
+
+  std::vector<TemporarySet> liveIn(cfg.blocks.size());
+  std::vector<TemporarySet> liveOut(cfg.blocks.size());
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = cfg.blocks.size(); b-- > 0;) {
+      TemporarySet out;
+      for (int successor : successors[b]) {
+        out.insert(liveIn[successor].begin(), liveIn[successor].end());
+      }
+      TemporarySet in = uses[b];
+      for (const auto &temporary : out) {
+        if (!defs[b].count(temporary)) {
+          in.insert(temporary);
+        }
+      }
+      if (in.size() != liveIn[b].size() || out.size() != liveOut[b].size()) {
+        liveIn[b] = std::move(in);
+        liveOut[b] = std::move(out);
+        changed = true;
+      }
+    }
+  }
+
+  // Intervals are the hull of every range a temporary is live in
+  std::unordered_map<std::string, LiveInterval> intervals;
+  auto addRange = [&intervals](const std::string &temporary, int from, int to) {
+    auto it = intervals.find(temporary);
+    if (it == intervals.end()) {
+      intervals[temporary] = {temporary, from, to, false, ""};
+    } else {
+      it->second.start = std::min(it->second.start, from);
+      it->second.end = std::max(it->second.end, to);
+    }
+  };
+
+  for (size_t b = 0; b < cfg.blocks.size(); b++) {
+    int blockTo = blockFrom[b] + static_cast<int>(decoded[b].size());
+    std::unordered_map<std::string, int> rangeEnd;
+    for (const auto &temporary : liveOut[b]) {
+      rangeEnd[temporary] = blockTo;
+    }
+
+    for (size_t i = decoded[b].size(); i-- > 0;) {
+      const DecodedInstruction &instr = decoded[b][i];
+      int at = blockFrom[b] + static_cast<int>(i);
+
+      if (isValue(instr.result)) {
+        auto live = rangeEnd.find(instr.result);
+        if (live != rangeEnd.end()) {
+          addRange(instr.result, at, live->second);
+          rangeEnd.erase(live);
+        } else {
+          addRange(instr.result, at, at);
+        }
+        if (!instr.operands.empty() && isValue(instr.operands[0]) &&
+            intervals[instr.result].hint.empty()) {
+          intervals[instr.result].hint = instr.operands[0];
+        }
+      }
+
+      for (const auto &operand : instr.operands) {
+        if (isValue(operand) && !rangeEnd.count(operand)) {
+          rangeEnd[operand] = at;
+        }
+      }
+    }
+
+    for (const auto &live : rangeEnd) {
+      addRange(live.first, blockFrom[b], live.second);
+    }
+  }
+
+  std::vector<LiveInterval> result;
+  for (auto &entry : intervals) {
+    LiveInterval &interval = entry.second;
+    auto call = std::upper_bound(callPositions.begin(), callPositions.end(),
+                                 interval.start);
+    interval.crossesCall = call != callPositions.end() && *call < interval.end;
+    result.push_back(interval);
+  }
+
+  std::sort(result.begin(), result.end(),
+            [](const LiveInterval &a, const LiveInterval &b) {
+              return a.start != b.start ? a.start < b.start
+                                        : a.temporary < b.temporary;
+            });
+  return result;
+}
+
+RegisterAllocation RegisterAllocator::allocate(const ControlFlowGraph &cfg) const {
+  RegisterAllocation allocation;
+  std::vector<LiveInterval> intervals = buildIntervals(cfg);
+
+  std::unordered_set<std::string> callerSaved(registerFile_.callerSaved.begin(),
+                                              registerFile_.callerSaved.end());
+  std::vector<std::string> freeRegisters = registerFile_.registers;
+  std::vector<const LiveInterval *> active; // sorted by increasing end
+  std::vector<int> spillSlotFreeAt;
+
+  auto isAllowed = [&callerSaved](const LiveInterval &interval,
+                                  const std::string &reg) {
+    return !interval.crossesCall || !callerSaved.count(reg);
+  };
+
+  auto addActive = [&active](const LiveInterval *interval) {
+    auto position = std::upper_bound(
+        active.begin(), active.end(), interval,
+        [](const LiveInterval *a, const LiveInterval *b) { return a->end < b->end; });
+    active.insert(position, interval);
+  };
+
+  auto spill = [&](const LiveInterval &interval) {
+    int slot = -1;
+    for (size_t i = 0; i < spillSlotFreeAt.size(); i++) {
+      if (spillSlotFreeAt[i] < interval.start) {
+        slot = static_cast<int>(i);
+        break;
+      }
+    }
+    if (slot < 0) {
+      slot = static_cast<int>(spillSlotFreeAt.size());
+      spillSlotFreeAt.push_back(0);
+    }
+    spillSlotFreeAt[slot] = interval.end;
+    allocation.spillSlots[interval.temporary] = slot;
+  };
+
+  for (const auto &interval : intervals) {
+    // Expire intervals that ended; one ending where this one starts is the
+    // operand of the defining instruction and can hand over its register
+    while (!active.empty() && active.front()->end <= interval.start) {
+      freeRegisters.push_back(allocation.registers[active.front()->temporary]);
+      active.erase(active.begin());
+    }
+
+    std::string chosen;
+    auto hinted = allocation.registers.find(interval.hint);
+    if (hinted != allocation.registers.end() && isAllowed(interval, hinted->second)) {
+      auto freeHint = std::find(freeRegisters.begin(), freeRegisters.end(),
+                                hinted->second);
+      if (freeHint != freeRegisters.end()) {
+        chosen = *freeHint;
+        freeRegisters.erase(freeHint);
+        allocation.coalescedMoves++;
+      }
+    }
+
+    if (chosen.empty()) {
+      // Keep the configured preference order among the free registers
+      for (const auto &reg : registerFile_.registers) {
+        auto free = std::find(freeRegisters.begin(), freeRegisters.end(), reg);
+        if (free != freeRegisters.end() && isAllowed(interval, reg)) {
+          chosen = reg;
+          freeRegisters.erase(free);
+          break;
+        }
+      }
+    }
+
+    if (chosen.empty()) {
+      // Spill whichever compatible interval lives longest
+      const LiveInterval *victim = nullptr;
+      for (auto it = active.rbegin(); it != active.rend(); ++it) {
+        if (isAllowed(interval, allocation.registers[(*it)->temporary])) {
+          victim = *it;
+          break;
+        }
+      }
+
+      if (victim != nullptr && victim->end > interval.end) {
+        chosen = allocation.registers[victim->temporary];
+        allocation.registers.erase(victim->temporary);
+        spill(*victim);
+        active.erase(std::find(active.begin(), active.end(), victim));
+      } else {
+        spill(interval);
+        continue;
+      }
+    }
+
+    allocation.registers[interval.temporary] = chosen;
+    addActive(&interval);
+  }
+
+  allocation.spillSlotCount = static_cast<int>(spillSlotFreeAt.size());
+  return allocation;
+}
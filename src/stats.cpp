@@ -0,0 +1,117 @@
+#include "stats.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <sys/resource.h>
+
+namespace {
+
+// Set once before compiling starts, read by every allocation after
+bool countingAllocations = false;
+std::atomic<uint64_t> allocations{0};
+
+double seconds(int64_t nanoseconds) { return nanoseconds / 1e9; }
+
+double perSecond(uint64_t count, int64_t nanoseconds) {
+  return nanoseconds > 0 ? count / seconds(nanoseconds) : 0.0;
+}
+
+std::string jsonString(const std::string &text) {
+  std::string quoted = "\"";
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += static_cast<char>(c);
+    } else if (c < 0x20) {
+      char escaped[7];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    } else {
+      quoted += static_cast<char>(c);
+    }
+  }
+  return quoted + "\"";
+}
+
+} // namespace
+
+// Replaces the global allocation function; the array, nothrow and sized
+// forms all end up here
+void *operator new(std::size_t size) {
+  if (countingAllocations) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  for (;;) {
+    if (void *memory = std::malloc(size == 0 ? 1 : size)) {
+      return memory;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+
+void operator delete(void *memory, std::size_t) noexcept { std::free(memory); }
+
+void countAllocations() { countingAllocations = true; }
+
+uint64_t allocationCount() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+long peakMemoryKb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return usage.ru_maxrss;
+}
+
+void printStats(const CompileStats &stats, std::ostream &out) {
+  int64_t parseOnly = stats.parseTime - stats.lexTime;
+  auto row = [&out](const char *phase, int64_t nanoseconds) -> std::ostream & {
+    return out << std::left << std::setw(11) << phase << std::right
+               << std::setw(11) << std::fixed << std::setprecision(3)
+               << nanoseconds / 1e6 << " ms";
+  };
+
+  out << "===== Compile statistics: " << stats.input << " =====\n";
+  row("lex", stats.lexTime) << std::setw(10) << stats.tokens << " tokens"
+                            << std::setw(14) << std::setprecision(0)
+                            << perSecond(stats.tokens, stats.lexTime)
+                            << " tokens/s\n";
+  row("parse", parseOnly) << std::setw(10) << stats.astNodes
+                          << " AST nodes, excluding lexing\n";
+  row("typecheck", stats.typecheckTime) << "\n";
+  row("codegen", stats.codegenTime) << std::setw(10) << stats.irInstructions
+                                    << " IR instructions\n";
+  row("optimize", stats.optimizeTime)
+      << std::setw(10) << stats.optimizedInstructions
+      << " IR instructions after\n";
+  out << "peak RSS " << stats.peakMemoryKb << " KB, " << stats.allocations
+      << " heap allocations\n";
+  out << std::defaultfloat;
+}
+
+void printStatsJson(const CompileStats &stats, std::ostream &out) {
+  int64_t parseOnly = stats.parseTime - stats.lexTime;
+  out << std::setprecision(9) << "{\"input\": " << jsonString(stats.input)
+      << ", \"lex\": {\"seconds\": " << seconds(stats.lexTime)
+      << ", \"tokens\": " << stats.tokens << ", \"tokens_per_second\": "
+      << perSecond(stats.tokens, stats.lexTime) << "}"
+      << ", \"parse\": {\"seconds\": " << seconds(parseOnly)
+      << ", \"ast_nodes\": " << stats.astNodes << "}"
+      << ", \"typecheck\": {\"seconds\": " << seconds(stats.typecheckTime)
+      << "}, \"codegen\": {\"seconds\": " << seconds(stats.codegenTime)
+      << ", \"ir_instructions\": " << stats.irInstructions << "}"
+      << ", \"optimize\": {\"seconds\": " << seconds(stats.optimizeTime)
+      << ", \"ir_instructions\": " << stats.optimizedInstructions << "}"
+      << ", \"peak_rss_kb\": " << stats.peakMemoryKb
+      << ", \"heap_allocations\": " << stats.allocations << "}\n";
+  out << std::defaultfloat;
+}
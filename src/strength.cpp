@@ -0,0 +1,253 @@
+#include "passes.h"
+#include "passmanager.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <unordered_map>
+
+namespace {
+
+// Powers with a larger constant exponent stay a runtime loop
+const long long kMaximumUnrolledExponent = 32;
+
+class StrengthReduction {
+public:
+  StrengthReduction(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+  bool run();
+
+private:
+  bool reduce(const DecodedInstruction &instr,
+              std::vector<std::shared_ptr<Instruction>> &code);
+  void power(const DecodedInstruction &instr, long long exponent,
+             std::vector<std::shared_ptr<Instruction>> &code);
+  void emit(std::vector<std::shared_ptr<Instruction>> &code,
+            const std::string &result, const std::string &op,
+            const std::string &lhs, const std::string &rhs);
+  bool forward(const DecodedInstruction &instr, const std::string &value);
+  std::string typeOf(const std::string &value) const;
+  std::string freshTemporary();
+
+  ControlFlowGraph &cfg_;
+  std::unordered_map<std::string, int> definitions_;
+  const std::unordered_map<std::string, std::string> &types_;
+  // Results equal to one of their operands, replaced once every block is done
+  std::vector<std::pair<std::string, std::string>> forwarded_;
+  int nextTemporary_ = 0;
+};
+
+// k when `operand` is the int literal 2^k
+int powerOfTwo(const std::string &operand) {
+  if (literalType(operand) != "int") {
+    return -1;
+  }
+  long long value = std::strtoll(operand.c_str(), nullptr, 10);
+  if (value <= 0 || (value & (value - 1)) != 0) {
+    return -1;
+  }
+  int k = 0;
+  while (value > 1) {
+    value >>= 1;
+    k++;
+  }
+  return k;
+}
+
+StrengthReduction::StrengthReduction(ControlFlowGraph &cfg,
+                                     AnalysisManager &analyses)
+    : cfg_(cfg), types_(analyses.types()) {
+  for (const auto &block : cfg.blocks) {
+    for (const auto &instr : block.instructions) {
+      std::string result = decodeInstruction(*instr).result;
+      if (result.empty()) {
+        continue;
+      }
+      definitions_[result]++;
+      if (result.size() > 2 && result.compare(0, 2, "%t") == 0 &&
+          std::all_of(result.begin() + 2, result.end(), ::isdigit)) {
+        nextTemporary_ =
+            std::max(nextTemporary_, std::atoi(result.c_str() + 2) + 1);
+      }
+    }
+  }
+}
+
+void StrengthReduction::emit(std::vector<std::shared_ptr<Instruction>> &code,
+                             const std::string &result, const std::string &op,
+                             const std::string &lhs, const std::string &rhs) {
+  DecodedInstruction decoded;
+  decoded.operation = op;
+  decoded.result = result;
+  decoded.operands = {lhs, rhs};
+  code.push_back(encodeInstruction(decoded));
+}
+
+// Drops an instruction whose result is always `value`. Both must have a
+// single definition, or a use could see a different one.
+bool StrengthReduction::forward(const DecodedInstruction &instr,
+                                const std::string &value) {
+  if (!isTemporary(value) || definitions_[value] != 1 ||
+      definitions_[instr.result] != 1) {
+    return false;
+  }
+  forwarded_.push_back({instr.result, value});
+  return true;
+}
+
+// The square and multiply steps the runtime loop takes for `exponent`,
+// without the multiply by one and the square nothing uses
+void StrengthReduction::power(const DecodedInstruction &instr,
+                              long long exponent,
+                              std::vector<std::shared_ptr<Instruction>> &code) {
+  std::vector<DecodedInstruction> steps;
+  auto step = [&steps, this](const std::string &lhs, const std::string &rhs) {
+    DecodedInstruction decoded;
+    decoded.operation = "mul";
+    decoded.result = freshTemporary();
+    decoded.operands = {lhs, rhs};
+    steps.push_back(decoded);
+    return decoded.result;
+  };
+
+  std::string base = instr.operands[0];
+  std::string result;
+  for (long long n = exponent; n > 0; n >>= 1) {
+    if (n & 1) {
+      result = result.empty() ? base : step(result, base);
+    }
+    if (n > 1) {
+      base = step(base, base);
+    }
+  }
+  // The last step computes the power
+  steps.back().result = instr.result;
+  for (const auto &decoded : steps) {
+    code.push_back(encodeInstruction(decoded));
+  }
+}
+
+// Appends a cheaper equivalent of `instr` to `code`, false to keep it
+bool StrengthReduction::reduce(const DecodedInstruction &instr,
+                               std::vector<std::shared_ptr<Instruction>> &code) {
+  const std::string &op = instr.operation;
+  if (instr.operands.size() != 2 || instr.result.empty()) {
+    return false;
+  }
+  const std::string &lhs = instr.operands[0];
+  const std::string &rhs = instr.operands[1];
+
+  if (op == "pow" && literalType(rhs) == "int") {
+    long long exponent = std::strtoll(rhs.c_str(), nullptr, 10);
+    if (exponent == 1) {
+      return forward(instr, lhs);
+    }
+    if (exponent < 2 || exponent > kMaximumUnrolledExponent) {
+      return false;
+    }
+    power(instr, exponent, code);
+    return true;
+  }
+
+  // Dividing by a power of two is exact as a multiply by its reciprocal
+  if (op == "div" && typeOf(lhs) == "float" && literalType(rhs) == "float") {
+    int k = 0;
+    double divisor = std::strtod(rhs.c_str(), nullptr);
+    if (divisor <= 0 || std::frexp(divisor, &k) != 0.5) {
+      return false;
+    }
+    std::string literal = floatLiteral(1.0 / divisor);
+    if (literalType(literal) != "float") {
+      return false;
+    }
+    emit(code, instr.result, "mul", lhs, literal);
+    return true;
+  }
+
+  if (typeOf(lhs) != "int" || typeOf(rhs) != "int") {
+    return false;
+  }
+
+  if (op == "mul") {
+    bool literalFirst = powerOfTwo(lhs) >= 0;
+    const std::string &value = literalFirst ? rhs : lhs;
+    int k = powerOfTwo(literalFirst ? lhs : rhs);
+    if (k == 0) {
+      return forward(instr, value);
+    }
+    if (k < 0) {
+      return false;
+    }
+    emit(code, instr.result, "shl", value, std::to_string(k));
+    return true;
+  }
+
+  if (op != "div" && op != "mod") {
+    return false;
+  }
+  int k = powerOfTwo(rhs);
+  if (k == 0 && op == "div") {
+    return forward(instr, lhs);
+  }
+  if (k <= 0) {
+    return false;
+  }
+
+  // Division rounds towards zero, so negative values are biased by 2^k - 1
+  // before shifting: the bias is the sign mask and'ed with the mask
+  std::string mask = std::to_string((1LL << k) - 1);
+  std::string sign = freshTemporary();
+  std::string bias = freshTemporary();
+  std::string biased = freshTemporary();
+  emit(code, sign, "shr", lhs, "63");
+  emit(code, bias, "and", sign, mask);
+  emit(code, biased, "add", lhs, bias);
+  if (op == "div") {
+    emit(code, instr.result, "shr", biased, std::to_string(k));
+  } else {
+    std::string low = freshTemporary();
+    emit(code, low, "and", biased, mask);
+    emit(code, instr.result, "sub", low, bias);
+  }
+  return true;
+}
+
+std::string StrengthReduction::typeOf(const std::string &value) const {
+  if (isTemporary(value)) {
+    auto it = types_.find(value);
+    return it == types_.end() ? "int" : it->second;
+  }
+  return literalType(value);
+}
+
+std::string StrengthReduction::freshTemporary() {
+  std::string name = "%t" + std::to_string(nextTemporary_++);
+  definitions_[name] = 1;
+  return name;
+}
+
+bool StrengthReduction::run() {
+  bool changed = false;
+  for (auto &block : cfg_.blocks) {
+    std::vector<std::shared_ptr<Instruction>> code;
+    for (const auto &instr : block.instructions) {
+      if (reduce(decodeInstruction(*instr), code)) {
+        changed = true;
+      } else {
+        code.push_back(instr);
+      }
+    }
+    block.instructions = code;
+  }
+
+  // Later results may forward to earlier ones, so those are replaced first
+  for (auto it = forwarded_.rbegin(); it != forwarded_.rend(); ++it) {
+    cfg_.replaceUses(it->first, it->second);
+  }
+  return changed;
+}
+
+} // namespace
+
+bool reduceStrength(ControlFlowGraph &cfg, AnalysisManager &analyses) {
+  return StrengthReduction(cfg, analyses).run();
+}
@@ -0,0 +1,316 @@
+#include "passes.h"
+#include "passmanager.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Chains shorter than this stay compare-and-branch
+const size_t kMinimumCases = 4;
+// Leaves of the search tree test up to this many cases one after another
+const size_t kLinearCases = 3;
+const long long kMaximumTableSize = 4096;
+
+struct Case {
+  long long value;
+  std::string target;
+};
+
+// `br %c, label %T, label %F` after `%c = (value == K)` at the end of a block
+struct Test {
+  std::string operand;
+  std::string condition;
+  long long constant;
+  std::string onTrue;
+  std::string onFalse;
+};
+
+class SwitchLowering {
+public:
+  SwitchLowering(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+  bool run();
+
+private:
+  std::optional<Test> matchTest(int block) const;
+  bool lowerChain(int head);
+  std::vector<std::shared_ptr<Instruction>> search(size_t lo, size_t hi);
+  std::string searchBlock(size_t lo, size_t hi);
+  std::string freshTemporary();
+  std::string freshLabel();
+
+  ControlFlowGraph &cfg_;
+  std::unordered_map<std::string, int> uses_;
+  const std::unordered_map<std::string, std::string> &types_;
+  int nextTemporary_ = 0;
+  int nextLabel_ = 0;
+
+  // State of the chain being lowered
+  std::string value_;
+  std::vector<Case> cases_;
+  std::string fallback_;
+  std::vector<BasicBlock> added_;
+};
+
+SwitchLowering::SwitchLowering(ControlFlowGraph &cfg, AnalysisManager &analyses)
+    : cfg_(cfg), types_(analyses.types()) {
+  auto number = [this](const std::string &value) {
+    if (value.size() > 2 && value.compare(0, 2, "%t") == 0 &&
+        std::all_of(value.begin() + 2, value.end(), ::isdigit)) {
+      nextTemporary_ = std::max(nextTemporary_, std::atoi(value.c_str() + 2) + 1);
+    }
+  };
+  for (const auto &block : cfg.blocks) {
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      number(decoded.result);
+      for (const auto &operand : decoded.operands) {
+        uses_[operand]++;
+        number(operand);
+      }
+    }
+  }
+}
+
+std::optional<Test> SwitchLowering::matchTest(int block) const {
+  const auto &code = cfg_.blocks[block].instructions;
+  if (code.size() < 2) {
+    return std::nullopt;
+  }
+
+  DecodedInstruction branch = decodeInstruction(*code.back());
+  DecodedInstruction compare = decodeInstruction(*code[code.size() - 2]);
+  if (branch.operation != "br" || branch.operands.size() != 1 ||
+      branch.targets.size() != 2 || compare.operation != "cmp" ||
+      compare.result != branch.operands[0]) {
+    return std::nullopt;
+  }
+
+  Test test;
+  test.condition = compare.result;
+  test.onTrue = branch.targets[0];
+  test.onFalse = branch.targets[1];
+  bool literalFirst = !isTemporary(compare.operands[0]);
+  test.operand = compare.operands[literalFirst ? 1 : 0];
+  const std::string &literal = compare.operands[literalFirst ? 0 : 1];
+  if (!isTemporary(test.operand) || literalType(literal) != "int") {
+    return std::nullopt;
+  }
+  auto type = types_.find(test.operand);
+  if (type == types_.end() || type->second != "int") {
+    return std::nullopt;
+  }
+  test.constant = std::strtoll(literal.c_str(), nullptr, 10);
+  if (test.constant < INT_MIN || test.constant > INT_MAX) {
+    return std::nullopt;
+  }
+  return test;
+}
+
+// Follows the false edges from `head` while every block is an equality test
+// of the same value entered only from the previous test, then replaces the
+// tests with a jump table or a binary search.
+bool SwitchLowering::lowerChain(int head) {
+  std::optional<Test> first = matchTest(head);
+  if (!first) {
+    return false;
+  }
+
+  // Later tests may reload the value from the slot it was loaded from in
+  // the head block
+  value_ = first->operand;
+  std::string slot;
+  const auto &headCode = cfg_.blocks[head].instructions;
+  for (size_t i = 0; i + 2 < headCode.size(); i++) {
+    DecodedInstruction decoded = decodeInstruction(*headCode[i]);
+    if (decoded.result == value_) {
+      slot = decoded.operation == "load" ? decoded.operands[0] : "";
+    } else if (decoded.operation == "store" && decoded.operands[1] == slot) {
+      slot.clear();
+    }
+  }
+
+  std::vector<std::vector<int>> preds = cfg_.predecessors();
+  std::unordered_set<long long> seen = {first->constant};
+  // Uses of the test conditions by the branches of the chain
+  std::unordered_map<std::string, int> conditionUses = {{first->condition, 1}};
+  std::vector<int> tests;
+  cases_ = {{first->constant, first->onTrue}};
+  fallback_ = first->onFalse;
+
+  while (true) {
+    int block = cfg_.findBlock(fallback_);
+    if (block <= 0 || block == head || preds[block].size() != 1 ||
+        std::find(tests.begin(), tests.end(), block) != tests.end()) {
+      break;
+    }
+
+    const auto &code = cfg_.blocks[block].instructions;
+    if (code.size() == 1) {
+      // A repeated test whose condition value numbering already reused; it
+      // is known to be false here
+      DecodedInstruction branch = decodeInstruction(*code[0]);
+      if (branch.operation != "br" || branch.operands.size() != 1 ||
+          !conditionUses.count(branch.operands[0])) {
+        break;
+      }
+      conditionUses[branch.operands[0]]++;
+      tests.push_back(block);
+      fallback_ = branch.targets[1];
+      continue;
+    }
+
+    // Nothing but the test, possibly on a reload of the value
+    std::optional<Test> test = matchTest(block);
+    if (!test || code.size() > 3) {
+      break;
+    }
+    if (test->operand != value_) {
+      DecodedInstruction load = decodeInstruction(*code[0]);
+      if (code.size() != 3 || slot.empty() || load.operation != "load" ||
+          load.operands[0] != slot || load.result != test->operand ||
+          uses_.at(load.result) != 1) {
+        break;
+      }
+    }
+
+    tests.push_back(block);
+    conditionUses[test->condition]++;
+    // A repeated constant was already taken by the earlier test
+    if (seen.insert(test->constant).second) {
+      cases_.push_back({test->constant, test->onTrue});
+    }
+    fallback_ = test->onFalse;
+  }
+
+  if (cases_.size() < kMinimumCases) {
+    return false;
+  }
+  for (const auto &c : cases_) {
+    if (std::find(tests.begin(), tests.end(), cfg_.findBlock(c.target)) !=
+        tests.end()) {
+      return false;
+    }
+  }
+  // Conditions computed in removed blocks must not be needed elsewhere; the
+  // one of the head block stays when it is
+  for (const auto &entry : conditionUses) {
+    if (entry.first != first->condition &&
+        uses_.at(entry.first) != entry.second) {
+      return false;
+    }
+  }
+  bool keepCondition = uses_.at(first->condition) != conditionUses.at(first->condition);
+
+  std::sort(cases_.begin(), cases_.end(),
+            [](const Case &a, const Case &b) { return a.value < b.value; });
+  long long range = cases_.back().value - cases_.front().value + 1;
+
+  added_.clear();
+  auto &code = cfg_.blocks[head].instructions;
+  code.resize(code.size() - (keepCondition ? 1 : 2));
+  if (range <= kMaximumTableSize &&
+      range * 2 <= static_cast<long long>(cases_.size()) * 5) {
+    // Dense: index a table by value - minimum, holes go to the fallback
+    DecodedInstruction table;
+    table.operation = "switch";
+    table.operands = {value_, std::to_string(cases_.front().value)};
+    table.targets.assign(static_cast<size_t>(range) + 1, fallback_);
+    for (const auto &c : cases_) {
+      table.targets[static_cast<size_t>(c.value - cases_.front().value) + 1] =
+          c.target;
+    }
+    code.push_back(encodeInstruction(table));
+  } else {
+    std::vector<std::shared_ptr<Instruction>> root =
+        search(0, cases_.size() - 1);
+    code.insert(code.end(), root.begin(), root.end());
+  }
+
+  std::sort(tests.rbegin(), tests.rend());
+  for (int block : tests) {
+    cfg_.blocks.erase(cfg_.blocks.begin() + block);
+    if (block < head) {
+      head--;
+    }
+  }
+  cfg_.blocks.insert(cfg_.blocks.begin() + head + 1, added_.begin(),
+                     added_.end());
+  cfg_.reindex();
+  return true;
+}
+
+// Code of a block that branches to the target of the case matching the
+// value among cases_[lo..hi], or to the fallback.
+std::vector<std::shared_ptr<Instruction>> SwitchLowering::search(size_t lo,
+                                                                 size_t hi) {
+  DecodedInstruction compare;
+  compare.result = freshTemporary();
+  compare.type = "int";
+  DecodedInstruction branch;
+  branch.operation = "br";
+  branch.operands = {compare.result};
+
+  if (hi - lo + 1 <= kLinearCases) {
+    compare.operation = "cmp";
+    compare.operands = {value_, std::to_string(cases_[lo].value)};
+    branch.targets = {cases_[lo].target,
+                      lo == hi ? fallback_ : searchBlock(lo + 1, hi)};
+  } else {
+    size_t middle = lo + (hi - lo + 1) / 2;
+    compare.operation = "lt";
+    compare.operands = {value_, std::to_string(cases_[middle].value)};
+    std::string below = searchBlock(lo, middle - 1);
+    branch.targets = {below, searchBlock(middle, hi)};
+  }
+
+  return {encodeInstruction(compare), encodeInstruction(branch)};
+}
+
+std::string SwitchLowering::searchBlock(size_t lo, size_t hi) {
+  size_t index = added_.size();
+  added_.emplace_back();
+  added_[index].label = freshLabel();
+  std::vector<std::shared_ptr<Instruction>> code = search(lo, hi);
+  added_[index].instructions = code;
+  return added_[index].label;
+}
+
+std::string SwitchLowering::freshTemporary() {
+  return "%t" + std::to_string(nextTemporary_++);
+}
+
+std::string SwitchLowering::freshLabel() {
+  std::string label;
+  do {
+    label = "%search" + std::to_string(nextLabel_++);
+  } while (cfg_.findBlock(label) >= 0);
+  return label;
+}
+
+bool SwitchLowering::run() {
+  bool changed = false;
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (size_t b = 0; b < cfg_.blocks.size(); b++) {
+      if (lowerChain(static_cast<int>(b))) {
+        progress = changed = true;
+        break;
+      }
+    }
+  }
+  return changed;
+}
+
+} // namespace
+
+bool lowerSwitches(ControlFlowGraph &cfg, AnalysisManager &analyses) {
+  cfg.makeFallthroughsExplicit();
+  bool changed = SwitchLowering(cfg, analyses).run();
+  cfg.removeFallthroughBranches();
+  return changed;
+}
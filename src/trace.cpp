@@ -0,0 +1,159 @@
+#include "trace.h"
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+  const char *name;
+  std::string detail;
+  int64_t start;
+  int64_t duration;
+};
+
+// Only its own thread appends to a buffer; the writer reads them all after
+// the workers have been joined
+struct ThreadBuffer {
+  size_t track;
+  std::vector<TraceEvent> events;
+};
+
+struct TraceState {
+  std::string path;
+  std::chrono::steady_clock::time_point epoch;
+  std::mutex mutex; // guards `buffers` while threads register
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+TraceState &state() {
+  static TraceState instance;
+  return instance;
+}
+
+ThreadBuffer &threadBuffer() {
+  thread_local ThreadBuffer *buffer = nullptr;
+  if (buffer == nullptr) {
+    TraceState &trace = state();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    trace.buffers.push_back(std::make_unique<ThreadBuffer>());
+    buffer = trace.buffers.back().get();
+    buffer->track = trace.buffers.size() - 1;
+  }
+  return *buffer;
+}
+
+void appendString(std::string &out, const std::string &text) {
+  out += '"';
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += static_cast<char>(c);
+    } else if (c < 0x20) {
+      char escaped[7];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += static_cast<char>(c);
+    }
+  }
+  out += '"';
+}
+
+// Microseconds with nanosecond precision, the unit of the format
+void appendTime(std::string &out, int64_t nanoseconds) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%lld.%03lld",
+                static_cast<long long>(nanoseconds / 1000),
+                static_cast<long long>(nanoseconds % 1000));
+  out += text;
+}
+
+void writeTrace() {
+  TraceState &trace = state();
+  std::lock_guard<std::mutex> lock(trace.mutex);
+
+  std::string out = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  bool first = true;
+  for (const auto &buffer : trace.buffers) {
+    std::string track = buffer->track == 0
+                            ? std::string("main")
+                            : "worker " + std::to_string(buffer->track);
+    out += first ? "" : ",\n";
+    first = false;
+    out += "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " +
+           std::to_string(buffer->track) + ", \"args\": {\"name\": ";
+    appendString(out, track);
+    out += "}}";
+
+    for (const TraceEvent &event : buffer->events) {
+      out += ",\n{\"name\": ";
+      appendString(out, event.name);
+      out += ", \"ph\": \"X\", \"pid\": 1, \"tid\": " +
+             std::to_string(buffer->track) + ", \"ts\": ";
+      appendTime(out, event.start);
+      out += ", \"dur\": ";
+      appendTime(out, event.duration);
+      if (!event.detail.empty()) {
+        out += ", \"args\": {\"detail\": ";
+        appendString(out, event.detail);
+        out += "}";
+      }
+      out += "}";
+    }
+  }
+  out += "\n]}\n";
+
+  std::FILE *file = std::fopen(trace.path.c_str(), "wb");
+  bool written = file != nullptr &&
+                 std::fwrite(out.data(), 1, out.size(), file) == out.size();
+  written = file != nullptr && std::fclose(file) == 0 && written;
+  if (!written) {
+    std::fprintf(stderr, "Error: Writing %s failed\n", trace.path.c_str());
+  }
+}
+
+} // namespace
+
+bool TraceSpan::enabled_ = false;
+
+TraceSpan::TraceSpan(const char *name, const std::string &detail) {
+  if (enabled_) {
+    name_ = name;
+    detail_ = detail;
+    start_ = now();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (name_ != nullptr) {
+    threadBuffer().events.push_back(
+        {name_, std::move(detail_), start_, now() - start_});
+  }
+}
+
+void TraceSpan::enable(const std::string &path) {
+  TraceState &trace = state();
+  trace.path = path;
+  trace.epoch = std::chrono::steady_clock::now();
+  // The calling thread is track 0; the state outlives the exit handler
+  // because it was constructed before the handler was registered
+  threadBuffer();
+  std::atexit(writeTrace);
+  enabled_ = true;
+}
+
+void TraceSpan::record(const char *name, int64_t start, int64_t duration,
+                       const std::string &detail) {
+  if (enabled_) {
+    threadBuffer().events.push_back({name, detail, start, duration});
+  }
+}
+
+int64_t TraceSpan::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - state().epoch)
+      .count();
+}
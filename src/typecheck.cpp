@@ -0,0 +1,360 @@
+#include "typecheck.h"
+#include "cfg.h"
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+namespace {
+
+std::string lowerCase(std::string string) {
+  std::transform(string.begin(), string.end(), string.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return string;
+}
+
+// int or float from the value the lexer converted
+std::string numericType(ASTNode *node) {
+  switch (node->getConstant().kind) {
+  case NumericConstant::Int:
+    return "int";
+  case NumericConstant::Float:
+    return "float";
+  default:
+    return literalType(node->getValue());
+  }
+}
+
+bool isIntLiteral(ASTNode *node) {
+  return node->getType() == "NUMERIC_LITERAL" && numericType(node) == "int";
+}
+
+bool isNumeric(const std::string &type) {
+  return type == "int" || type == "float";
+}
+
+bool isArray(const std::string &type) {
+  return type.size() > 2 && type.compare(type.size() - 2, 2, "[]") == 0;
+}
+
+// An int literal next to a float is a float
+void promote(ASTNode *node, std::string &type, const std::string &other) {
+  if (type == "int" && other == "float" && isIntLiteral(node)) {
+    node->setValueType("float");
+    type = "float";
+  }
+}
+
+} // namespace
+
+bool TypeChecker::check(ASTNode *program) {
+  for (ASTNode *child : program->getChildren()) {
+    if (child->getType() != "FUNCTION") {
+      continue;
+    }
+    FunctionSignature signature;
+    signature.returnType = lowerCase(child->getChildren()[0]->getValue());
+    for (ASTNode *parameter : child->getChildren()[1]->getChildren()) {
+      signature.parameterTypes.push_back(
+          lowerCase(parameter->getChildren()[0]->getValue()));
+    }
+    functions_[child->getValue()] = signature;
+  }
+
+  for (ASTNode *child : program->getChildren()) {
+    if (child->getType() == "FUNCTION") {
+      checkFunction(child);
+    }
+  }
+  variables_.clear();
+  returnType_.clear();
+  inFunction_ = false;
+  for (ASTNode *child : program->getChildren()) {
+    if (child->getType() != "FUNCTION") {
+      checkStatement(child);
+    }
+  }
+  return errors_ == 0;
+}
+
+void TypeChecker::checkFunction(ASTNode *function) {
+  const FunctionSignature &signature = functions_[function->getValue()];
+  variables_.clear();
+  const std::vector<ASTNode *> &parameters =
+      function->getChildren()[1]->getChildren();
+  for (size_t i = 0; i < parameters.size(); i++) {
+    variables_.push_back({parameters[i]->getValue(), signature.parameterTypes[i]});
+  }
+  returnType_ = signature.returnType;
+  inFunction_ = true;
+  checkStatement(function->getChildren()[2]);
+}
+
+void TypeChecker::checkStatement(ASTNode *node) {
+  std::string nodeType = node->getType();
+  std::string value = node->getValue();
+  const std::vector<ASTNode *> &children = node->getChildren();
+
+  if (nodeType == "CODE_BLOCK") {
+    for (ASTNode *child : children) {
+      checkStatement(child);
+    }
+  } else if (nodeType == "VAR_DECLARATION") {
+    std::string name = children[1]->getValue();
+    std::string type = lowerCase(children[0]->getValue());
+    // A string array would start out full of null strings
+    if (type == "string[]") {
+      error(name + " is an array of strings, arrays hold int, float, char or "
+                   "bool");
+    }
+    std::string initializer =
+        checkExpression(children[2]->getChildren()[0], type);
+    if (!initializer.empty() && initializer != type) {
+      error(name + " is " + type + ", its initializer " + initializer);
+    }
+    variables_.push_back({name, type});
+  } else if (nodeType != "STATEMENT") {
+    return;
+  } else if (value == "if" || value == "else if" || value == "while") {
+    checkCondition(children[0]);
+    checkStatement(children[1]);
+  } else if (value == "else") {
+    checkStatement(children[0]);
+  } else if (value == "for") {
+    checkForCondition(children[0]);
+    checkStatement(children[1]);
+  } else if (value == "step") {
+    std::string name = children[0]->getValue();
+    std::string type = lookup(name);
+    if (!isNumeric(type) && type != "char") {
+      error("'" + children[1]->getValue() + "' on " + name + ", a " + type);
+    }
+  } else if (value == "assign") {
+    std::string name = children[0]->getValue();
+    std::string type = children[0]->getType() == "ARRAY_ACCESS"
+                           ? checkExpression(children[0])
+                           : lookup(name);
+    std::string assigned = checkExpression(children[1], type);
+    if (!type.empty() && !assigned.empty() && assigned != type) {
+      error(name + " is " + type + ", the assigned value " + assigned);
+    }
+  } else if (value == "out") {
+    ASTNode *argument = children[0]->getChildren()[0];
+    std::string type = checkExpression(argument);
+    if (isArray(type)) {
+      error("out of " + type + ", print its elements one by one");
+    }
+  } else if (value == "call") {
+    checkCall(children[0]);
+  } else if (value == "return") {
+    if (children.empty()) {
+      return;
+    }
+    std::string type = checkExpression(children[0], returnType_);
+    if (isArray(type)) {
+      error("returning " + type + ", arrays cannot leave their function");
+    } else if (inFunction_ && returnType_.empty()) {
+      error("returning " + type + " from a function without a return type");
+    } else if (inFunction_ && !type.empty() && type != returnType_) {
+      error("returning " + type + " from a function returning " + returnType_);
+    }
+  }
+}
+
+// Both sides of `a op b` are variables or literals of one type, or ints
+// and floats, which compare as floats
+void TypeChecker::checkCondition(ASTNode *node) {
+  ASTNode *left = node->getChildren()[0];
+  ASTNode *op = node->getChildren()[1];
+  ASTNode *right = node->getChildren()[2];
+  std::string lhs = checkExpression(left);
+  std::string rhs = checkExpression(right);
+  promote(left, lhs, rhs);
+  promote(right, rhs, lhs);
+
+  std::string type = lhs;
+  if (isArray(lhs) || isArray(rhs)) {
+    error("cannot compare " + lhs + " and " + rhs);
+    return;
+  } else if (isNumeric(lhs) && isNumeric(rhs)) {
+    type = lhs == "float" || rhs == "float" ? "float" : "int";
+  } else if (lhs != rhs) {
+    if (!lhs.empty() && !rhs.empty()) {
+      error("cannot compare " + lhs + " and " + rhs);
+    }
+    return;
+  } else if (type == "bool" && op->getValue() != "==" && op->getValue() != "!=") {
+    error("'" + op->getValue() + "' on bool, only == and != compare bools");
+  }
+  op->setValueType(type);
+}
+
+// for (type i = start; i < bound; i++), the counter is declared from here on
+void TypeChecker::checkForCondition(ASTNode *node) {
+  const std::vector<ASTNode *> &children = node->getChildren();
+  std::string name = children[1]->getValue();
+  std::string type = lowerCase(children[0]->getValue());
+  ASTNode *start = children[2]->getChildren()[0];
+  std::string startType = checkExpression(start, type);
+  if (!startType.empty() && startType != type) {
+    error(name + " is " + type + ", its initializer " + startType);
+  }
+  variables_.push_back({name, type});
+
+  ASTNode *bound = children[5];
+  std::string boundType = checkExpression(bound, type);
+  if (!isNumeric(type) || !isNumeric(boundType)) {
+    error("cannot compare " + type + " and " + boundType);
+    return;
+  }
+  children[4]->setValueType(type == "float" || boundType == "float" ? "float"
+                                                                    : "int");
+}
+
+std::string TypeChecker::checkExpression(ASTNode *node,
+                                         const std::string &expected) {
+  std::string nodeType = node->getType();
+  std::string type;
+
+  if (nodeType == "NUMERIC_LITERAL") {
+    type = numericType(node);
+    if (type == "int" && expected == "float") {
+      type = "float";
+    }
+  } else if (nodeType == "STRING_LITERAL") {
+    type = "string";
+  } else if (nodeType == "CHAR_LITERAL") {
+    type = "char";
+  } else if (nodeType == "BOOL_LITERAL") {
+    type = "bool";
+  } else if (nodeType == "IDENTIFIER") {
+    type = lookup(node->getValue());
+  } else if (nodeType == "FUNCTIONCALL") {
+    type = checkCall(node);
+    if (type.empty()) {
+      error(node->getValue() + " returns no value");
+    }
+  } else if (nodeType == "MATH_OPERATOR") {
+    type = checkArithmetic(node);
+  } else {
+    type = checkArray(node, expected);
+  }
+
+  node->setValueType(type);
+  return type;
+}
+
+// + - * / on two ints or two floats, % on ints, ^ on an int or float base
+// with an int exponent. A unary minus keeps the type of its operand.
+std::string TypeChecker::checkArithmetic(ASTNode *node) {
+  const std::vector<ASTNode *> &operands = node->getChildren();
+  std::string op = node->getValue();
+
+  if (operands.size() == 1) {
+    std::string type = checkExpression(operands[0]);
+    if (!type.empty() && !isNumeric(type)) {
+      error("'-' on " + type);
+    }
+    return type;
+  }
+
+  std::string lhs = checkExpression(operands[0]);
+  std::string rhs = checkExpression(operands[1]);
+  if (op != "^" && op != "%") {
+    promote(operands[0], lhs, rhs);
+    promote(operands[1], rhs, lhs);
+  }
+  bool valid = op == "^"   ? isNumeric(lhs) && rhs == "int"
+               : op == "%" ? lhs == "int" && rhs == "int"
+                           : isNumeric(lhs) && lhs == rhs;
+  if (!valid && !lhs.empty() && !rhs.empty()) {
+    error("'" + op + "' on " + lhs + " and " + rhs);
+  }
+  return lhs;
+}
+
+// a[i] and len(a) on an array variable with an int index, and the
+// initializers type[size] and [a, b, ...], whose elements have the element
+// type of `expected`
+std::string TypeChecker::checkArray(ASTNode *node, const std::string &expected) {
+  std::string nodeType = node->getType();
+  const std::vector<ASTNode *> &children = node->getChildren();
+
+  if (nodeType == "NEW_ARRAY" || nodeType == "ARRAY_ACCESS") {
+    std::string index = checkExpression(children[0]);
+    if (!index.empty() && index != "int") {
+      error((nodeType == "NEW_ARRAY" ? "size of an array is "
+                                     : "index into " + node->getValue() + " is ") +
+            index);
+    }
+  }
+  if (nodeType == "NEW_ARRAY") {
+    return lowerCase(node->getValue()) + "[]";
+  }
+  if (nodeType == "ARRAY_LITERAL") {
+    std::string element =
+        isArray(expected) ? expected.substr(0, expected.size() - 2) : "";
+    for (ASTNode *child : children) {
+      std::string type = checkExpression(child, element);
+      if (element.empty()) {
+        element = type;
+      } else if (!type.empty() && type != element) {
+        error("array of " + element + " has an element " + type);
+      }
+    }
+    return element.empty() ? "" : element + "[]";
+  }
+  if (nodeType != "ARRAY_ACCESS" && nodeType != "ARRAY_LENGTH") {
+    return "";
+  }
+
+  std::string type = lookup(node->getValue());
+  if (!type.empty() && !isArray(type)) {
+    error(node->getValue() + " is " + type + ", not an array");
+    return "";
+  }
+  if (nodeType == "ARRAY_LENGTH") {
+    return "int";
+  }
+  return type.empty() ? "" : type.substr(0, type.size() - 2);
+}
+
+std::string TypeChecker::checkCall(ASTNode *call) {
+  auto it = functions_.find(call->getValue());
+  if (it == functions_.end()) {
+    error("unknown function " + call->getValue());
+    return "";
+  }
+  const FunctionSignature &signature = it->second;
+  const std::vector<ASTNode *> &arguments = call->getChildren();
+  if (arguments.size() != signature.parameterTypes.size()) {
+    error(call->getValue() + " takes " +
+          std::to_string(signature.parameterTypes.size()) + " arguments, got " +
+          std::to_string(arguments.size()));
+  }
+  for (size_t i = 0; i < arguments.size(); i++) {
+    std::string expected =
+        i < signature.parameterTypes.size() ? signature.parameterTypes[i] : "";
+    std::string type = checkExpression(arguments[i], expected);
+    if (!expected.empty() && !type.empty() && type != expected) {
+      error("argument " + std::to_string(i + 1) + " of " + call->getValue() +
+            " is " + expected + ", not " + type);
+    }
+  }
+  call->setValueType(signature.returnType);
+  return signature.returnType;
+}
+
+std::string TypeChecker::lookup(const std::string &name) {
+  auto it = std::find_if(variables_.rbegin(), variables_.rend(),
+                         [&name](const auto &pair) { return pair.first == name; });
+  if (it == variables_.rend()) {
+    error("unknown variable " + name);
+    return "";
+  }
+  return it->second;
+}
+
+void TypeChecker::error(const std::string &message) {
+  std::cerr << "Type error: " << message << std::endl;
+  errors_++;
+}
@@ -0,0 +1,312 @@
+#include "passes.h"
+#include "passmanager.h"
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Trip counts up to this are unrolled completely
+const unsigned long long kMaximumFullUnroll = 16;
+// Copies of the body in each iteration of a partially unrolled loop
+const unsigned long long kUnrollFactor = 4;
+// Most instructions unrolling may turn one loop into
+const unsigned long long kMaximumUnrolledSize = 64;
+
+class LoopUnroller {
+public:
+  LoopUnroller(ControlFlowGraph &cfg, AnalysisManager &analyses);
+
+  bool run();
+
+private:
+  bool unroll(const Loop &loop);
+  std::optional<long long> entryValue(const CountedLoop &counted,
+                                      int preheader) const;
+  std::vector<std::shared_ptr<Instruction>>
+  copy(const std::vector<DecodedInstruction> &code, const std::string &counter,
+       long long *value);
+  std::string freshTemporary();
+  std::string freshLabel(const std::string &base) const;
+
+  ControlFlowGraph &cfg_;
+  AnalysisManager &analyses_;
+  std::vector<std::vector<int>> preds_;
+  // Headers of loops already unrolled, whose remainder loop stays as it is
+  std::unordered_set<std::string> unrolled_;
+  int nextTemporary_ = 0;
+};
+
+LoopUnroller::LoopUnroller(ControlFlowGraph &cfg, AnalysisManager &analyses)
+    : cfg_(cfg), analyses_(analyses) {
+  for (const auto &block : cfg.blocks) {
+    for (const auto &instr : block.instructions) {
+      std::string result = decodeInstruction(*instr).result;
+      if (result.size() > 2 && result.compare(0, 2, "%t") == 0 &&
+          std::all_of(result.begin() + 2, result.end(), ::isdigit)) {
+        nextTemporary_ =
+            std::max(nextTemporary_, std::atoi(result.c_str() + 2) + 1);
+      }
+    }
+  }
+}
+
+// The literal last stored to the counter's slot before the loop, looking
+// back from the preheader through blocks with a single predecessor.
+std::optional<long long> LoopUnroller::entryValue(const CountedLoop &counted,
+                                                  int preheader) const {
+  std::string slot = counted.slot;
+  bool counterDefined = !slot.empty();
+  std::vector<bool> visited(cfg_.blocks.size(), false);
+
+  for (int b = preheader; b >= 0 && !visited[b];
+       b = preds_[b].size() == 1 ? preds_[b][0] : -1) {
+    visited[b] = true;
+    const auto &code = cfg_.blocks[b].instructions;
+    for (size_t i = code.size(); i-- > 0;) {
+      DecodedInstruction decoded = decodeInstruction(*code[i]);
+      if (!counterDefined && decoded.result == counted.counter) {
+        if (decoded.operation != "load") {
+          return std::nullopt;
+        }
+        slot = decoded.operands[0];
+        counterDefined = true;
+      } else if (counterDefined && decoded.operation == "store" &&
+                 decoded.operands[1] == slot) {
+        if (literalType(decoded.operands[0]) != "int") {
+          return std::nullopt;
+        }
+        return std::strtoll(decoded.operands[0].c_str(), nullptr, 10);
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+// One copy of `code` with fresh names for the temporaries it defines. With
+// `value`, the counter is replaced by its value and its increments are
+// counted instead of emitted.
+std::vector<std::shared_ptr<Instruction>>
+LoopUnroller::copy(const std::vector<DecodedInstruction> &code,
+                   const std::string &counter, long long *value) {
+  std::unordered_map<std::string, std::string> renamed;
+  std::vector<std::shared_ptr<Instruction>> result;
+
+  for (DecodedInstruction decoded : code) {
+    if (value != nullptr && decoded.result == counter) {
+      if (decoded.operation == "inc") {
+        ++*value;
+      }
+      continue;
+    }
+    for (auto &operand : decoded.operands) {
+      auto it = renamed.find(operand);
+      if (it != renamed.end()) {
+        operand = it->second;
+      } else if (value != nullptr && operand == counter) {
+        operand = std::to_string(*value);
+      }
+    }
+    if (isTemporary(decoded.result) && decoded.operation != "alloc" &&
+        decoded.result != counter) {
+      renamed[decoded.result] = freshTemporary();
+      decoded.result = renamed[decoded.result];
+    }
+    result.push_back(encodeInstruction(decoded));
+  }
+  return result;
+}
+
+bool LoopUnroller::unroll(const Loop &loop) {
+  std::optional<CountedLoop> counted = findCountedLoop(cfg_, loop);
+  if (!counted || unrolled_.count(cfg_.blocks[counted->header].label) ||
+      literalType(counted->bound) != "int") {
+    return false;
+  }
+  const std::unordered_map<std::string, std::string> &types = analyses_.types();
+  auto type = types.find(counted->counter);
+  if (type == types.end() || type->second != "int") {
+    return false;
+  }
+
+  std::vector<int> outside;
+  for (int pred : preds_[counted->header]) {
+    if (!loop.contains(pred)) {
+      outside.push_back(pred);
+    }
+  }
+  if (outside.size() != 1) {
+    return false;
+  }
+  int preheader = outside[0];
+  std::optional<long long> start = entryValue(*counted, preheader);
+  if (!start) {
+    return false;
+  }
+  long long bound = std::strtoll(counted->bound.c_str(), nullptr, 10);
+  unsigned long long trips =
+      bound > *start ? static_cast<unsigned long long>(bound) -
+                           static_cast<unsigned long long>(*start)
+                     : 0;
+
+  // Header loads and the body, without the compare and the branches
+  BasicBlock &header = cfg_.blocks[counted->header];
+  const BasicBlock &body = cfg_.blocks[counted->body];
+  std::vector<DecodedInstruction> headerCode;
+  std::vector<DecodedInstruction> bodyCode;
+  for (size_t i = 0; i + 1 < header.instructions.size(); i++) {
+    headerCode.push_back(decodeInstruction(*header.instructions[i]));
+  }
+  for (size_t i = 0; i + 1 < body.instructions.size(); i++) {
+    bodyCode.push_back(decodeInstruction(*body.instructions[i]));
+  }
+  DecodedInstruction compare = headerCode.back();
+  headerCode.pop_back();
+  std::vector<DecodedInstruction> iteration = headerCode;
+  iteration.insert(iteration.end(), bodyCode.begin(), bodyCode.end());
+
+  // Copies get their own temporaries, so none may be read before it is
+  // defined in an iteration or once the loop is left
+  std::unordered_set<std::string> defined;
+  for (const auto &decoded : iteration) {
+    if (isTemporary(decoded.result) && decoded.operation != "alloc") {
+      defined.insert(decoded.result);
+    }
+  }
+  defined.insert(compare.result);
+  std::unordered_set<std::string> seen;
+  for (const auto &decoded : iteration) {
+    for (const auto &operand : decoded.operands) {
+      if (operand != counted->counter && defined.count(operand) &&
+          !seen.count(operand)) {
+        return false;
+      }
+    }
+    seen.insert(decoded.result);
+  }
+  bool counterLiveOut = false;
+  for (size_t b = 0; b < cfg_.blocks.size(); b++) {
+    if (loop.contains(static_cast<int>(b))) {
+      continue;
+    }
+    for (const auto &instr : cfg_.blocks[b].instructions) {
+      for (const auto &operand : decodeInstruction(*instr).operands) {
+        if (operand == counted->counter) {
+          counterLiveOut = true;
+        } else if (defined.count(operand)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  unsigned long long size = iteration.size();
+  if (trips <= kMaximumFullUnroll && trips * size <= kMaximumUnrolledSize &&
+      !counterLiveOut) {
+    // Every iteration in a row with the counter as a constant
+    std::vector<std::shared_ptr<Instruction>> code;
+    long long value = *start;
+    for (unsigned long long k = 0; k < trips; k++) {
+      std::vector<std::shared_ptr<Instruction>> next =
+          copy(iteration, counted->counter, &value);
+      code.insert(code.end(), next.begin(), next.end());
+    }
+    DecodedInstruction exit;
+    exit.operation = "br";
+    exit.targets = {counted->exit};
+    code.push_back(encodeInstruction(exit));
+    header.instructions = code;
+    cfg_.blocks.erase(cfg_.blocks.begin() + counted->body);
+    cfg_.reindex();
+    return true;
+  }
+
+  if (trips < 2 * kUnrollFactor || size * kUnrollFactor > kMaximumUnrolledSize) {
+    return false;
+  }
+
+  // A copy of the loop running kUnrollFactor iterations per round up to the
+  // last whole round, then the original loop finishes the rest
+  long long limit =
+      *start + static_cast<long long>(trips / kUnrollFactor * kUnrollFactor);
+  BasicBlock unrolledHeader;
+  BasicBlock unrolledBody;
+  unrolledHeader.label = freshLabel(header.label + "_unrolled");
+  unrolledBody.label = freshLabel(body.label + "_unrolled");
+
+  compare.operands[1] = std::to_string(limit);
+  headerCode.push_back(compare);
+  unrolledHeader.instructions = copy(headerCode, counted->counter, nullptr);
+  DecodedInstruction test = decodeInstruction(*unrolledHeader.instructions.back());
+  DecodedInstruction branch;
+  branch.operation = "br";
+  branch.operands = {test.result};
+  branch.targets = {unrolledBody.label, header.label};
+  unrolledHeader.instructions.push_back(encodeInstruction(branch));
+
+  for (unsigned long long k = 0; k < kUnrollFactor; k++) {
+    std::vector<std::shared_ptr<Instruction>> next =
+        copy(bodyCode, counted->counter, nullptr);
+    unrolledBody.instructions.insert(unrolledBody.instructions.end(),
+                                     next.begin(), next.end());
+  }
+  DecodedInstruction back;
+  back.operation = "br";
+  back.targets = {unrolledHeader.label};
+  unrolledBody.instructions.push_back(encodeInstruction(back));
+
+  std::shared_ptr<Instruction> &entry =
+      cfg_.blocks[preheader].instructions.back();
+  DecodedInstruction decoded = decodeInstruction(*entry);
+  std::replace(decoded.targets.begin(), decoded.targets.end(), header.label,
+               unrolledHeader.label);
+  entry = encodeInstruction(decoded);
+
+  unrolled_.insert(header.label);
+  int position = counted->header;
+  cfg_.blocks.insert(cfg_.blocks.begin() + position,
+                     {unrolledHeader, unrolledBody});
+  cfg_.reindex();
+  return true;
+}
+
+std::string LoopUnroller::freshTemporary() {
+  return "%t" + std::to_string(nextTemporary_++);
+}
+
+std::string LoopUnroller::freshLabel(const std::string &base) const {
+  std::string label = base;
+  for (int k = 1; cfg_.findBlock(label) >= 0; k++) {
+    label = base + std::to_string(k);
+  }
+  return label;
+}
+
+bool LoopUnroller::run() {
+  bool changed = false;
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    preds_ = cfg_.predecessors();
+    for (const Loop &loop : analyses_.loops()) {
+      if (unroll(loop)) {
+        progress = changed = true;
+        break;
+      }
+    }
+    if (progress) {
+      analyses_.invalidate();
+    }
+  }
+  return changed;
+}
+
+} // namespace
+
+bool unrollLoops(ControlFlowGraph &cfg, AnalysisManager &analyses) {
+  cfg.makeFallthroughsExplicit();
+  bool changed = LoopUnroller(cfg, analyses).run();
+  cfg.removeFallthroughBranches();
+  return changed;
+}
@@ -0,0 +1,431 @@
+#include "vm.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+namespace {
+
+// A zero divisor, or the one quotient that does not fit, ends the program
+// like a failed bounds check
+int divisionError(int64_t dividend, int64_t divisor) {
+  std::fflush(stdout);
+  if (divisor == 0) {
+    std::fprintf(stderr, "Runtime error: division by zero\n");
+  } else {
+    std::fprintf(stderr, "Runtime error: integer overflow in %lld / %lld\n",
+                 static_cast<long long>(dividend),
+                 static_cast<long long>(divisor));
+  }
+  return 1;
+}
+
+} // namespace
+
+VirtualMachine::VirtualMachine(const BytecodeProgram &program)
+    : program_(program) {
+  for (const BytecodeFunction &function : program.functions) {
+    std::vector<Value> constants = function.constants;
+    for (uint32_t k : function.stringConstants) {
+      constants[k].s = &program.strings[function.constants[k].i];
+    }
+    constants_.push_back(std::move(constants));
+  }
+}
+
+int VirtualMachine::run() {
+  if (program_.functions.empty()) {
+    return 0;
+  }
+  const BytecodeFunction *function = &program_.functions[0];
+  stack_.assign(function->registerCount, Value{0});
+  calls_.clear();
+  counters_.assign(program_.counterCount, 0);
+  arrays_.clear();
+  std::copy(constants_[0].begin(), constants_[0].end(),
+            stack_.begin() + function->constantBase);
+
+  size_t base = 0;
+  Value *r = stack_.data();
+  const BytecodeInstruction *code = program_.code.data();
+  const BytecodeInstruction *pc = code + function->entry;
+
+#if defined(__GNUC__)
+  // Threaded dispatch: every handler jumps straight to the next handler
+  static void *const handlers[] = {
+      &&op_MOVE,       &&op_SELECT,    &&op_INC_INT,   &&op_DEC_INT,
+      &&op_INC_FLOAT,  &&op_DEC_FLOAT, &&op_TO_FLOAT,  &&op_ADD_INT,
+      &&op_SUB_INT,    &&op_MUL_INT,   &&op_DIV_INT,   &&op_MOD_INT,
+      &&op_POW_INT,    &&op_SHL_INT,   &&op_SHR_INT,   &&op_AND_INT,
+      &&op_ADD_FLOAT,  &&op_SUB_FLOAT, &&op_MUL_FLOAT, &&op_DIV_FLOAT,
+      &&op_POW_FLOAT,  &&op_EQ_INT,    &&op_NE_INT,    &&op_LT_INT,
+      &&op_LE_INT,     &&op_GT_INT,    &&op_GE_INT,    &&op_EQ_FLOAT,
+      &&op_NE_FLOAT,   &&op_LT_FLOAT,  &&op_LE_FLOAT,  &&op_GT_FLOAT,
+      &&op_GE_FLOAT,   &&op_EQ_STRING, &&op_NE_STRING, &&op_LT_STRING,
+      &&op_LE_STRING,  &&op_GT_STRING, &&op_GE_STRING, &&op_NEW_ARRAY,
+      &&op_LENGTH,     &&op_LOAD_ELEMENT, &&op_STORE_ELEMENT,
+      &&op_CHECK_INDEX, &&op_JUMP,
+      &&op_JUMP_IF,    &&op_JUMP_IF_NOT, &&op_SWITCH,  &&op_COUNTER,
+      &&op_OUT_INT,    &&op_OUT_FLOAT, &&op_OUT_STRING, &&op_OUT_CHAR,
+      &&op_OUT_BOOL,   &&op_CALL,      &&op_ARGS,      &&op_RET,
+      &&op_HALT,
+  };
+  static_assert(sizeof(handlers) / sizeof(handlers[0]) ==
+                    static_cast<size_t>(Opcode::COUNT),
+                "every opcode needs a handler");
+
+#define CASE(name) op_##name:
+#define DISPATCH() goto *handlers[static_cast<uint16_t>(pc->opcode)]
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ++pc;                                                                      \
+    DISPATCH();                                                                \
+  } while (0)
+#define JUMP_TO(target)                                                        \
+  do {                                                                         \
+    pc = code + (target);                                                      \
+    DISPATCH();                                                                \
+  } while (0)
+
+  DISPATCH();
+#else
+#define CASE(name) case Opcode::name:
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ++pc;                                                                      \
+    goto dispatch;                                                             \
+  } while (0)
+#define JUMP_TO(target)                                                        \
+  do {                                                                         \
+    pc = code + (target);                                                      \
+    goto dispatch;                                                             \
+  } while (0)
+
+dispatch:
+  switch (pc->opcode) {
+#endif
+
+  CASE(MOVE) {
+    r[pc->a] = r[pc->b];
+    NEXT();
+  }
+  CASE(SELECT) {
+    r[pc->a] = r[pc->b].i != 0 ? r[pc->c] : r[pc[1].a];
+    ++pc; // past the ARGS word
+    NEXT();
+  }
+  CASE(INC_INT) {
+    r[pc->a].i = r[pc->b].i + 1;
+    NEXT();
+  }
+  CASE(DEC_INT) {
+    r[pc->a].i = r[pc->b].i - 1;
+    NEXT();
+  }
+  CASE(INC_FLOAT) {
+    r[pc->a].f = r[pc->b].f + 1.0;
+    NEXT();
+  }
+  CASE(DEC_FLOAT) {
+    r[pc->a].f = r[pc->b].f - 1.0;
+    NEXT();
+  }
+  CASE(TO_FLOAT) {
+    r[pc->a].f = static_cast<double>(r[pc->b].i);
+    NEXT();
+  }
+  // Int arithmetic wraps around like the native code
+  CASE(ADD_INT) {
+    r[pc->a].i = static_cast<int64_t>(static_cast<uint64_t>(r[pc->b].i) +
+                                      static_cast<uint64_t>(r[pc->c].i));
+    NEXT();
+  }
+  CASE(SUB_INT) {
+    r[pc->a].i = static_cast<int64_t>(static_cast<uint64_t>(r[pc->b].i) -
+                                      static_cast<uint64_t>(r[pc->c].i));
+    NEXT();
+  }
+  CASE(MUL_INT) {
+    r[pc->a].i = static_cast<int64_t>(static_cast<uint64_t>(r[pc->b].i) *
+                                      static_cast<uint64_t>(r[pc->c].i));
+    NEXT();
+  }
+  CASE(DIV_INT) {
+    int64_t dividend = r[pc->b].i;
+    int64_t divisor = r[pc->c].i;
+    if (divisor == 0 || (divisor == -1 && dividend == INT64_MIN)) {
+      return divisionError(dividend, divisor);
+    }
+    r[pc->a].i = dividend / divisor;
+    NEXT();
+  }
+  CASE(MOD_INT) {
+    int64_t divisor = r[pc->c].i;
+    if (divisor == 0) {
+      return divisionError(r[pc->b].i, divisor);
+    }
+    // INT64_MIN % -1 traps in hardware, the remainder of any x / -1 is 0
+    r[pc->a].i = divisor == -1 ? 0 : r[pc->b].i % divisor;
+    NEXT();
+  }
+  CASE(POW_INT) {
+    // Square and multiply, the order strength reduction unrolls
+    uint64_t result = 1;
+    uint64_t base = static_cast<uint64_t>(r[pc->b].i);
+    for (int64_t n = r[pc->c].i; n > 0; n >>= 1) {
+      if (n & 1) {
+        result *= base;
+      }
+      base *= base;
+    }
+    r[pc->a].i = static_cast<int64_t>(result);
+    NEXT();
+  }
+  CASE(SHL_INT) {
+    r[pc->a].i = static_cast<int64_t>(static_cast<uint64_t>(r[pc->b].i)
+                                      << (r[pc->c].i & 63));
+    NEXT();
+  }
+  CASE(SHR_INT) {
+    r[pc->a].i = r[pc->b].i >> (r[pc->c].i & 63);
+    NEXT();
+  }
+  CASE(AND_INT) {
+    r[pc->a].i = r[pc->b].i & r[pc->c].i;
+    NEXT();
+  }
+  CASE(ADD_FLOAT) {
+    r[pc->a].f = r[pc->b].f + r[pc->c].f;
+    NEXT();
+  }
+  CASE(SUB_FLOAT) {
+    r[pc->a].f = r[pc->b].f - r[pc->c].f;
+    NEXT();
+  }
+  CASE(MUL_FLOAT) {
+    r[pc->a].f = r[pc->b].f * r[pc->c].f;
+    NEXT();
+  }
+  CASE(DIV_FLOAT) {
+    r[pc->a].f = r[pc->b].f / r[pc->c].f;
+    NEXT();
+  }
+  CASE(POW_FLOAT) {
+    double result = 1.0;
+    double base = r[pc->b].f;
+    for (int64_t n = r[pc->c].i; n > 0; n >>= 1) {
+      if (n & 1) {
+        result *= base;
+      }
+      base *= base;
+    }
+    r[pc->a].f = result;
+    NEXT();
+  }
+  CASE(EQ_INT) {
+    r[pc->a].i = r[pc->b].i == r[pc->c].i;
+    NEXT();
+  }
+  CASE(NE_INT) {
+    r[pc->a].i = r[pc->b].i != r[pc->c].i;
+    NEXT();
+  }
+  CASE(LT_INT) {
+    r[pc->a].i = r[pc->b].i < r[pc->c].i;
+    NEXT();
+  }
+  CASE(LE_INT) {
+    r[pc->a].i = r[pc->b].i <= r[pc->c].i;
+    NEXT();
+  }
+  CASE(GT_INT) {
+    r[pc->a].i = r[pc->b].i > r[pc->c].i;
+    NEXT();
+  }
+  CASE(GE_INT) {
+    r[pc->a].i = r[pc->b].i >= r[pc->c].i;
+    NEXT();
+  }
+  CASE(EQ_FLOAT) {
+    r[pc->a].i = r[pc->b].f == r[pc->c].f;
+    NEXT();
+  }
+  CASE(NE_FLOAT) {
+    r[pc->a].i = r[pc->b].f != r[pc->c].f;
+    NEXT();
+  }
+  CASE(LT_FLOAT) {
+    r[pc->a].i = r[pc->b].f < r[pc->c].f;
+    NEXT();
+  }
+  CASE(LE_FLOAT) {
+    r[pc->a].i = r[pc->b].f <= r[pc->c].f;
+    NEXT();
+  }
+  CASE(GT_FLOAT) {
+    r[pc->a].i = r[pc->b].f > r[pc->c].f;
+    NEXT();
+  }
+  CASE(GE_FLOAT) {
+    r[pc->a].i = r[pc->b].f >= r[pc->c].f;
+    NEXT();
+  }
+  CASE(EQ_STRING) {
+    r[pc->a].i = *r[pc->b].s == *r[pc->c].s;
+    NEXT();
+  }
+  CASE(NE_STRING) {
+    r[pc->a].i = *r[pc->b].s != *r[pc->c].s;
+    NEXT();
+  }
+  CASE(LT_STRING) {
+    r[pc->a].i = *r[pc->b].s < *r[pc->c].s;
+    NEXT();
+  }
+  CASE(LE_STRING) {
+    r[pc->a].i = *r[pc->b].s <= *r[pc->c].s;
+    NEXT();
+  }
+  CASE(GT_STRING) {
+    r[pc->a].i = *r[pc->b].s > *r[pc->c].s;
+    NEXT();
+  }
+  CASE(GE_STRING) {
+    r[pc->a].i = *r[pc->b].s >= *r[pc->c].s;
+    NEXT();
+  }
+  CASE(NEW_ARRAY) {
+    int64_t length = r[pc->b].i;
+    if (length < 0) {
+      std::fflush(stdout);
+      std::fprintf(stderr, "Runtime error: negative array length %lld\n",
+                   static_cast<long long>(length));
+      return 1;
+    }
+    arrays_.emplace_back(new Value[length + 1]());
+    arrays_.back()[0].i = length;
+    r[pc->a].a = arrays_.back().get() + 1;
+    NEXT();
+  }
+  CASE(LENGTH) {
+    r[pc->a].i = r[pc->b].a[-1].i;
+    NEXT();
+  }
+  CASE(LOAD_ELEMENT) {
+    r[pc->a] = r[pc->b].a[r[pc->c].i];
+    NEXT();
+  }
+  CASE(STORE_ELEMENT) {
+    r[pc->a].a[r[pc->b].i] = r[pc->c];
+    NEXT();
+  }
+  CASE(CHECK_INDEX) {
+    int64_t length = r[pc->b].a[-1].i;
+    // A negative index compares as a huge unsigned one
+    if (static_cast<uint64_t>(r[pc->a].i) >= static_cast<uint64_t>(length)) {
+      std::fflush(stdout);
+      std::fprintf(stderr,
+                   "Runtime error: index %lld out of bounds for length %lld\n",
+                   static_cast<long long>(r[pc->a].i),
+                   static_cast<long long>(length));
+      return 1;
+    }
+    NEXT();
+  }
+  CASE(JUMP) { JUMP_TO(pc->target()); }
+  CASE(JUMP_IF) {
+    if (r[pc->a].i != 0) {
+      JUMP_TO(pc->target());
+    }
+    NEXT();
+  }
+  CASE(JUMP_IF_NOT) {
+    if (r[pc->a].i == 0) {
+      JUMP_TO(pc->target());
+    }
+    NEXT();
+  }
+  CASE(SWITCH) {
+    uint64_t index =
+        static_cast<uint64_t>(r[pc->a].i) - static_cast<uint64_t>(r[pc->b].i);
+    JUMP_TO(pc[index < pc->c ? index + 2 : 1].target());
+  }
+  CASE(COUNTER) {
+    counters_[pc->target()]++;
+    NEXT();
+  }
+  CASE(OUT_INT) {
+    std::printf("%lld\n", static_cast<long long>(r[pc->a].i));
+    NEXT();
+  }
+  CASE(OUT_FLOAT) {
+    std::printf("%g\n", r[pc->a].f);
+    NEXT();
+  }
+  CASE(OUT_STRING) {
+    const std::string &value = *r[pc->a].s;
+    std::fwrite(value.data(), 1, value.size(), stdout);
+    std::fputc('\n', stdout);
+    NEXT();
+  }
+  CASE(OUT_CHAR) {
+    std::printf("%c\n", static_cast<char>(r[pc->a].i));
+    NEXT();
+  }
+  CASE(OUT_BOOL) {
+    std::puts(r[pc->a].i != 0 ? "true" : "false");
+    NEXT();
+  }
+  CASE(CALL) {
+    const BytecodeFunction &callee = program_.functions[pc->b];
+    size_t calleeBase = base + function->registerCount;
+    if (stack_.size() < calleeBase + callee.registerCount) {
+      stack_.resize(std::max(stack_.size() * 2,
+                             calleeBase + callee.registerCount));
+      r = stack_.data() + base;
+    }
+    Value *frame = stack_.data() + calleeBase;
+
+    const BytecodeInstruction *args = pc + 1;
+    for (uint16_t k = 0; k < pc->c; k++) {
+      const BytecodeInstruction &word = args[k / 3];
+      uint16_t source = k % 3 == 0 ? word.a : k % 3 == 1 ? word.b : word.c;
+      frame[callee.argumentBase + k] = r[source];
+    }
+    std::copy(constants_[pc->b].begin(), constants_[pc->b].end(),
+              frame + callee.constantBase);
+
+    calls_.push_back({args + (pc->c + 2) / 3, base,
+                      static_cast<uint16_t>(function - &program_.functions[0]),
+                      pc->a});
+    function = &callee;
+    base = calleeBase;
+    r = frame;
+    JUMP_TO(callee.entry);
+  }
+  CASE(ARGS) { NEXT(); }
+  CASE(RET) {
+    Value value = r[pc->a];
+    CallFrame caller = calls_.back();
+    calls_.pop_back();
+    function = &program_.functions[caller.function];
+    base = caller.base;
+    r = stack_.data() + base;
+    r[caller.result] = value;
+    JUMP_TO(caller.returnPc - code);
+  }
+  CASE(HALT) {
+    std::fflush(stdout);
+    return 0;
+  }
+
+#if !defined(__GNUC__)
+  default:
+    return 0;
+  }
+#endif
+
+#undef CASE
+#undef NEXT
+#undef JUMP_TO
+#undef DISPATCH
+}
@@ -0,0 +1,799 @@
+#include "x86backend.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const std::vector<X86Register> calleeSavedRegisters = {
+    X86Register::RBX, X86Register::R12, X86Register::R13, X86Register::R14,
+    X86Register::R15};
+
+long long doubleBits(const std::string &literal) {
+  double value = std::strtod(literal.c_str(), nullptr);
+  long long bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+X86Condition condition(const std::string &op) {
+  return op == "cmp"   ? X86Condition::E
+         : op == "neq" ? X86Condition::NE
+         : op == "lt"  ? X86Condition::L
+         : op == "le"  ? X86Condition::LE
+         : op == "gt"  ? X86Condition::G
+                       : X86Condition::GE;
+}
+
+const X86Register argumentRegisters[] = {X86Register::RDI, X86Register::RSI,
+                                         X86Register::RDX, X86Register::RCX,
+                                         X86Register::R8,  X86Register::R9};
+
+} // namespace
+
+std::string functionLabel(const std::string &name) { return name + ".entry"; }
+
+X86Backend::X86Backend(const Module &module) : module_(module) {}
+
+std::string X86Backend::emitAssembly() {
+  AssemblyEmitter emitter;
+  lower(emitter);
+
+  std::ostringstream assembly;
+  assembly << "\t.section .rodata\n"
+           << emitter.data() << "\t.text\n"
+           << "\t.globl main\n"
+           << "\t.type main, @function\n"
+           << "main:\n"
+           << emitter.text() << "\t.size main, .-main\n"
+           << "\t.section .note.GNU-stack,\"\",@progbits\n";
+  return assembly.str();
+}
+
+bool X86Backend::buildExecutable(const std::string &outputFile) {
+  std::string assemblyFile = outputFile + ".tmp.s";
+  std::ofstream out(assemblyFile);
+  if (!out.is_open()) {
+    std::cerr << "Error: Could not write " << assemblyFile << std::endl;
+    return false;
+  }
+  out << emitAssembly();
+  out.close();
+
+  std::string command = "cc -o '" + outputFile + "' '" + assemblyFile + "'";
+  int status = std::system(command.c_str());
+  std::remove(assemblyFile.c_str());
+
+  if (status != 0) {
+    std::cerr << "Error: Linking " << outputFile << " failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void X86Backend::lower(X86Emitter &emitter) {
+  out_ = &emitter;
+  for (const Function &function : module_.functions) {
+    lowerFunction(function);
+  }
+  out_ = nullptr;
+}
+
+void X86Backend::lowerFunction(const Function &function) {
+  cfg_ = &function.cfg;
+  function_ = function.name;
+  allocation_ = RegisterAllocator(RegisterFile::x86_64()).allocate(*cfg_);
+  types_ = inferTemporaryTypes(*cfg_);
+  frameOffsets_.clear();
+  parameterOffsets_.clear();
+  parameterIndex_.clear();
+  savedRegisters_.clear();
+  liveCallerSaved_.clear();
+  powerLoops_ = 0;
+  divisions_ = 0;
+  outOfBounds_ = false;
+  negativeLength_ = false;
+  divisionByZero_ = false;
+  divisionOverflow_ = false;
+
+  auto allocated = [this](X86Register reg) {
+    for (const auto &entry : allocation_.registers) {
+      if (x86Register(entry.second) == reg) {
+        return true;
+      }
+    }
+    return false;
+  };
+  for (X86Register reg : calleeSavedRegisters) {
+    if (allocated(reg)) {
+      savedRegisters_.push_back(reg);
+    }
+  }
+  for (const auto &name : RegisterFile::x86_64().callerSaved) {
+    if (allocated(x86Register(name))) {
+      liveCallerSaved_.push_back(x86Register(name));
+    }
+  }
+
+  // Frame: saved registers, one slot per alloc, the spill slots, then the
+  // incoming arguments
+  int base = 8 * static_cast<int>(savedRegisters_.size());
+  int slots = 0;
+  for (const auto &block : cfg_->blocks) {
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      if (decoded.operation == "alloc" && !frameOffsets_.count(decoded.result)) {
+        frameOffsets_[decoded.result] = -(base + 8 * ++slots);
+      } else if (decoded.operation == "param") {
+        size_t index = parameterIndex_.size();
+        parameterIndex_[decoded.result] = index;
+      }
+    }
+  }
+  for (const auto &spill : allocation_.spillSlots) {
+    frameOffsets_[spill.first] = -(base + 8 * (slots + spill.second + 1));
+  }
+  size_t parameters = function.signature.parameterTypes.size();
+  for (size_t i = 0; i < parameters; i++) {
+    parameterOffsets_.push_back(
+        -(base + 8 * (static_cast<int>(frameOffsets_.size() + i) + 1)));
+  }
+
+  if (function_ != "main") {
+    out_->label(functionLabel(function_));
+  }
+  emitPrologue(parameters);
+  for (size_t b = 0; b < cfg_->blocks.size(); b++) {
+    const BasicBlock &block = cfg_->blocks[b];
+    if (!block.label.empty()) {
+      out_->label(blockLabel(block.label));
+    }
+    for (const auto &instr : block.instructions) {
+      emitInstruction(decodeInstruction(*instr), b);
+    }
+  }
+  emitEpilogue();
+  emitRuntimeErrors();
+}
+
+void X86Backend::emitPrologue(size_t parameters) {
+  out_->push(X86Register::RBP);
+  out_->mov(X86Operand::of(X86Register::RBP), X86Operand::of(X86Register::RSP));
+  for (X86Register reg : savedRegisters_) {
+    out_->push(reg);
+  }
+
+  int frame = 8 * static_cast<int>(frameOffsets_.size() + parameters);
+  if ((frame + 8 * savedRegisters_.size()) % 16 != 0) {
+    frame += 8;
+  }
+  if (frame > 0) {
+    out_->sub(X86Register::RSP, frame);
+  }
+
+  for (size_t i = 0; i < parameters; i++) {
+    out_->mov(X86Operand::frame(parameterOffsets_[i]),
+              X86Operand::of(argumentRegisters[i]));
+  }
+
+  // Slots start out zero as in the VM; if-conversion may read a slot on a
+  // path that never stored it
+  bool zeroed = false;
+  for (const auto &block : cfg_->blocks) {
+    for (const auto &instr : block.instructions) {
+      DecodedInstruction decoded = decodeInstruction(*instr);
+      if (decoded.operation != "alloc") {
+        continue;
+      }
+      if (!zeroed) {
+        out_->zero(X86Register::RAX);
+        zeroed = true;
+      }
+      out_->mov(X86Operand::frame(frameOffsets_[decoded.result]),
+                X86Operand::of(X86Register::RAX));
+    }
+  }
+}
+
+void X86Backend::emitEpilogue() {
+  // Falling off the end returns 0, a ret elsewhere jumps past this
+  std::shared_ptr<Instruction> last = cfg_->blocks.back().terminator();
+  if (last == nullptr || decodeInstruction(*last).operation != "ret") {
+    out_->zero(X86Register::RAX);
+  }
+  out_->label(function_ + ".return");
+  out_->lea(X86Register::RSP,
+            X86Operand::frame(-8 * static_cast<int>(savedRegisters_.size())));
+  for (auto it = savedRegisters_.rbegin(); it != savedRegisters_.rend(); ++it) {
+    out_->pop(*it);
+  }
+  out_->pop(X86Register::RBP);
+  out_->ret();
+}
+
+void X86Backend::emitInstruction(const DecodedInstruction &instr, size_t block) {
+  const std::string &op = instr.operation;
+
+  if (op == "alloc") {
+    return;
+  } else if (op == "store") {
+    loadValue(instr.operands[0], X86Register::RAX);
+    out_->mov(X86Operand::frame(frameOffsets_[instr.operands[1]]),
+              X86Operand::of(X86Register::RAX));
+  } else if (op == "load") {
+    X86Operand target = location(instr.result);
+    if (target.kind == X86Operand::None) {
+      return;
+    }
+    X86Operand source = X86Operand::frame(frameOffsets_[instr.operands[0]]);
+    if (target.kind == X86Operand::Register) {
+      out_->mov(target, source);
+    } else {
+      out_->mov(X86Operand::of(X86Register::RAX), source);
+      storeResult(instr.result, X86Register::RAX);
+    }
+  } else if (op == "inc" || op == "dec") {
+    X86Operand target = location(instr.result);
+    if (typeOf(instr.operands[0]) == "float") {
+      loadDouble(instr.operands[0], 0);
+      loadDouble("1.0", 1);
+      op == "inc" ? out_->addsd(0, 1) : out_->subsd(0, 1);
+      out_->movFromXmm(X86Register::RAX, 0);
+      storeResult(instr.result, X86Register::RAX);
+    } else if (target == location(instr.operands[0]) &&
+               target.kind == X86Operand::Register) {
+      op == "inc" ? out_->add(target.reg, 1) : out_->sub(target.reg, 1);
+    } else {
+      loadValue(instr.operands[0], X86Register::RAX);
+      op == "inc" ? out_->add(X86Register::RAX, 1)
+                  : out_->sub(X86Register::RAX, 1);
+      storeResult(instr.result, X86Register::RAX);
+    }
+  } else if (op == "br") {
+    emitBranch(instr, block);
+  } else if (op == "switch") {
+    emitSwitch(instr);
+  } else if (op == "select") {
+    emitSelect(instr);
+  } else if (op == "count") {
+    out_->incrementCounter(static_cast<uint32_t>(
+        std::strtoul(instr.attribute.c_str(), nullptr, 10)));
+  } else if (op == "call" && instr.attribute == "out") {
+    emitOut(instr.operands.empty() ? "\"\"" : instr.operands[0]);
+  } else if (op == "call") {
+    emitCall(instr);
+  } else if (op == "param") {
+    auto index = parameterIndex_.find(instr.result);
+    if (location(instr.result).kind != X86Operand::None &&
+        index != parameterIndex_.end() &&
+        index->second < parameterOffsets_.size()) {
+      out_->mov(X86Operand::of(X86Register::RAX),
+                X86Operand::frame(parameterOffsets_[index->second]));
+      storeResult(instr.result, X86Register::RAX);
+    }
+  } else if (op == "ret") {
+    emitReturn(instr, block);
+  } else if (op == "cmp" || op == "neq" || op == "lt" || op == "gt" ||
+             op == "le" || op == "ge") {
+    emitCompare(instr);
+  } else if (op == "newarray") {
+    emitNewArray(instr);
+  } else if (op == "length" || op == "elem" || op == "setelem" ||
+             op == "check") {
+    emitArray(instr);
+  } else if (op == "pow") {
+    emitPower(instr);
+  } else if (op == "add" || op == "sub" || op == "mul" || op == "div" ||
+             op == "mod" || op == "shl" || op == "shr" || op == "and") {
+    emitArithmetic(instr);
+  } else {
+    std::cerr << "x86 backend: unsupported operation '" << op << "'"
+              << std::endl;
+  }
+}
+
+void X86Backend::emitCompare(const DecodedInstruction &instr) {
+  const std::string &op = instr.operation;
+  std::string lhs = instr.operands[0];
+  std::string rhs = instr.operands[1];
+  std::string type = comparisonType(instr, types_);
+
+  if (type == "string") {
+    saveCallerSaved();
+    loadValue(lhs, X86Register::RDI);
+    loadValue(rhs, X86Register::RSI);
+    out_->call("strcmp");
+    restoreCallerSaved();
+    // strcmp returns an int; against zero, test is the same as cmp
+    out_->movsx32(X86Register::RAX);
+    out_->test(X86Register::RAX);
+    out_->set(condition(op), X86Register::RAX);
+  } else if (type == "float") {
+    // Less-than compares are swapped so that unordered operands are false
+    if (op == "lt" || op == "le") {
+      std::swap(lhs, rhs);
+    }
+    loadDouble(lhs, 0);
+    loadDouble(rhs, 1);
+    out_->ucomisd(0, 1);
+    if (op == "cmp") {
+      out_->set(X86Condition::E, X86Register::RAX);
+      out_->set(X86Condition::NP, X86Register::R11);
+      out_->and8(X86Register::RAX, X86Register::R11);
+    } else if (op == "neq") {
+      out_->set(X86Condition::NE, X86Register::RAX);
+      out_->set(X86Condition::P, X86Register::R11);
+      out_->or8(X86Register::RAX, X86Register::R11);
+    } else if (op == "lt" || op == "gt") {
+      out_->set(X86Condition::A, X86Register::RAX);
+    } else {
+      out_->set(X86Condition::AE, X86Register::RAX);
+    }
+  } else {
+    loadValue(lhs, X86Register::RAX);
+    loadValue(rhs, X86Register::R11);
+    out_->cmp(X86Operand::of(X86Register::RAX), X86Operand::of(X86Register::R11));
+    out_->set(condition(op), X86Register::RAX);
+  }
+
+  out_->movzx8(X86Register::RAX);
+  storeResult(instr.result, X86Register::RAX);
+}
+
+void X86Backend::emitArithmetic(const DecodedInstruction &instr) {
+  const std::string &op = instr.operation;
+  const std::string &lhs = instr.operands[0];
+  const std::string &rhs = instr.operands[1];
+
+  if (typeOf(lhs) == "float" || typeOf(rhs) == "float") {
+    loadDouble(lhs, 0);
+    loadDouble(rhs, 1);
+    if (op == "add") {
+      out_->addsd(0, 1);
+    } else if (op == "sub") {
+      out_->subsd(0, 1);
+    } else if (op == "mul") {
+      out_->mulsd(0, 1);
+    } else if (op == "div") {
+      out_->divsd(0, 1);
+    } else {
+      std::cerr << "x86 backend: no float form of '" << op << "'" << std::endl;
+    }
+    out_->movFromXmm(X86Register::RAX, 0);
+    storeResult(instr.result, X86Register::RAX);
+    return;
+  }
+
+  loadValue(lhs, X86Register::RAX);
+  if (op == "shl" || op == "shr") {
+    // Only strength reduction shifts, always by a constant
+    if (literalType(rhs) != "int") {
+      std::cerr << "x86 backend: shift by a variable amount" << std::endl;
+      return;
+    }
+    uint8_t count =
+        static_cast<uint8_t>(std::strtoll(rhs.c_str(), nullptr, 10) & 63);
+    op == "shl" ? out_->shl(X86Register::RAX, count)
+                : out_->sar(X86Register::RAX, count);
+    storeResult(instr.result, X86Register::RAX);
+    return;
+  }
+
+  loadValue(rhs, X86Register::R11);
+  if (op == "add") {
+    out_->add(X86Register::RAX, X86Register::R11);
+  } else if (op == "sub") {
+    out_->sub(X86Register::RAX, X86Register::R11);
+  } else if (op == "mul") {
+    out_->imul(X86Register::RAX, X86Register::R11);
+  } else if (op == "and") {
+    out_->and64(X86Register::RAX, X86Register::R11);
+  } else {
+    emitDivision(instr);
+  }
+  storeResult(instr.result, X86Register::RAX);
+}
+
+// rax / r11 or rax % r11 into rax. idiv traps on a zero divisor and on
+// INT64_MIN / -1, so unless the divisor is another constant, zero goes to
+// a stub and -1 is a negation whose overflow goes to another.
+void X86Backend::emitDivision(const DecodedInstruction &instr) {
+  const std::string &rhs = instr.operands[1];
+  long long constant = std::strtoll(rhs.c_str(), nullptr, 10);
+  bool checked = literalType(rhs) != "int" || constant == 0 || constant == -1;
+  std::string divide = function_ + ".div" + std::to_string(divisions_);
+  std::string done = function_ + ".divdone" + std::to_string(divisions_++);
+
+  if (checked) {
+    out_->test(X86Register::R11);
+    out_->jcc(X86Condition::E, function_ + ".divzero");
+    divisionByZero_ = true;
+    out_->cmp(X86Operand::of(X86Register::R11), X86Operand::immediate(-1));
+    out_->jcc(X86Condition::NE, divide);
+    if (instr.operation == "div") {
+      out_->imul(X86Register::RAX, X86Register::R11);
+      out_->jcc(X86Condition::O, function_ + ".overflow");
+      divisionOverflow_ = true;
+    } else {
+      out_->zero(X86Register::RAX);
+    }
+    out_->jmp(done);
+    out_->label(divide);
+  }
+
+  // idiv takes rdx as well, which may hold a temporary
+  out_->mov(X86Operand::of(X86Register::RSI), X86Operand::of(X86Register::RDX));
+  out_->cqo();
+  out_->idiv(X86Register::R11);
+  if (instr.operation == "mod") {
+    out_->mov(X86Operand::of(X86Register::RAX), X86Operand::of(X86Register::RDX));
+  }
+  out_->mov(X86Operand::of(X86Register::RDX), X86Operand::of(X86Register::RSI));
+  if (checked) {
+    out_->label(done);
+  }
+}
+
+// Square and multiply over the bits of the exponent in rsi
+void X86Backend::emitPower(const DecodedInstruction &instr) {
+  bool isFloat = typeOf(instr.operands[0]) == "float";
+  std::string loop = function_ + ".pow" + std::to_string(powerLoops_++);
+
+  if (isFloat) {
+    loadDouble(instr.operands[0], 1);
+    loadDouble("1.0", 0);
+  } else {
+    loadValue(instr.operands[0], X86Register::R11);
+    out_->mov(X86Operand::of(X86Register::RAX), X86Operand::immediate(1));
+  }
+  loadValue(instr.operands[1], X86Register::RSI);
+
+  out_->label(loop);
+  out_->test(X86Register::RSI);
+  out_->jcc(X86Condition::LE, loop + ".done");
+  out_->shr(X86Register::RSI, 1);
+  out_->jcc(X86Condition::AE, loop + ".square");
+  isFloat ? out_->mulsd(0, 1) : out_->imul(X86Register::RAX, X86Register::R11);
+  out_->label(loop + ".square");
+  isFloat ? out_->mulsd(1, 1) : out_->imul(X86Register::R11, X86Register::R11);
+  out_->jmp(loop);
+  out_->label(loop + ".done");
+
+  if (isFloat) {
+    out_->movFromXmm(X86Register::RAX, 0);
+  }
+  storeResult(instr.result, X86Register::RAX);
+}
+
+// Arrays in registers are addressed directly, the element or length goes
+// straight to the result's register
+void X86Backend::emitArray(const DecodedInstruction &instr) {
+  const std::string &op = instr.operation;
+  X86Operand target = location(instr.result);
+  X86Register result =
+      target.kind == X86Operand::Register ? target.reg : X86Register::RAX;
+
+  if (op == "length") {
+    X86Register array = inRegister(instr.operands[0], X86Register::RSI);
+    out_->loadLength(result, array);
+    storeResult(instr.result, result);
+  } else if (op == "elem") {
+    X86Register array = inRegister(instr.operands[0], X86Register::RSI);
+    X86Register index = inRegister(instr.operands[1], X86Register::R11);
+    out_->loadElement(result, array, index);
+    storeResult(instr.result, result);
+  } else if (op == "setelem") {
+    X86Register value = inRegister(instr.operands[0], X86Register::RAX);
+    X86Register array = inRegister(instr.operands[1], X86Register::RSI);
+    X86Register index = inRegister(instr.operands[2], X86Register::R11);
+    out_->storeElement(array, index, value);
+  } else {
+    // An unsigned compare also catches negative indices. The stub reports
+    // the index in rax and the length in r11.
+    X86Register array = inRegister(instr.operands[1], X86Register::RSI);
+    loadValue(instr.operands[0], X86Register::RAX);
+    out_->loadLength(X86Register::R11, array);
+    out_->cmp(X86Operand::of(X86Register::RAX), X86Operand::of(X86Register::R11));
+    out_->jcc(X86Condition::AE, function_ + ".bounds");
+    outOfBounds_ = true;
+  }
+}
+
+// calloc(n + 1, 8) zeroes the elements; the length goes in the first 8
+// bytes and the array points past it
+void X86Backend::emitNewArray(const DecodedInstruction &instr) {
+  loadValue(instr.operands[0], X86Register::RAX);
+  out_->test(X86Register::RAX);
+  out_->jcc(X86Condition::L, function_ + ".length");
+  negativeLength_ = true;
+
+  saveCallerSaved();
+  out_->mov(X86Operand::of(X86Register::RDI), X86Operand::of(X86Register::RAX));
+  out_->add(X86Register::RDI, 1);
+  out_->mov(X86Operand::of(X86Register::RSI), X86Operand::immediate(8));
+  out_->call("calloc");
+  restoreCallerSaved();
+  out_->add(X86Register::RAX, 8);
+  loadValue(instr.operands[0], X86Register::R11);
+  out_->storeLength(X86Register::RAX, X86Register::R11);
+  storeResult(instr.result, X86Register::RAX);
+}
+
+// Stubs after the epilogue for the array and division checks that failed
+void X86Backend::emitRuntimeErrors() {
+  if (outOfBounds_) {
+    out_->label(function_ + ".bounds");
+    emitRuntimeError("Runtime error: index %ld out of bounds for length %ld\n");
+  }
+  if (negativeLength_) {
+    out_->label(function_ + ".length");
+    emitRuntimeError("Runtime error: negative array length %ld\n");
+  }
+  if (divisionByZero_) {
+    out_->label(function_ + ".divzero");
+    emitRuntimeError("Runtime error: division by zero\n");
+  }
+  if (divisionOverflow_) {
+    out_->label(function_ + ".overflow");
+    emitRuntimeError("Runtime error: integer overflow in %ld / %ld\n");
+  }
+}
+
+// Flushes what the program printed, reports rax and r11 with `format` on
+// stderr and exits with status 1. Two pushes keep the stack aligned.
+void X86Backend::emitRuntimeError(const std::string &format) {
+  out_->push(X86Register::RAX);
+  out_->push(X86Register::R11);
+  out_->zero(X86Register::RDI);
+  out_->call("fflush");
+  out_->pop(X86Register::RCX);
+  out_->pop(X86Register::RDX);
+  out_->mov(X86Operand::of(X86Register::RDI), X86Operand::immediate(2));
+  out_->loadString(X86Register::RSI, format);
+  out_->zero(X86Register::RAX);
+  out_->call("dprintf");
+  out_->mov(X86Operand::of(X86Register::RDI), X86Operand::immediate(1));
+  out_->call("exit");
+}
+
+void X86Backend::emitOut(const std::string &value) {
+  std::string type = typeOf(value);
+
+  if (type == "float") {
+    loadDouble(value, 0);
+    out_->loadString(X86Register::RDI, "%g\n");
+    out_->mov(X86Operand::of(X86Register::RAX), X86Operand::immediate(1));
+  } else if (type == "bool") {
+    loadValue(value, X86Register::RAX);
+    out_->loadString(X86Register::RSI, "true");
+    out_->loadString(X86Register::R11, "false");
+    out_->test(X86Register::RAX);
+    out_->cmov(X86Condition::E, X86Register::RSI, X86Register::R11);
+    out_->loadString(X86Register::RDI, "%s\n");
+    out_->zero(X86Register::RAX);
+  } else {
+    loadValue(value, X86Register::RSI);
+    out_->loadString(X86Register::RDI, type == "string" ? "%s\n"
+                                       : type == "char" ? "%c\n"
+                                                        : "%ld\n");
+    out_->zero(X86Register::RAX);
+  }
+  out_->call("printf");
+}
+
+void X86Backend::emitCall(const DecodedInstruction &instr) {
+  if (module_.findFunction(instr.attribute) == nullptr) {
+    std::cerr << "x86 backend: call to unknown function '" << instr.attribute
+              << "'" << std::endl;
+    return;
+  }
+
+  // Arguments may sit in argument registers themselves, so they all go
+  // through the stack before any register is overwritten. Nothing live
+  // across the call is kept in a caller-saved register.
+  for (const auto &argument : instr.operands) {
+    loadValue(argument, X86Register::RAX);
+    out_->push(X86Register::RAX);
+  }
+  for (size_t i = instr.operands.size(); i-- > 0;) {
+    out_->pop(argumentRegisters[i]);
+  }
+  out_->callLabel(functionLabel(instr.attribute));
+  if (!instr.result.empty()) {
+    storeResult(instr.result, X86Register::RAX);
+  }
+}
+
+void X86Backend::emitReturn(const DecodedInstruction &instr, size_t block) {
+  if (instr.operands.empty()) {
+    out_->zero(X86Register::RAX);
+  } else {
+    loadValue(instr.operands[0], X86Register::RAX);
+  }
+  if (block + 1 < cfg_->blocks.size()) {
+    out_->jmp(function_ + ".return");
+  }
+}
+
+void X86Backend::emitBranch(const DecodedInstruction &instr, size_t block) {
+  std::string next =
+      block + 1 < cfg_->blocks.size() ? cfg_->blocks[block + 1].label : "";
+
+  if (instr.operands.empty()) {
+    if (instr.targets[0] != next) {
+      out_->jmp(blockLabel(instr.targets[0]));
+    }
+    return;
+  }
+
+  X86Operand condition = location(instr.operands[0]);
+  if (condition.kind == X86Operand::None) {
+    loadValue(instr.operands[0], X86Register::RAX);
+    condition = X86Operand::of(X86Register::RAX);
+  }
+  if (condition.kind == X86Operand::Register) {
+    out_->test(condition.reg);
+  } else {
+    out_->cmp(condition, X86Operand::immediate(0));
+  }
+
+  const std::string &onTrue = instr.targets[0];
+  const std::string &onFalse = instr.targets[1];
+  if (onTrue == next) {
+    out_->jcc(X86Condition::E, blockLabel(onFalse));
+  } else {
+    out_->jcc(X86Condition::NE, blockLabel(onTrue));
+    if (onFalse != next) {
+      out_->jmp(blockLabel(onFalse));
+    }
+  }
+}
+
+// Both values are loaded and cmov picks one, there is no branch
+void X86Backend::emitSelect(const DecodedInstruction &instr) {
+  const std::string &condition = instr.operands[0];
+  loadValue(instr.operands[2], X86Register::RAX);
+  loadValue(instr.operands[1], X86Register::R11);
+
+  X86Operand flag = location(condition);
+  if (flag.kind == X86Operand::Register) {
+    out_->test(flag.reg);
+  } else if (flag.kind == X86Operand::Frame) {
+    out_->cmp(flag, X86Operand::immediate(0));
+  } else {
+    // A literal or undefined condition is known here
+    if (condition == "true") {
+      out_->mov(X86Operand::of(X86Register::RAX),
+                X86Operand::of(X86Register::R11));
+    }
+    storeResult(instr.result, X86Register::RAX);
+    return;
+  }
+  out_->cmov(X86Condition::NE, X86Register::RAX, X86Register::R11);
+  storeResult(instr.result, X86Register::RAX);
+}
+
+// Values below the table wrap around to large unsigned indices, so one
+// unsigned compare covers both ends
+void X86Backend::emitSwitch(const DecodedInstruction &instr) {
+  long long minimum = std::strtoll(instr.operands[1].c_str(), nullptr, 10);
+  std::vector<std::string> labels;
+  for (size_t i = 1; i < instr.targets.size(); i++) {
+    labels.push_back(blockLabel(instr.targets[i]));
+  }
+
+  loadValue(instr.operands[0], X86Register::RAX);
+  if (minimum != 0) {
+    out_->sub(X86Register::RAX, static_cast<int32_t>(minimum));
+  }
+  out_->mov(X86Operand::of(X86Register::R11),
+            X86Operand::immediate(static_cast<int64_t>(labels.size())));
+  out_->cmp(X86Operand::of(X86Register::RAX), X86Operand::of(X86Register::R11));
+  out_->jcc(X86Condition::AE, blockLabel(instr.targets[0]));
+  out_->jumpTable(X86Register::RAX, X86Register::R11, labels);
+}
+
+void X86Backend::loadValue(const std::string &value, X86Register reg) {
+  if (isTemporary(value)) {
+    X86Operand source = location(value);
+    if (source.kind == X86Operand::None) {
+      source = X86Operand::immediate(0);
+    }
+    if (source != X86Operand::of(reg)) {
+      out_->mov(X86Operand::of(reg), source);
+    }
+    return;
+  }
+
+  std::string type = literalType(value);
+  if (type == "string") {
+    out_->loadString(reg, module_.stringConstant(value));
+    return;
+  }
+
+  long long immediate = 0;
+  if (type == "float") {
+    immediate = doubleBits(value);
+  } else if (type == "char") {
+    immediate = charLiteralCode(value);
+  } else if (type == "bool") {
+    immediate = value == "true" ? 1 : 0;
+  } else if (type == "int") {
+    immediate = std::strtoll(value.c_str(), nullptr, 10);
+  }
+  out_->mov(X86Operand::of(reg), X86Operand::immediate(immediate));
+}
+
+X86Register X86Backend::inRegister(const std::string &value,
+                                   X86Register scratch) {
+  X86Operand source = location(value);
+  if (isTemporary(value) && source.kind == X86Operand::Register) {
+    return source.reg;
+  }
+  loadValue(value, scratch);
+  return scratch;
+}
+
+void X86Backend::loadDouble(const std::string &value, int xmm) {
+  loadValue(value, X86Register::RAX);
+  if (typeOf(value) == "float") {
+    out_->movToXmm(xmm, X86Register::RAX);
+  } else {
+    out_->cvtsi2sd(xmm, X86Register::RAX);
+  }
+}
+
+void X86Backend::storeResult(const std::string &temporary, X86Register reg) {
+  X86Operand target = location(temporary);
+  if (target.kind != X86Operand::None && target != X86Operand::of(reg)) {
+    out_->mov(target, X86Operand::of(reg));
+  }
+}
+
+X86Operand X86Backend::location(const std::string &temporary) const {
+  auto reg = allocation_.registers.find(temporary);
+  if (reg != allocation_.registers.end()) {
+    return X86Operand::of(x86Register(reg->second));
+  }
+  auto offset = frameOffsets_.find(temporary);
+  if (offset != frameOffsets_.end()) {
+    return X86Operand::frame(offset->second);
+  }
+  return X86Operand();
+}
+
+// Blocks of main keep their IR names, other functions prefix theirs
+std::string X86Backend::blockLabel(const std::string &label) const {
+  std::string name = label.substr(label[0] == '%' ? 1 : 0);
+  return function_ == "main" ? name : function_ + "." + name;
+}
+
+std::string X86Backend::typeOf(const std::string &value) const {
+  if (isTemporary(value)) {
+    auto it = types_.find(value);
+    return it == types_.end() ? "int" : it->second;
+  }
+  return literalType(value);
+}
+
+void X86Backend::saveCallerSaved() {
+  for (X86Register reg : liveCallerSaved_) {
+    out_->push(reg);
+  }
+  if (liveCallerSaved_.size() % 2 != 0) {
+    out_->sub(X86Register::RSP, 8);
+  }
+}
+
+void X86Backend::restoreCallerSaved() {
+  if (liveCallerSaved_.size() % 2 != 0) {
+    out_->add(X86Register::RSP, 8);
+  }
+  for (auto it = liveCallerSaved_.rbegin(); it != liveCallerSaved_.rend(); ++it) {
+    out_->pop(*it);
+  }
+}
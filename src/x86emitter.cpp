@@ -0,0 +1,833 @@
+#include "x86emitter.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char *const registerNames64[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"};
+const char *const registerNames32[] = {
+    "eax", "ecx", "edx",  "ebx",  "esp",  "ebp",  "esi",  "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+const char *const registerNames8[] = {
+    "al",  "cl",  "dl",   "bl",   "spl",  "bpl",  "sil",  "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+const char *const conditionNames[] = {"o", "no", "b",  "ae", "e", "ne",
+                                      "be", "a", "s",  "ns", "p", "np",
+                                      "l",  "ge", "le", "g"};
+
+int number(X86Register reg) { return static_cast<int>(reg); }
+
+std::string reg64(X86Register reg) {
+  return std::string("%") + registerNames64[number(reg)];
+}
+
+std::string reg8(X86Register reg) {
+  return std::string("%") + registerNames8[number(reg)];
+}
+
+std::string xmm(int index) { return "%xmm" + std::to_string(index); }
+
+std::string asmLabel(const std::string &name) { return ".L" + name; }
+
+std::string operand(const X86Operand &op) {
+  switch (op.kind) {
+  case X86Operand::Register:
+    return reg64(op.reg);
+  case X86Operand::Frame:
+    return std::to_string(op.value) + "(%rbp)";
+  case X86Operand::Immediate:
+    return "$" + std::to_string(op.value);
+  default:
+    return "";
+  }
+}
+
+bool fitsIn32(int64_t value) {
+  return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+bool fitsIn8(int64_t value) { return value >= INT8_MIN && value <= INT8_MAX; }
+
+// Contents of a .string directive
+std::string escape(const std::string &contents) {
+  std::string escaped;
+  for (unsigned char c : contents) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += static_cast<char>(c);
+    } else if (c < 0x20 || c >= 0x7f) {
+      char octal[5];
+      std::snprintf(octal, sizeof(octal), "\\%03o", c);
+      escaped += octal;
+    } else {
+      escaped += static_cast<char>(c);
+    }
+  }
+  return escaped;
+}
+
+void unsupported(const char *instruction) {
+  std::cerr << "x86 emitter: unsupported operands for " << instruction
+            << std::endl;
+}
+
+} // namespace
+
+X86Register x86Register(const std::string &name) {
+  for (int i = 0; i < 16; i++) {
+    if (name == registerNames64[i]) {
+      return static_cast<X86Register>(i);
+    }
+  }
+  std::cerr << "x86 emitter: unknown register '" << name << "'" << std::endl;
+  return X86Register::RAX;
+}
+
+X86Operand X86Operand::of(X86Register reg) {
+  X86Operand op;
+  op.kind = Register;
+  op.reg = reg;
+  return op;
+}
+
+X86Operand X86Operand::frame(int offset) {
+  X86Operand op;
+  op.kind = Frame;
+  op.value = offset;
+  return op;
+}
+
+X86Operand X86Operand::immediate(int64_t value) {
+  X86Operand op;
+  op.kind = Immediate;
+  op.value = value;
+  return op;
+}
+
+bool X86Operand::operator==(const X86Operand &other) const {
+  if (kind != other.kind) {
+    return false;
+  }
+  return kind == Register ? reg == other.reg : value == other.value;
+}
+
+// AssemblyEmitter
+
+void AssemblyEmitter::label(const std::string &name) {
+  text_ << asmLabel(name) << ":\n";
+}
+
+void AssemblyEmitter::push(X86Register reg) {
+  text_ << "\tpushq " << reg64(reg) << "\n";
+}
+
+void AssemblyEmitter::pop(X86Register reg) {
+  text_ << "\tpopq " << reg64(reg) << "\n";
+}
+
+void AssemblyEmitter::ret() { text_ << "\tret\n"; }
+
+void AssemblyEmitter::mov(X86Operand dst, X86Operand src) {
+  bool wide = src.kind == X86Operand::Immediate && !fitsIn32(src.value);
+  text_ << (wide ? "\tmovabsq " : "\tmovq ") << operand(src) << ", "
+        << operand(dst) << "\n";
+}
+
+void AssemblyEmitter::movsx32(X86Register reg) {
+  text_ << "\tmovslq %" << registerNames32[number(reg)] << ", " << reg64(reg)
+        << "\n";
+}
+
+void AssemblyEmitter::movzx8(X86Register reg) {
+  text_ << "\tmovzbq " << reg8(reg) << ", " << reg64(reg) << "\n";
+}
+
+void AssemblyEmitter::lea(X86Register dst, X86Operand slot) {
+  text_ << "\tleaq " << operand(slot) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::loadElement(X86Register dst, X86Register base,
+                                  X86Register index) {
+  text_ << "\tmovq (" << reg64(base) << ", " << reg64(index) << ", 8), "
+        << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::storeElement(X86Register base, X86Register index,
+                                   X86Register src) {
+  text_ << "\tmovq " << reg64(src) << ", (" << reg64(base) << ", "
+        << reg64(index) << ", 8)\n";
+}
+
+void AssemblyEmitter::loadLength(X86Register dst, X86Register base) {
+  text_ << "\tmovq -8(" << reg64(base) << "), " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::storeLength(X86Register base, X86Register src) {
+  text_ << "\tmovq " << reg64(src) << ", -8(" << reg64(base) << ")\n";
+}
+
+void AssemblyEmitter::add(X86Register dst, int32_t immediate) {
+  text_ << "\taddq $" << immediate << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::sub(X86Register dst, int32_t immediate) {
+  text_ << "\tsubq $" << immediate << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::add(X86Register dst, X86Register src) {
+  text_ << "\taddq " << reg64(src) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::sub(X86Register dst, X86Register src) {
+  text_ << "\tsubq " << reg64(src) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::imul(X86Register dst, X86Register src) {
+  text_ << "\timulq " << reg64(src) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::and64(X86Register dst, X86Register src) {
+  text_ << "\tandq " << reg64(src) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::shl(X86Register dst, uint8_t count) {
+  text_ << "\tshlq $" << static_cast<int>(count) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::sar(X86Register dst, uint8_t count) {
+  text_ << "\tsarq $" << static_cast<int>(count) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::shr(X86Register dst, uint8_t count) {
+  text_ << "\tshrq $" << static_cast<int>(count) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::cqo() { text_ << "\tcqto\n"; }
+
+void AssemblyEmitter::idiv(X86Register src) {
+  text_ << "\tidivq " << reg64(src) << "\n";
+}
+
+void AssemblyEmitter::zero(X86Register reg) {
+  const char *name = registerNames32[number(reg)];
+  text_ << "\txorl %" << name << ", %" << name << "\n";
+}
+
+void AssemblyEmitter::cmp(X86Operand lhs, X86Operand rhs) {
+  text_ << "\tcmpq " << operand(rhs) << ", " << operand(lhs) << "\n";
+}
+
+void AssemblyEmitter::test(X86Register reg) {
+  text_ << "\ttestq " << reg64(reg) << ", " << reg64(reg) << "\n";
+}
+
+void AssemblyEmitter::set(X86Condition condition, X86Register reg) {
+  text_ << "\tset" << conditionNames[static_cast<int>(condition)] << " "
+        << reg8(reg) << "\n";
+}
+
+void AssemblyEmitter::and8(X86Register dst, X86Register src) {
+  text_ << "\tandb " << reg8(src) << ", " << reg8(dst) << "\n";
+}
+
+void AssemblyEmitter::or8(X86Register dst, X86Register src) {
+  text_ << "\torb " << reg8(src) << ", " << reg8(dst) << "\n";
+}
+
+void AssemblyEmitter::cmov(X86Condition condition, X86Register dst,
+                           X86Register src) {
+  text_ << "\tcmov" << conditionNames[static_cast<int>(condition)] << "q "
+        << reg64(src) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::movToXmm(int index, X86Register src) {
+  text_ << "\tmovq " << reg64(src) << ", " << xmm(index) << "\n";
+}
+
+void AssemblyEmitter::movFromXmm(X86Register dst, int index) {
+  text_ << "\tmovq " << xmm(index) << ", " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::cvtsi2sd(int index, X86Register src) {
+  text_ << "\tcvtsi2sdq " << reg64(src) << ", " << xmm(index) << "\n";
+}
+
+void AssemblyEmitter::addsd(int dst, int src) {
+  text_ << "\taddsd " << xmm(src) << ", " << xmm(dst) << "\n";
+}
+
+void AssemblyEmitter::subsd(int dst, int src) {
+  text_ << "\tsubsd " << xmm(src) << ", " << xmm(dst) << "\n";
+}
+
+void AssemblyEmitter::mulsd(int dst, int src) {
+  text_ << "\tmulsd " << xmm(src) << ", " << xmm(dst) << "\n";
+}
+
+void AssemblyEmitter::divsd(int dst, int src) {
+  text_ << "\tdivsd " << xmm(src) << ", " << xmm(dst) << "\n";
+}
+
+void AssemblyEmitter::ucomisd(int lhs, int rhs) {
+  text_ << "\tucomisd " << xmm(rhs) << ", " << xmm(lhs) << "\n";
+}
+
+void AssemblyEmitter::jmp(const std::string &label) {
+  text_ << "\tjmp " << asmLabel(label) << "\n";
+}
+
+void AssemblyEmitter::jcc(X86Condition condition, const std::string &label) {
+  text_ << "\tj" << conditionNames[static_cast<int>(condition)] << " "
+        << asmLabel(label) << "\n";
+}
+
+void AssemblyEmitter::jumpTable(X86Register index, X86Register scratch,
+                                const std::vector<std::string> &labels) {
+  std::string table = ".LJT" + std::to_string(tables_++);
+  text_ << "\tleaq " << table << "(%rip), " << reg64(scratch) << "\n"
+        << "\tmovslq (" << reg64(scratch) << "," << reg64(index) << ",4), "
+        << reg64(index) << "\n"
+        << "\taddq " << reg64(scratch) << ", " << reg64(index) << "\n"
+        << "\tjmp *" << reg64(index) << "\n"
+        << "\t.p2align 2\n"
+        << table << ":\n";
+  for (const auto &label : labels) {
+    text_ << "\t.long " << asmLabel(label) << " - " << table << "\n";
+  }
+}
+
+void AssemblyEmitter::call(const std::string &function) {
+  text_ << "\tcall " << function << "@PLT\n";
+}
+
+void AssemblyEmitter::callLabel(const std::string &label) {
+  text_ << "\tcall " << asmLabel(label) << "\n";
+}
+
+void AssemblyEmitter::loadString(X86Register dst, const std::string &contents) {
+  auto it = strings_.find(contents);
+  if (it == strings_.end()) {
+    std::string label = ".LC" + std::to_string(strings_.size());
+    data_ << label << ":\n\t.string \"" << escape(contents) << "\"\n";
+    it = strings_.emplace(contents, label).first;
+  }
+  text_ << "\tleaq " << it->second << "(%rip), " << reg64(dst) << "\n";
+}
+
+void AssemblyEmitter::incrementCounter(uint32_t index) {
+  counters_ = std::max(counters_, index + 1);
+  text_ << "\tincq .Lcounters+" << 8 * static_cast<uint64_t>(index)
+        << "(%rip)\n";
+}
+
+std::string AssemblyEmitter::data() const {
+  std::string data = data_.str();
+  if (counters_ > 0) {
+    data += "\t.lcomm .Lcounters, " +
+            std::to_string(8 * static_cast<uint64_t>(counters_)) + "\n";
+  }
+  return data;
+}
+
+// MachineCodeEmitter
+
+bool MachineCodeEmitter::finish() {
+  bool resolved = true;
+  for (const auto &fixup : fixups_) {
+    auto target = labels_.find(fixup.second);
+    if (target == labels_.end()) {
+      std::cerr << "x86 emitter: jump to unknown label '" << fixup.second
+                << "'" << std::endl;
+      resolved = false;
+      continue;
+    }
+    int32_t displacement = static_cast<int32_t>(
+        static_cast<int64_t>(target->second) -
+        static_cast<int64_t>(fixup.first + 4));
+    std::memcpy(&code_[fixup.first], &displacement, sizeof(displacement));
+  }
+  fixups_.clear();
+
+  for (const auto &entry : tableEntries_) {
+    auto target = labels_.find(entry.label);
+    if (target == labels_.end()) {
+      std::cerr << "x86 emitter: jump table entry for unknown label '"
+                << entry.label << "'" << std::endl;
+      resolved = false;
+      continue;
+    }
+    int32_t offset = static_cast<int32_t>(static_cast<int64_t>(target->second) -
+                                          static_cast<int64_t>(entry.table));
+    std::memcpy(&code_[entry.position], &offset, sizeof(offset));
+  }
+  tableEntries_.clear();
+  return resolved;
+}
+
+void MachineCodeEmitter::byte(uint8_t value) { code_.push_back(value); }
+
+void MachineCodeEmitter::imm32(int32_t value) {
+  uint8_t bytes[4];
+  std::memcpy(bytes, &value, sizeof(bytes));
+  code_.insert(code_.end(), bytes, bytes + sizeof(bytes));
+}
+
+void MachineCodeEmitter::imm64(int64_t value) {
+  uint8_t bytes[8];
+  std::memcpy(bytes, &value, sizeof(bytes));
+  code_.insert(code_.end(), bytes, bytes + sizeof(bytes));
+}
+
+// `force` emits an empty REX so that byte registers 4-7 mean spl..dil
+void MachineCodeEmitter::rex(bool wide, int reg, int rm, bool force) {
+  uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) |
+                   ((rm & 8) ? 0x01 : 0);
+  if (prefix != 0x40 || force) {
+    byte(prefix);
+  }
+}
+
+void MachineCodeEmitter::modrm(int reg, int rm) {
+  byte(static_cast<uint8_t>(0xc0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+// [rbp + offset]; rbp always needs a displacement
+void MachineCodeEmitter::frameSlot(int reg, int offset) {
+  if (fitsIn8(offset)) {
+    byte(static_cast<uint8_t>(0x45 | ((reg & 7) << 3)));
+    byte(static_cast<uint8_t>(static_cast<int8_t>(offset)));
+  } else {
+    byte(static_cast<uint8_t>(0x85 | ((reg & 7) << 3)));
+    imm32(offset);
+  }
+}
+
+// rsp and r12 as a base need a SIB byte, rbp and r13 a displacement
+void MachineCodeEmitter::arrayMemory(uint8_t opcode, int reg, int base,
+                                     int index) {
+  bool displacement = index < 0 || (base & 7) == 5;
+  byte(static_cast<uint8_t>(0x48 | ((reg & 8) ? 0x04 : 0) |
+                            (index >= 0 && (index & 8) ? 0x02 : 0) |
+                            ((base & 8) ? 0x01 : 0)));
+  byte(opcode);
+  uint8_t mod = displacement ? 0x40 : 0x00;
+  if (index >= 0) {
+    byte(static_cast<uint8_t>(mod | ((reg & 7) << 3) | 0x04));
+    byte(static_cast<uint8_t>(0xc0 | ((index & 7) << 3) | (base & 7)));
+  } else {
+    byte(static_cast<uint8_t>(mod | ((reg & 7) << 3) | (base & 7)));
+    if ((base & 7) == 4) {
+      byte(0x24);
+    }
+  }
+  if (displacement) {
+    byte(static_cast<uint8_t>(index < 0 ? -8 : 0));
+  }
+}
+
+// 64 bit `opcode` with a register in both modrm fields
+void MachineCodeEmitter::registers(uint8_t opcode, int reg, int rm) {
+  rex(true, reg, rm);
+  byte(opcode);
+  modrm(reg, rm);
+}
+
+// C1 /extension ib
+void MachineCodeEmitter::shift(int extension, X86Register dst, uint8_t count) {
+  rex(true, 0, number(dst));
+  byte(0xc1);
+  modrm(extension, number(dst));
+  byte(count);
+}
+
+void MachineCodeEmitter::movImmediate64(int reg, int64_t value) {
+  if (fitsIn32(value)) {
+    rex(true, 0, reg);
+    byte(0xc7);
+    modrm(0, reg);
+    imm32(static_cast<int32_t>(value));
+  } else {
+    rex(true, 0, reg);
+    byte(static_cast<uint8_t>(0xb8 + (reg & 7)));
+    imm64(value);
+  }
+}
+
+void MachineCodeEmitter::rel32(const std::string &label) {
+  fixups_.push_back({code_.size(), label});
+  imm32(0);
+}
+
+void MachineCodeEmitter::label(const std::string &name) {
+  labels_[name] = code_.size();
+}
+
+void MachineCodeEmitter::push(X86Register reg) {
+  rex(false, 0, number(reg));
+  byte(static_cast<uint8_t>(0x50 + (number(reg) & 7)));
+}
+
+void MachineCodeEmitter::pop(X86Register reg) {
+  rex(false, 0, number(reg));
+  byte(static_cast<uint8_t>(0x58 + (number(reg) & 7)));
+}
+
+void MachineCodeEmitter::ret() { byte(0xc3); }
+
+void MachineCodeEmitter::mov(X86Operand dst, X86Operand src) {
+  if (dst.kind == X86Operand::Register && src.kind == X86Operand::Register) {
+    rex(true, number(src.reg), number(dst.reg));
+    byte(0x89);
+    modrm(number(src.reg), number(dst.reg));
+  } else if (dst.kind == X86Operand::Register &&
+             src.kind == X86Operand::Frame) {
+    rex(true, number(dst.reg), 0);
+    byte(0x8b);
+    frameSlot(number(dst.reg), static_cast<int>(src.value));
+  } else if (dst.kind == X86Operand::Frame &&
+             src.kind == X86Operand::Register) {
+    rex(true, number(src.reg), 0);
+    byte(0x89);
+    frameSlot(number(src.reg), static_cast<int>(dst.value));
+  } else if (dst.kind == X86Operand::Register &&
+             src.kind == X86Operand::Immediate) {
+    movImmediate64(number(dst.reg), src.value);
+  } else {
+    unsupported("mov");
+  }
+}
+
+void MachineCodeEmitter::loadElement(X86Register dst, X86Register base,
+                                     X86Register index) {
+  arrayMemory(0x8b, number(dst), number(base), number(index));
+}
+
+void MachineCodeEmitter::storeElement(X86Register base, X86Register index,
+                                      X86Register src) {
+  arrayMemory(0x89, number(src), number(base), number(index));
+}
+
+void MachineCodeEmitter::loadLength(X86Register dst, X86Register base) {
+  arrayMemory(0x8b, number(dst), number(base), -1);
+}
+
+void MachineCodeEmitter::storeLength(X86Register base, X86Register src) {
+  arrayMemory(0x89, number(src), number(base), -1);
+}
+
+void MachineCodeEmitter::movsx32(X86Register reg) {
+  rex(true, number(reg), number(reg));
+  byte(0x63);
+  modrm(number(reg), number(reg));
+}
+
+void MachineCodeEmitter::movzx8(X86Register reg) {
+  rex(true, number(reg), number(reg));
+  byte(0x0f);
+  byte(0xb6);
+  modrm(number(reg), number(reg));
+}
+
+void MachineCodeEmitter::lea(X86Register dst, X86Operand slot) {
+  if (slot.kind != X86Operand::Frame) {
+    unsupported("lea");
+    return;
+  }
+  rex(true, number(dst), 0);
+  byte(0x8d);
+  frameSlot(number(dst), static_cast<int>(slot.value));
+}
+
+void MachineCodeEmitter::add(X86Register dst, int32_t immediate) {
+  rex(true, 0, number(dst));
+  if (fitsIn8(immediate)) {
+    byte(0x83);
+    modrm(0, number(dst));
+    byte(static_cast<uint8_t>(static_cast<int8_t>(immediate)));
+  } else {
+    byte(0x81);
+    modrm(0, number(dst));
+    imm32(immediate);
+  }
+}
+
+void MachineCodeEmitter::sub(X86Register dst, int32_t immediate) {
+  rex(true, 0, number(dst));
+  if (fitsIn8(immediate)) {
+    byte(0x83);
+    modrm(5, number(dst));
+    byte(static_cast<uint8_t>(static_cast<int8_t>(immediate)));
+  } else {
+    byte(0x81);
+    modrm(5, number(dst));
+    imm32(immediate);
+  }
+}
+
+void MachineCodeEmitter::add(X86Register dst, X86Register src) {
+  registers(0x01, number(src), number(dst));
+}
+
+void MachineCodeEmitter::sub(X86Register dst, X86Register src) {
+  registers(0x29, number(src), number(dst));
+}
+
+void MachineCodeEmitter::imul(X86Register dst, X86Register src) {
+  rex(true, number(dst), number(src));
+  byte(0x0f);
+  byte(0xaf);
+  modrm(number(dst), number(src));
+}
+
+void MachineCodeEmitter::and64(X86Register dst, X86Register src) {
+  registers(0x21, number(src), number(dst));
+}
+
+void MachineCodeEmitter::shl(X86Register dst, uint8_t count) {
+  shift(4, dst, count);
+}
+
+void MachineCodeEmitter::sar(X86Register dst, uint8_t count) {
+  shift(7, dst, count);
+}
+
+void MachineCodeEmitter::shr(X86Register dst, uint8_t count) {
+  shift(5, dst, count);
+}
+
+void MachineCodeEmitter::cqo() {
+  byte(0x48);
+  byte(0x99);
+}
+
+void MachineCodeEmitter::idiv(X86Register src) {
+  rex(true, 0, number(src));
+  byte(0xf7);
+  modrm(7, number(src));
+}
+
+void MachineCodeEmitter::zero(X86Register reg) {
+  rex(false, number(reg), number(reg));
+  byte(0x31);
+  modrm(number(reg), number(reg));
+}
+
+void MachineCodeEmitter::cmp(X86Operand lhs, X86Operand rhs) {
+  if (lhs.kind == X86Operand::Register && rhs.kind == X86Operand::Register) {
+    rex(true, number(rhs.reg), number(lhs.reg));
+    byte(0x39);
+    modrm(number(rhs.reg), number(lhs.reg));
+  } else if (lhs.kind == X86Operand::Frame &&
+             rhs.kind == X86Operand::Immediate && fitsIn8(rhs.value)) {
+    rex(true, 0, 0);
+    byte(0x83);
+    frameSlot(7, static_cast<int>(lhs.value));
+    byte(static_cast<uint8_t>(static_cast<int8_t>(rhs.value)));
+  } else if (lhs.kind == X86Operand::Register &&
+             rhs.kind == X86Operand::Immediate && fitsIn8(rhs.value)) {
+    rex(true, 0, number(lhs.reg));
+    byte(0x83);
+    modrm(7, number(lhs.reg));
+    byte(static_cast<uint8_t>(static_cast<int8_t>(rhs.value)));
+  } else {
+    unsupported("cmp");
+  }
+}
+
+void MachineCodeEmitter::test(X86Register reg) {
+  rex(true, number(reg), number(reg));
+  byte(0x85);
+  modrm(number(reg), number(reg));
+}
+
+void MachineCodeEmitter::set(X86Condition condition, X86Register reg) {
+  rex(false, 0, number(reg), number(reg) >= 4);
+  byte(0x0f);
+  byte(static_cast<uint8_t>(0x90 + static_cast<int>(condition)));
+  modrm(0, number(reg));
+}
+
+void MachineCodeEmitter::and8(X86Register dst, X86Register src) {
+  rex(false, number(src), number(dst), number(src) >= 4 || number(dst) >= 4);
+  byte(0x20);
+  modrm(number(src), number(dst));
+}
+
+void MachineCodeEmitter::or8(X86Register dst, X86Register src) {
+  rex(false, number(src), number(dst), number(src) >= 4 || number(dst) >= 4);
+  byte(0x08);
+  modrm(number(src), number(dst));
+}
+
+void MachineCodeEmitter::cmov(X86Condition condition, X86Register dst,
+                              X86Register src) {
+  rex(true, number(dst), number(src));
+  byte(0x0f);
+  byte(static_cast<uint8_t>(0x40 + static_cast<int>(condition)));
+  modrm(number(dst), number(src));
+}
+
+void MachineCodeEmitter::movToXmm(int index, X86Register src) {
+  byte(0x66);
+  rex(true, index, number(src));
+  byte(0x0f);
+  byte(0x6e);
+  modrm(index, number(src));
+}
+
+void MachineCodeEmitter::movFromXmm(X86Register dst, int index) {
+  byte(0x66);
+  rex(true, index, number(dst));
+  byte(0x0f);
+  byte(0x7e);
+  modrm(index, number(dst));
+}
+
+void MachineCodeEmitter::cvtsi2sd(int index, X86Register src) {
+  byte(0xf2);
+  rex(true, index, number(src));
+  byte(0x0f);
+  byte(0x2a);
+  modrm(index, number(src));
+}
+
+void MachineCodeEmitter::addsd(int dst, int src) {
+  byte(0xf2);
+  rex(false, dst, src);
+  byte(0x0f);
+  byte(0x58);
+  modrm(dst, src);
+}
+
+void MachineCodeEmitter::subsd(int dst, int src) {
+  byte(0xf2);
+  rex(false, dst, src);
+  byte(0x0f);
+  byte(0x5c);
+  modrm(dst, src);
+}
+
+void MachineCodeEmitter::mulsd(int dst, int src) {
+  byte(0xf2);
+  rex(false, dst, src);
+  byte(0x0f);
+  byte(0x59);
+  modrm(dst, src);
+}
+
+void MachineCodeEmitter::divsd(int dst, int src) {
+  byte(0xf2);
+  rex(false, dst, src);
+  byte(0x0f);
+  byte(0x5e);
+  modrm(dst, src);
+}
+
+void MachineCodeEmitter::ucomisd(int lhs, int rhs) {
+  byte(0x66);
+  rex(false, lhs, rhs);
+  byte(0x0f);
+  byte(0x2e);
+  modrm(lhs, rhs);
+}
+
+void MachineCodeEmitter::jmp(const std::string &label) {
+  byte(0xe9);
+  rel32(label);
+}
+
+void MachineCodeEmitter::jcc(X86Condition condition,
+                             const std::string &label) {
+  byte(0x0f);
+  byte(static_cast<uint8_t>(0x80 + static_cast<int>(condition)));
+  rel32(label);
+}
+
+void MachineCodeEmitter::jumpTable(X86Register index, X86Register scratch,
+                                   const std::vector<std::string> &labels) {
+  int i = number(index);
+  int s = number(scratch);
+  std::string table = "jumptable." + std::to_string(code_.size());
+
+  // lea scratch, [rip + table]
+  rex(true, s, 0);
+  byte(0x8d);
+  byte(static_cast<uint8_t>(0x05 | ((s & 7) << 3)));
+  rel32(table);
+  // movsxd index, dword [scratch + index * 4]
+  byte(static_cast<uint8_t>(0x48 | ((i & 8) ? 0x04 : 0) | ((i & 8) ? 0x02 : 0) |
+                            ((s & 8) ? 0x01 : 0)));
+  byte(0x63);
+  byte(static_cast<uint8_t>(0x04 | ((i & 7) << 3)));
+  byte(static_cast<uint8_t>(0x80 | ((i & 7) << 3) | (s & 7)));
+  // add index, scratch
+  rex(true, s, i);
+  byte(0x01);
+  modrm(s, i);
+  // jmp index
+  rex(false, 0, i);
+  byte(0xff);
+  modrm(4, i);
+
+  label(table);
+  size_t start = code_.size();
+  for (const auto &target : labels) {
+    tableEntries_.push_back({code_.size(), target, start});
+    imm32(0);
+  }
+}
+
+void MachineCodeEmitter::incrementCounter(uint32_t index) {
+  while (counters_.size() <= index) {
+    counters_.push_back(0);
+  }
+  // inc qword [r11]
+  int r11 = number(X86Register::R11);
+  movImmediate64(r11, reinterpret_cast<int64_t>(&counters_[index]));
+  rex(true, 0, r11);
+  byte(0xff);
+  byte(static_cast<uint8_t>(r11 & 7));
+}
+
+void MachineCodeEmitter::call(const std::string &function) {
+  static const std::unordered_map<std::string, const void *> functions = {
+      {"printf", reinterpret_cast<const void *>(&std::printf)},
+      {"strcmp", reinterpret_cast<const void *>(&std::strcmp)},
+      {"calloc", reinterpret_cast<const void *>(&std::calloc)},
+      {"fflush", reinterpret_cast<const void *>(&std::fflush)},
+      {"dprintf", reinterpret_cast<const void *>(&dprintf)},
+      {"exit", reinterpret_cast<const void *>(&std::exit)},
+  };
+  auto it = functions.find(function);
+  if (it == functions.end()) {
+    std::cerr << "x86 emitter: unknown function '" << function << "'"
+              << std::endl;
+    return;
+  }
+  // r11 is free at every call site and never holds an argument
+  int r11 = number(X86Register::R11);
+  movImmediate64(r11, reinterpret_cast<int64_t>(it->second));
+  rex(false, 0, r11);
+  byte(0xff);
+  modrm(2, r11);
+}
+
+void MachineCodeEmitter::callLabel(const std::string &label) {
+  byte(0xe8);
+  rel32(label);
+}
+
+void MachineCodeEmitter::loadString(X86Register dst,
+                                    const std::string &contents) {
+  auto it = stringAddresses_.find(contents);
+  if (it == stringAddresses_.end()) {
+    strings_.push_back(contents);
+    it = stringAddresses_.emplace(contents, strings_.back().c_str()).first;
+  }
+  movImmediate64(number(dst), reinterpret_cast<int64_t>(it->second));
+}
@@ -0,0 +1,160 @@
+// Feeds damaged IR files to `quirk dis` and `quirk run`. A program is
+// compiled to IR, then every word of the file is overwritten with values
+// that make offsets, counts and indices point outside their tables, and a
+// few hundred seeded byte flips are added. quirk may reject such a file or
+// run whatever it still describes, but it must exit normally with 0 or 1;
+// a signal or any other status fails the test.
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef QUIRK_EXECUTABLE
+#define QUIRK_EXECUTABLE "quirk"
+#endif
+
+namespace {
+
+// Functions, string constants, arrays, loops and a division, so every
+// table of the file has entries
+const char *const kProgram = R"(function int sum(int count) {
+  int[count] values;
+  for (int i = 0; i < count; i++) {
+    values[i] = i * 3;
+  }
+  int total = 0;
+  for (int j = 0; j < len(values); j++) {
+    total = total + values[j];
+  }
+  return total;
+}
+function string name(int n) {
+  if (n > 10) {
+    return "large";
+  }
+  return "small";
+}
+int total = sum(5);
+out(total);
+out(name(total));
+out(total / 4);
+)";
+
+const uint32_t kWordValues[] = {0, 1, 0xffffffff};
+const int kFlips = 200;
+// A damaged loop bound may make a program run for a long time
+const char *const kTimeout = "timeout 2 ";
+const int kTimedOut = 124;
+
+std::string shellQuote(const std::string &text) {
+  std::string quoted = "'";
+  for (char c : text) {
+    quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+  }
+  return quoted + "'";
+}
+
+// Exit status of `command`, -1 when it did not exit normally
+int run(const std::string &command) {
+  int status = std::system(command.c_str());
+  return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool write(const std::filesystem::path &path, const std::vector<char> &bytes) {
+  std::ofstream out(path, std::ios::binary);
+  out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+  return static_cast<bool>(out);
+}
+
+// Runs dis and run on one damaged file; false and a report when either
+// crashed
+bool survives(const std::vector<char> &bytes, const std::filesystem::path &path,
+              const std::string &what) {
+  if (!write(path, bytes)) {
+    std::cerr << "Error: Could not write " << path << std::endl;
+    return false;
+  }
+  for (const char *command : {" dis ", " run "}) {
+    int status = run(kTimeout + shellQuote(QUIRK_EXECUTABLE) + command +
+                     shellQuote(path.string()) + " >/dev/null 2>&1");
+    if (status != 0 && status != 1 && status != kTimedOut) {
+      std::cerr << "quirk" << command << "exited with " << status << " on "
+                << what << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main() {
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() /
+      ("quirk_irfile_corrupt." + std::to_string(getpid()));
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    std::cerr << "Error: Could not create " << directory << std::endl;
+    return 1;
+  }
+  std::filesystem::path source = directory / "program.qk";
+  std::filesystem::path good = directory / "program.qir";
+  std::filesystem::path bad = directory / "damaged.qir";
+
+  std::ofstream(source) << kProgram;
+  if (run(shellQuote(QUIRK_EXECUTABLE) + " --emit-ir " +
+          shellQuote(good.string()) + " " + shellQuote(source.string()) +
+          " >/dev/null") != 0 ||
+      run(shellQuote(QUIRK_EXECUTABLE) + " run " + shellQuote(good.string()) +
+          " >/dev/null") != 0) {
+    std::cerr << "Error: The undamaged program does not compile and run"
+              << std::endl;
+    std::filesystem::remove_all(directory, error);
+    return 1;
+  }
+  std::ifstream in(good, std::ios::binary);
+  const std::vector<char> original((std::istreambuf_iterator<char>(in)),
+                                   std::istreambuf_iterator<char>());
+
+  int failures = 0;
+  size_t cases = 0;
+  for (size_t offset = 0; offset + 4 <= original.size(); offset += 4) {
+    for (uint32_t value : kWordValues) {
+      std::vector<char> bytes = original;
+      for (int i = 0; i < 4; i++) {
+        bytes[offset + i] = static_cast<char>(value >> (8 * i));
+      }
+      if (bytes == original) {
+        continue;
+      }
+      cases++;
+      failures += !survives(bytes, bad,
+                            "word at " + std::to_string(offset) + " set to " +
+                                std::to_string(value));
+    }
+  }
+
+  std::mt19937 random(1);
+  for (int flip = 0; flip < kFlips; flip++) {
+    std::vector<char> bytes = original;
+    int count = 1 + static_cast<int>(random() % 4);
+    for (int i = 0; i < count; i++) {
+      bytes[random() % bytes.size()] ^= static_cast<char>(1 << (random() % 8));
+    }
+    cases++;
+    failures += !survives(bytes, bad, "byte flips " + std::to_string(flip));
+  }
+  std::filesystem::remove_all(directory, error);
+
+  std::cout << cases << " damaged files, " << failures << " crashes"
+            << std::endl;
+  return failures == 0 ? 0 : 1;
+}